@@ -0,0 +1,251 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Runs the benchmarks by hand, away from iPhoto, and writes what they found out as JSON for comparing
+// against earlier runs:
+//
+//     Benchmarks resizer <corpus directory> [-width 1600] [-height 1600] [-iterations 3] [-results <file>]
+//     Benchmarks derivatives <image> [-width 1600] [-height 1600] [-iterations 3] [-results <file>]
+//     Benchmarks messaging [-messages 100000] [-producers 1] [-rate <messages a second>] [-results <file>]
+//     Benchmarks album-search [-albums 5000] [-results <file>]
+//
+// The results go to standard output unless there's a -results file to write them to.
+
+#import <Cocoa/Cocoa.h>
+#include <stdio.h>
+
+#import "ZWResizerBenchmark.h"
+#import "ZWMessagingBenchmark.h"
+#import "ZWAlbumSearchBenchmark.h"
+
+// Runs the messaging benchmark on a thread of its own, since one of the transports sends to the main 
+// thread, which has to be free to run its run loop
+@interface ZWMessagingBenchmarkRunner : NSObject {
+@public
+    unsigned int producers;
+    unsigned long messages;
+    double rate;
+    NSMutableArray *runs;
+    volatile BOOL finished;
+}
+- (void)runTransports:(id)unused;
+@end
+
+static void printUsage(const char *tool)
+{
+    fprintf(stderr, "usage: %s resizer <corpus directory> [-width 1600] [-height 1600] [-iterations 3] [-results <file>]\n", tool);
+    fprintf(stderr, "       %s derivatives <image> [-width 1600] [-height 1600] [-iterations 3] [-results <file>]\n", tool);
+    fprintf(stderr, "       %s messaging [-messages 100000] [-producers 1] [-rate <messages a second>] [-results <file>]\n", tool);
+    fprintf(stderr, "       %s album-search [-albums 5000] [-results <file>]\n", tool);
+}
+
+static int writeResults(NSDictionary *results, NSString *path)
+{
+    NSString *json = [ZWResizerBenchmark JSONStringFromResults:results];
+    
+    if (path == nil) {
+        printf("%s\n", [json UTF8String]);
+        return 0;
+    }
+    if (![json writeToFile:[path stringByExpandingTildeInPath] atomically:YES]) {
+        fprintf(stderr, "couldn't write results to %s\n", [path fileSystemRepresentation]);
+        return 1;
+    }
+    return 0;
+}
+
+// Each photo in the folder, scaled to fit the size given as the export would
+static int benchmarkResizer(NSArray *arguments, NSUserDefaults *defaults)
+{
+    NSSize size = NSMakeSize(1600, 1600);
+    int iterations = 3;
+    NSDictionary *results;
+    
+    if ([arguments count] < 3) 
+        return -1;
+    if ([defaults integerForKey:@"width"] > 0) 
+        size.width = [defaults integerForKey:@"width"];
+    if ([defaults integerForKey:@"height"] > 0) 
+        size.height = [defaults integerForKey:@"height"];
+    if ([defaults integerForKey:@"iterations"] > 0) 
+        iterations = [defaults integerForKey:@"iterations"];
+    
+    results = [ZWResizerBenchmark benchmarkCorpusAtPath:[[arguments objectAtIndex:2] stringByExpandingTildeInPath] 
+                                                 toSize:size 
+                                             iterations:iterations 
+                                           scratchArena:NULL];
+    fprintf(stderr, "resizer: %u images at %.0fx%.0f\n", [[results objectForKey:@"Images"] count], size.width, size.height);
+    return writeResults(results, [defaults stringForKey:@"results"]);
+}
+
+// One photo scaled to the size given plus the resize and thumbnail an export can make alongside it, each 
+// from a decode of its own against all three from one decode
+static int benchmarkDerivatives(NSArray *arguments, NSUserDefaults *defaults)
+{
+    NSSize size = NSMakeSize(1600, 1600);
+    int iterations = 3;
+    NSString *path;
+    NSData *data;
+    NSArray *sizes;
+    NSDictionary *timings;
+    
+    if ([arguments count] < 3) 
+        return -1;
+    if ([defaults integerForKey:@"width"] > 0) 
+        size.width = [defaults integerForKey:@"width"];
+    if ([defaults integerForKey:@"height"] > 0) 
+        size.height = [defaults integerForKey:@"height"];
+    if ([defaults integerForKey:@"iterations"] > 0) 
+        iterations = [defaults integerForKey:@"iterations"];
+    
+    path = [[arguments objectAtIndex:2] stringByExpandingTildeInPath];
+    data = [NSData dataWithContentsOfFile:path];
+    if (data == nil) {
+        fprintf(stderr, "derivatives: couldn't read %s\n", [path fileSystemRepresentation]);
+        return 1;
+    }
+    
+    // the same sizes the export asks for when the gallery takes a resize and Growl is running
+    sizes = [NSArray arrayWithObjects:[NSValue valueWithSize:size], 
+                                      [NSValue valueWithSize:NSMakeSize(640, 640)], 
+                                      [NSValue valueWithSize:NSMakeSize(150, 150)], nil];
+    timings = [ZWResizerBenchmark benchmarkDerivativesFromData:data toSizes:sizes iterations:iterations scratchArena:NULL];
+    
+    fprintf(stderr, "derivatives: %s at %.0fx%.0f, separate %.3fs (%lu bytes), one decode %.3fs (%lu bytes)\n", 
+            [[path lastPathComponent] UTF8String], size.width, size.height, 
+            [[timings objectForKey:@"SeparateSeconds"] doubleValue], [[timings objectForKey:@"SeparateBytes"] unsignedLongValue], 
+            [[timings objectForKey:@"CascadeSeconds"] doubleValue], [[timings objectForKey:@"CascadeBytes"] unsignedLongValue]);
+    return writeResults(timings, [defaults stringForKey:@"results"]);
+}
+
+// Every InterThreadMessaging transport, and performSelectorOnMainThread: to this thread. Switching transports
+// is only safe in a process of our own like this one, since it applies to every thread prepared afterwards.
+static int benchmarkMessaging(NSArray *arguments, NSUserDefaults *defaults)
+{
+    ZWMessagingBenchmarkRunner *runner = [[[ZWMessagingBenchmarkRunner alloc] init] autorelease];
+    NSRunLoop *runLoop = [NSRunLoop currentRunLoop];
+    
+    runner->producers = ([defaults integerForKey:@"producers"] > 0) ? [defaults integerForKey:@"producers"] : 1;
+    runner->messages = ([defaults integerForKey:@"messages"] > 0) ? [defaults integerForKey:@"messages"] : 100000;
+    runner->rate = [defaults doubleForKey:@"rate"];
+    runner->runs = [NSMutableArray array];
+    
+    // Without a port to wait on, the run loop would return straight away rather than sleeping between messages
+    [runLoop addPort:[NSPort port] forMode:NSDefaultRunLoopMode];
+    [NSThread detachNewThreadSelector:@selector(runTransports:) toTarget:runner withObject:nil];
+    while (!runner->finished) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [runLoop runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+        [pool release];
+    }
+    
+    return writeResults([NSDictionary dictionaryWithObject:runner->runs forKey:@"Runs"], [defaults stringForKey:@"results"]);
+}
+
+// The type-ahead search, on a made-up gallery of that many albums
+static int benchmarkAlbumSearch(NSArray *arguments, NSUserDefaults *defaults)
+{
+    int albums = ([defaults integerForKey:@"albums"] > 0) ? [defaults integerForKey:@"albums"] : 5000;
+    NSDictionary *timings = [ZWAlbumSearchBenchmark benchmarkAlbums:albums];
+    
+    if (timings == nil) {
+        fprintf(stderr, "album-search: couldn't run over %d albums\n", albums);
+        return 1;
+    }
+    
+    fprintf(stderr, "album-search: %d albums built in %.1f ms, %d keystrokes at %.1f us mean, %.1f us p50, %.1f us p99, %.1f us max\n", 
+            albums, [[timings objectForKey:@"BuildSeconds"] doubleValue] * 1e3, [[timings objectForKey:@"Keystrokes"] intValue], 
+            [[timings objectForKey:@"MeanLatencySeconds"] doubleValue] * 1e6, [[timings objectForKey:@"P50LatencySeconds"] doubleValue] * 1e6, 
+            [[timings objectForKey:@"P99LatencySeconds"] doubleValue] * 1e6, [[timings objectForKey:@"MaxLatencySeconds"] doubleValue] * 1e6);
+    fprintf(stderr, "album-search: %.0f bytes an album, every album walked in %.1f ms, %ld bytes of views left after\n", 
+            [[timings objectForKey:@"BytesPerAlbum"] doubleValue], [[timings objectForKey:@"WalkSeconds"] doubleValue] * 1e3, 
+            [[timings objectForKey:@"ViewBytesAfterWalk"] longValue]);
+    return writeResults(timings, [defaults stringForKey:@"results"]);
+}
+
+@implementation ZWMessagingBenchmarkRunner
+
+- (void)runTransports:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSEnumerator *transportEnumerator = [[ZWMessagingBenchmark allTransports] objectEnumerator];
+    NSNumber *transport;
+    
+    [self retain];
+    
+    while ((transport = [transportEnumerator nextObject])) {
+        NSDictionary *timings = [ZWMessagingBenchmark benchmarkTransport:[transport intValue] 
+                                                               producers:producers 
+                                                     messagesPerProducer:messages 
+                                                                    rate:rate];
+        if (timings == nil) 
+            continue;
+        [runs addObject:timings];
+        fprintf(stderr, "messaging: %u x %lu messages by %s: %.0f a second, latency %.1f us p50, %.1f us p99, %.1f us p999, %.1f us max\n", 
+                producers, messages, [[timings objectForKey:@"Transport"] UTF8String], [[timings objectForKey:@"MessagesPerSecond"] doubleValue], 
+                [[timings objectForKey:@"P50LatencySeconds"] doubleValue] * 1e6, [[timings objectForKey:@"P99LatencySeconds"] doubleValue] * 1e6, 
+                [[timings objectForKey:@"P999LatencySeconds"] doubleValue] * 1e6, [[timings objectForKey:@"MaxLatencySeconds"] doubleValue] * 1e6);
+    }
+    
+    finished = YES;
+    [pool release];
+    [self release];
+}
+
+@end
+
+int main(int argc, char *argv[])
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSArray *arguments = [[NSProcessInfo processInfo] arguments];
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];   // picks up the -name value options
+    NSString *benchmark = ([arguments count] > 1) ? [arguments objectAtIndex:1] : nil;
+    int status = -1;
+    
+    // NSBitmapImageRep, which the resizer falls back on, wants AppKit set up
+    [NSApplication sharedApplication];
+    
+    if ([benchmark isEqualToString:@"resizer"]) 
+        status = benchmarkResizer(arguments, defaults);
+    else if ([benchmark isEqualToString:@"derivatives"]) 
+        status = benchmarkDerivatives(arguments, defaults);
+    else if ([benchmark isEqualToString:@"messaging"]) 
+        status = benchmarkMessaging(arguments, defaults);
+    else if ([benchmark isEqualToString:@"album-search"]) 
+        status = benchmarkAlbumSearch(arguments, defaults);
+    
+    if (status < 0) {
+        printUsage(argv[0]);
+        status = 2;
+    }
+    
+    [pool release];
+    return status;
+}
@@ -29,6 +29,7 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "ZWScratchArena.h"
 
 @interface ImageResizer : NSObject {
 
@@ -36,4 +37,44 @@
 
 + (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size;
 
+// Like the above, but searches for the highest JPEG quality whose output fits in maxBytes. The image is
+// decoded and scaled once; only the compression is repeated for each attempt. If even the lowest quality
+// doesn't fit, the lowest quality result is returned anyway. A maxBytes of 0 means no limit.
++ (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size maxBytes:(unsigned long)maxBytes;
+
+// Like the above, but the big intermediate buffers (the scaled bitmap, decode and resample rows) come
+// from arena and are handed back to it when we're done, so they can be reused for the next photo.
+// arena may be NULL.
++ (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size maxBytes:(unsigned long)maxBytes scratchArena:(ZWScratchArena *)arena;
+
+// Makes several sizes of the image (NSValue-wrapped NSSizes, largest first) from a single decode. The first
+// is made just like the methods above; each of the rest is resampled from the one before it. Returns the
+// JPEG data for each size in the same order, or just the first if the others couldn't be made, or nil.
+// maxBytes only applies to the first. Baseline JPEGs go through our own decoder and resampler: they're
+// scaled in linear light, and those with an ICC profile we understand (any matrix/TRC profile, like Adobe 
+// RGB's) are converted to sRGB and tagged as sRGB. They're streamed, derivatives included, so memory goes
+// with the width of the output rather than its area - except with a maxBytes, where the whole first image
+// is kept to be compressed again for each quality tried, since decoding the source every time is far 
+// slower. Anything else (progressive JPEGs, other formats) is scaled by QuickTime, in gamma space, with 
+// only the derivatives made in linear light.
++ (NSArray*) getScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes scratchArena:(ZWScratchArena *)arena;
+
+// Like the above, with an unsharp mask of sharpenAmount (0 for none; 1 doubles the contrast of fine detail)
+// and sharpenRadius (in pixels of the scaled image) fused into the resampling. Every size is sharpened.
++ (NSArray*) getScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes sharpenAmount:(float)sharpenAmount sharpenRadius:(float)sharpenRadius scratchArena:(ZWScratchArena *)arena;
+
+// Rewrites a JPEG without recompressing it, with ZWJPEGRewrite's flags: metadata can be dropped, the 
+// Huffman tables optimized, and (with applyOrientation) the image turned the right way up according to 
+// its Exif orientation by moving DCT blocks around. Returns nil if there was nothing to do or it couldn't
+// be done, in which case the original data is fine to use.
++ (NSData*) rewriteJPEGData:(NSData*)data flags:(int)flags applyOrientation:(BOOL)applyOrientation scratchArena:(ZWScratchArena *)arena;
+
+// Identifies the encoder and its settings. Anything that caches our output should include this in
+// its key, and it must change whenever the output of the resizer would.
++ (NSString*) encoderIdentifier;
+
 @end
+
+// Fits size inside maxSize (turned around if need be to match size's orientation) keeping its aspect 
+// ratio. Never makes anything bigger.
+NSSize getGoodSize(NSSize size, NSSize maxSize);
@@ -30,6 +30,13 @@
 
 #import "ImageResizer.h"
 #import "QuickTime/QuickTime.h"
+#import "ZWJPEGCommon.h"
+#import "ZWJPEGDecoder.h"
+#import "ZWJPEGEncoder.h"
+#import "ZWJPEGRewriter.h"
+#import "ZWImageResampler.h"
+#import "ZWColorTransform.h"
+#import <sys/sysctl.h>
 
 Handle myCreateHandleDataRef(
                              Handle             dataHandle,
@@ -40,22 +47,100 @@ Handle myCreateHandleDataRef(
                              Size               initDataByteCount
                              );
 
+Handle myCreatePointerDataRef(
+                              void              *data,
+                              Size              dataSize,
+                              Str255            fileName,
+                              OSType            fileType,
+                              StringPtr         mimeTypeString
+                              );
+
+static OSErr myAddDataRefExtensions(Handle dataRef, Str255 fileName, OSType fileType, StringPtr mimeTypeString, Boolean hasInitData);
+
 NSSize getGoodSize(NSSize size, NSSize maxSize);
 
+// Bump this whenever a change to the resizer changes the bytes it produces
+#define IMAGE_RESIZER_VERSION 6
+
+// The quality our own encoder uses when there's no byte budget, about what QuickTime's default gives
+#define OWN_ENCODER_QUALITY 85
+
+// Scaled images with at least this many pixels are compressed on every processor. Smaller ones don't
+// take long enough for the threads to pay for themselves.
+#define PARALLEL_ENCODE_MIN_PIXELS (4 * 1024 * 1024)
+
+@interface ImageResizer (PrivateStuff)
++ (NSArray*) getStreamedScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes sharpenAmount:(float)sharpenAmount sharpenRadius:(float)sharpenRadius scratchArena:(ZWScratchArena *)arena;
+@end
+
+static NSArray *cascadeDerivatives(unsigned char *pixels, int width, int height, int components, NSArray *sizes, float sharpenAmount, float sharpenRadius, ZWScratchArena *arena);
+struct StreamedResizeContext;
+static BOOL chainDerivatives(struct StreamedResizeContext *first, int width, int height, int components, NSArray *sizes, struct StreamedResizeContext *steps, NSMutableArray *outputs, const ZWColorTransform *transform, float sharpenAmount, float sharpenRadius, ZWScratchArena *arena);
+static void destroyDerivativeChain(struct StreamedResizeContext *first, struct StreamedResizeContext *steps, int count);
+static ZWColorTransform *createProfileColorTransform(NSData *data, int components, ZWScratchArena *arena);
+static int processorCount(void);
+
 @implementation ImageResizer
 
++ (NSString*) encoderIdentifier {
+    return [NSString stringWithFormat:@"qt-jpeg/%d", IMAGE_RESIZER_VERSION];
+}
+
 + (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size {
+    return [self getScaledImageFromData:data toSize:size maxBytes:0];
+}
+
++ (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size maxBytes:(unsigned long)maxBytes {
+    return [self getScaledImageFromData:data toSize:size maxBytes:maxBytes scratchArena:NULL];
+}
+
++ (NSData*) getScaledImageFromData:(NSData*)data toSize:(NSSize)size maxBytes:(unsigned long)maxBytes scratchArena:(ZWScratchArena *)arena {
+    NSArray *sizes = [NSArray arrayWithObject:[NSValue valueWithSize:size]];
+    NSArray *images = [self getScaledImagesFromData:data toSizes:sizes maxBytes:maxBytes scratchArena:arena];
+    
+    return [images count] ? [images objectAtIndex:0] : nil;
+}
+
++ (NSArray*) getScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes scratchArena:(ZWScratchArena *)arena {
+    return [self getScaledImagesFromData:data toSizes:sizes maxBytes:maxBytes sharpenAmount:0 sharpenRadius:0 scratchArena:arena];
+}
+
++ (NSArray*) getScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes sharpenAmount:(float)sharpenAmount sharpenRadius:(float)sharpenRadius scratchArena:(ZWScratchArena *)arena {
     NSData *scaledImageData;
+    NSArray *derivatives = nil;
+    NSSize size = [[sizes objectAtIndex:0] sizeValue];
+    BOOL wantsDerivatives = ([sizes count] > 1);
+    ZWJPEGInfo jpegInfo;
+    
+    // Every JPEG our own decoder can read goes through it and our resampler rather than QuickTime. QuickTime
+    // scales in gamma space, decodes the whole source into memory (4 bytes a pixel) first - which for really
+    // big JPEGs either fails outright or takes the machine down with it paging - copies a wide gamut 
+    // photo's ICC profile over as it is (so it comes out washed out anywhere that ignores profiles, which
+    // is most browsers), can't sharpen, and only compresses on one processor. QuickTime is left with what
+    // we can't read ourselves: progressive JPEGs and anything that isn't a JPEG.
+    BOOL canStream = ZWJPEGGetInfo([data bytes], [data length], &jpegInfo) && jpegInfo.baseline;
+    if (canStream) {
+        NSArray *images = [self getStreamedScaledImagesFromData:data toSizes:sizes maxBytes:maxBytes sharpenAmount:sharpenAmount sharpenRadius:sharpenRadius scratchArena:arena];
+        if (images) 
+            return images;
+    }
     
-    Handle imageDataH = NULL;
-    PtrToHand([data bytes], &imageDataH, [data length]);
-    Handle dataRef = myCreateHandleDataRef(imageDataH, "\pdummy.jpg", kQTFileTypeJPEG, nil, nil, 0);
+    // Point the importer straight at the caller's bytes (which may well be a mapped file) rather than
+    // copying them into a Handle first. The data has to outlive the importer, which it does since
+    // the caller is holding on to it for the duration of this call.
+    Handle dataRef = myCreatePointerDataRef((void *)[data bytes], [data length], "\pdummy.jpg", kQTFileTypeJPEG, nil);
     
     // create a Graphics Importer component that will read from the PNG data
     ComponentInstance importComponent=0, exportComponent=0;
-    GetGraphicsImporterForDataRef(dataRef, HandleDataHandlerSubType, &importComponent);  // TODO: check return value
+    OSErr importErr = GetGraphicsImporterForDataRef(dataRef, PointerDataHandlerSubType, &importComponent);
     DisposeHandle(dataRef);
     
+    if (importErr != noErr || importComponent == 0) {
+        if (importComponent) 
+            CloseComponent(importComponent);
+        return nil;
+    }
+    
     // get metadata
     UserData imageMetadata;
     NewUserData(&imageMetadata);
@@ -76,7 +161,38 @@ NSSize getGoodSize(NSSize size, NSSize maxSize);
     // Now the exporter
     OpenADefaultComponent(GraphicsExporterComponentType, kQTFileTypeJPEG, &exportComponent);
     
-    GraphicsExportSetInputGraphicsImporter(exportComponent, importComponent);
+    // When we have a byte budget we'll be compressing several times, and when there are derivatives to
+    // make we need the scaled pixels to make them from, so decode and scale into an offscreen GWorld once 
+    // and have the exporter read from that instead of from the importer.
+    GWorldPtr scaledGWorld = NULL;
+    void *scaledPixels = NULL;
+    if (maxBytes > 0 || wantsDerivatives) {
+        OSErr gworldErr;
+        
+        // Take the pixels from the arena if we have one, so a run of photos reuses one bitmap
+        if (arena) {
+            long rowBytes = ((scaledBounds.right - scaledBounds.left) * 4 + 15) & ~15;
+            scaledPixels = ZWScratchArenaAlloc(arena, rowBytes * (scaledBounds.bottom - scaledBounds.top));
+            gworldErr = scaledPixels ? QTNewGWorldFromPtr(&scaledGWorld, k32ARGBPixelFormat, &scaledBounds, NULL, NULL, 0, scaledPixels, rowBytes) : memFullErr;
+        }
+        else {
+            gworldErr = QTNewGWorld(&scaledGWorld, k32ARGBPixelFormat, &scaledBounds, NULL, NULL, 0);
+        }
+        
+        if (gworldErr == noErr) {
+            GraphicsImportSetGWorld(importComponent, scaledGWorld, NULL);
+            GraphicsImportDraw(importComponent);
+            GraphicsExportSetInputGWorld(exportComponent, scaledGWorld);
+        }
+        else {
+            // no memory for the GWorld - fall back to the default quality, and no derivatives
+            scaledGWorld = NULL;
+            maxBytes = 0;
+        }
+    }
+    
+    if (scaledGWorld == NULL) 
+        GraphicsExportSetInputGraphicsImporter(exportComponent, importComponent);
     
     Handle scaledImageDataH = NewHandle(0);
     GraphicsExportSetOutputHandle(exportComponent, scaledImageDataH);
@@ -86,21 +202,493 @@ NSSize getGoodSize(NSSize size, NSSize maxSize);
     GraphicsExportSetExifEnabled(exportComponent, TRUE);
 
     unsigned long actualSizeWritten = 0;
-    GraphicsExportDoExport(exportComponent, &actualSizeWritten);
-    HLock(scaledImageDataH);
-    scaledImageData = [NSData dataWithBytes:*scaledImageDataH 
-                                     length:GetHandleSize(scaledImageDataH)];
-    HUnlock(scaledImageDataH);
+    if (maxBytes == 0) {
+        GraphicsExportDoExport(exportComponent, &actualSizeWritten);
+        HLock(scaledImageDataH);
+        scaledImageData = [NSData dataWithBytes:*scaledImageDataH 
+                                         length:GetHandleSize(scaledImageDataH)];
+        HUnlock(scaledImageDataH);
+    }
+    else {
+        // Binary search on quality. Try the top first, since small images will often fit outright.
+        CodecQ low = codecMinQuality, high = codecMaxQuality, quality = codecMaxQuality;
+        NSData *bestFit = nil, *smallest = nil;
+        
+        while (1) {
+            SetHandleSize(scaledImageDataH, 0);
+            GraphicsExportSetCompressionQuality(exportComponent, quality);
+            GraphicsExportDoExport(exportComponent, &actualSizeWritten);
+            
+            HLock(scaledImageDataH);
+            NSData *attempt = [NSData dataWithBytes:*scaledImageDataH length:GetHandleSize(scaledImageDataH)];
+            HUnlock(scaledImageDataH);
+            
+            if ([attempt length] <= maxBytes) {
+                bestFit = attempt;
+                low = quality;
+            }
+            else {
+                high = quality;
+            }
+            if (smallest == nil || [attempt length] < [smallest length]) 
+                smallest = attempt;
+            
+            if (quality == codecMaxQuality && bestFit) 
+                break;
+            
+            // Qualities closer together than this don't make a visible (or byte-count) difference
+            if (high - low <= (codecNormalQuality - codecLowQuality) / 8) {
+                if (bestFit || quality == codecMinQuality) 
+                    break;
+                // Nothing has fit yet - last chance is the bottom of the range
+                quality = codecMinQuality;
+                low = codecMinQuality;
+                continue;
+            }
+            
+            quality = low + (high - low) / 2;
+        }
+        
+        scaledImageData = bestFit ? bestFit : smallest;
+    }
 
+    // The derivatives are made from the scaled image rather than the source, each from the one before
+    if (scaledGWorld && wantsDerivatives) {
+        PixMapHandle pixMap = GetGWorldPixMap(scaledGWorld);
+        int width = scaledBounds.right - scaledBounds.left, height = scaledBounds.bottom - scaledBounds.top;
+        unsigned char *rgb = (unsigned char *)ZWScratchAlloc(arena, width * height * 3);
+        
+        if (rgb && LockPixels(pixMap)) {
+            const unsigned char *base = (const unsigned char *)GetPixBaseAddr(pixMap);
+            long rowBytes = GetPixRowBytes(pixMap);
+            int x, y;
+            
+            // ARGB -> RGB
+            for (y = 0; y < height; y++) {
+                const unsigned char *in = base + y * rowBytes;
+                unsigned char *out = rgb + y * width * 3;
+                for (x = 0; x < width; x++) {
+                    out[0] = in[1];
+                    out[1] = in[2];
+                    out[2] = in[3];
+                    in += 4;
+                    out += 3;
+                }
+            }
+            UnlockPixels(pixMap);
+            
+            derivatives = cascadeDerivatives(rgb, width, height, 3, [sizes subarrayWithRange:NSMakeRange(1, [sizes count] - 1)], sharpenAmount, sharpenRadius, arena);
+        }
+        ZWScratchFree(arena, rgb);
+    }
+    
     DisposeHandle(scaledImageDataH);
     CloseComponent(exportComponent);
+    if (scaledGWorld) 
+        DisposeGWorld(scaledGWorld);
+    ZWScratchFree(arena, scaledPixels);
     DisposeUserData(imageMetadata);
     CloseComponent(importComponent);
-    DisposeHandle(imageDataH);
+    
+    if (scaledImageData == nil) 
+        return nil;
+    
+    NSMutableArray *images = [NSMutableArray arrayWithObject:scaledImageData];
+    if (derivatives) 
+        [images addObjectsFromArray:derivatives];
+    return images;
+}
+
+#pragma mark Streaming
+
+typedef struct StreamedResizeContext {
+    ZWJPEGEncoder *encoder;     // if we're compressing as we go
+    unsigned char *pixels;      // if we're keeping the scaled image around to compress later
+    int rowLength;
+    struct StreamedResizeContext *next;     // the next size down, if we're making one from these rows
+    ZWImageResampler *nextResampler;        // and what scales them to it, unless it's the same size
+} StreamedResizeContext;
+
+static int appendToData(void *context, const unsigned char *bytes, size_t length)
+{
+    [(NSMutableData *)context appendBytes:bytes length:length];
+    return 1;
+}
+
+static int takeScaledRow(void *context, const unsigned char *row, int y)
+{
+    StreamedResizeContext *resize = (StreamedResizeContext *)context;
+    
+    if (resize->pixels) 
+        memcpy(resize->pixels + y * resize->rowLength, row, resize->rowLength);
+    if (resize->encoder && !ZWJPEGEncoderWriteScanline(resize->encoder, row)) 
+        return 0;
+    if (resize->nextResampler) 
+        return ZWImageResamplerPushRow(resize->nextResampler, row);
+    if (resize->next) 
+        return takeScaledRow(resize->next, row, y);
+    return 1;
+}
+
+// A transform from the ICC profile data carries, or NULL if it hasn't got one we can convert from
+static ZWColorTransform *createProfileColorTransform(NSData *data, int components, ZWScratchArena *arena)
+{
+    size_t length = ZWJPEGCopyICCProfile([data bytes], [data length], NULL);
+    ZWColorTransform *transform = NULL;
+    unsigned char *profile;
+    
+    if (length == 0) 
+        return NULL;
+    
+    profile = (unsigned char *)ZWScratchAlloc(arena, length);
+    if (profile) {
+        ZWJPEGCopyICCProfile([data bytes], [data length], profile);
+        transform = ZWColorTransformCreateFromICC(profile, length, components);
+    }
+    ZWScratchFree(arena, profile);
+    
+    return transform;
+}
+
+static int processorCount(void)
+{
+    static int count = 0;
+    
+    if (count == 0) {
+        int mib[2] = { CTL_HW, HW_NCPU };
+        size_t length = sizeof(count);
+        
+        if (sysctl(mib, 2, &count, &length, NULL, 0) != 0 || count < 1) 
+            count = 1;
+    }
+    
+    return count;
+}
+
+// Starts a JPEG of the scaled image, carrying over the source's EXIF like QuickTime does. The source's ICC 
+// profile comes too, unless the pixels have been converted to sRGB, in which case they're tagged as that.
+static ZWJPEGEncoder *createStreamingEncoder(NSData *source, NSMutableData *output, int width, int height, int components, int quality, BOOL convertedToSRGB, ZWScratchArena *arena)
+{
+    ZWJPEGEncoder *encoder = ZWJPEGEncoderCreate(width, height, components, quality, appendToData, output, arena);
+    ZWJPEGSegment segment;
+    size_t position = 0;
+    
+    if (encoder == NULL) 
+        return NULL;
+    
+    if ((double)width * height >= PARALLEL_ENCODE_MIN_PIXELS && processorCount() > 1) 
+        ZWJPEGEncoderSetThreads(encoder, processorCount());
+    
+    while (ZWJPEGNextSegment([source bytes], [source length], &position, &segment) && segment.marker != ZWJPEG_SOS) {
+        if ((segment.marker == ZWJPEG_APP1 && segment.length >= 6 && memcmp(segment.data, "Exif\0", 5) == 0) || 
+            (segment.marker == ZWJPEG_APP2 && segment.length >= 12 && memcmp(segment.data, "ICC_PROFILE", 11) == 0 && !convertedToSRGB)) 
+            ZWJPEGEncoderWriteMarker(encoder, segment.marker, segment.data, segment.length);
+    }
+    
+    // Gray images are left untagged, as there's no such thing as a gray sRGB profile
+    if (convertedToSRGB && components == 3) {
+        unsigned char segmentData[14 + ZWCOLOR_SRGB_PROFILE_LENGTH];
+        
+        memcpy(segmentData, "ICC_PROFILE\0\1\1", 14);
+        ZWColorTransformWriteSRGBProfile(segmentData + 14);
+        ZWJPEGEncoderWriteMarker(encoder, ZWJPEG_APP2, segmentData, sizeof(segmentData));
+    }
+    
+    return encoder;
+}
+
+// Decodes, scales and compresses a scanline at a time, so only a handful of source rows are ever in 
+// memory however big the source is. The derivatives are scaled down from the rows as they come out. 
+// Returns nil if the source isn't a JPEG our decoder can read.
++ (NSArray*) getStreamedScaledImagesFromData:(NSData*)data toSizes:(NSArray*)sizes maxBytes:(unsigned long)maxBytes sharpenAmount:(float)sharpenAmount sharpenRadius:(float)sharpenRadius scratchArena:(ZWScratchArena *)arena {
+    NSSize size = [[sizes objectAtIndex:0] sizeValue];
+    BOOL wantsDerivatives = ([sizes count] > 1);
+    ZWJPEGDecoder *decoder = ZWJPEGDecoderCreate([data bytes], [data length], arena);
+    ZWImageResampler *resampler = NULL;
+    ZWColorTransform *transform = NULL, *derivativeTransform = NULL;
+    BOOL convertedToSRGB;
+    StreamedResizeContext resize, *derivativeSteps = NULL;
+    NSMutableArray *derivativeOutputs = nil;
+    int derivativeCount = [sizes count] - 1;
+    NSMutableData *output = nil;
+    unsigned char *sourceRow = NULL;
+    NSData *result = nil;
+    NSArray *derivatives = nil;
+    int width, height, components, i;
+    BOOL keepPixels = (maxBytes > 0);
+    
+    if (decoder == NULL) 
+        return nil;
+    
+    components = ZWJPEGDecoderGetComponents(decoder);
+    NSSize scaledSize = getGoodSize(NSMakeSize(ZWJPEGDecoderGetWidth(decoder), ZWJPEGDecoderGetHeight(decoder)), size);
+    width = scaledSize.width;
+    height = scaledSize.height;
+    
+    memset(&resize, 0, sizeof(resize));
+    resize.rowLength = width * components;
+    
+    // Resample in linear light, converting to sRGB if the source has a profile. Sources without one are
+    // taken to be sRGB already.
+    transform = createProfileColorTransform(data, components, arena);
+    convertedToSRGB = (transform != NULL);
+    if (transform == NULL) 
+        transform = ZWColorTransformCreateSRGB(components);
+    
+    // With a byte budget we'll be compressing more than once, and decoding the source again each time 
+    // would be far slower than holding on to the (much smaller) scaled image
+    if (keepPixels) 
+        resize.pixels = (unsigned char *)ZWScratchAlloc(arena, resize.rowLength * height);
+    if (maxBytes == 0) {
+        output = [NSMutableData data];
+        resize.encoder = createStreamingEncoder(data, output, width, height, components, OWN_ENCODER_QUALITY, convertedToSRGB, arena);
+    }
+    
+    // If the derivatives can't be set up, the scaled image is still worth having on its own
+    if (wantsDerivatives) {
+        derivativeTransform = ZWColorTransformCreateSRGB(components);
+        derivativeSteps = (StreamedResizeContext *)ZWScratchAlloc(arena, derivativeCount * sizeof(StreamedResizeContext));
+        derivativeOutputs = [NSMutableArray arrayWithCapacity:derivativeCount];
+        if (derivativeSteps) 
+            memset(derivativeSteps, 0, derivativeCount * sizeof(StreamedResizeContext));
+        if (derivativeTransform == NULL || derivativeSteps == NULL || 
+            !chainDerivatives(&resize, width, height, components, [sizes subarrayWithRange:NSMakeRange(1, derivativeCount)], derivativeSteps, derivativeOutputs, derivativeTransform, sharpenAmount, sharpenRadius, arena)) {
+            if (derivativeSteps) 
+                destroyDerivativeChain(&resize, derivativeSteps, derivativeCount);
+            ZWScratchFree(arena, derivativeSteps);
+            derivativeSteps = NULL;
+            resize.next = NULL;
+            resize.nextResampler = NULL;
+        }
+    }
+    
+    sourceRow = (unsigned char *)ZWScratchAlloc(arena, ZWJPEGDecoderGetWidth(decoder) * components);
+    resampler = ZWImageResamplerCreate(ZWJPEGDecoderGetWidth(decoder), ZWJPEGDecoderGetHeight(decoder), width, height, components, takeScaledRow, &resize, arena);
+    
+    if (sourceRow && resampler && transform && ZWImageResamplerSetColorTransform(resampler, transform) && 
+        ZWImageResamplerSetSharpening(resampler, sharpenAmount, sharpenRadius) && 
+        (resize.pixels || !keepPixels) && (resize.encoder || maxBytes > 0)) {
+        BOOL ok = YES;
+        
+        while (ok && ZWJPEGDecoderReadScanline(decoder, sourceRow)) 
+            ok = ZWImageResamplerPushRow(resampler, sourceRow);
+        
+        if (ok && resize.encoder) {
+            if (ZWJPEGEncoderFinish(resize.encoder)) 
+                result = output;
+        }
+        else if (ok) {
+            // Same search as the QuickTime path: try the top first, then bisect
+            int low = 1, high = 100, quality = 100, y;
+            NSData *bestFit = nil, *smallest = nil;
+            
+            while (1) {
+                NSMutableData *attempt = [NSMutableData data];
+                ZWJPEGEncoder *encoder = createStreamingEncoder(data, attempt, width, height, components, quality, convertedToSRGB, arena);
+                
+                if (encoder == NULL) 
+                    break;
+                for (y = 0; y < height; y++) 
+                    ZWJPEGEncoderWriteScanline(encoder, resize.pixels + y * resize.rowLength);
+                ZWJPEGEncoderFinish(encoder);
+                ZWJPEGEncoderDestroy(encoder);
+                
+                if ([attempt length] <= maxBytes) {
+                    bestFit = attempt;
+                    low = quality;
+                }
+                else {
+                    high = quality;
+                }
+                if (smallest == nil || [attempt length] < [smallest length]) 
+                    smallest = attempt;
+                
+                if (quality == 100 && bestFit) 
+                    break;
+                if (high - low <= 3) {
+                    if (bestFit || quality == 1) 
+                        break;
+                    quality = low = 1;
+                    continue;
+                }
+                
+                quality = low + (high - low) / 2;
+            }
+            
+            result = bestFit ? bestFit : smallest;
+        }
+        
+        if (ok && result && derivativeSteps) {
+            for (i = 0; i < derivativeCount && ok; i++) 
+                ok = ZWJPEGEncoderFinish(derivativeSteps[i].encoder);
+            if (ok) 
+                derivatives = derivativeOutputs;
+        }
+    }
+    
+    if (derivativeSteps) 
+        destroyDerivativeChain(&resize, derivativeSteps, derivativeCount);
+    ZWScratchFree(arena, derivativeSteps);
+    ZWColorTransformDestroy(derivativeTransform);
+    ZWImageResamplerDestroy(resampler);
+    ZWColorTransformDestroy(transform);
+    ZWJPEGEncoderDestroy(resize.encoder);
+    ZWJPEGDecoderDestroy(decoder);
+    ZWScratchFree(arena, resize.pixels);
+    ZWScratchFree(arena, sourceRow);
+    
+    if (result == nil) 
+        return nil;
+    
+    NSMutableArray *images = [NSMutableArray arrayWithObject:result];
+    if (derivatives) 
+        [images addObjectsFromArray:derivatives];
+    return images;
+}
+
+#pragma mark Rewriting
+
++ (NSData*) rewriteJPEGData:(NSData*)data flags:(int)flags applyOrientation:(BOOL)applyOrientation scratchArena:(ZWScratchArena *)arena {
+    const unsigned char *bytes = (const unsigned char *)[data bytes];
+    ZWJPEGTransform transform = ZWJPEGTransformNone;
+    ZWJPEGSegment exif;
+    
+    if (applyOrientation && ZWJPEGFindSegment(bytes, [data length], ZWJPEG_APP1, "Exif\0\0", 6, &exif)) 
+        transform = ZWJPEGTransformForExifOrientation(ZWJPEGExifOrientation((unsigned char *)exif.data, exif.length, 0));
+    if (flags == ZWJPEGKeepAllMetadata && transform == ZWJPEGTransformNone) 
+        return nil;
+    
+    NSMutableData *output = [NSMutableData dataWithCapacity:[data length]];
+    if (!ZWJPEGRewrite(bytes, [data length], flags, transform, appendToData, output, arena)) 
+        return nil;
+    
+    return output;
+}
 
-    return scaledImageData;
+// Sets up each of sizes (largest first) to be made from the rows of the size before it as they come out, 
+// starting with first's, and compressed as they go, so none of them is ever held whole. steps has a 
+// context for each size and outputs gets the JPEG data for each. It's the same cascade as the one below,
+// only streamed; transform is an sRGB one since the rows are sRGB by then. Returns NO if any step 
+// couldn't be set up, in which case the chain still has to be destroyed.
+static BOOL chainDerivatives(StreamedResizeContext *first, int width, int height, int components, NSArray *sizes, StreamedResizeContext *steps, NSMutableArray *outputs, const ZWColorTransform *transform, float sharpenAmount, float sharpenRadius, ZWScratchArena *arena)
+{
+    StreamedResizeContext *previous = first;
+    int previousWidth = width, previousHeight = height;
+    unsigned int i;
+    
+    for (i = 0; i < [sizes count]; i++) {
+        NSSize goodSize = getGoodSize(NSMakeSize(previousWidth, previousHeight), [[sizes objectAtIndex:i] sizeValue]);
+        int newWidth = goodSize.width, newHeight = goodSize.height;
+        NSMutableData *output = [NSMutableData data];
+        
+        steps[i].rowLength = newWidth * components;
+        steps[i].encoder = ZWJPEGEncoderCreate(newWidth, newHeight, components, OWN_ENCODER_QUALITY, appendToData, output, arena);
+        if (steps[i].encoder == NULL) 
+            return NO;
+        [outputs addObject:output];
+        
+        // sizes that would need enlarging just get the previous size's rows again
+        if (newWidth != previousWidth || newHeight != previousHeight) {
+            previous->nextResampler = ZWImageResamplerCreate(previousWidth, previousHeight, newWidth, newHeight, components, takeScaledRow, &steps[i], arena);
+            if (previous->nextResampler == NULL || !ZWImageResamplerSetColorTransform(previous->nextResampler, transform) || 
+                !ZWImageResamplerSetSharpening(previous->nextResampler, sharpenAmount, sharpenRadius)) 
+                return NO;
+        }
+        previous->next = &steps[i];
+        
+        previous = &steps[i];
+        previousWidth = newWidth;
+        previousHeight = newHeight;
+    }
+    
+    return YES;
 }
 
+static void destroyDerivativeChain(StreamedResizeContext *first, StreamedResizeContext *steps, int count)
+{
+    int i;
+    
+    ZWImageResamplerDestroy(first->nextResampler);
+    for (i = 0; i < count; i++) {
+        ZWImageResamplerDestroy(steps[i].nextResampler);
+        ZWJPEGEncoderDestroy(steps[i].encoder);
+    }
+}
+
+// Makes an image for each of sizes (largest first) by resampling the one before it, starting from pixels.
+// Each step only has to look at the pixels of the last, so a thumbnail after a 640 pixel resize costs
+// next to nothing. Sizes that would need enlarging just get the previous image again. pixels are sRGB 
+// (they've already been converted if the source had a profile), and are resampled in linear light. Each
+// step is sharpened as it's made; the sharpening from the step before is mostly averaged away by then.
+static NSArray *cascadeDerivatives(unsigned char *pixels, int width, int height, int components, NSArray *sizes, float sharpenAmount, float sharpenRadius, ZWScratchArena *arena)
+{
+    NSMutableArray *derivatives = [NSMutableArray arrayWithCapacity:[sizes count]];
+    ZWColorTransform *transform = ZWColorTransformCreateSRGB(components);
+    unsigned char *previous = pixels;
+    int previousWidth = width, previousHeight = height;
+    unsigned int i;
+    int y;
+    
+    for (i = 0; i < [sizes count]; i++) {
+        NSSize goodSize = getGoodSize(NSMakeSize(previousWidth, previousHeight), [[sizes objectAtIndex:i] sizeValue]);
+        int newWidth = goodSize.width, newHeight = goodSize.height;
+        NSMutableData *output = [NSMutableData data];
+        StreamedResizeContext resize;
+        BOOL ok = NO;
+        
+        memset(&resize, 0, sizeof(resize));
+        resize.rowLength = newWidth * components;
+        resize.encoder = ZWJPEGEncoderCreate(newWidth, newHeight, components, OWN_ENCODER_QUALITY, appendToData, output, arena);
+        if (resize.encoder == NULL) 
+            break;
+        
+        if (newWidth == previousWidth && newHeight == previousHeight) {
+            for (y = 0; y < newHeight; y++) 
+                ZWJPEGEncoderWriteScanline(resize.encoder, previous + y * resize.rowLength);
+            ok = ZWJPEGEncoderFinish(resize.encoder);
+        }
+        else {
+            ZWImageResampler *resampler;
+            
+            resize.pixels = (unsigned char *)ZWScratchAlloc(arena, resize.rowLength * newHeight);
+            resampler = ZWImageResamplerCreate(previousWidth, previousHeight, newWidth, newHeight, components, takeScaledRow, &resize, arena);
+            if (resize.pixels && resampler && transform && ZWImageResamplerSetColorTransform(resampler, transform) && 
+                ZWImageResamplerSetSharpening(resampler, sharpenAmount, sharpenRadius)) {
+                ok = YES;
+                for (y = 0; y < previousHeight && ok; y++) 
+                    ok = ZWImageResamplerPushRow(resampler, previous + y * previousWidth * components);
+                ok = ok && ZWJPEGEncoderFinish(resize.encoder);
+            }
+            ZWImageResamplerDestroy(resampler);
+            
+            if (ok) {
+                if (previous != pixels) 
+                    ZWScratchFree(arena, previous);
+                previous = resize.pixels;
+                previousWidth = newWidth;
+                previousHeight = newHeight;
+            }
+            else {
+                ZWScratchFree(arena, resize.pixels);
+            }
+        }
+        ZWJPEGEncoderDestroy(resize.encoder);
+        
+        if (!ok) 
+            break;
+        [derivatives addObject:output];
+    }
+    
+    if (previous != pixels) 
+        ZWScratchFree(arena, previous);
+    ZWColorTransformDestroy(transform);
+    
+    // all or nothing, so the caller can match them up with the sizes it asked for
+    return ([derivatives count] == [sizes count]) ? derivatives : nil;
+}
+
+#pragma mark -
+
 NSSize getGoodSize(NSSize size, NSSize maxSize) {    
     int old_x = size.width;
     int old_y = size.height;
@@ -145,26 +733,15 @@ NSSize getGoodSize(NSSize size, NSSize maxSize) {
     return NSMakeSize(good_x, good_y);
 }
 
-Handle myCreateHandleDataRef(
-                             Handle             dataHandle,
-                             Str255             fileName,
-                             OSType             fileType,
-                             StringPtr          mimeTypeString,
-                             Ptr                initDataPtr,
-                             Size               initDataByteCount
-                             )
+// Appends the filename, file type and MIME type data ref extensions that help QuickTime pick an importer.
+// This works on both handle and pointer data refs since the extensions just follow the base record.
+static OSErr myAddDataRefExtensions(Handle dataRef, Str255 fileName, OSType fileType, StringPtr mimeTypeString, Boolean hasInitData)
 {
-    OSErr        err;
-    Handle    dataRef = nil;
+    OSErr        err = noErr;
     Str31        tempName;
     long        atoms[3];
     StringPtr    name;
     
-    
-    // First create a data reference handle for our data
-    err = PtrToHand( &dataHandle, &dataRef, sizeof(Handle));
-    if (err) goto bail;
-    
     // If this is QuickTime 3 or later, we can add
     // the filename to the data ref to help importer
     // finding process. Find uses the extension.
@@ -178,10 +755,10 @@ Handle myCreateHandleDataRef(
     
     // Only add the file name if we are also adding a
     // file type, MIME type or initialization data
-    if ((fileType) || (mimeTypeString) || (initDataPtr))
+    if ((fileType) || (mimeTypeString) || (hasInitData))
     {
         err = PtrAndHand(name, dataRef, name[0]+1);
-        if (err) goto bail;
+        if (err) return err;
     }
     
     // If this is QuickTime 4, the handle data handler
@@ -203,7 +780,7 @@ Handle myCreateHandleDataRef(
         atoms[2] = EndianU32_NtoB(fileType);
         
         err = PtrAndHand(atoms, dataRef, sizeof(long) * 3);
-        if (err) goto bail;
+        if (err) return err;
     }
     
     
@@ -216,12 +793,68 @@ Handle myCreateHandleDataRef(
         atoms[1] = EndianU32_NtoB(kDataRefExtensionMIMEType);
         
         err = PtrAndHand(atoms, dataRef, sizeof(long) * 2);
-        if (err) goto bail;
+        if (err) return err;
         
         err = PtrAndHand(mimeTypeString, dataRef, mimeTypeString[0]+1);
-        if (err) goto bail;
+        if (err) return err;
     }
     
+    return noErr;
+}
+
+// Like myCreateHandleDataRef, but the data ref refers to memory we already have instead of a Handle, so
+// there's no need to copy the image into a Handle first. Requires QuickTime 6.
+Handle myCreatePointerDataRef(
+                              void              *data,
+                              Size              dataSize,
+                              Str255            fileName,
+                              OSType            fileType,
+                              StringPtr         mimeTypeString
+                              )
+{
+    OSErr                   err;
+    PointerDataRefRecord    pointerRecord;
+    Handle                  dataRef = nil;
+    
+    pointerRecord.data = data;
+    pointerRecord.dataLength = dataSize;
+    
+    err = PtrToHand(&pointerRecord, &dataRef, sizeof(PointerDataRefRecord));
+    if (err) goto bail;
+    
+    err = myAddDataRefExtensions(dataRef, fileName, fileType, mimeTypeString, false);
+    if (err) goto bail;
+    
+    return dataRef;
+    
+bail:
+    if (dataRef) 
+        DisposeHandle(dataRef);
+    
+    return nil;
+}
+
+Handle myCreateHandleDataRef(
+                             Handle             dataHandle,
+                             Str255             fileName,
+                             OSType             fileType,
+                             StringPtr          mimeTypeString,
+                             Ptr                initDataPtr,
+                             Size               initDataByteCount
+                             )
+{
+    OSErr        err;
+    Handle    dataRef = nil;
+    long        atoms[3];
+    
+    
+    // First create a data reference handle for our data
+    err = PtrToHand( &dataHandle, &dataRef, sizeof(Handle));
+    if (err) goto bail;
+    
+    err = myAddDataRefExtensions(dataRef, fileName, fileType, mimeTypeString, (initDataPtr != nil));
+    if (err) goto bail;
+    
     // add any initialization data, but only if a dataHandle was
     // not already specified (any initialization data is ignored
     // in this case)
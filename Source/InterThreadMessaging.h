@@ -25,6 +25,44 @@
 
 + (void) prepareForInterThreadMessages; // in NSDefaultRunLoopMode
 
+/* How messages get to threads prepared from now on.  kITMQueueTransport,
+   the default where it's available (Mac OS X 10.4 and later), gives each
+   thread a lock-free ring of messages that any number of threads can add to
+   without taking a lock or allocating anything, and a run loop source that
+   is only signalled when the ring goes from empty to non-empty.  Elsewhere,
+   or when asked for, messages travel as NSPortMessages on a port per thread,
+   as they always have.  Either way a full queue makes the sender wait until
+   its limit date and then raise NSPortTimeoutException, and a send that
+   races the receiving thread's exit raises NSInvalidSendPortException, as
+   sending on an invalidated port does.  Returns the
+   transport actually used, which is the port one if the queue one isn't
+   available. */
+
+typedef enum InterThreadMessageTransport InterThreadMessageTransport;
+enum InterThreadMessageTransport
+{
+    kITMPortTransport = 0,
+    kITMQueueTransport
+};
+
++ (InterThreadMessageTransport) setInterThreadMessageTransport:(InterThreadMessageTransport)transport;
++ (InterThreadMessageTransport) interThreadMessageTransport;
+
+/* What the messaging is up to right now: how many threads are prepared to
+   receive messages, and how many messages have been sent that haven't been
+   handled yet.  A thread's port is removed when it exits, so livePorts
+   should come back down once the threads started for an operation are
+   done. */
+
+typedef struct InterThreadMessagingStatistics InterThreadMessagingStatistics;
+struct InterThreadMessagingStatistics
+{
+    unsigned int livePorts;
+    int messagesInFlight;
+};
+
++ (void) getInterThreadMessagingStatistics:(InterThreadMessagingStatistics *)statistics;
+
 @end
 
 
@@ -8,6 +8,9 @@
  */
 
 #import <pthread.h>
+#import <unistd.h>
+#import <libkern/OSAtomic.h>
+#import <CoreFoundation/CoreFoundation.h>
 #import "InterThreadMessaging.h"
 
 /* There are four types of messages that can be posted between threads: a
@@ -52,83 +55,398 @@ struct InterThreadMessage
 
 
 
-/* Each thread is associated with an NSPort.  This port is used to deliver
-   messages to the target thread. */
+/* With the queue transport, messages are copied straight into a fixed ring
+   of cells belonging to the receiving thread.  Any number of threads can
+   add to it at once (each claims a cell by bumping tail with a compare-and-
+   swap); only the receiving thread takes from it.  Each cell's sequence
+   number says whose turn it is: a cell at position p is free for the
+   producer that claims p when its sequence is p, and holds a message for
+   the consumer when its sequence is p + 1.
+
+   pending counts messages added but not yet taken off.  Only the producer
+   that takes it from 0 to 1 rings the doorbell (signals the run loop source
+   and wakes the run loop), so a burst of messages costs one wakeup.
+
+   closed is set when the receiving thread exits.  A sender that got hold of
+   the queue just before then checks it after adding its message, so it
+   raises like a send to an invalidated port would rather than leaving the
+   message where nobody will ever take it. */
+
+#define kITMQueueSize 1024      /* messages per thread; a power of two */
+
+typedef struct InterThreadQueueCell InterThreadQueueCell;
+struct InterThreadQueueCell
+{
+    volatile int32_t sequence;
+    InterThreadMessage message;
+};
+
+typedef struct InterThreadQueue InterThreadQueue;
+struct InterThreadQueue
+{
+    volatile int32_t tail;      /* next cell for producers to claim */
+    int32_t head;               /* next cell to read; the consumer's alone */
+    volatile int32_t pending;
+    volatile int32_t closed;
+    CFRunLoopSourceRef source;
+    CFRunLoopRef runLoop;
+    InterThreadQueueCell cells[kITMQueueSize];
+};
+
+
+
+/* Each thread is associated with a receiver: an NSPort, or a queue, used
+   to deliver messages to the target thread.  The receiver keeps the run
+   loop it was scheduled in, so it can be taken out again when the thread
+   exits without having to ask the thread for it. */
+
+@interface InterThreadReceiver : NSObject
+{
+@public
+    NSPort *port;
+    InterThreadQueue *queue;
+    NSRunLoop *runLoop;
+}
+@end
+
+/* The registry of receivers is read on every message and written only when
+   a thread is prepared or exits, so it's guarded by a read-write lock that
+   any number of senders can hold at once.  Most sends don't even take that:
+   each sending thread remembers the last receiver it looked up, along with
+   the registry's generation at the time.  Removing a receiver bumps the
+   generation, which makes every remembered receiver get looked up again -
+   that's what stops a new thread that happens to get a dead one's address
+   from being sent the dead one's messages.  The remembered receiver is
+   retained, so it can never go away under a sender that's using it. */
+
+typedef struct InterThreadSenderCache InterThreadSenderCache;
+struct InterThreadSenderCache
+{
+    NSThread *thread;
+    InterThreadReceiver *receiver;
+    int32_t generation;
+};
 
 static NSMapTable *pThreadMessagePorts = NULL;
-static pthread_mutex_t pGate = { 0 };
+static pthread_rwlock_t pGate;
+static volatile int32_t pGeneration = 0;
+static pthread_key_t pSenderCacheKey;
+static InterThreadMessageTransport pTransport = kITMQueueTransport;
+
+/* For +getInterThreadMessagingStatistics: */
+static unsigned int pLiveReceivers = 0;       /* guarded by pGate */
+static volatile int32_t pMessagesInFlight = 0;
+static pthread_mutex_t pCountGate = PTHREAD_MUTEX_INITIALIZER;
 
 @interface InterThreadManager : NSObject
 + (void) threadDied:(NSNotification *)notification;
 + (void) handlePortMessage:(NSPortMessage *)msg;
 @end
 
+static void deliverMessage (InterThreadMessage *msg);
+static void drainQueue (void *info);
+
+static BOOL
+queueTransportAvailable (void)
+{
+    /* OSAtomic is weak linked; it's not there before 10.4 */
+    return (NULL != OSAtomicCompareAndSwap32Barrier);
+}
+
+/* Keeps count of messages sent but not yet delivered */
+static void
+countMessages (int32_t delta)
+{
+    if (NULL != OSAtomicAdd32Barrier) {
+        OSAtomicAdd32Barrier(delta, (int32_t *) &pMessagesInFlight);
+    } else {
+        pthread_mutex_lock(&pCountGate);
+        pMessagesInFlight += delta;
+        pthread_mutex_unlock(&pCountGate);
+    }
+}
+
+/* The sending thread's cached receiver goes when the thread does */
+static void
+releaseSenderCache (void *value)
+{
+    InterThreadSenderCache *cache = (InterThreadSenderCache *) value;
+
+    [cache->receiver release];
+    free(cache);
+}
+
+static InterThreadQueue *
+createQueue (NSRunLoop *runLoop)
+{
+    InterThreadQueue *queue;
+    CFRunLoopSourceContext context;
+    int i;
+
+    queue = (InterThreadQueue *) calloc(1, sizeof(InterThreadQueue));
+    if (NULL == queue) {
+        return NULL;
+    }
+    for (i = 0; i < kITMQueueSize; i++) {
+        queue->cells[i].sequence = i;
+    }
+
+    bzero(&context, sizeof(context));
+    context.info = queue;
+    context.perform = drainQueue;
+    queue->source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+    queue->runLoop = (CFRunLoopRef) CFRetain([runLoop getCFRunLoop]);
+
+    CFRunLoopAddSource(queue->runLoop, queue->source, (CFStringRef) NSModalPanelRunLoopMode);  // ZWw: same as the port
+    CFRunLoopAddSource(queue->runLoop, queue->source, kCFRunLoopDefaultMode);
+
+    return queue;
+}
+
+/* Called once nobody can be sending to the queue any more.  Messages that
+   never got delivered still hold their objects. */
+static void
+destroyQueue (InterThreadQueue *queue)
+{
+    InterThreadQueueCell *cell;
+    InterThreadMessage *msg;
+
+    CFRunLoopSourceInvalidate(queue->source);
+    CFRelease(queue->source);
+    CFRelease(queue->runLoop);
+
+    for (;;) {
+        cell = &queue->cells[queue->head & (kITMQueueSize - 1)];
+        if (cell->sequence != queue->head + 1) {
+            break;
+        }
+        msg = &cell->message;
+        if (kITMPostNotification == msg->type) {
+            [msg->data.notification release];
+        } else {
+            [msg->data.sel.receiver release];
+            [msg->data.sel.arg1 release];
+            [msg->data.sel.arg2 release];
+        }
+        queue->head++;
+        countMessages(-1);
+    }
+
+    free(queue);
+}
+
+/* Returns NO if the queue is full */
+static BOOL
+enqueueMessage (InterThreadQueue *queue, const InterThreadMessage *message)
+{
+    InterThreadQueueCell *cell;
+    int32_t position, difference;
+
+    for (;;) {
+        position = queue->tail;
+        cell = &queue->cells[position & (kITMQueueSize - 1)];
+        OSMemoryBarrier();
+        difference = cell->sequence - position;
+
+        if (0 == difference) {
+            if (OSAtomicCompareAndSwap32Barrier(position, position + 1,
+                                                (int32_t *) &queue->tail)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return NO;
+        }
+        /* otherwise another sender got this cell first; try the next */
+    }
+
+    cell->message = *message;
+    OSMemoryBarrier();
+    cell->sequence = position + 1;
+
+    if (1 == OSAtomicIncrement32Barrier((int32_t *) &queue->pending)) {
+        CFRunLoopSourceSignal(queue->source);
+        CFRunLoopWakeUp(queue->runLoop);
+    }
+
+    return YES;
+}
+
+/* The run loop source's perform routine, in the receiving thread */
+static void
+drainQueue (void *info)
+{
+    InterThreadQueue *queue = (InterThreadQueue *) info;
+    InterThreadQueueCell *cell;
+    InterThreadMessage msg;
+    NSAutoreleasePool *pool;
+
+    pool = [[NSAutoreleasePool alloc] init];
+
+    NS_DURING
+        for (;;) {
+            cell = &queue->cells[queue->head & (kITMQueueSize - 1)];
+            OSMemoryBarrier();
+            if (cell->sequence != queue->head + 1) {
+                break;
+            }
+
+            msg = cell->message;
+            OSMemoryBarrier();
+            cell->sequence = queue->head + kITMQueueSize;
+
+            /* Moved on before delivering, in case the message runs the run
+               loop and we're called again from inside it, or raises */
+            queue->head++;
+            OSAtomicDecrement32Barrier((int32_t *) &queue->pending);
+            deliverMessage(&msg);
+        }
+    NS_HANDLER
+        /* Nobody will ring the doorbell for the messages still waiting
+           behind this one, so ring it before passing the exception on */
+        OSMemoryBarrier();
+        if (queue->pending > 0) {
+            CFRunLoopSourceSignal(queue->source);
+        }
+        [localException raise];
+    NS_ENDHANDLER
+
+    /* A sender can have claimed a cell ahead of one that's been filled in,
+       and we stopped at the empty one.  The doorbell won't ring for the
+       full one, so ring it ourselves. */
+    OSMemoryBarrier();
+    if (queue->pending > 0) {
+        CFRunLoopSourceSignal(queue->source);
+    }
+
+    [pool release];
+}
+
+@implementation InterThreadReceiver
+
+- (void) dealloc
+{
+    [port release];
+    if (NULL != queue) {
+        destroyQueue(queue);
+    }
+    [runLoop release];
+    [super dealloc];
+}
+
+@end
+
 static void
 createMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
 {
+    InterThreadReceiver *receiver;
     NSPort *port;
 
     assert(nil != thread);
     assert(nil != runLoop);
     assert(NULL != pThreadMessagePorts);
 
-    pthread_mutex_lock(&pGate);
-
-    port = NSMapGet(pThreadMessagePorts, thread);
-    if (nil == port) {
-        port = [[NSPort allocWithZone:NULL] init];
-        [port setDelegate:[InterThreadManager class]];
-        [port scheduleInRunLoop:runLoop forMode:NSModalPanelRunLoopMode];  // ZWw: I need this for iPhotoToGallery usage
-        [port scheduleInRunLoop:runLoop forMode:NSDefaultRunLoopMode];
-        NSMapInsertKnownAbsent(pThreadMessagePorts, thread, port);
-
-        /* Transfer ownership of this port to the map table. */
-        [port release];
+    pthread_rwlock_wrlock(&pGate);
+
+    receiver = NSMapGet(pThreadMessagePorts, thread);
+    if (nil == receiver) {
+        receiver = [[InterThreadReceiver allocWithZone:NULL] init];
+        receiver->runLoop = [runLoop retain];
+
+        if (kITMQueueTransport == pTransport) {
+            receiver->queue = createQueue(runLoop);
+        }
+        if (NULL == receiver->queue) {
+            port = [[NSPort allocWithZone:NULL] init];
+            [port setDelegate:[InterThreadManager class]];
+            [port scheduleInRunLoop:runLoop forMode:NSModalPanelRunLoopMode];  // ZWw: I need this for iPhotoToGallery usage
+            [port scheduleInRunLoop:runLoop forMode:NSDefaultRunLoopMode];
+            receiver->port = port;
+        }
+        NSMapInsertKnownAbsent(pThreadMessagePorts, thread, receiver);
+        pLiveReceivers++;
+
+        /* Transfer ownership of this receiver to the map table. */
+        [receiver release];
     }
 
-    pthread_mutex_unlock(&pGate);
+    pthread_rwlock_unlock(&pGate);
 }
 
-static NSPort *
+/* The receiver comes back retained, so it can't go away under us if the
+   thread exits while we're sending */
+static InterThreadReceiver *
 messagePortForThread (NSThread *thread)
 {
-    NSPort *port;
+    InterThreadSenderCache *cache;
+    InterThreadReceiver *receiver;
+    int32_t generation;
 
     assert(nil != thread);
     assert(NULL != pThreadMessagePorts);
 
-    pthread_mutex_lock(&pGate);
-    port = NSMapGet(pThreadMessagePorts, thread);
-    pthread_mutex_unlock(&pGate);
+    cache = (InterThreadSenderCache *) pthread_getspecific(pSenderCacheKey);
+    if (NULL != cache && thread == cache->thread &&
+        pGeneration == cache->generation) {
+        return [cache->receiver retain];
+    }
 
-    if (nil == port) {
+    pthread_rwlock_rdlock(&pGate);
+    receiver = [NSMapGet(pThreadMessagePorts, thread) retain];
+    generation = pGeneration;
+    pthread_rwlock_unlock(&pGate);
+
+    if (nil == receiver) {
         [NSException raise:NSInvalidArgumentException
                      format:@"Thread %@ is not prepared to receive "
                             @"inter-thread messages.  You must invoke "
                             @"+prepareForInterThreadMessages first.", thread];
     }
 
-    return port;
+    if (NULL == cache) {
+        cache = (InterThreadSenderCache *)
+            calloc(1, sizeof(InterThreadSenderCache));
+        if (NULL == cache) {
+            return receiver;
+        }
+        pthread_setspecific(pSenderCacheKey, cache);
+    }
+    [cache->receiver release];
+    cache->receiver = [receiver retain];
+    cache->thread = thread;
+    cache->generation = generation;
+
+    return receiver;
 }
 
 static void
-removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
+removeMessagePortForThread (NSThread *thread)
 {
-    NSPort *port;
+    InterThreadReceiver *receiver;
 
     assert(nil != thread);
     assert(NULL != pThreadMessagePorts);
 
-    pthread_mutex_lock(&pGate);
+    pthread_rwlock_wrlock(&pGate);
     
-    port = (NSPort *) NSMapGet(pThreadMessagePorts, thread);
-    if (nil != port) {
-        [port removeFromRunLoop:runLoop forMode:NSModalPanelRunLoopMode];    // ZWw: I added it, so I need to remove it
-        [port removeFromRunLoop:runLoop forMode:NSDefaultRunLoopMode];
+    receiver = (InterThreadReceiver *) NSMapGet(pThreadMessagePorts, thread);
+    if (nil != receiver) {
+        if (nil != receiver->port) {
+            [receiver->port removeFromRunLoop:receiver->runLoop forMode:NSModalPanelRunLoopMode];    // ZWw: I added it, so I need to remove it
+            [receiver->port removeFromRunLoop:receiver->runLoop forMode:NSDefaultRunLoopMode];
+            [receiver->port invalidate];
+        }
+        if (NULL != receiver->queue) {
+            OSAtomicIncrement32Barrier((int32_t *) &receiver->queue->closed);
+            CFRunLoopSourceInvalidate(receiver->queue->source);
+        }
         NSMapRemove(pThreadMessagePorts, thread);
+        pLiveReceivers--;
+
+        /* Senders that remember this receiver have to look again */
+        pGeneration++;
     }
 
-    pthread_mutex_unlock(&pGate);
+    pthread_rwlock_unlock(&pGate);
 }
 
 
@@ -145,15 +463,43 @@ removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
                                [NSRunLoop currentRunLoop]);
 }
 
-@end
++ (InterThreadMessageTransport) setInterThreadMessageTransport:(InterThreadMessageTransport)transport
+{
+    [InterThreadManager class];
 
+    pthread_rwlock_wrlock(&pGate);
+    if (kITMQueueTransport == transport && !queueTransportAvailable()) {
+        transport = kITMPortTransport;
+    }
+    pTransport = transport;
+    pthread_rwlock_unlock(&pGate);
 
+    return transport;
+}
 
++ (InterThreadMessageTransport) interThreadMessageTransport
+{
+    [InterThreadManager class];
+
+    return pTransport;
+}
+
++ (void) getInterThreadMessagingStatistics:(InterThreadMessagingStatistics *)statistics
+{
+    [InterThreadManager class];
+
+    pthread_rwlock_rdlock(&pGate);
+    statistics->livePorts = pLiveReceivers;
+    pthread_rwlock_unlock(&pGate);
+
+    statistics->messagesInFlight = pMessagesInFlight;
+}
 
-@interface NSThread (SecretStuff)
-- (NSRunLoop *) runLoop;
 @end
 
+
+
+
 @implementation InterThreadManager
 
 + (void) initialize
@@ -162,12 +508,17 @@ removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
        (in a thread-safe manner) before any one can use this module, so I
        don't think I need to worry about race conditions here. */
     if (nil == pThreadMessagePorts) {
-        pthread_mutex_init(&pGate, NULL);
+        pthread_rwlock_init(&pGate, NULL);
+        pthread_key_create(&pSenderCacheKey, releaseSenderCache);
 
         pThreadMessagePorts =
             NSCreateMapTable(NSNonRetainedObjectMapKeyCallBacks,
                              NSObjectMapValueCallBacks, 0);
 
+        if (!queueTransportAvailable()) {
+            pTransport = kITMPortTransport;
+        }
+
         [[NSNotificationCenter defaultCenter]
             addObserver:[self class]
             selector:@selector(threadDied:)
@@ -176,16 +527,12 @@ removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
     }
 }
 
+/* Every thread that was prepared gets here on its way out, whether or not
+   it ever ran its run loop, so nothing is left behind for the threads that
+   are started for a single operation */
 + (void) threadDied:(NSNotification *)notification
 {
-    NSThread *thread;
-    NSRunLoop *runLoop;
-
-    thread = [notification object];
-    runLoop = [thread runLoop];
-    if (nil != runLoop) {
-        removeMessagePortForThread(thread, [thread runLoop]);
-    }
+    removeMessagePortForThread([notification object]);
 }
 
 + (void) handlePortMessage:(NSPortMessage *)portMessage
@@ -200,6 +547,17 @@ removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
     data = [components objectAtIndex:0];
     msg = *((InterThreadMessage **) [data bytes]);
     
+    deliverMessage(msg);
+    free(msg);
+}
+
+@end
+
+
+
+static void
+deliverMessage (InterThreadMessage *msg)
+{
     switch (msg->type)
     {
         case kITMPostNotification:
@@ -233,65 +591,121 @@ removeMessagePortForThread (NSThread *thread, NSRunLoop *runLoop)
             assert(0);
     }
 
-    free(msg);
+    countMessages(-1);
 }
 
-@end
-
-
-
-
-
 static void
-postMessage (InterThreadMessage *message, NSThread *thread, NSDate *limitDate)
+postPortMessage (InterThreadMessage *message, NSPort *port, NSThread *thread,
+                 NSDate *limitDate)
 {
     NSPortMessage *portMessage;
     NSMutableArray *components;
-    NSPort *port;
+    InterThreadMessage *copy;
     NSData *data;
     BOOL retval;
 
-    if (nil == thread) { thread = [NSThread currentThread]; }
-    port = messagePortForThread(thread);
-    assert(nil != port);
+    /* The port carries a pointer to a copy, freed in the receiving thread */
+    copy = (InterThreadMessage *) malloc(sizeof(struct InterThreadMessage));
+    *copy = *message;
 
-    data = [[NSData alloc] initWithBytes:&message length:sizeof(void *)];
+    data = [[NSData alloc] initWithBytes:&copy length:sizeof(void *)];
     components = [[NSMutableArray alloc] initWithObjects:&data count:1];
     portMessage = [[NSPortMessage alloc] initWithSendPort:port
                                          receivePort:nil
                                          components:components];
 
-    if (nil == limitDate) { limitDate = [NSDate distantFuture]; }
     retval = [portMessage sendBeforeDate:limitDate];
     [portMessage release];
     [components release];
     [data release];
 
     if (!retval) {
+        free(copy);
         [NSException raise:NSPortTimeoutException
                      format:@"Can't send message to thread %@: timeout "
                             @"before date %@", thread, limitDate];
     }
 }
 
+/* Returns NO if the message went into the queue but the thread has exited
+   since, in which case the queue owns the message and will release it */
+static BOOL
+postQueueMessage (InterThreadMessage *message, InterThreadQueue *queue,
+                  NSThread *thread, NSDate *limitDate)
+{
+    if (queue->closed) {
+        [NSException raise:NSInvalidSendPortException
+                     format:@"Can't send message to thread %@: it has "
+                            @"exited", thread];
+    }
+
+    /* A full queue is rare enough that polling for room is fine */
+    while (!enqueueMessage(queue, message)) {
+        if ([limitDate timeIntervalSinceNow] <= 0) {
+            [NSException raise:NSPortTimeoutException
+                         format:@"Can't send message to thread %@: timeout "
+                                @"before date %@", thread, limitDate];
+        }
+        usleep(1000);
+    }
+
+    OSMemoryBarrier();
+    return (0 == queue->closed);
+}
+
+static void
+postMessage (InterThreadMessage *message, NSThread *thread, NSDate *limitDate)
+{
+    InterThreadReceiver *receiver;
+    volatile BOOL queued = YES;
+
+    if (nil == thread) { thread = [NSThread currentThread]; }
+    receiver = messagePortForThread(thread);
+    assert(nil != receiver);
+
+    if (nil == limitDate) { limitDate = [NSDate distantFuture]; }
+
+    countMessages(1);
+    NS_DURING
+        if (NULL != receiver->queue) {
+            queued = postQueueMessage(message, receiver->queue, thread,
+                                      limitDate);
+        } else {
+            postPortMessage(message, receiver->port, thread, limitDate);
+        }
+    NS_HANDLER
+        countMessages(-1);
+        [receiver release];
+        [localException raise];
+    NS_ENDHANDLER
+
+    [receiver release];
+
+    /* Not counted back down here; the queue does that when it lets go */
+    if (!queued) {
+        [NSException raise:NSInvalidSendPortException
+                     format:@"Can't send message to thread %@: it exited "
+                            @"before the message could be handled", thread];
+    }
+}
+
 static void
 performSelector (InterThreadMessageType type, SEL selector, id receiver,
                  id object1, id object2, NSThread *thread, NSDate *limitDate)
 {
-    InterThreadMessage *msg;
+    InterThreadMessage msg;
 
     assert(NULL != selector);
     
     if (nil != receiver) {
-        msg = (InterThreadMessage *) malloc(sizeof(struct InterThreadMessage));
-        bzero(msg, sizeof(struct InterThreadMessage));
-        msg->type = type;
-        msg->data.sel.selector = selector;
-        msg->data.sel.receiver = [receiver retain];
-        msg->data.sel.arg1 = [object1 retain];
-        msg->data.sel.arg2 = [object2 retain];
-
-        postMessage(msg, thread, limitDate);
+        bzero(&msg, sizeof(struct InterThreadMessage));
+        msg.type = type;
+        msg.data.sel.selector = selector;
+        msg.data.sel.receiver = [receiver retain];
+        msg.data.sel.arg1 = [object1 retain];
+        msg.data.sel.arg2 = [object2 retain];
+
+        postMessage(&msg, thread, limitDate);
     }
 }
 
@@ -299,16 +713,15 @@ static void
 postNotification (NSNotification *notification, NSThread *thread,
                   NSDate *limitDate)
 {
-    InterThreadMessage *msg;
+    InterThreadMessage msg;
 
     assert(nil != notification);
     
-    msg = (InterThreadMessage *) malloc(sizeof(struct InterThreadMessage));
-    bzero(msg, sizeof(struct InterThreadMessage));
-    msg->type = kITMPostNotification;
-    msg->data.notification = [notification retain];
+    bzero(&msg, sizeof(struct InterThreadMessage));
+    msg.type = kITMPostNotification;
+    msg.data.notification = [notification retain];
 
-    postMessage(msg, thread, limitDate);
+    postMessage(&msg, thread, limitDate);
 }
 
 
@@ -0,0 +1,50 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+//
+//  Timing for the album search index, on a made-up gallery. Run by hand from the Benchmarks tool; nothing
+//  here is used in a normal export.
+//
+
+#import <Foundation/Foundation.h>
+
+@interface ZWAlbumSearchBenchmark : NSObject {
+}
+
+// Makes a gallery of count albums nested up to a few deep, indexes them the way a fetch would, then types 
+// a handful of searches into it a letter at a time. Returns a dictionary with "Albums", "BuildSeconds" 
+// (adding every album and putting the tree together), "Keystrokes", and "MeanLatencySeconds", 
+// "P50LatencySeconds", "P99LatencySeconds" and "MaxLatencySeconds" for the search after each keystroke.
+// Also "BytesPerAlbum", what the tree and index take from malloc for each album, "WalkSeconds", for going
+// through every album's view and its parent's the way the album menus do, and "ViewBytesAfterWalk", what 
+// malloc still has out once that's done, which should be next to nothing since the views go again.
++ (NSDictionary *)benchmarkAlbums:(unsigned int)count;
+
+@end
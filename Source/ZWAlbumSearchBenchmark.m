@@ -0,0 +1,185 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWAlbumSearchBenchmark.h"
+#import "ZWAlbumSearchIndex.h"
+#import "ZWAlbumTree.h"
+#import "ZWGalleryAlbum.h"
+#include <mach/mach_time.h>
+#include <malloc/malloc.h>
+#include <math.h>
+
+// What the type-ahead asks for
+#define RESULT_LIMIT 50
+
+static const char *titleWords[] = {
+    "Summer", "Winter", "Beach", "Wedding", "Birthday", "Vacation", "Family", "Party", "Trip", "Holiday",
+    "Garden", "Kids", "Graduation", "Christmas", "Hiking", "Concert", "Misc", "Friends", "Camping", "Zoo"
+};
+
+static const char *searches[] = {
+    "summer", "beach 2004", "wedding", "chr", "vacation party", "zoo 19", "misc"
+};
+
+static double secondsFromAbsolute(uint64_t absolute)
+{
+    static mach_timebase_info_data_t timebase;
+    
+    if (timebase.denom == 0) 
+        mach_timebase_info(&timebase);
+    return (double)absolute * timebase.numer / timebase.denom / 1e9;
+}
+
+static int compareLatencies(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+    return (first > second) - (first < second);
+}
+
+// Nearest rank, from latencies already sorted
+static NSNumber *percentile(const uint64_t *latencies, unsigned long count, double fraction)
+{
+    unsigned long rank = (unsigned long)ceil(fraction * count);
+    
+    if (rank < 1) 
+        rank = 1;
+    return [NSNumber numberWithDouble:secondsFromAbsolute(latencies[rank - 1])];
+}
+
+@implementation ZWAlbumSearchBenchmark
+
++ (NSDictionary *)benchmarkAlbums:(unsigned int)count
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    ZWAlbumTree *tree = nil;
+    ZWAlbumSearchIndex *index = nil;
+    unsigned int words = sizeof(titleWords) / sizeof(titleWords[0]);
+    unsigned int seed = 1, i, s, keystrokes = 0, maxKeystrokes = 0;
+    uint64_t start, buildTime, walkTime, total = 0, *latencies;
+    long bytesBefore, albumBytes, viewBytes;
+    NSDictionary *results = nil;
+    NSAutoreleasePool *stepPool;
+    NSArray *albums;
+    
+    for (s = 0; s < sizeof(searches) / sizeof(searches[0]); s++) 
+        maxKeystrokes += strlen(searches[s]);
+    latencies = malloc(maxKeystrokes * sizeof(uint64_t));
+    if (count == 0 || latencies == NULL) 
+        goto bail;
+    
+    // Everything made along the way goes with the pool, so what's left is what the tree and index keep
+    bytesBefore = mstats().bytes_used;
+    stepPool = [[NSAutoreleasePool alloc] init];
+    tree = [[ZWAlbumTree alloc] initWithGallery:nil];
+    index = [[ZWAlbumSearchIndex alloc] initWithAlbumTree:tree];
+    
+    // a year at the top, then albums in it and in each other, the way people tend to lay galleries out
+    for (i = 0; i < count; i++) {
+        NSString *title;
+        
+        seed = seed * 1103515245 + 12345;
+        if (i < 20 || i % 500 == 0) 
+            title = [NSString stringWithFormat:@"%u", 1990 + i % 20];
+        else 
+            title = [NSString stringWithFormat:@"%s %s %u", titleWords[(seed >> 16) % words], titleWords[(seed >> 8) % words], i];
+        
+        [tree addAlbumWithTitle:title name:[NSString stringWithFormat:@"album%u", i] summary:nil];
+        [tree setPermissions:(((seed >> 4) % 8 != 0) ? ZWAlbumCanAddItem : 0) ofAlbumAtIndex:i];
+    }
+    
+    // the parse adds albums before it knows their parents, so the index is built the same way
+    start = mach_absolute_time();
+    for (i = 0; i < count; i++) 
+        [index addAlbumAtIndex:i];
+    buildTime = mach_absolute_time() - start;
+    
+    for (i = 20; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        [tree setParent:(((seed >> 16) % 4 == 0) ? (seed >> 8) % 20 : (seed >> 8) % i) ofAlbumAtIndex:i];
+    }
+    
+    // the first search has the tree put its structure together
+    start = mach_absolute_time();
+    [index albumsMatching:@"a" limit:1];
+    buildTime += mach_absolute_time() - start;
+    [stepPool release];
+    albumBytes = (long)mstats().bytes_used - bytesBefore;
+    
+    // every title, and its parent's, as a menu would show them; the views are all gone again with the pool
+    stepPool = [[NSAutoreleasePool alloc] init];
+    start = mach_absolute_time();
+    albums = [tree albums];
+    for (i = 0; i < count; i++) {
+        ZWGalleryAlbum *album = [albums objectAtIndex:i];
+        [album title];
+        [[album parent] title];
+    }
+    walkTime = mach_absolute_time() - start;
+    [stepPool release];
+    viewBytes = (long)mstats().bytes_used - bytesBefore - albumBytes;
+    
+    for (s = 0; s < sizeof(searches) / sizeof(searches[0]); s++) {
+        NSString *search = [NSString stringWithUTF8String:searches[s]];
+        
+        for (i = 1; i <= [search length]; i++) {
+            NSAutoreleasePool *searchPool = [[NSAutoreleasePool alloc] init];
+            NSString *typed = [search substringToIndex:i];
+            
+            start = mach_absolute_time();
+            [index albumsMatching:typed limit:RESULT_LIMIT];
+            latencies[keystrokes] = mach_absolute_time() - start;
+            total += latencies[keystrokes++];
+            [searchPool release];
+        }
+    }
+    qsort(latencies, keystrokes, sizeof(uint64_t), compareLatencies);
+    
+    results = [[NSDictionary alloc] initWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInt:count], @"Albums",
+        [NSNumber numberWithDouble:secondsFromAbsolute(buildTime)], @"BuildSeconds",
+        [NSNumber numberWithUnsignedInt:keystrokes], @"Keystrokes",
+        [NSNumber numberWithDouble:secondsFromAbsolute(total) / keystrokes], @"MeanLatencySeconds",
+        percentile(latencies, keystrokes, 0.5), @"P50LatencySeconds",
+        percentile(latencies, keystrokes, 0.99), @"P99LatencySeconds",
+        [NSNumber numberWithDouble:secondsFromAbsolute(latencies[keystrokes - 1])], @"MaxLatencySeconds",
+        [NSNumber numberWithDouble:(double)albumBytes / count], @"BytesPerAlbum",
+        [NSNumber numberWithDouble:secondsFromAbsolute(walkTime)], @"WalkSeconds",
+        [NSNumber numberWithLong:viewBytes], @"ViewBytesAfterWalk",
+        nil];
+    
+bail:
+    [index release];
+    [tree release];
+    free(latencies);
+    [pool release];
+    return [results autorelease];
+}
+
+@end
@@ -0,0 +1,65 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+
+@class ZWAlbumTree;
+
+// Finds albums as the user types. Each album's title and name are folded to lower case and broken into 
+// trigrams, and the first one and two letters of each word are kept too; a search term of three or more
+// letters matches anywhere in the text, a shorter one only at the start of a word. Every term of a search
+// has to match the album itself or one of the albums it's in, so "2007 beach" finds the beach album 
+// inside 2007. Only albums photos can be added to are returned.
+//
+// The index is of one tree's albums, by their index in it, and walks the tree's own arrays to search; 
+// only the albums a search returns get views. Albums are added one at a time, in index order (any 
+// skipped are never found), so the index can be built while the album list is read. An index is built 
+// on one thread and only searched once it's finished, on any one thread at a time.
+@interface ZWAlbumSearchIndex : NSObject {
+    ZWAlbumTree *tree;
+    unsigned int albumCount;        // added
+    
+    char *texts;                    // the folded text of each album, one after another
+    size_t textsLength, textsCapacity;
+    uint32_t *textOffsets;          // by index; albums that weren't added have the empty text at the start
+    uint32_t textCount, textOffsetsCapacity;
+    
+    void *postings;
+}
+
+- (id)initWithAlbumTree:(ZWAlbumTree *)albumTree;
+
+- (void)addAlbumAtIndex:(unsigned int)index;
+- (unsigned int)count;
+
+// At most limit albums matching every word of query. Albums come before the ones inside them.
+- (NSArray *)albumsMatching:(NSString *)query limit:(unsigned int)limit;
+
+@end
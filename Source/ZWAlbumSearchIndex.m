@@ -0,0 +1,425 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWAlbumSearchIndex.h"
+#import "ZWAlbumTree.h"
+
+#include <ctype.h>
+
+// Words of a search beyond this many are ignored
+#define MAX_TERMS 8
+
+// Postings are kept per key in one open-addressed table. A key is a trigram of the folded text, or the
+// first one or two bytes of a word, marked in the top byte so they can't collide with trigrams.
+#define TRIGRAM_KEY(a, b, c) (((uint32_t)(a) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(c))
+#define PREFIX2_KEY(a, b) (0x01000000 | ((uint32_t)(a) << 8) | (uint32_t)(b))
+#define PREFIX1_KEY(a) (0x02000000 | (uint32_t)(a))
+#define EMPTY_KEY 0xFFFFFFFF
+
+typedef struct {
+    uint32_t *ids;      // ascending, since albums are added in order
+    uint32_t count, capacity;
+} Posting;
+
+typedef struct {
+    uint32_t *keys;
+    Posting *postings;
+    uint32_t capacity, used;
+} PostingTable;
+
+static uint32_t hashKey(uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    return key;
+}
+
+static Posting *findPosting(const PostingTable *table, uint32_t key)
+{
+    uint32_t mask = table->capacity - 1, slot;
+    
+    if (table->capacity == 0) 
+        return NULL;
+    for (slot = hashKey(key) & mask; table->keys[slot] != EMPTY_KEY; slot = (slot + 1) & mask) {
+        if (table->keys[slot] == key) 
+            return &table->postings[slot];
+    }
+    return NULL;
+}
+
+static int growTable(PostingTable *table)
+{
+    uint32_t oldCapacity = table->capacity, i, slot, mask;
+    uint32_t *oldKeys = table->keys;
+    Posting *oldPostings = table->postings;
+    uint32_t capacity = oldCapacity ? oldCapacity * 2 : 4096;
+    
+    table->keys = malloc(capacity * sizeof(uint32_t));
+    table->postings = calloc(capacity, sizeof(Posting));
+    if (table->keys == NULL || table->postings == NULL) {
+        free(table->keys);
+        free(table->postings);
+        table->keys = oldKeys;
+        table->postings = oldPostings;
+        return 0;
+    }
+    memset(table->keys, 0xFF, capacity * sizeof(uint32_t));
+    table->capacity = capacity;
+    mask = capacity - 1;
+    
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldKeys[i] == EMPTY_KEY) 
+            continue;
+        for (slot = hashKey(oldKeys[i]) & mask; table->keys[slot] != EMPTY_KEY; slot = (slot + 1) & mask) 
+            ;
+        table->keys[slot] = oldKeys[i];
+        table->postings[slot] = oldPostings[i];
+    }
+    free(oldKeys);
+    free(oldPostings);
+    return 1;
+}
+
+static void addPosting(PostingTable *table, uint32_t key, uint32_t albumID)
+{
+    uint32_t mask, slot;
+    Posting *posting;
+    
+    if ((table->used + 1) * 10 > table->capacity * 7 && !growTable(table)) 
+        return;
+    
+    mask = table->capacity - 1;
+    for (slot = hashKey(key) & mask; table->keys[slot] != EMPTY_KEY && table->keys[slot] != key; slot = (slot + 1) & mask) 
+        ;
+    if (table->keys[slot] == EMPTY_KEY) {
+        table->keys[slot] = key;
+        table->used++;
+    }
+    posting = &table->postings[slot];
+    
+    // the same trigram twice in one album only needs the one entry
+    if (posting->count && posting->ids[posting->count - 1] == albumID) 
+        return;
+    if (posting->count == posting->capacity) {
+        uint32_t capacity = posting->capacity ? posting->capacity * 2 : 4;
+        uint32_t *ids = realloc(posting->ids, capacity * sizeof(uint32_t));
+        if (ids == NULL) 
+            return;
+        posting->ids = ids;
+        posting->capacity = capacity;
+    }
+    posting->ids[posting->count++] = albumID;
+}
+
+static void freeTable(PostingTable *table)
+{
+    uint32_t i;
+    
+    for (i = 0; i < table->capacity; i++) 
+        free(table->postings[i].ids);
+    free(table->keys);
+    free(table->postings);
+    memset(table, 0, sizeof(PostingTable));
+}
+
+static int isWordByte(unsigned char c)
+{
+    return c >= 0x80 || isalnum(c);
+}
+
+// Text is already folded, and fields are separated by newlines, which no key spans
+static void addText(PostingTable *table, const unsigned char *text, uint32_t albumID)
+{
+    size_t i;
+    
+    for (i = 0; text[i]; i++) {
+        if (isWordByte(text[i]) && (i == 0 || !isWordByte(text[i - 1]))) {
+            addPosting(table, PREFIX1_KEY(text[i]), albumID);
+            if (isWordByte(text[i + 1])) 
+                addPosting(table, PREFIX2_KEY(text[i], text[i + 1]), albumID);
+        }
+        if (text[i + 1] && text[i + 2] && text[i] != '\n' && text[i + 1] != '\n' && text[i + 2] != '\n') 
+            addPosting(table, TRIGRAM_KEY(text[i], text[i + 1], text[i + 2]), albumID);
+    }
+}
+
+static int comparePostingCounts(const void *a, const void *b)
+{
+    uint32_t first = (*(Posting * const *)a)->count, second = (*(Posting * const *)b)->count;
+    return (first > second) - (first < second);
+}
+
+// The albums whose own text holds term: a word starting with it if it's short, anywhere if not. Returns the
+// number of ids put in matches, which has room for every album.
+static uint32_t matchTerm(const PostingTable *table, const char *term, size_t length, 
+                          const char *texts, const uint32_t *textOffsets, uint32_t *matches)
+{
+    const unsigned char *bytes = (const unsigned char *)term;
+    Posting *postings[64];
+    uint32_t count = 0, i, j, k, n;
+    Posting *posting;
+    
+    if (length == 0) 
+        return 0;
+    if (length < 3) {
+        posting = findPosting(table, length == 1 ? PREFIX1_KEY(bytes[0]) : PREFIX2_KEY(bytes[0], bytes[1]));
+        if (posting == NULL) 
+            return 0;
+        memcpy(matches, posting->ids, posting->count * sizeof(uint32_t));
+        return posting->count;
+    }
+    
+    // intersect the trigrams' postings, shortest first; long terms only need some of their trigrams
+    n = 0;
+    for (i = 0; i + 2 < length && n < 64; i++) {
+        posting = findPosting(table, TRIGRAM_KEY(bytes[i], bytes[i + 1], bytes[i + 2]));
+        if (posting == NULL) 
+            return 0;
+        postings[n++] = posting;
+    }
+    qsort(postings, n, sizeof(Posting *), comparePostingCounts);
+    
+    memcpy(matches, postings[0]->ids, postings[0]->count * sizeof(uint32_t));
+    count = postings[0]->count;
+    for (k = 1; k < n && count; k++) {
+        uint32_t kept = 0;
+        for (i = 0, j = 0; i < count && j < postings[k]->count; ) {
+            if (matches[i] < postings[k]->ids[j]) 
+                i++;
+            else if (matches[i] > postings[k]->ids[j]) 
+                j++;
+            else {
+                matches[kept++] = matches[i];
+                i++;
+                j++;
+            }
+        }
+        count = kept;
+    }
+    
+    // having all the trigrams doesn't mean having them in order
+    for (i = 0, k = 0; i < count; i++) {
+        if (strstr(texts + textOffsets[matches[i]], term)) 
+            matches[k++] = matches[i];
+    }
+    return k;
+}
+
+#define BIT_IS_SET(bits, i) ((bits)[(i) >> 3] & (1 << ((i) & 7)))
+#define SET_BIT(bits, i) ((bits)[(i) >> 3] |= (1 << ((i) & 7)))
+
+// Whether the album or anything above it is in the set
+static int inPath(const int32_t *parents, const unsigned char *bits, int32_t album)
+{
+    for (; album >= 0; album = parents[album]) {
+        if (BIT_IS_SET(bits, album)) 
+            return 1;
+    }
+    return 0;
+}
+
+// An album matches when every term is in its own text or an ancestor's. Every album under one that holds
+// the rarest term does for that term, so those subtrees are all that's walked.
+static uint32_t collectMatches(const ZWAlbumTreeStructure *tree, const uint32_t *rarest, uint32_t rarestCount, 
+                               unsigned char **bitsets, int terms, int rarestTerm, uint32_t *results, uint32_t limit)
+{
+    const int32_t *parents = tree->parents, *firstChild = tree->firstChild, *nextSibling = tree->nextSibling;
+    uint32_t count = 0, r;
+    int32_t root, album;
+    int t;
+    
+    for (r = 0; r < rarestCount && count < limit; r++) {
+        root = (int32_t)rarest[r];
+        
+        // under another match, so already walked
+        if (parents[root] >= 0 && inPath(parents, bitsets[rarestTerm], parents[root])) 
+            continue;
+        
+        album = root;
+        while (count < limit) {
+            if (tree->flags[album] & ZWAlbumCanAddItem) {
+                for (t = 0; t < terms; t++) {
+                    if (t != rarestTerm && !inPath(parents, bitsets[t], album)) 
+                        break;
+                }
+                if (t == terms) 
+                    results[count++] = album;
+            }
+            
+            // depth first, without a stack
+            if (firstChild[album] >= 0) {
+                album = firstChild[album];
+                continue;
+            }
+            while (album != root && nextSibling[album] < 0) 
+                album = parents[album];
+            if (album == root) 
+                break;
+            album = nextSibling[album];
+        }
+    }
+    return count;
+}
+
+@implementation ZWAlbumSearchIndex
+
+- (id)initWithAlbumTree:(ZWAlbumTree *)albumTree
+{
+    self = [super init];
+    if (self) {
+        tree = [albumTree retain];
+        postings = calloc(1, sizeof(PostingTable));
+        
+        // the empty text, for the albums that weren't added
+        texts = calloc(1, 4096);
+        textsLength = 1;
+        textsCapacity = 4096;
+        if (postings == NULL || texts == NULL) {
+            [self release];
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [tree release];
+    if (postings) 
+        freeTable((PostingTable *)postings);
+    free(postings);
+    free(texts);
+    free(textOffsets);
+    [super dealloc];
+}
+
+- (void)addAlbumAtIndex:(unsigned int)index
+{
+    NSString *title = [tree titleOfAlbumAtIndex:index], *name = [tree nameOfAlbumAtIndex:index];
+    NSString *folded = [NSString stringWithFormat:@"%@\n%@", title ? title : @"", name ? name : @""];
+    const char *text = [[folded lowercaseString] UTF8String];
+    size_t length = strlen(text) + 1;
+    
+    // postings have to stay in ascending order
+    if (text == NULL || index < textCount) 
+        return;
+    
+    if (textsLength + length > textsCapacity) {
+        size_t capacity = MAX(textsCapacity * 2, textsLength + length + 4096);
+        char *newTexts = realloc(texts, capacity);
+        if (newTexts == NULL) 
+            return;
+        texts = newTexts;
+        textsCapacity = capacity;
+    }
+    if (index >= textOffsetsCapacity) {
+        uint32_t capacity = MAX(textOffsetsCapacity * 2, index + 16);
+        uint32_t *newOffsets = realloc(textOffsets, capacity * sizeof(uint32_t));
+        if (newOffsets == NULL) 
+            return;
+        textOffsets = newOffsets;
+        textOffsetsCapacity = capacity;
+    }
+    
+    while (textCount < index) 
+        textOffsets[textCount++] = 0;
+    memcpy(texts + textsLength, text, length);
+    textOffsets[textCount++] = textsLength;
+    textsLength += length;
+    addText((PostingTable *)postings, (const unsigned char *)texts + textOffsets[index], index);
+    albumCount++;
+}
+
+- (unsigned int)count
+{
+    return albumCount;
+}
+
+- (NSArray *)albumsMatching:(NSString *)query limit:(unsigned int)limit
+{
+    NSArray *words = [[[query lowercaseString] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] 
+                      componentsSeparatedByString:@" "];
+    NSMutableArray *results = [NSMutableArray array];
+    uint32_t *matches[MAX_TERMS], matchCounts[MAX_TERMS], *found = NULL, foundCount = 0, count, bitsLength, i;
+    unsigned char *bitsets[MAX_TERMS];
+    const char *terms[MAX_TERMS];
+    int termCount = 0, rarest = 0, t;
+    ZWAlbumTreeStructure structure;
+    
+    for (i = 0; i < [words count] && termCount < MAX_TERMS; i++) {
+        const char *term = [[words objectAtIndex:i] UTF8String];
+        if (term && *term) 
+            terms[termCount++] = term;
+    }
+    if (termCount == 0 || textCount == 0 || limit == 0) 
+        return results;
+    
+    // The tree only grows, so everything indexed is in it. Its views can't be made until it's unlocked.
+    [tree lockStructure:&structure];
+    count = structure.count;
+    bitsLength = count / 8 + 1;
+    
+    memset(matches, 0, sizeof(matches));
+    memset(bitsets, 0, sizeof(bitsets));
+    for (t = 0; t < termCount; t++) {
+        matches[t] = malloc(count * sizeof(uint32_t));
+        bitsets[t] = calloc(bitsLength, 1);
+        if (matches[t] == NULL || bitsets[t] == NULL) 
+            goto bail;
+        
+        matchCounts[t] = matchTerm((PostingTable *)postings, terms[t], strlen(terms[t]), texts, textOffsets, matches[t]);
+        if (matchCounts[t] == 0) 
+            goto bail;
+        for (i = 0; i < matchCounts[t]; i++) 
+            SET_BIT(bitsets[t], matches[t][i]);
+        if (matchCounts[t] < matchCounts[rarest]) 
+            rarest = t;
+    }
+    
+    found = malloc(limit * sizeof(uint32_t));
+    if (found == NULL) 
+        goto bail;
+    foundCount = collectMatches(&structure, matches[rarest], matchCounts[rarest], bitsets, termCount, rarest, found, limit);
+    
+bail:
+    [tree unlockStructure];
+    for (i = 0; i < foundCount; i++) 
+        [results addObject:[tree albumAtIndex:found[i]]];
+    
+    for (t = 0; t < termCount; t++) {
+        free(matches[t]);
+        free(bitsets[t]);
+    }
+    free(found);
+    return results;
+}
+
+@end
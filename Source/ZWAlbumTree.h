@@ -0,0 +1,148 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+#include <pthread.h>
+
+@class ZWGallery, ZWGalleryAlbum;
+
+// What an album allows
+enum {
+    ZWAlbumCanAddItem = 1 << 0,
+    ZWAlbumCanAddSubAlbum = 1 << 1
+};
+
+// Stands for no album, as a parent or a child
+#define ZWAlbumTreeNoAlbum (-1)
+
+// The tree's own arrays, for walking a lot of albums without a message and a lock for each. Each album's 
+// permissions (ZWAlbumCanAddItem and so on) are in the low bits of its flags.
+typedef struct {
+    unsigned int count;
+    const int32_t *parents;
+    const int32_t *firstChild;
+    const int32_t *nextSibling;
+    const uint8_t *flags;
+} ZWAlbumTreeStructure;
+
+// A gallery's albums, kept as flat arrays indexed by album number rather than as objects pointing at each
+// other. Albums are added with their strings and permissions, then given parents. The children, depth and
+// what each subtree allows are worked out together, in one pass, the next time any of them is asked for
+// after a change. Titles, names and summaries are kept once each, as UTF-8 in one block.
+//
+// ZWGalleryAlbum objects are views of one album in a tree. The tree hands out the same view of an album
+// for as long as anyone holds on to it, without holding on to it itself, and views hold on to their tree.
+// The gallery isn't held on to either; it tells its tree when it goes.
+//
+// A tree can be used from any thread.
+@interface ZWAlbumTree : NSObject {
+    pthread_mutex_t lock;
+    ZWGallery *gallery;
+    
+    unsigned int count, capacity;
+    int32_t *parents;
+    uint32_t *titles;           // offsets into strings
+    uint32_t *names;
+    uint32_t *summaries;
+    uint8_t *flags;             // the album's permissions, and its subtree's above them
+    
+    // worked out from the parents when structureValid is NO
+    int32_t *firstChild;
+    int32_t *nextSibling;
+    uint16_t *depths;
+    BOOL structureValid;
+    
+    char *strings;
+    uint32_t stringsLength, stringsCapacity;
+    uint32_t *internSlots;      // offset + 1 of each string kept, open-addressed by its hash
+    uint32_t internCapacity, internUsed;
+    
+    ZWGalleryAlbum **views;
+}
+
+- (id)initWithGallery:(ZWGallery *)gallery;
+
+// The arrays and strings, in an order and byte order that don't depend on the machine, for caching.
+// The init returns nil for data that isn't a tree.
+- (NSData *)serializedData;
+- (id)initWithSerializedData:(NSData *)data gallery:(ZWGallery *)gallery;
+
+- (ZWGallery *)gallery;
+- (void)setGallery:(ZWGallery *)gallery;
+
+- (unsigned int)count;
+
+// Returns the new album's index
+- (unsigned int)addAlbumWithTitle:(NSString *)title name:(NSString *)name summary:(NSString *)summary;
+
+// The view of an album, made if nobody has one right now
+- (ZWGalleryAlbum *)albumAtIndex:(unsigned int)index;
+
+// Every album's view, in index order. The array holds on to the tree rather than the views, so each is 
+// made as it's asked for and goes again once nobody wants it.
+- (NSArray *)albums;
+
+- (int)parentOfAlbumAtIndex:(unsigned int)index;
+
+// Does nothing if the album is already under the new parent, which would make a loop
+- (void)setParent:(int)parent ofAlbumAtIndex:(unsigned int)index;
+
+// Children come in the order they were added. The array is nil if there aren't any.
+- (NSArray *)childrenOfAlbumAtIndex:(unsigned int)index;
+- (int)firstChildOfAlbumAtIndex:(unsigned int)index;
+- (int)nextSiblingOfAlbumAtIndex:(unsigned int)index;
+- (int)depthOfAlbumAtIndex:(unsigned int)index;
+
+- (NSString *)titleOfAlbumAtIndex:(unsigned int)index;
+- (void)setTitle:(NSString *)title ofAlbumAtIndex:(unsigned int)index;
+- (NSString *)nameOfAlbumAtIndex:(unsigned int)index;
+- (void)setName:(NSString *)name ofAlbumAtIndex:(unsigned int)index;
+- (NSString *)summaryOfAlbumAtIndex:(unsigned int)index;
+- (void)setSummary:(NSString *)summary ofAlbumAtIndex:(unsigned int)index;
+
+- (int)permissionsOfAlbumAtIndex:(unsigned int)index;
+- (void)setPermissions:(int)permissions ofAlbumAtIndex:(unsigned int)index;
+
+// What the album or anything under it allows
+- (int)subtreePermissionsOfAlbumAtIndex:(unsigned int)index;
+
+// Fills in structure with the arrays, children worked out, and holds the lock until -unlockStructure so
+// they stay put. Nothing else of the tree's, views included, can be used in between.
+- (void)lockStructure:(ZWAlbumTreeStructure *)structure;
+- (void)unlockStructure;
+
+@end
+
+// For ZWGalleryAlbum's -release alone: it forgets a view, under the lock, before the view's last release
+@interface ZWAlbumTree (ZWGalleryAlbumViews)
+- (void)lockAlbums;
+- (void)unlockAlbums;
+- (void)forgetAlbumAtIndex:(unsigned int)index;
+@end
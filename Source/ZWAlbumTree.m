@@ -0,0 +1,693 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWAlbumTree.h"
+#import "ZWGalleryAlbum.h"
+
+#define NO_STRING 0xFFFFFFFF
+#define SUBTREE_SHIFT 2
+#define PERMISSION_MASK (ZWAlbumCanAddItem | ZWAlbumCanAddSubAlbum)
+
+#define SERIALIZED_MAGIC 0x5A574154     // 'ZWAT'
+#define SERIALIZED_VERSION 1
+
+// What -albums returns: the tree's views, made as they're asked for
+@interface ZWAlbumTreeAlbums : NSArray {
+    ZWAlbumTree *tree;
+}
+- (id)initWithTree:(ZWAlbumTree *)newTree;
+@end
+
+@interface ZWAlbumTree (PrivateStuff)
+- (BOOL)reserveAlbums:(unsigned int)newCapacity;
+- (uint32_t)internString:(NSString *)string;
+- (BOOL)internBytes:(const char *)bytes length:(uint32_t)length offset:(uint32_t *)offset;
+- (NSString *)stringAtOffset:(uint32_t)offset;
+- (void)updateStructure;
+- (ZWGalleryAlbum *)viewAtIndex:(unsigned int)index;
+@end
+
+static uint32_t hashBytes(const char *bytes, uint32_t length)
+{
+    uint32_t hash = 2166136261U, i;
+    
+    for (i = 0; i < length; i++) 
+        hash = (hash ^ (unsigned char)bytes[i]) * 16777619U;
+    return hash;
+}
+
+static void appendBigEndian(NSMutableData *data, const uint32_t *values, unsigned int count)
+{
+    unsigned int i;
+    
+    for (i = 0; i < count; i++) {
+        uint32_t value = NSSwapHostIntToBig(values[i]);
+        [data appendBytes:&value length:sizeof(value)];
+    }
+}
+
+static BOOL readBigEndian(const unsigned char **bytes, const unsigned char *end, uint32_t *values, unsigned int count)
+{
+    unsigned int i;
+    
+    if ((unsigned long)(end - *bytes) / sizeof(uint32_t) < count) 
+        return NO;
+    for (i = 0; i < count; i++) {
+        uint32_t value;
+        memcpy(&value, *bytes, sizeof(value));
+        values[i] = NSSwapBigIntToHost(value);
+        *bytes += sizeof(value);
+    }
+    return YES;
+}
+
+@implementation ZWAlbumTree
+
+- (id)initWithGallery:(ZWGallery *)newGallery
+{
+    self = [super init];
+    if (self) {
+        gallery = newGallery;   // weak reference
+        pthread_mutex_init(&lock, NULL);
+    }
+    return self;
+}
+
+- (id)initWithSerializedData:(NSData *)data gallery:(ZWGallery *)newGallery
+{
+    const unsigned char *bytes = [data bytes], *end = bytes + [data length];
+    uint32_t header[4], i;
+    
+    self = [self initWithGallery:newGallery];
+    if (self == nil) 
+        return nil;
+    
+    if (!readBigEndian(&bytes, end, header, 4) || header[0] != SERIALIZED_MAGIC || header[1] != SERIALIZED_VERSION) 
+        goto bail;
+    if (![self reserveAlbums:header[2]]) 
+        goto bail;
+    count = header[2];
+    if (!readBigEndian(&bytes, end, (uint32_t *)parents, count) || !readBigEndian(&bytes, end, titles, count) || 
+        !readBigEndian(&bytes, end, names, count) || !readBigEndian(&bytes, end, summaries, count) || 
+        (unsigned long)(end - bytes) < count || (unsigned long)(end - bytes) - count != header[3]) 
+        goto bail;
+    memcpy(flags, bytes, count);
+    bytes += count;
+    
+    // every string has to end inside the block, and every parent has to be an album
+    if (header[3] == 0 || bytes[header[3] - 1] != '\0') 
+        goto bail;
+    strings = malloc(header[3]);
+    if (strings == NULL) 
+        goto bail;
+    memcpy(strings, bytes, header[3]);
+    stringsLength = stringsCapacity = header[3];
+    for (i = 0; i < count; i++) {
+        uint32_t offset;
+        
+        if ((titles[i] != NO_STRING && titles[i] >= stringsLength) || (names[i] != NO_STRING && names[i] >= stringsLength) || 
+            (summaries[i] != NO_STRING && summaries[i] >= stringsLength) || parents[i] < ZWAlbumTreeNoAlbum || parents[i] >= (int32_t)count) 
+            goto bail;
+        flags[i] &= PERMISSION_MASK;
+        
+        // put the strings back in the intern table, so new ones find them
+        if (titles[i] != NO_STRING && ![self internBytes:strings + titles[i] length:strlen(strings + titles[i]) offset:&offset]) 
+            goto bail;
+        if (names[i] != NO_STRING && ![self internBytes:strings + names[i] length:strlen(strings + names[i]) offset:&offset]) 
+            goto bail;
+        if (summaries[i] != NO_STRING && ![self internBytes:strings + summaries[i] length:strlen(strings + summaries[i]) offset:&offset]) 
+            goto bail;
+    }
+    
+    // Saved parents could still make a loop, which would leave albums that no walk from the top reaches.
+    // Putting the structure together finds them.
+    [self updateStructure];
+    for (i = 0; i < count; i++) {
+        if (parents[i] != ZWAlbumTreeNoAlbum && depths[i] == 0) 
+            goto bail;
+    }
+    
+    return self;
+    
+bail:
+    [self release];
+    return nil;
+}
+
+- (void)dealloc
+{
+    // there are no views left, since they hold on to the tree
+    free(parents);
+    free(titles);
+    free(names);
+    free(summaries);
+    free(flags);
+    free(firstChild);
+    free(nextSibling);
+    free(depths);
+    free(strings);
+    free(internSlots);
+    free(views);
+    pthread_mutex_destroy(&lock);
+    [super dealloc];
+}
+
+- (NSData *)serializedData
+{
+    NSMutableData *data;
+    uint32_t header[4];
+    
+    pthread_mutex_lock(&lock);
+    header[0] = SERIALIZED_MAGIC;
+    header[1] = SERIALIZED_VERSION;
+    header[2] = count;
+    header[3] = stringsLength;
+    data = [NSMutableData dataWithCapacity:sizeof(header) + count * (4 * sizeof(uint32_t) + 1) + stringsLength];
+    appendBigEndian(data, header, 4);
+    appendBigEndian(data, (const uint32_t *)parents, count);
+    appendBigEndian(data, titles, count);
+    appendBigEndian(data, names, count);
+    appendBigEndian(data, summaries, count);
+    [data appendBytes:flags length:count];
+    [data appendBytes:strings length:stringsLength];
+    pthread_mutex_unlock(&lock);
+    
+    // the subtree's permissions are worked out again when it's read
+    if (count) {
+        unsigned char *savedFlags = (unsigned char *)[data mutableBytes] + sizeof(header) + count * 4 * sizeof(uint32_t);
+        unsigned int i;
+        for (i = 0; i < count; i++) 
+            savedFlags[i] &= PERMISSION_MASK;
+    }
+    
+    return data;
+}
+
+- (ZWGallery *)gallery
+{
+    return gallery;
+}
+
+- (void)setGallery:(ZWGallery *)newGallery
+{
+    gallery = newGallery;
+}
+
+- (unsigned int)count
+{
+    return count;
+}
+
+- (unsigned int)addAlbumWithTitle:(NSString *)title name:(NSString *)name summary:(NSString *)summary
+{
+    unsigned int index;
+    
+    pthread_mutex_lock(&lock);
+    if (count == capacity && ![self reserveAlbums:(capacity ? capacity * 2 : 64)]) {
+        pthread_mutex_unlock(&lock);
+        [NSException raise:NSMallocException format:@"Out of memory for %u albums", count + 1];
+    }
+    index = count++;
+    parents[index] = ZWAlbumTreeNoAlbum;
+    titles[index] = [self internString:title];
+    names[index] = [self internString:name];
+    summaries[index] = [self internString:summary];
+    flags[index] = 0;
+    views[index] = NULL;
+    structureValid = NO;
+    pthread_mutex_unlock(&lock);
+    
+    return index;
+}
+
+- (ZWGalleryAlbum *)albumAtIndex:(unsigned int)index
+{
+    ZWGalleryAlbum *album;
+    
+    pthread_mutex_lock(&lock);
+    album = [self viewAtIndex:index];
+    pthread_mutex_unlock(&lock);
+    
+    return album;
+}
+
+- (NSArray *)albums
+{
+    return [[[ZWAlbumTreeAlbums alloc] initWithTree:self] autorelease];
+}
+
+- (int)parentOfAlbumAtIndex:(unsigned int)index
+{
+    int parent;
+    
+    pthread_mutex_lock(&lock);
+    parent = (index < count) ? parents[index] : ZWAlbumTreeNoAlbum;
+    pthread_mutex_unlock(&lock);
+    
+    return parent;
+}
+
+- (void)setParent:(int)parent ofAlbumAtIndex:(unsigned int)index
+{
+    int ancestor;
+    
+    pthread_mutex_lock(&lock);
+    if (index < count && parent >= ZWAlbumTreeNoAlbum && parent < (int)count) {
+        for (ancestor = parent; ancestor != ZWAlbumTreeNoAlbum && ancestor != (int)index; ancestor = parents[ancestor]) 
+            ;
+        if (ancestor == ZWAlbumTreeNoAlbum && parents[index] != parent) {
+            parents[index] = parent;
+            structureValid = NO;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSArray *)childrenOfAlbumAtIndex:(unsigned int)index
+{
+    NSMutableArray *children = nil;
+    int child;
+    
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    if (index < count && firstChild[index] != ZWAlbumTreeNoAlbum) {
+        children = [NSMutableArray array];
+        for (child = firstChild[index]; child != ZWAlbumTreeNoAlbum; child = nextSibling[child]) 
+            [children addObject:[self viewAtIndex:child]];
+    }
+    pthread_mutex_unlock(&lock);
+    
+    return children;
+}
+
+- (int)firstChildOfAlbumAtIndex:(unsigned int)index
+{
+    int child;
+    
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    child = (index < count) ? firstChild[index] : ZWAlbumTreeNoAlbum;
+    pthread_mutex_unlock(&lock);
+    
+    return child;
+}
+
+- (int)nextSiblingOfAlbumAtIndex:(unsigned int)index
+{
+    int sibling;
+    
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    sibling = (index < count) ? nextSibling[index] : ZWAlbumTreeNoAlbum;
+    pthread_mutex_unlock(&lock);
+    
+    return sibling;
+}
+
+- (int)depthOfAlbumAtIndex:(unsigned int)index
+{
+    int depth;
+    
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    depth = (index < count) ? depths[index] : 0;
+    pthread_mutex_unlock(&lock);
+    
+    return depth;
+}
+
+- (NSString *)titleOfAlbumAtIndex:(unsigned int)index
+{
+    NSString *string;
+    
+    pthread_mutex_lock(&lock);
+    string = (index < count) ? [self stringAtOffset:titles[index]] : nil;
+    pthread_mutex_unlock(&lock);
+    
+    return string;
+}
+
+- (void)setTitle:(NSString *)title ofAlbumAtIndex:(unsigned int)index
+{
+    pthread_mutex_lock(&lock);
+    if (index < count) 
+        titles[index] = [self internString:title];
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSString *)nameOfAlbumAtIndex:(unsigned int)index
+{
+    NSString *string;
+    
+    pthread_mutex_lock(&lock);
+    string = (index < count) ? [self stringAtOffset:names[index]] : nil;
+    pthread_mutex_unlock(&lock);
+    
+    return string;
+}
+
+- (void)setName:(NSString *)name ofAlbumAtIndex:(unsigned int)index
+{
+    pthread_mutex_lock(&lock);
+    if (index < count) 
+        names[index] = [self internString:name];
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSString *)summaryOfAlbumAtIndex:(unsigned int)index
+{
+    NSString *string;
+    
+    pthread_mutex_lock(&lock);
+    string = (index < count) ? [self stringAtOffset:summaries[index]] : nil;
+    pthread_mutex_unlock(&lock);
+    
+    return string;
+}
+
+- (void)setSummary:(NSString *)summary ofAlbumAtIndex:(unsigned int)index
+{
+    pthread_mutex_lock(&lock);
+    if (index < count) 
+        summaries[index] = [self internString:summary];
+    pthread_mutex_unlock(&lock);
+}
+
+- (int)permissionsOfAlbumAtIndex:(unsigned int)index
+{
+    int permissions;
+    
+    pthread_mutex_lock(&lock);
+    permissions = (index < count) ? (flags[index] & PERMISSION_MASK) : 0;
+    pthread_mutex_unlock(&lock);
+    
+    return permissions;
+}
+
+- (void)setPermissions:(int)permissions ofAlbumAtIndex:(unsigned int)index
+{
+    pthread_mutex_lock(&lock);
+    if (index < count && (flags[index] & PERMISSION_MASK) != (permissions & PERMISSION_MASK)) {
+        flags[index] = (flags[index] & ~PERMISSION_MASK) | (permissions & PERMISSION_MASK);
+        structureValid = NO;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+- (int)subtreePermissionsOfAlbumAtIndex:(unsigned int)index
+{
+    int permissions;
+    
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    permissions = (index < count) ? (flags[index] >> SUBTREE_SHIFT) & PERMISSION_MASK : 0;
+    pthread_mutex_unlock(&lock);
+    
+    return permissions;
+}
+
+- (void)lockStructure:(ZWAlbumTreeStructure *)structure
+{
+    pthread_mutex_lock(&lock);
+    [self updateStructure];
+    structure->count = count;
+    structure->parents = parents;
+    structure->firstChild = firstChild;
+    structure->nextSibling = nextSibling;
+    structure->flags = flags;
+}
+
+- (void)unlockStructure
+{
+    pthread_mutex_unlock(&lock);
+}
+
+@end
+
+@implementation ZWAlbumTree (ZWGalleryAlbumViews)
+
+- (void)lockAlbums
+{
+    pthread_mutex_lock(&lock);
+}
+
+- (void)unlockAlbums
+{
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)forgetAlbumAtIndex:(unsigned int)index
+{
+    if (index < count) 
+        views[index] = NULL;
+}
+
+@end
+
+@implementation ZWAlbumTree (PrivateStuff)
+
+// Everything below is called with the lock held, or before anyone else can have the tree
+
+- (BOOL)reserveAlbums:(unsigned int)newCapacity
+{
+    void *grown;
+    
+    if (newCapacity <= capacity) 
+        return YES;
+    
+#define GROW(array) \
+    if ((grown = realloc(array, newCapacity * sizeof(*(array)))) == NULL) \
+        return NO; \
+    array = grown;
+    
+    GROW(parents);
+    GROW(titles);
+    GROW(names);
+    GROW(summaries);
+    GROW(flags);
+    GROW(firstChild);
+    GROW(nextSibling);
+    GROW(depths);
+    GROW(views);
+#undef GROW
+    
+    capacity = newCapacity;
+    return YES;
+}
+
+- (uint32_t)internString:(NSString *)string
+{
+    const char *bytes = [string UTF8String];
+    uint32_t offset;
+    
+    if (bytes == NULL) 
+        return NO_STRING;
+    if (![self internBytes:bytes length:strlen(bytes) offset:&offset]) {
+        NSLog(@"ZWAlbumTree: out of memory for album strings");
+        return NO_STRING;
+    }
+    return offset;
+}
+
+// Finds the string, or adds it to the block if it isn't there, or just puts it in the table if it's already
+// in the block (for reading a saved tree)
+- (BOOL)internBytes:(const char *)bytes length:(uint32_t)length offset:(uint32_t *)offset
+{
+    BOOL inBlock = (bytes >= strings && bytes < strings + stringsLength);
+    uint32_t mask, slot, i;
+    
+    if ((internUsed + 1) * 2 > internCapacity) {
+        uint32_t newCapacity = internCapacity ? internCapacity * 2 : 256;
+        uint32_t *newSlots = calloc(newCapacity, sizeof(uint32_t));
+        
+        if (newSlots == NULL) 
+            return NO;
+        for (i = 0; i < internCapacity; i++) {
+            if (internSlots[i] == 0) 
+                continue;
+            const char *kept = strings + internSlots[i] - 1;
+            for (slot = hashBytes(kept, strlen(kept)) & (newCapacity - 1); newSlots[slot]; slot = (slot + 1) & (newCapacity - 1)) 
+                ;
+            newSlots[slot] = internSlots[i];
+        }
+        free(internSlots);
+        internSlots = newSlots;
+        internCapacity = newCapacity;
+    }
+    
+    mask = internCapacity - 1;
+    for (slot = hashBytes(bytes, length) & mask; internSlots[slot]; slot = (slot + 1) & mask) {
+        const char *kept = strings + internSlots[slot] - 1;
+        if (strncmp(kept, bytes, length) == 0 && kept[length] == '\0') {
+            *offset = internSlots[slot] - 1;
+            return YES;
+        }
+    }
+    
+    if (inBlock) {
+        *offset = bytes - strings;
+    }
+    else {
+        if (stringsLength + length + 1 > stringsCapacity) {
+            uint32_t newCapacity = MAX(stringsCapacity * 2, stringsLength + length + 4096);
+            char *newStrings = realloc(strings, newCapacity);
+            if (newStrings == NULL) 
+                return NO;
+            strings = newStrings;
+            stringsCapacity = newCapacity;
+        }
+        memcpy(strings + stringsLength, bytes, length + 1);
+        *offset = stringsLength;
+        stringsLength += length + 1;
+    }
+    internSlots[slot] = *offset + 1;
+    internUsed++;
+    return YES;
+}
+
+- (NSString *)stringAtOffset:(uint32_t)offset
+{
+    return (offset == NO_STRING) ? nil : [NSString stringWithUTF8String:strings + offset];
+}
+
+// Children in the order they were added, then depth and subtree permissions over the albums in tree order,
+// which puts every album after its parent
+- (void)updateStructure
+{
+    int32_t *lastChild, *order;
+    unsigned int i, ordered = 0;
+    
+    if (structureValid || count == 0) 
+        return;
+    
+    lastChild = malloc(count * sizeof(int32_t));
+    order = malloc(count * sizeof(int32_t));
+    if (lastChild == NULL || order == NULL) {
+        free(lastChild);
+        free(order);
+        return;
+    }
+    
+    for (i = 0; i < count; i++) {
+        firstChild[i] = nextSibling[i] = lastChild[i] = ZWAlbumTreeNoAlbum;
+        depths[i] = 0;
+        flags[i] = (flags[i] & PERMISSION_MASK) | ((flags[i] & PERMISSION_MASK) << SUBTREE_SHIFT);
+    }
+    for (i = 0; i < count; i++) {
+        int32_t parent = parents[i];
+        if (parent == ZWAlbumTreeNoAlbum) 
+            continue;
+        if (lastChild[parent] == ZWAlbumTreeNoAlbum) 
+            firstChild[parent] = i;
+        else 
+            nextSibling[lastChild[parent]] = i;
+        lastChild[parent] = i;
+    }
+    
+    // depth first from each top-level album, without a stack
+    for (i = 0; i < count; i++) {
+        int32_t album = i;
+        
+        if (parents[i] != ZWAlbumTreeNoAlbum) 
+            continue;
+        while (1) {
+            order[ordered++] = album;
+            if (parents[album] != ZWAlbumTreeNoAlbum) 
+                depths[album] = (depths[parents[album]] < 0xFFFF) ? depths[parents[album]] + 1 : 0xFFFF;
+            
+            if (firstChild[album] != ZWAlbumTreeNoAlbum) {
+                album = firstChild[album];
+                continue;
+            }
+            while (album != (int32_t)i && nextSibling[album] == ZWAlbumTreeNoAlbum) 
+                album = parents[album];
+            if (album == (int32_t)i) 
+                break;
+            album = nextSibling[album];
+        }
+    }
+    
+    // children come after their parents in that order, so going backwards finishes each subtree first
+    while (ordered--) {
+        int32_t album = order[ordered];
+        if (parents[album] != ZWAlbumTreeNoAlbum) 
+            flags[parents[album]] |= flags[album] & (PERMISSION_MASK << SUBTREE_SHIFT);
+    }
+    
+    free(lastChild);
+    free(order);
+    structureValid = YES;
+}
+
+- (ZWGalleryAlbum *)viewAtIndex:(unsigned int)index
+{
+    ZWGalleryAlbum *album;
+    
+    if (index >= count) 
+        return nil;
+    if (views[index]) 
+        return [[views[index] retain] autorelease];
+    
+    album = [[ZWGalleryAlbum alloc] initWithTree:self index:index];
+    views[index] = album;
+    return [album autorelease];
+}
+
+@end
+
+@implementation ZWAlbumTreeAlbums
+
+- (id)initWithTree:(ZWAlbumTree *)newTree
+{
+    self = [super init];
+    if (self) 
+        tree = [newTree retain];
+    return self;
+}
+
+- (void)dealloc
+{
+    [tree release];
+    [super dealloc];
+}
+
+- (unsigned)count
+{
+    return [tree count];
+}
+
+- (id)objectAtIndex:(unsigned)index
+{
+    if (index >= [tree count]) 
+        [NSException raise:NSRangeException format:@"Album index %u beyond %u", index, [tree count]];
+    return [tree albumAtIndex:index];
+}
+
+@end
@@ -0,0 +1,69 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Turns 8-bit samples in a matrix/TRC ICC profile (the kind cameras, scanners and displays use: Adobe RGB,
+// ProPhoto, Display P3, sRGB itself...) into sRGB, in two halves so a resampler can work in linear light
+// between them. The first half only looks the samples up in the profile's tone curves, which gives linear
+// light in the profile's own primaries. Because the change of primaries is linear it can wait until after
+// resampling, and the second half does it along with sRGB's tone curve, on what are usually far fewer 
+// pixels. Profiles built from lookup tables (printer and some scanner profiles) aren't supported.
+
+#ifndef ZWCOLORTRANSFORM_H
+#define ZWCOLORTRANSFORM_H
+
+#include <stddef.h>
+
+typedef struct ZWColorTransform ZWColorTransform;
+
+// The length of the profile ZWColorTransformWriteSRGBProfile writes
+#define ZWCOLOR_SRGB_PROFILE_LENGTH 2524
+
+// components is 1 (gray) or 3 (RGB) and has to match the profile's color space. Returns NULL if the 
+// profile isn't one we can handle.
+ZWColorTransform *ZWColorTransformCreateFromICC(const unsigned char *profile, size_t length, int components);
+
+// For untagged images, which are taken to be sRGB already: just the tone curves, for resampling in linear light
+ZWColorTransform *ZWColorTransformCreateSRGB(int components);
+
+void ZWColorTransformDestroy(ZWColorTransform *transform);
+
+int ZWColorTransformGetComponents(const ZWColorTransform *transform);
+
+// Looks count pixels up in the profile's tone curves. Linear values run from 0 to 1.
+void ZWColorTransformToLinear(const ZWColorTransform *transform, const unsigned char *in, float *out, int count);
+
+// Converts count pixels of linear light in the profile's primaries to 8-bit sRGB. Values that are out of
+// sRGB's gamut (or out of range, as resampling can leave them) are clipped.
+void ZWColorTransformToSRGB(const ZWColorTransform *transform, const float *in, unsigned char *out, int count);
+
+// Writes an ICC profile for sRGB to tag our output with, ZWCOLOR_SRGB_PROFILE_LENGTH bytes of it
+void ZWColorTransformWriteSRGBProfile(unsigned char *profile);
+
+#endif
@@ -0,0 +1,537 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWColorTransform.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Entries in the table that encodes linear light with sRGB's curve. The curve is steepest at the dark 
+// end (12.92 sRGB steps per linear step), and this many keeps each entry well under a code value apart there.
+#define SRGB_ENCODE_TABLE_SIZE 16384
+
+// Entries in the tone curve of the profile we tag our output with
+#define SRGB_PROFILE_CURVE_SIZE 1024
+
+struct ZWColorTransform {
+    float columns[3][4];            // the change of primaries, a column per input channel, padded for SSE
+    int components;
+    int changesPrimaries;           // 0 when the primaries are already sRGB's
+    float toLinear[3][256];
+    unsigned char encode[SRGB_ENCODE_TABLE_SIZE];
+};
+
+// sRGB's primaries adapted to the D50 of the profile connection space, rounded to s15Fixed16 the way 
+// they appear in sRGB profiles, so an sRGB profile comes out as exactly no change of primaries
+static const double sRGBPrimaries[3][3] = {
+    { 0.4360657, 0.3851471, 0.1430664 },
+    { 0.2224884, 0.7168732, 0.0606079 },
+    { 0.0139160, 0.0970764, 0.7140961 }
+};
+
+static const double sRGBWhite[3] = { 0.9504547, 1.0, 1.0890503 };
+
+#pragma mark Curves
+
+static double sRGBDecode(double value)
+{
+    return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+}
+
+static double sRGBEncode(double value)
+{
+    return value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1.0 / 2.4) - 0.055;
+}
+
+static unsigned long readICC32(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+
+static double readS15Fixed16(const unsigned char *p)
+{
+    unsigned long bits = readICC32(p);
+    double value = (double)bits;
+    
+    if (bits & 0x80000000UL) 
+        value -= 4294967296.0;
+    return value / 65536.0;
+}
+
+static void writeICC32(unsigned char *p, unsigned long value)
+{
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+static void writeS15Fixed16(unsigned char *p, double value)
+{
+    writeICC32(p, (unsigned long)(long)floor(value * 65536.0 + 0.5));
+}
+
+// Finds a tag's data. Returns 0 if the profile doesn't have it or it runs off the end.
+static int findTag(const unsigned char *profile, size_t length, const char *signature, const unsigned char **data, size_t *size)
+{
+    unsigned long count, i;
+    
+    if (length < 132) 
+        return 0;
+    
+    count = readICC32(profile + 128);
+    for (i = 0; i < count && 132 + (i + 1) * 12 <= length; i++) {
+        const unsigned char *entry = profile + 132 + i * 12;
+        unsigned long offset = readICC32(entry + 4), tagSize = readICC32(entry + 8);
+        
+        if (memcmp(entry, signature, 4) != 0) 
+            continue;
+        if (offset > length || tagSize > length - offset || tagSize < 8) 
+            return 0;
+        *data = profile + offset;
+        *size = tagSize;
+        return 1;
+    }
+    return 0;
+}
+
+static int readXYZTag(const unsigned char *profile, size_t length, const char *signature, double xyz[3])
+{
+    const unsigned char *data;
+    size_t size;
+    
+    if (!findTag(profile, length, signature, &data, &size) || size < 20 || memcmp(data, "XYZ ", 4) != 0) 
+        return 0;
+    xyz[0] = readS15Fixed16(data + 8);
+    xyz[1] = readS15Fixed16(data + 12);
+    xyz[2] = readS15Fixed16(data + 16);
+    return 1;
+}
+
+// Fills table with the tone curve for each 8-bit input. Curves come as a gamma, a table of samples
+// (which we interpolate), or one of the parametric functions from ICC v4.
+static int readCurveTag(const unsigned char *profile, size_t length, const char *signature, float *table)
+{
+    const unsigned char *data;
+    size_t size;
+    int i;
+    
+    if (!findTag(profile, length, signature, &data, &size) || size < 12) 
+        return 0;
+    
+    if (memcmp(data, "curv", 4) == 0) {
+        unsigned long count = readICC32(data + 8);
+        
+        if (count > (size - 12) / 2) 
+            return 0;
+        
+        for (i = 0; i < 256; i++) {
+            double x = i / 255.0, y;
+            
+            if (count == 0) {
+                y = x;
+            }
+            else if (count == 1) {
+                y = pow(x, (data[12] + data[13] / 256.0));
+            }
+            else {
+                double position = x * (count - 1);
+                unsigned long index = (unsigned long)position;
+                double fraction = position - index;
+                const unsigned char *sample = data + 12 + index * 2;
+                
+                y = ((sample[0] << 8) | sample[1]) / 65535.0;
+                if (index + 1 < count) 
+                    y += (((sample[2] << 8) | sample[3]) / 65535.0 - y) * fraction;
+            }
+            table[i] = (float)y;
+        }
+        return 1;
+    }
+    
+    if (memcmp(data, "para", 4) == 0) {
+        static const int parameterCounts[5] = { 1, 3, 4, 5, 7 };
+        double g, a = 1, b = 0, c = 0, d = 0, e = 0, f = 0;
+        int function;
+        
+        function = (data[8] << 8) | data[9];
+        if (function > 4 || size < 12 + (size_t)parameterCounts[function] * 4) 
+            return 0;
+        
+        g = readS15Fixed16(data + 12);
+        if (function >= 1) {
+            a = readS15Fixed16(data + 16);
+            b = readS15Fixed16(data + 20);
+            // types 1 and 2 switch over where aX + b crosses 0, which 3 and 4 call d
+            d = a != 0 ? -b / a : 0;
+        }
+        if (function >= 2) 
+            c = readS15Fixed16(data + 24);
+        if (function >= 3) 
+            d = readS15Fixed16(data + 28);
+        if (function == 4) {
+            e = readS15Fixed16(data + 32);
+            f = readS15Fixed16(data + 36);
+        }
+        if (function == 2) {
+            // Y = (aX + b)^g + c above the switch, c below
+            e = c;
+            f = c;
+            c = 0;
+        }
+        
+        for (i = 0; i < 256; i++) {
+            double x = i / 255.0, y;
+            
+            if (function == 0) 
+                y = pow(x, g);
+            else if (x >= d) 
+                y = (a * x + b > 0 ? pow(a * x + b, g) : 0) + e;
+            else 
+                y = c * x + f;
+            table[i] = (float)(y < 0 ? 0 : y > 1 ? 1 : y);
+        }
+        return 1;
+    }
+    
+    return 0;
+}
+
+#pragma mark Matrices
+
+static int invert3x3(const double m[3][3], double inverse[3][3])
+{
+    double determinant = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) 
+                       - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) 
+                       + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    int row, column;
+    
+    if (fabs(determinant) < 1e-10) 
+        return 0;
+    
+    for (row = 0; row < 3; row++) {
+        for (column = 0; column < 3; column++) {
+            int r0 = (column + 1) % 3, r1 = (column + 2) % 3, c0 = (row + 1) % 3, c1 = (row + 2) % 3;
+            inverse[row][column] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / determinant;
+        }
+    }
+    return 1;
+}
+
+static ZWColorTransform *createTransform(int components)
+{
+    ZWColorTransform *transform;
+    int i;
+    
+    if (components != 1 && components != 3) 
+        return NULL;
+    
+    transform = (ZWColorTransform *)calloc(1, sizeof(ZWColorTransform));
+    if (transform == NULL) 
+        return NULL;
+    
+    transform->components = components;
+    for (i = 0; i < 3; i++) 
+        transform->columns[i][i] = 1.0f;
+    for (i = 0; i < SRGB_ENCODE_TABLE_SIZE; i++) 
+        transform->encode[i] = (unsigned char)floor(sRGBEncode((double)i / (SRGB_ENCODE_TABLE_SIZE - 1)) * 255.0 + 0.5);
+    
+    return transform;
+}
+
+ZWColorTransform *ZWColorTransformCreateSRGB(int components)
+{
+    ZWColorTransform *transform = createTransform(components);
+    int i, c;
+    
+    if (transform == NULL) 
+        return NULL;
+    
+    for (i = 0; i < 256; i++) {
+        float value = (float)sRGBDecode(i / 255.0);
+        for (c = 0; c < 3; c++) 
+            transform->toLinear[c][i] = value;
+    }
+    return transform;
+}
+
+ZWColorTransform *ZWColorTransformCreateFromICC(const unsigned char *profile, size_t length, int components)
+{
+    static const char *curveTags[3] = { "rTRC", "gTRC", "bTRC" };
+    static const char *primaryTags[3] = { "rXYZ", "gXYZ", "bXYZ" };
+    ZWColorTransform *transform;
+    double primaries[3][3], toSRGB[3][3];
+    int i, c, row;
+    
+    if (length < 132 || readICC32(profile) > length || memcmp(profile + 36, "acsp", 4) != 0) 
+        return NULL;
+    if (memcmp(profile + 16, components == 3 ? "RGB " : "GRAY", 4) != 0) 
+        return NULL;
+    
+    transform = createTransform(components);
+    if (transform == NULL) 
+        return NULL;
+    
+    if (components == 1) {
+        // Gray profiles are just a curve to the luminance, which is the same in sRGB
+        if (!readCurveTag(profile, length, "kTRC", transform->toLinear[0])) 
+            goto bail;
+        return transform;
+    }
+    
+    // Matrix profiles have to connect through XYZ
+    if (memcmp(profile + 20, "XYZ ", 4) != 0) 
+        goto bail;
+    
+    for (c = 0; c < 3; c++) {
+        double xyz[3];
+        
+        if (!readCurveTag(profile, length, curveTags[c], transform->toLinear[c]) || 
+            !readXYZTag(profile, length, primaryTags[c], xyz)) 
+            goto bail;
+        for (row = 0; row < 3; row++) 
+            primaries[row][c] = xyz[row];
+    }
+    
+    // The profile's primaries to XYZ, then XYZ to sRGB's
+    if (!invert3x3(sRGBPrimaries, toSRGB)) 
+        goto bail;
+    for (c = 0; c < 3; c++) {
+        for (row = 0; row < 3; row++) {
+            double value = 0;
+            for (i = 0; i < 3; i++) 
+                value += toSRGB[row][i] * primaries[i][c];
+            transform->columns[c][row] = (float)value;
+            if (fabs(value - (row == c ? 1.0 : 0.0)) > 1.0 / 4096) 
+                transform->changesPrimaries = 1;
+        }
+    }
+    
+    return transform;
+    
+bail:
+    ZWColorTransformDestroy(transform);
+    return NULL;
+}
+
+void ZWColorTransformDestroy(ZWColorTransform *transform)
+{
+    free(transform);
+}
+
+int ZWColorTransformGetComponents(const ZWColorTransform *transform)
+{
+    return transform->components;
+}
+
+#pragma mark Converting
+
+void ZWColorTransformToLinear(const ZWColorTransform *transform, const unsigned char *in, float *out, int count)
+{
+    int i;
+    
+    if (transform->components == 1) {
+        for (i = 0; i < count; i++) 
+            out[i] = transform->toLinear[0][in[i]];
+        return;
+    }
+    
+    for (i = 0; i < count; i++) {
+        out[0] = transform->toLinear[0][in[0]];
+        out[1] = transform->toLinear[1][in[1]];
+        out[2] = transform->toLinear[2][in[2]];
+        in += 3;
+        out += 3;
+    }
+}
+
+static inline int encodeIndex(float value)
+{
+    // clips, and catches NaN too
+    if (!(value > 0.0f)) 
+        return 0;
+    if (value >= 1.0f) 
+        return SRGB_ENCODE_TABLE_SIZE - 1;
+    return (int)(value * (SRGB_ENCODE_TABLE_SIZE - 1) + 0.5f);
+}
+
+void ZWColorTransformToSRGB(const ZWColorTransform *transform, const float *in, unsigned char *out, int count)
+{
+    const unsigned char *encode = transform->encode;
+    int i;
+    
+    if (transform->components == 1 || !transform->changesPrimaries) {
+        int samples = count * transform->components;
+        for (i = 0; i < samples; i++) 
+            out[i] = encode[encodeIndex(in[i])];
+        return;
+    }
+    
+#if defined(__SSE2__)
+    {
+        // A pixel per vector: each input channel scales its column of the matrix, then the sum is 
+        // clipped and scaled to a table index, all four lanes at once
+        __m128 red = _mm_loadu_ps(transform->columns[0]);
+        __m128 green = _mm_loadu_ps(transform->columns[1]);
+        __m128 blue = _mm_loadu_ps(transform->columns[2]);
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 scale = _mm_set1_ps((float)(SRGB_ENCODE_TABLE_SIZE - 1));
+        __m128 half = _mm_set1_ps(0.5f);
+        union {
+            __m128i vector;
+            int lanes[4];
+        } index;
+        
+        for (i = 0; i < count; i++) {
+            __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(red, _mm_set1_ps(in[0])), 
+                                                 _mm_mul_ps(green, _mm_set1_ps(in[1]))), 
+                                      _mm_mul_ps(blue, _mm_set1_ps(in[2])));
+            value = _mm_min_ps(_mm_max_ps(value, zero), one);
+            index.vector = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+            out[0] = encode[index.lanes[0]];
+            out[1] = encode[index.lanes[1]];
+            out[2] = encode[index.lanes[2]];
+            in += 3;
+            out += 3;
+        }
+    }
+#else
+    {
+        const float (*columns)[4] = transform->columns;
+        
+        for (i = 0; i < count; i++) {
+            float r = in[0], g = in[1], b = in[2];
+            out[0] = encode[encodeIndex(columns[0][0] * r + columns[1][0] * g + columns[2][0] * b)];
+            out[1] = encode[encodeIndex(columns[0][1] * r + columns[1][1] * g + columns[2][1] * b)];
+            out[2] = encode[encodeIndex(columns[0][2] * r + columns[1][2] * g + columns[2][2] * b)];
+            in += 3;
+            out += 3;
+        }
+    }
+#endif
+}
+
+#pragma mark sRGB Profile
+
+static unsigned char *writeXYZTag(unsigned char *p, const double xyz[3])
+{
+    memcpy(p, "XYZ \0\0\0\0", 8);
+    writeS15Fixed16(p + 8, xyz[0]);
+    writeS15Fixed16(p + 12, xyz[1]);
+    writeS15Fixed16(p + 16, xyz[2]);
+    return p + 20;
+}
+
+// A version 2 matrix/TRC profile, since plenty of software still doesn't read version 4. Version 2 has no
+// parametric curves, so the tone curve goes in as a table.
+void ZWColorTransformWriteSRGBProfile(unsigned char *profile)
+{
+    static const char *description = "sRGB IEC61966-2.1";
+    static const char *copyright = "No copyright, use freely";
+    static const char *tagNames[9] = { "desc", "cprt", "wtpt", "rXYZ", "gXYZ", "bXYZ", "rTRC", "gTRC", "bTRC" };
+    unsigned long tagOffsets[9], tagSizes[9];
+    unsigned char *p;
+    int i, c;
+    
+    memset(profile, 0, ZWCOLOR_SRGB_PROFILE_LENGTH);
+    
+    // header
+    writeICC32(profile, ZWCOLOR_SRGB_PROFILE_LENGTH);
+    writeICC32(profile + 8, 0x02100000);
+    memcpy(profile + 12, "mntrRGB XYZ ", 12);
+    profile[24] = 2000 >> 8;            // 2000/1/1
+    profile[25] = 2000 & 0xFF;
+    profile[27] = 1;
+    profile[29] = 1;
+    memcpy(profile + 36, "acsp", 4);
+    writeS15Fixed16(profile + 68, 0.9642);
+    writeS15Fixed16(profile + 72, 1.0);
+    writeS15Fixed16(profile + 76, 0.8249);
+    
+    p = profile + 132 + 9 * 12;
+    
+    // textDescriptionType: the ASCII name, then empty Unicode and ScriptCode names
+    tagOffsets[0] = p - profile;
+    memcpy(p, "desc", 4);
+    writeICC32(p + 8, strlen(description) + 1);
+    strcpy((char *)p + 12, description);
+    p += 12 + strlen(description) + 1 + 8 + 3 + 67;
+    tagSizes[0] = p - profile - tagOffsets[0];
+    p = profile + ((p - profile + 3) & ~3);
+    
+    tagOffsets[1] = p - profile;
+    memcpy(p, "text", 4);
+    strcpy((char *)p + 8, copyright);
+    p += 8 + strlen(copyright) + 1;
+    tagSizes[1] = p - profile - tagOffsets[1];
+    p = profile + ((p - profile + 3) & ~3);
+    
+    tagOffsets[2] = p - profile;
+    p = writeXYZTag(p, sRGBWhite);
+    tagSizes[2] = 20;
+    
+    for (c = 0; c < 3; c++) {
+        double xyz[3];
+        xyz[0] = sRGBPrimaries[0][c];
+        xyz[1] = sRGBPrimaries[1][c];
+        xyz[2] = sRGBPrimaries[2][c];
+        tagOffsets[3 + c] = p - profile;
+        tagSizes[3 + c] = 20;
+        p = writeXYZTag(p, xyz);
+    }
+    
+    // the three channels share one curve
+    tagOffsets[6] = tagOffsets[7] = tagOffsets[8] = p - profile;
+    tagSizes[6] = tagSizes[7] = tagSizes[8] = 12 + SRGB_PROFILE_CURVE_SIZE * 2;
+    memcpy(p, "curv", 4);
+    writeICC32(p + 8, SRGB_PROFILE_CURVE_SIZE);
+    p += 12;
+    for (i = 0; i < SRGB_PROFILE_CURVE_SIZE; i++) {
+        unsigned int value = (unsigned int)floor(sRGBDecode((double)i / (SRGB_PROFILE_CURVE_SIZE - 1)) * 65535.0 + 0.5);
+        p[0] = (unsigned char)(value >> 8);
+        p[1] = (unsigned char)value;
+        p += 2;
+    }
+    
+    // tag table
+    writeICC32(profile + 128, 9);
+    for (i = 0; i < 9; i++) {
+        unsigned char *entry = profile + 132 + i * 12;
+        memcpy(entry, tagNames[i], 4);
+        writeICC32(entry + 4, tagOffsets[i]);
+        writeICC32(entry + 8, tagSizes[i]);
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+
+// An on-disk cache of resized images. Entries are keyed on everything that can change the output
+// (the source file's path, size and modification date, the target size, and the encoder settings),
+// so a stale entry simply never gets looked up again and ages out of the LRU.
+@interface ZWDerivedImageCache : NSObject {
+    NSString *directory;
+    NSMutableDictionary *index;
+    unsigned long long maxBytes;
+    unsigned long long totalBytes;
+    BOOL indexDirty;
+    
+    unsigned int hits;
+    unsigned int misses;
+    
+    NSLock *lock;
+}
+
++ (ZWDerivedImageCache *)sharedCache;
+
+- (id)initWithDirectory:(NSString *)newDirectory maxBytes:(unsigned long long)newMaxBytes;
+
+// Returns nil if the source file can't be stat'd (in which case don't bother caching)
+- (NSString *)keyForImageAtPath:(NSString *)path size:(NSSize)size options:(NSString *)options;
+
+- (NSData *)dataForKey:(NSString *)key;
+- (void)setData:(NSData *)data forKey:(NSString *)key;
+
+- (void)setMaxBytes:(unsigned long long)newMaxBytes;
+- (unsigned long long)maxBytes;
+- (unsigned long long)totalBytes;
+
+- (void)resetStatistics;
+- (unsigned int)hits;
+- (unsigned int)misses;
+
+- (void)synchronize;
+- (void)removeAllEntries;
+
+@end
@@ -0,0 +1,344 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWDerivedImageCache.h"
+
+#define DEFAULT_CACHE_MAX_BYTES (256ULL * 1024 * 1024)
+
+// When we go over the size cap, trim down to this fraction of it so we don't evict on every insert
+#define CACHE_TRIM_FRACTION 0.9
+
+static NSString *hashForKey(NSString *key);
+static int compareLastUsed(id a, id b, void *context);
+
+@interface ZWDerivedImageCache (PrivateStuff)
+- (NSString *)pathForEntry:(NSDictionary *)entry;
+- (void)removeEntryForHash:(NSString *)hash;
+- (void)trimToBytes:(unsigned long long)limit;
+@end
+
+@implementation ZWDerivedImageCache
+
++ (ZWDerivedImageCache *)sharedCache
+{
+    static ZWDerivedImageCache *sharedCache = nil;
+    
+    if (sharedCache == nil) {
+        NSArray *cachesDirectories = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+        NSString *cachesDirectory = [cachesDirectories count] ? [cachesDirectories objectAtIndex:0] : [NSHomeDirectory() stringByAppendingPathComponent:@"Library/Caches"];
+        NSString *bundleIdentifier = [[NSBundle bundleForClass:[self class]] bundleIdentifier];
+        if (bundleIdentifier == nil) 
+            bundleIdentifier = @"iPhotoToGallery";
+        NSString *directory = [[cachesDirectory stringByAppendingPathComponent:bundleIdentifier] stringByAppendingPathComponent:@"Derived Images"];
+        
+        sharedCache = [[ZWDerivedImageCache alloc] initWithDirectory:directory maxBytes:DEFAULT_CACHE_MAX_BYTES];
+    }
+    
+    return sharedCache;
+}
+
+- (id)initWithDirectory:(NSString *)newDirectory maxBytes:(unsigned long long)newMaxBytes
+{
+    directory = [newDirectory copy];
+    maxBytes = newMaxBytes;
+    lock = [[NSLock alloc] init];
+    
+    // create the directory (and any missing parents)
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSArray *components = [directory pathComponents];
+    NSString *partialPath = @"";
+    int i;
+    for (i = 0; i < (int)[components count]; i++) {
+        partialPath = [partialPath stringByAppendingPathComponent:[components objectAtIndex:i]];
+        if (![fileManager fileExistsAtPath:partialPath]) 
+            [fileManager createDirectoryAtPath:partialPath attributes:nil];
+    }
+    
+    NSDictionary *savedIndex = [NSDictionary dictionaryWithContentsOfFile:[directory stringByAppendingPathComponent:@"Index.plist"]];
+    index = [[NSMutableDictionary alloc] init];
+    
+    // only keep index entries whose files are still around
+    NSEnumerator *each = [savedIndex keyEnumerator];
+    NSString *hash;
+    while (hash = [each nextObject]) {
+        NSDictionary *entry = [savedIndex objectForKey:hash];
+        if (![entry isKindOfClass:[NSDictionary class]] || ![fileManager fileExistsAtPath:[self pathForEntry:entry]]) {
+            indexDirty = YES;
+            continue;
+        }
+        [index setObject:[[entry mutableCopy] autorelease] forKey:hash];
+        totalBytes += [[entry objectForKey:@"Bytes"] unsignedLongLongValue];
+    }
+    
+    return self;
+}
+
+- (void)dealloc
+{
+    [self synchronize];
+    
+    [directory release];
+    [index release];
+    [lock release];
+    
+    [super dealloc];
+}
+
+#pragma mark Accessors
+
+- (void)setMaxBytes:(unsigned long long)newMaxBytes
+{
+    [lock lock];
+    maxBytes = newMaxBytes;
+    [self trimToBytes:maxBytes];
+    [lock unlock];
+}
+
+- (unsigned long long)maxBytes
+{
+    unsigned long long bytes;
+    
+    [lock lock];
+    bytes = maxBytes;
+    [lock unlock];
+    
+    return bytes;
+}
+
+- (unsigned long long)totalBytes
+{
+    unsigned long long bytes;
+    
+    [lock lock];
+    bytes = totalBytes;
+    [lock unlock];
+    
+    return bytes;
+}
+
+- (void)resetStatistics
+{
+    [lock lock];
+    hits = 0;
+    misses = 0;
+    [lock unlock];
+}
+
+- (unsigned int)hits
+{
+    unsigned int count;
+    
+    [lock lock];
+    count = hits;
+    [lock unlock];
+    
+    return count;
+}
+
+- (unsigned int)misses
+{
+    unsigned int count;
+    
+    [lock lock];
+    count = misses;
+    [lock unlock];
+    
+    return count;
+}
+
+#pragma mark Cache
+
+- (NSString *)keyForImageAtPath:(NSString *)path size:(NSSize)size options:(NSString *)options
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] fileAttributesAtPath:path traverseLink:YES];
+    if (attributes == nil) 
+        return nil;
+    
+    return [NSString stringWithFormat:@"%@|%qu|%.0f|%dx%d|%@", 
+        path, 
+        [attributes fileSize], 
+        [[attributes fileModificationDate] timeIntervalSinceReferenceDate], 
+        (int)size.width, (int)size.height, 
+        options ? options : @""];
+}
+
+- (NSData *)dataForKey:(NSString *)key
+{
+    if (key == nil) 
+        return nil;
+    
+    NSData *data = nil;
+    NSString *hash = hashForKey(key);
+    
+    [lock lock];
+    
+    NSMutableDictionary *entry = [index objectForKey:hash];
+    // the full key is stored in the entry so a hash collision just looks like a miss
+    if (entry && [[entry objectForKey:@"Key"] isEqual:key]) {
+        data = [NSData dataWithContentsOfFile:[self pathForEntry:entry]];
+        if (data) {
+            [entry setObject:[NSDate date] forKey:@"LastUsed"];
+            indexDirty = YES;
+        }
+        else {
+            // somebody cleaned out the cache directory behind our back
+            [self removeEntryForHash:hash];
+        }
+    }
+    
+    if (data) 
+        hits++;
+    else 
+        misses++;
+    
+    [lock unlock];
+    
+    return data;
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key
+{
+    if (key == nil || data == nil || [data length] == 0) 
+        return;
+    
+    NSString *hash = hashForKey(key);
+    NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+        key, @"Key",
+        [hash stringByAppendingPathExtension:@"jpg"], @"File",
+        [NSNumber numberWithUnsignedLongLong:[data length]], @"Bytes",
+        [NSDate date], @"LastUsed",
+        nil];
+    
+    [lock lock];
+    
+    // Don't let a single huge image flush everything else out
+    if ((unsigned long long)[data length] > maxBytes / 4) {
+        [lock unlock];
+        return;
+    }
+    
+    [self removeEntryForHash:hash];
+    
+    // writeToFile:atomically: writes to a temporary file and renames it into place, so a crash
+    // mid-write can never leave a truncated image behind for the next export to pick up
+    if ([data writeToFile:[self pathForEntry:entry] atomically:YES]) {
+        [index setObject:entry forKey:hash];
+        totalBytes += [data length];
+        indexDirty = YES;
+        
+        if (totalBytes > maxBytes) 
+            [self trimToBytes:(unsigned long long)(maxBytes * CACHE_TRIM_FRACTION)];
+    }
+    
+    [lock unlock];
+}
+
+- (void)synchronize
+{
+    [lock lock];
+    if (indexDirty) {
+        [index writeToFile:[directory stringByAppendingPathComponent:@"Index.plist"] atomically:YES];
+        indexDirty = NO;
+    }
+    [lock unlock];
+}
+
+- (void)removeAllEntries
+{
+    [lock lock];
+    [self trimToBytes:0];
+    [lock unlock];
+    
+    [self synchronize];
+}
+
+@end
+
+@implementation ZWDerivedImageCache (PrivateStuff)
+
+- (NSString *)pathForEntry:(NSDictionary *)entry
+{
+    return [directory stringByAppendingPathComponent:[entry objectForKey:@"File"]];
+}
+
+// Must be called with the lock held
+- (void)removeEntryForHash:(NSString *)hash
+{
+    NSDictionary *entry = [index objectForKey:hash];
+    if (entry == nil) 
+        return;
+    
+    [[NSFileManager defaultManager] removeFileAtPath:[self pathForEntry:entry] handler:nil];
+    totalBytes -= [[entry objectForKey:@"Bytes"] unsignedLongLongValue];
+    [index removeObjectForKey:hash];
+    indexDirty = YES;
+}
+
+// Must be called with the lock held. Evicts least recently used entries until we're under the limit.
+- (void)trimToBytes:(unsigned long long)limit
+{
+    if (totalBytes <= limit) 
+        return;
+    
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:[index count]];
+    NSEnumerator *each = [index keyEnumerator];
+    NSString *hash;
+    while (hash = [each nextObject]) 
+        [entries addObject:[NSArray arrayWithObjects:[[index objectForKey:hash] objectForKey:@"LastUsed"], hash, nil]];
+    
+    [entries sortUsingFunction:compareLastUsed context:NULL];
+    
+    int i;
+    for (i = 0; i < (int)[entries count] && totalBytes > limit; i++) 
+        [self removeEntryForHash:[[entries objectAtIndex:i] objectAtIndex:1]];
+}
+
+@end
+
+// 64-bit FNV-1a over the UTF-8 key. We only need this to make a safe, fixed-length filename;
+// the full key is kept in the index to catch collisions.
+static NSString *hashForKey(NSString *key)
+{
+    const unsigned char *bytes = (const unsigned char *)[key UTF8String];
+    unsigned long long hash = 14695981039346656037ULL;
+    
+    while (*bytes) {
+        hash ^= *bytes++;
+        hash *= 1099511628211ULL;
+    }
+    
+    return [NSString stringWithFormat:@"%016qx", hash];
+}
+
+// Sorts [LastUsed, hash] pairs oldest first
+static int compareLastUsed(id a, id b, void *context)
+{
+    return [[a objectAtIndex:0] compare:[b objectAtIndex:0]];
+}
@@ -31,7 +31,9 @@
 #import <Foundation/Foundation.h>
 
 @class ZWGalleryAlbum;
-@class ZWURLConnection;
+@class ZWAlbumSearchIndex;
+@class ZWAlbumTree;
+@class ZWGalleryOperation;
 
 typedef enum
 {
@@ -72,13 +74,14 @@ typedef enum
     BOOL loggedIn;
     int majorVersion;
     int minorVersion;
-    NSArray* albums;
+    ZWAlbumTree *albumTree;     // the albums; it doesn't hold on to us, so we tell it when we go
+    ZWAlbumSearchIndex *albumSearchIndex;
     NSString *lastCreatedAlbumName;
     
     NSStringEncoding sniffedEncoding;
     
     id delegate;    
-    ZWURLConnection *currentConnection;
+    ZWGalleryOperation *currentOperation;   // the one -cancelOperation cancels
 }
 
 - (id)init;
@@ -93,6 +96,26 @@ typedef enum
 - (void)createAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGallery *)parent;
 - (void)getAlbums;
 
+// The same as -login and -getAlbums, but done on the calling thread, with the status returned rather than
+// sent to the delegate. -cancelOperation works on them from another thread.
+- (ZWGalleryRemoteStatusCode)loginSynchronously;
+- (ZWGalleryRemoteStatusCode)getAlbumsSynchronously;
+
+// The same again, each on a thread of its own with a connection of its own; see ZWGalleryOperation. The 
+// result of a fetch is the albums, which are also what -albums returns from then on, and the result of a 
+// create is the new album's name. Fetches, creates and uploads can all go at once, but logging in starts
+// a new session, so it shouldn't overlap anything else on the same gallery. -cancelOperation leaves these
+// alone; cancel them through the operation.
+- (ZWGalleryOperation *)loginWithTarget:(id)target action:(SEL)action thread:(NSThread *)thread;
+- (ZWGalleryOperation *)getAlbumsWithTarget:(id)target action:(SEL)action thread:(NSThread *)thread;
+- (ZWGalleryOperation *)createAlbumWithName:(NSString *)name 
+                                      title:(NSString *)title 
+                                    summary:(NSString *)summary 
+                                     parent:(ZWGalleryAlbum *)parent 
+                                     target:(id)target 
+                                     action:(SEL)action 
+                                     thread:(NSThread *)thread;
+
 // accessor methods
 - (NSURL *)url;
 - (NSURL *)fullURL;
@@ -102,7 +125,10 @@ typedef enum
 - (int)majorVersion;
 - (int)minorVersion;
 - (BOOL)loggedIn;
+// The last fetch's albums, in the order the gallery sent them after an empty one at the top. Each view 
+// is made as it's asked for and goes once nobody holds on to it.
 - (NSArray *)albums;
+- (ZWAlbumSearchIndex *)albumSearchIndex;
 - (NSDictionary *)infoDictionary;
 - (ZWGalleryType)type;
 - (BOOL)isGalleryV2;
@@ -112,6 +138,10 @@ typedef enum
 - (NSString *)lastCreatedAlbumName;
 - (NSStringEncoding)sniffedEncoding;
 
+// Whether the gallery will take a thumbnail and resized version along with an uploaded photo, so it doesn't
+// have to make them itself
+- (BOOL)acceptsClientDerivatives;
+
 // This helper method can be used by children too
 - (NSDictionary *)parseResponseData:(NSData*)responseData;
 - (NSString *)formNameWithName:(NSString *)paramName;
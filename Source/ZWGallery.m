@@ -30,20 +30,33 @@
 
 #import "ZWGallery.h"
 #import "ZWGalleryAlbum.h"
+#import "ZWAlbumSearchIndex.h"
+#import "ZWAlbumTree.h"
+#import "ZWGalleryOperation.h"
 #import "NSString+misc.h"
 #import "ZWURLConnection.h"
-#import "InterThreadMessaging.h"
 #import "ZWMutableURLRequest.h"
 
+// guards every gallery's current operation, and the albums and such that operations on other threads replace
+static pthread_mutex_t galleryOperationLock = PTHREAD_MUTEX_INITIALIZER;
+
 @interface ZWGallery (PrivateAPI)
-- (void)loginThread:(NSDictionary *)threadDispatchInfo;
-- (ZWGalleryRemoteStatusCode)doLogin;
+- (ZWGalleryOperation *)operationWithSelector:(SEL)selector arguments:(NSDictionary *)arguments target:(id)target action:(SEL)action thread:(NSThread *)thread;
+- (void)setCurrentOperation:(ZWGalleryOperation *)operation;
+- (void)currentOperationDidFinish:(ZWGalleryOperation *)operation;
+- (ZWGalleryRemoteStatusCode)runOperation:(ZWGalleryOperation *)operation;
+
+- (void)performLogin:(ZWGalleryOperation *)operation;
+- (void)loginDidFinish:(ZWGalleryOperation *)operation;
+- (ZWGalleryRemoteStatusCode)doLogin:(ZWGalleryOperation *)operation;
 
-- (void)getAlbumsThread:(NSDictionary *)threadDispatchInfo;
-- (ZWGalleryRemoteStatusCode)doGetAlbums;
+- (void)performGetAlbums:(ZWGalleryOperation *)operation;
+- (void)getAlbumsDidFinish:(ZWGalleryOperation *)operation;
+- (ZWGalleryRemoteStatusCode)doGetAlbums:(ZWGalleryOperation *)operation;
 
-- (void)createAlbumThread:(NSDictionary *)threadDispatchInfo;
-- (ZWGalleryRemoteStatusCode)doCreateAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGalleryAlbum *)parent;
+- (void)performCreateAlbum:(ZWGalleryOperation *)operation;
+- (void)createAlbumDidFinish:(ZWGalleryOperation *)operation;
+- (ZWGalleryRemoteStatusCode)doCreateAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGalleryAlbum *)parent operation:(ZWGalleryOperation *)operation;
 
 @end
 
@@ -92,8 +105,11 @@
     [url release];
     [username release];
     [password release];
-    [albums release];
+    [albumTree setGallery:nil];
+    [albumTree release];
+    [albumSearchIndex release];
     [lastCreatedAlbumName release];
+    [currentOperation release];
     
     [super dealloc];
 }
@@ -159,7 +175,23 @@
 }
 
 - (NSArray*)albums {
-    return albums;
+    NSArray *currentAlbums;
+    
+    pthread_mutex_lock(&galleryOperationLock);
+    currentAlbums = [[albumTree albums] retain];
+    pthread_mutex_unlock(&galleryOperationLock);
+    
+    return [currentAlbums autorelease];
+}
+
+- (ZWAlbumSearchIndex *)albumSearchIndex {
+    ZWAlbumSearchIndex *currentIndex;
+    
+    pthread_mutex_lock(&galleryOperationLock);
+    currentIndex = [albumSearchIndex retain];
+    pthread_mutex_unlock(&galleryOperationLock);
+    
+    return [currentIndex autorelease];
 }
 
 - (NSDictionary*)infoDictionary {
@@ -180,7 +212,13 @@
 
 - (NSString *)lastCreatedAlbumName
 {
-    return lastCreatedAlbumName;
+    NSString *name;
+    
+    pthread_mutex_lock(&galleryOperationLock);
+    name = [lastCreatedAlbumName retain];
+    pthread_mutex_unlock(&galleryOperationLock);
+    
+    return [name autorelease];
 }
 
 - (NSStringEncoding)sniffedEncoding
@@ -188,20 +226,36 @@
     return sniffedEncoding;
 }
 
+- (BOOL)acceptsClientDerivatives
+{
+    // Neither the G1 remote protocol nor G2's GalleryRemote module has a way to hand over a thumbnail or
+    // resize with add-item - the server always builds its own from the uploaded file. If a server ever
+    // advertises support (say, a newer protocol_version in the login response), check for it here.
+    return NO;
+}
+
 #pragma mark Actions
 
 - (void)cancelOperation
 {
-    if (currentConnection && ![currentConnection isCancelled]) {
-        [currentConnection cancel];
-    }
+    ZWGalleryOperation *operation;
+    
+    pthread_mutex_lock(&galleryOperationLock);
+    operation = [currentOperation retain];
+    pthread_mutex_unlock(&galleryOperationLock);
+    
+    [operation cancel];
+    [operation release];
 }
 
 - (void)login {
-    NSDictionary *threadDispatchInfo = [NSDictionary dictionaryWithObjectsAndKeys:
-        [NSThread currentThread], @"CallingThread",
-        nil];
-    [NSThread detachNewThreadSelector:@selector(loginThread:) toTarget:self withObject:threadDispatchInfo];
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performLogin:) 
+                                                      arguments:nil 
+                                                         target:self 
+                                                         action:@selector(loginDidFinish:) 
+                                                         thread:[NSThread currentThread]];
+    [self setCurrentOperation:operation];
+    [operation start];
 }
 
 - (void)logout {
@@ -210,25 +264,68 @@
 
 - (void)createAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGallery *)parent
 {
-    if (parent == nil) 
-        (id)parent = (id)[NSNull null];
-        
-    NSDictionary *threadDispatchInfo = [NSDictionary dictionaryWithObjectsAndKeys:
+    NSDictionary *arguments = [NSDictionary dictionaryWithObjectsAndKeys:
         name, @"AlbumName",
         title, @"AlbumTitle",
         summary, @"AlbumSummary",
-        parent, @"AlbumParent",
-        [NSThread currentThread], @"CallingThread",
+        (parent ? (id)parent : (id)[NSNull null]), @"AlbumParent",
         nil];
-
-    [NSThread detachNewThreadSelector:@selector(createAlbumThread:) toTarget:self withObject:threadDispatchInfo];
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performCreateAlbum:) 
+                                                      arguments:arguments 
+                                                         target:self 
+                                                         action:@selector(createAlbumDidFinish:) 
+                                                         thread:[NSThread currentThread]];
+    [self setCurrentOperation:operation];
+    [operation start];
 }
 
 - (void)getAlbums {
-    NSDictionary *threadDispatchInfo = [NSDictionary dictionaryWithObjectsAndKeys:
-        [NSThread currentThread], @"CallingThread",
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performGetAlbums:) 
+                                                      arguments:nil 
+                                                         target:self 
+                                                         action:@selector(getAlbumsDidFinish:) 
+                                                         thread:[NSThread currentThread]];
+    [self setCurrentOperation:operation];
+    [operation start];
+}
+
+- (ZWGalleryRemoteStatusCode)loginSynchronously {
+    return [self runOperation:[self operationWithSelector:@selector(performLogin:) arguments:nil target:nil action:NULL thread:nil]];
+}
+
+- (ZWGalleryRemoteStatusCode)getAlbumsSynchronously {
+    return [self runOperation:[self operationWithSelector:@selector(performGetAlbums:) arguments:nil target:nil action:NULL thread:nil]];
+}
+
+- (ZWGalleryOperation *)loginWithTarget:(id)target action:(SEL)action thread:(NSThread *)thread {
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performLogin:) arguments:nil target:target action:action thread:thread];
+    [operation start];
+    return operation;
+}
+
+- (ZWGalleryOperation *)getAlbumsWithTarget:(id)target action:(SEL)action thread:(NSThread *)thread {
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performGetAlbums:) arguments:nil target:target action:action thread:thread];
+    [operation start];
+    return operation;
+}
+
+- (ZWGalleryOperation *)createAlbumWithName:(NSString *)name 
+                                      title:(NSString *)title 
+                                    summary:(NSString *)summary 
+                                     parent:(ZWGalleryAlbum *)parent 
+                                     target:(id)target 
+                                     action:(SEL)action 
+                                     thread:(NSThread *)thread
+{
+    NSDictionary *arguments = [NSDictionary dictionaryWithObjectsAndKeys:
+        name, @"AlbumName",
+        title, @"AlbumTitle",
+        summary, @"AlbumSummary",
+        (parent ? (id)parent : (id)[NSNull null]), @"AlbumParent",
         nil];
-    [NSThread detachNewThreadSelector:@selector(getAlbumsThread:) toTarget:self withObject:threadDispatchInfo];
+    ZWGalleryOperation *operation = [self operationWithSelector:@selector(performCreateAlbum:) arguments:arguments target:target action:action thread:thread];
+    [operation start];
+    return operation;
 }
 
 #pragma mark Helpers
@@ -281,31 +378,67 @@
     return [NSString stringWithFormat:@"g2_form[%@]", paramName];
 }
 
-#pragma mark Threads
+#pragma mark Operations
 
-- (void)loginThread:(NSDictionary *)threadDispatchInfo {
-    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+- (ZWGalleryOperation *)operationWithSelector:(SEL)selector arguments:(NSDictionary *)arguments target:(id)target action:(SEL)action thread:(NSThread *)thread
+{
+    return [[[ZWGalleryOperation alloc] initWithPerformer:self 
+                                                 selector:selector 
+                                                arguments:arguments 
+                                                   target:target 
+                                                   action:action 
+                                                   thread:thread] autorelease];
+}
+
+- (void)setCurrentOperation:(ZWGalleryOperation *)operation
+{
+    pthread_mutex_lock(&galleryOperationLock);
+    [operation retain];
+    [currentOperation release];
+    currentOperation = operation;
+    pthread_mutex_unlock(&galleryOperationLock);
+}
+
+// A later one may have taken its place already
+- (void)currentOperationDidFinish:(ZWGalleryOperation *)operation
+{
+    pthread_mutex_lock(&galleryOperationLock);
+    if (currentOperation == operation) {
+        [currentOperation release];
+        currentOperation = nil;
+    }
+    pthread_mutex_unlock(&galleryOperationLock);
+}
+
+- (ZWGalleryRemoteStatusCode)runOperation:(ZWGalleryOperation *)operation
+{
+    [self setCurrentOperation:operation];
+    [operation run];
+    [self currentOperationDidFinish:operation];
     
-    [NSThread prepareForInterThreadMessages];
+    return [operation status];
+}
+
+- (void)performLogin:(ZWGalleryOperation *)operation
+{
+    [operation finishWithStatus:[self doLogin:operation] result:nil];
+}
 
-    NSThread *callingThread = [threadDispatchInfo objectForKey:@"CallingThread"];
+- (void)loginDidFinish:(ZWGalleryOperation *)operation
+{
+    ZWGalleryRemoteStatusCode status = [operation status];
     
-    ZWGalleryRemoteStatusCode status = [self doLogin];
+    [self currentOperationDidFinish:operation];
     
     if (status == GR_STAT_SUCCESS)
-        [delegate performSelector:@selector(galleryDidLogin:) 
-                       withObject:self 
-                         inThread:callingThread];
+        [delegate galleryDidLogin:self];
     else
         [delegate performSelector:@selector(gallery:loginFailedWithCode:) 
                        withObject:self 
-                       withObject:[NSNumber numberWithInt:status] 
-                         inThread:callingThread];
-    
-    [pool release];
+                       withObject:[NSNumber numberWithInt:status]];
 }
     
-- (ZWGalleryRemoteStatusCode)doLogin
+- (ZWGalleryRemoteStatusCode)doLogin:(ZWGalleryOperation *)operation
 {
     // remove the cookies sent to the gallery (the login function ain't so smart)
     NSHTTPCookieStorage *cookieStore = [NSHTTPCookieStorage sharedHTTPCookieStorage];
@@ -322,16 +455,14 @@
                                                             timeoutInterval:60.0];
     [setupRequest setHTTPMethod:@"GET"];
     
-    currentConnection = [ZWURLConnection connectionWithRequest:setupRequest];
-    while ([currentConnection isRunning]) 
-        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    ZWURLConnection *connection = [operation loadRequest:setupRequest];
     
-    if ([currentConnection isCancelled]) 
+    if ([connection isCancelled]) 
         return ZW_GALLERY_OPERATION_DID_CANCEL;
     
     // Default to UTF-8
     sniffedEncoding = NSUTF8StringEncoding;
-    NSURLResponse *response = [currentConnection response];
+    NSURLResponse *response = [connection response];
     NSString *encodingString = [response textEncodingName];
     if (encodingString) {
         CFStringEncoding cfStrEncoding = CFStringConvertIANACharSetNameToEncoding((CFStringRef)encodingString);
@@ -361,16 +492,13 @@
             NSData *requestData = [requestString dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
             [theRequest setHTTPBody:requestData];
             
-            currentConnection = [ZWURLConnection connectionWithRequest:theRequest];
-            while ([currentConnection isRunning]) {
-                [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
-            }
+            connection = [operation loadRequest:theRequest];
             
-            if ([currentConnection isCancelled]) 
+            if ([connection isCancelled]) 
                 return ZW_GALLERY_OPERATION_DID_CANCEL;
             
-            NSData *data = [currentConnection data];
-            response = [currentConnection response];
+            NSData *data = [connection data];
+            response = [connection response];
 
             if (data == nil) {
                 if (tryGalleryV2) 
@@ -408,16 +536,13 @@
             NSData *requestData = [requestString dataUsingEncoding:NSUTF8StringEncoding allowLossyConversion:YES];
             [theRequest setHTTPBody:requestData];
             
-            currentConnection = [ZWURLConnection connectionWithRequest:theRequest];
-            while ([currentConnection isRunning]) {
-                [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
-            }
+            connection = [operation loadRequest:theRequest];
             
-            if ([currentConnection isCancelled]) 
+            if ([connection isCancelled]) 
                 return ZW_GALLERY_OPERATION_DID_CANCEL;
             
-            NSData *data = [currentConnection data];
-            response = [currentConnection response];
+            NSData *data = [connection data];
+            response = [connection response];
             
             if (data == nil) 
                 return ZW_GALLERY_COULD_NOT_CONNECT;
@@ -464,29 +589,28 @@
     return ZW_GALLERY_UNKNOWN_ERROR;
 }
 
-- (void)getAlbumsThread:(NSDictionary *)threadDispatchInfo {
-    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
-
-    [NSThread prepareForInterThreadMessages];
+- (void)performGetAlbums:(ZWGalleryOperation *)operation
+{
+    ZWGalleryRemoteStatusCode status = [self doGetAlbums:operation];
+    
+    [operation finishWithStatus:status result:(status == GR_STAT_SUCCESS) ? [self albums] : nil];
+}
 
-    NSThread *callingThread = [threadDispatchInfo objectForKey:@"CallingThread"];
+- (void)getAlbumsDidFinish:(ZWGalleryOperation *)operation
+{
+    ZWGalleryRemoteStatusCode status = [operation status];
     
-    ZWGalleryRemoteStatusCode status = [self doGetAlbums];
+    [self currentOperationDidFinish:operation];
     
     if (status == GR_STAT_SUCCESS)
-        [delegate performSelector:@selector(galleryDidGetAlbums:) 
-                       withObject:self
-                         inThread:callingThread];
+        [delegate galleryDidGetAlbums:self];
     else
         [delegate performSelector:@selector(gallery:getAlbumsFailedWithCode:) 
                        withObject:self 
-                       withObject:[NSNumber numberWithInt:status] 
-                         inThread:callingThread];
-
-    [pool release];
+                       withObject:[NSNumber numberWithInt:status]];
 }
 
-- (ZWGalleryRemoteStatusCode)doGetAlbums
+- (ZWGalleryRemoteStatusCode)doGetAlbums:(ZWGalleryOperation *)operation
 {
     NSMutableURLRequest *theRequest = [NSMutableURLRequest requestWithURL:fullURL
                                                               cachePolicy:NSURLRequestReloadIgnoringCacheData
@@ -503,14 +627,12 @@
     NSData *requestData = [requestString dataUsingEncoding:NSUTF8StringEncoding];
     [theRequest setHTTPBody:requestData];
     
-    currentConnection = [ZWURLConnection connectionWithRequest:theRequest];
-    while ([currentConnection isRunning]) 
-        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    ZWURLConnection *connection = [operation loadRequest:theRequest];
     
-    if ([currentConnection isCancelled]) 
+    if ([connection isCancelled]) 
         return ZW_GALLERY_OPERATION_DID_CANCEL;
 
-    NSData *data = [currentConnection data];
+    NSData *data = [connection data];
     
     if (data == nil) 
         return ZW_GALLERY_COULD_NOT_CONNECT;
@@ -521,38 +643,43 @@
     
     ZWGalleryRemoteStatusCode status = (ZWGalleryRemoteStatusCode)[[galleryResponse objectForKey:@"statusCode"] intValue];
         
-    [albums release];
-    albums = nil;
-    
-    if (status != GR_STAT_SUCCESS)
+    if (status != GR_STAT_SUCCESS) {
+        pthread_mutex_lock(&galleryOperationLock);
+        [albumSearchIndex release];
+        albumSearchIndex = nil;
+        [albumTree release];
+        albumTree = nil;
+        pthread_mutex_unlock(&galleryOperationLock);
+        
         return status;
+    }
     
     // add the albums to myself here...
     int numAlbums = [[galleryResponse objectForKey:@"album_count"] intValue];
-    NSMutableArray *galleriesArray = [NSMutableArray array];
-    [galleriesArray addObject:[ZWGalleryAlbum albumWithTitle:@"" name:@"" gallery:self]];
+    ZWAlbumTree *tree = [[[ZWAlbumTree alloc] initWithGallery:self] autorelease];
+    NSMutableDictionary *indexesByName = [NSMutableDictionary dictionaryWithCapacity:numAlbums];
+    ZWAlbumSearchIndex *searchIndex = [[[ZWAlbumSearchIndex alloc] initWithAlbumTree:tree] autorelease];
+    [tree addAlbumWithTitle:@"" name:@"" summary:nil];
     int i;
-    // first we'll iterate through to create the objects, since we don't know if they'll be in an order
+    // first we'll iterate through to add the albums, since we don't know if they'll be in an order
     // where parents will always come before children
     for (i = 1; i <= numAlbums; i++) {
         NSString *a_name = [galleryResponse objectForKey:[NSString stringWithFormat:@"album.name.%i", i]];
         NSString *a_title = [galleryResponse objectForKey:[NSString stringWithFormat:@"album.title.%i", i]];
-        ZWGalleryAlbum *album = [ZWGalleryAlbum albumWithTitle:a_title name:a_name gallery:self];
-
-        // this album will use the delegate of the gallery we're on
-        [album setDelegate:[self delegate]];
+        [tree addAlbumWithTitle:a_title name:a_name summary:nil];
         
-        BOOL a_can_add = NO;
+        int permissions = 0;
         if ([[galleryResponse objectForKey:[NSString stringWithFormat:@"album.perms.add.%i", i]] isEqual:@"true"]) {
-            a_can_add = YES;
+            permissions |= ZWAlbumCanAddItem;
         }
-        [album setCanAddItem:a_can_add];
-        BOOL a_can_create_sub = NO;
         if ([[galleryResponse objectForKey:[NSString stringWithFormat:@"album.perms.create_sub.%i", i]] isEqual:@"true"]) {
-            a_can_create_sub = YES;
+            permissions |= ZWAlbumCanAddSubAlbum;
         }
-        [album setCanAddSubAlbum:a_can_create_sub];
-        [galleriesArray addObject:album];
+        [tree setPermissions:permissions ofAlbumAtIndex:i];
+        
+        if (a_name) 
+            [indexesByName setObject:[NSNumber numberWithInt:i] forKey:[NSNumber numberWithInt:[a_name intValue]]];
+        [searchIndex addAlbumAtIndex:i];
     }
 	
     // now iterate through setting the parents
@@ -560,66 +687,65 @@
 	// we can't make that assumption anymore so this has to be a little more complicated.
     for (i = 1; i <= numAlbums; i++) { 
         int album_parent_id = [[galleryResponse objectForKey:[NSString stringWithFormat:@"album.parent.%i", i]] intValue];
-		ZWGalleryAlbum *album = [galleriesArray objectAtIndex:i];
 		
         if (album_parent_id) {
             if ([self type] == GalleryTypeG1) {
                 // For G1, the parent field is referring back to the item at that index in the list we got.
-                ZWGalleryAlbum *parent = [galleriesArray objectAtIndex:album_parent_id];
-                
-                [album setParent:parent];
-                [parent addChild:album];
+                if (album_parent_id > 0 && album_parent_id <= numAlbums) 
+                    [tree setParent:album_parent_id ofAlbumAtIndex:i];
             }
             else if ([self type] == GalleryTypeG2) {
-                // For G2, the parent id is actually referring to the "name", so we have to iterate to find it
-                int j;
-                for (j = 1; j <= numAlbums; j++) {
-                    int this_parent_id = [[galleryResponse objectForKey:[NSString stringWithFormat:@"album.name.%i", j]] intValue];
-                    
-                    if (this_parent_id == album_parent_id) {
-                        ZWGalleryAlbum *parentAlbum = [galleriesArray objectAtIndex:j];
-                        
-                        [album setParent:parentAlbum];
-                        [parentAlbum addChild:album];
-                    }
-                }
+                // For G2, the parent id is actually referring to the "name", so we look it up by that
+                NSNumber *parentIndex = [indexesByName objectForKey:[NSNumber numberWithInt:album_parent_id]];
+                
+                if (parentIndex) 
+                    [tree setParent:[parentIndex intValue] ofAlbumAtIndex:i];
             }
             else {
                 // Who knows how XMLRPC version does it.
             }
         }
     }
-    albums = [[NSArray alloc] initWithArray:galleriesArray];
+    
+    // No views are made here: they come from the tree as the rest of the plugin asks for them, and go
+    // again once it's done with them. Another fetch could have finished in the meantime; whichever 
+    // finishes last wins.
+    pthread_mutex_lock(&galleryOperationLock);
+    [albumSearchIndex release];
+    albumSearchIndex = [searchIndex retain];
+    [albumTree release];
+    albumTree = [tree retain];
+    pthread_mutex_unlock(&galleryOperationLock);
     
     return GR_STAT_SUCCESS;
 }
 
-- (void)createAlbumThread:(NSDictionary *)threadDispatchInfo {
-    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
-    
-    [NSThread prepareForInterThreadMessages];
+- (void)performCreateAlbum:(ZWGalleryOperation *)operation
+{
+    ZWGalleryRemoteStatusCode status = [self doCreateAlbumWithName:[operation argumentForKey:@"AlbumName"]
+                                                             title:[operation argumentForKey:@"AlbumTitle"]
+                                                           summary:[operation argumentForKey:@"AlbumSummary"]
+                                                            parent:[operation argumentForKey:@"AlbumParent"]
+                                                         operation:operation];
     
-    NSThread *callingThread = [threadDispatchInfo objectForKey:@"CallingThread"];
+    [operation finishWithStatus:status result:(status == GR_STAT_SUCCESS) ? [self lastCreatedAlbumName] : nil];
+}
+
+- (void)createAlbumDidFinish:(ZWGalleryOperation *)operation
+{
+    ZWGalleryRemoteStatusCode status = [operation status];
     
-    ZWGalleryRemoteStatusCode status = [self doCreateAlbumWithName:[threadDispatchInfo objectForKey:@"AlbumName"]
-                                                             title:[threadDispatchInfo objectForKey:@"AlbumTitle"]
-                                                           summary:[threadDispatchInfo objectForKey:@"AlbumSummary"]
-                                                            parent:[threadDispatchInfo objectForKey:@"AlbumParent"]];
+    [self currentOperationDidFinish:operation];
     
     if (status == GR_STAT_SUCCESS)
-        [delegate performSelector:@selector(galleryDidCreateAlbum:) 
-                       withObject:self
-                         inThread:callingThread];
+        [delegate galleryDidCreateAlbum:self];
     else
         [delegate performSelector:@selector(gallery:createAlbumFailedWithCode:) 
                        withObject:self 
-                       withObject:[NSNumber numberWithInt:status] 
-                         inThread:callingThread];
-    
-    [pool release];
+                       withObject:[NSNumber numberWithInt:status]];
 }
 
-- (ZWGalleryRemoteStatusCode)doCreateAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGalleryAlbum *)parent
+- (ZWGalleryRemoteStatusCode)doCreateAlbumWithName:(NSString *)name title:(NSString *)title summary:(NSString *)summary parent:(ZWGalleryAlbum *)parent operation:(ZWGalleryOperation *)operation
 {    
     NSString *parentName;
     if (parent != nil && ![parent isKindOfClass:[NSNull class]]) 
@@ -645,14 +771,12 @@
     [theRequest addString:title forName:[self formNameWithName:@"newAlbumTitle"]];
     [theRequest addString:summary forName:[self formNameWithName:@"newAlbumDesc"]];
     
-    currentConnection = [ZWURLConnection connectionWithRequest:theRequest];
-    while ([currentConnection isRunning]) 
-        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    ZWURLConnection *connection = [operation loadRequest:theRequest];
     
-    if ([currentConnection isCancelled]) 
+    if ([connection isCancelled]) 
         return ZW_GALLERY_OPERATION_DID_CANCEL;
     
-    NSData *data = [currentConnection data];
+    NSData *data = [connection data];
     
     if (data == nil) 
         return ZW_GALLERY_COULD_NOT_CONNECT;
@@ -664,8 +788,10 @@
     ZWGalleryRemoteStatusCode status = (ZWGalleryRemoteStatusCode)[[galleryResponse objectForKey:@"statusCode"] intValue];
     
     if (status == GR_STAT_SUCCESS) {
+        pthread_mutex_lock(&galleryOperationLock);
         [lastCreatedAlbumName release];
         lastCreatedAlbumName = [[galleryResponse objectForKey:@"album_name"] copy];
+        pthread_mutex_unlock(&galleryOperationLock);
     }
     
     // TODO: create an actual ZWGalleryAlbum to return?
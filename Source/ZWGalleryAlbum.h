@@ -31,26 +31,26 @@
 #import <Foundation/Foundation.h>
 #import "ZWGallery.h"
 
-@class ZWGalleryItem;
+@class ZWGalleryItem, ZWAlbumTree, ZWGalleryOperation;
 
+// A view of one album in a ZWAlbumTree, which has everything about the album but what an upload needs. 
+// Views are made by their tree; the inits below make a view in a tree of its own, or in the one its 
+// parent is in. Parents can only be set within one tree.
 @interface ZWGalleryAlbum : NSObject {
-    NSString *title;
-    NSString *name;
-    NSString *summary;
+    ZWAlbumTree *tree;
+    unsigned int index;
     
-    ZWGallery *gallery;
-    ZWGalleryAlbum *parent;
-    NSMutableArray *children;    
-    NSMutableArray *items;
-    
-    BOOL canAddItem;
-    BOOL canAddSubAlbum;
+    NSMutableArray *items;      // made when the first item goes up
     
     id delegate;
     
-    BOOL cancelled;
+    ZWGalleryOperation *currentOperation;   // the one -cancelOperation cancels
 }
 
+- (id)initWithTree:(ZWAlbumTree *)newTree index:(unsigned int)newIndex;
+- (ZWAlbumTree *)tree;
+- (unsigned int)index;
+
 - (id)initWithTitle:(NSString *)newTitle name:(NSString *)newName gallery:(ZWGallery *)newGallery;
 + (ZWGalleryAlbum *)albumWithTitle:(NSString *)newTitle name:(NSString *)newName gallery:(ZWGallery *)newGallery;
 
@@ -68,6 +68,9 @@
 
 - (void)setCanAddItem:(BOOL)canAddItem;
 - (BOOL)canAddItem;
+
+// Whether the album or any album under it allows it. The tree works it out for every album at once the 
+// first time it's asked for after a change, so asking again is cheap.
 - (BOOL)canAddItemToAlbumOrSub;
 
 - (void)setCanAddSubAlbum:(BOOL)canAddSubAlbum;
@@ -85,16 +88,22 @@
 - (NSString *)summary;
 - (void)setSummary:(NSString *)newSummary;
 
+// The gallery is the tree's, so setting it sets it for every album in the tree
 - (ZWGallery *)gallery;
 - (void)setGallery:(ZWGallery *)newGallery;
 
 - (void)cancelOperation;
 - (ZWGalleryRemoteStatusCode)addItemSynchronously:(ZWGalleryItem *)item;
 
+// Uploads the item on a thread of its own; see ZWGalleryOperation. Uploads to the same album, or others in
+// the same gallery, can go at once. The delegate still hears about progress, from the upload's thread.
+- (ZWGalleryOperation *)addItem:(ZWGalleryItem *)item target:(id)target action:(SEL)action thread:(NSThread *)thread;
+
 @end
 
 @interface ZWGalleryAlbum (ZWGalleryAlbumDelegate)
 
-- (void)album:(ZWGalleryAlbum *)sender item:(ZWGalleryItem *)item updateBytesSent:(unsigned long)bytes;
+// bytes of total bytes of the request body have gone up
+- (void)album:(ZWGalleryAlbum *)sender item:(ZWGalleryItem *)item updateBytesSent:(unsigned long long)bytes ofTotal:(unsigned long long)total;
 
 @end
@@ -29,17 +29,38 @@
 //
 
 #import "ZWGalleryAlbum.h"
+#import "ZWAlbumTree.h"
 #import "ZWGalleryItem.h"
+#import "ZWGalleryOperation.h"
 #import "ZWMutableURLRequest.h"
+#import "ZWStreamedUploadBody.h"
 
 #import <SystemConfiguration/SystemConfiguration.h>
 
 #define BUFSIZE 1024
 
+// guards every album's current operation and items, which uploads on other threads change
+static pthread_mutex_t albumOperationLock = PTHREAD_MUTEX_INITIALIZER;
+
+@interface ZWGalleryAlbum (PrivateStuff)
+- (void)performAddItem:(ZWGalleryOperation *)operation;
+- (ZWGalleryRemoteStatusCode)doAddItem:(ZWGalleryItem *)item operation:(ZWGalleryOperation *)operation;
+@end
+
 @implementation ZWGalleryAlbum
 
 #pragma mark -
 
+- (id)initWithTree:(ZWAlbumTree *)newTree index:(unsigned int)newIndex
+{
+    self = [super init];
+    if (self) {
+        tree = [newTree retain];
+        index = newIndex;
+    }
+    return self;
+}
+
 - (id)initWithTitle:(NSString*)newTitle name:(NSString*)newName gallery:(ZWGallery*)newGallery {
     return [self initWithTitle:newTitle name:newName summary:nil nestedIn:nil gallery:newGallery];
 }
@@ -48,32 +69,47 @@
     return [[[ZWGalleryAlbum alloc] initWithTitle:newTitle name:newName gallery:newGallery] autorelease];
 }
 
+// The album goes in its parent's tree, or a tree of its own, and the tree's view of it is what's returned
 - (id)initWithTitle:(NSString*)newTitle name:(NSString*)newName summary:(NSString*)newSummary nestedIn:(ZWGalleryAlbum*)newParent gallery:(ZWGallery*)newGallery
 {
-    title = [newTitle retain];
-    name = [newName retain];
-    gallery = [newGallery retain];
-    summary = [newSummary retain];
-    parent = [newParent retain];
-    items = [[NSMutableArray array] retain];
+    ZWAlbumTree *albumTree = newParent ? [newParent tree] : [[[ZWAlbumTree alloc] initWithGallery:newGallery] autorelease];
+    unsigned int albumIndex = [albumTree addAlbumWithTitle:newTitle name:newName summary:newSummary];
     
-    return self;
+    if (newParent) 
+        [albumTree setParent:[newParent index] ofAlbumAtIndex:albumIndex];
+    
+    [self release];
+    return [[albumTree albumAtIndex:albumIndex] retain];
 }
 
 - (ZWGalleryAlbum*)albumWithTitle:(NSString*)newTitle name:(NSString*)newName summary:(NSString*)newSummary nestedIn:(ZWGalleryAlbum*)newParent gallery:(ZWGallery*)newGallery
 {
-    return [[[ZWGalleryAlbum alloc] initWithTitle:newTitle name:newName summary:newSummary nestedIn:parent gallery:newGallery] autorelease];
+    return [[[ZWGalleryAlbum alloc] initWithTitle:newTitle name:newName summary:newSummary nestedIn:[self parent] gallery:newGallery] autorelease];
+}
+
+// The tree hands out this view for as long as there is one, so it has to forget it before the last release
+// rather than in -dealloc, when another thread could already have been handed it again
+- (oneway void)release
+{
+    ZWAlbumTree *albumTree = tree;
+    
+    [albumTree lockAlbums];
+    if ([self retainCount] == 1) {
+        [albumTree forgetAlbumAtIndex:index];
+        [albumTree unlockAlbums];
+        [super release];
+    }
+    else {
+        [super release];
+        [albumTree unlockAlbums];
+    }
 }
 
 - (void)dealloc
 {
-    [title release];
-    [name release];
-    [summary release];
-    [gallery release];
-    [parent release];
-    [children release];
+    [tree release];
     [items release];
+    [currentOperation release];
     
     [super dealloc];
 }
@@ -82,13 +118,22 @@
 
 - (BOOL)isEqual:(id)otherAlbum 
 {
-    return ([gallery isEqual:[otherAlbum gallery]] && [name isEqual:[otherAlbum name]]);
+    return ([[self gallery] isEqual:[otherAlbum gallery]] && [[self name] isEqual:[otherAlbum name]]);
 }
 
 #pragma mark Accessors
 
+- (ZWAlbumTree *)tree {
+    return tree;
+}
+
+- (unsigned int)index {
+    return index;
+}
+
+// Views come and go, so one nobody has given a delegate uses the gallery's
 - (id)delegate {
-    return delegate;
+    return delegate ? delegate : [[self gallery] delegate];
 }
 
 - (void)setDelegate:(id)newDelegate {
@@ -96,139 +141,170 @@
 }
 
 - (NSString*)title {
-    return title;
+    return [tree titleOfAlbumAtIndex:index];
 }
 
 - (void)setTitle:(NSString*)newTitle
 {
-    [newTitle retain];
-    [title release];
-    title = newTitle;
+    [tree setTitle:newTitle ofAlbumAtIndex:index];
 }
 
 - (NSString*)name 
 {
-    return name;
+    return [tree nameOfAlbumAtIndex:index];
 }
 
 - (void)setName:(NSString*)newName
 {
-    [newName retain];
-    [name release];
-    name = newName;
+    [tree setName:newName ofAlbumAtIndex:index];
 }
 
 - (NSString*)summary
 {
-    return summary;
+    return [tree summaryOfAlbumAtIndex:index];
 }
 
 - (void)setSummary:(NSString*)newSummary
 {
-    [newSummary retain];
-    [summary release];
-    summary = newSummary;
+    [tree setSummary:newSummary ofAlbumAtIndex:index];
 }
 
 - (ZWGallery*)gallery
 {
-    return gallery;
+    return [tree gallery];
 }
 
 - (void)setGallery:(ZWGallery*)newGallery
 {
-    [newGallery retain];
-    [gallery release];
-    gallery = newGallery;
+    [tree setGallery:newGallery];
 }
 
 - (void)setParent:(ZWGalleryAlbum*)newParent {
-    [newParent retain];
-    [parent release];
-    parent = newParent;
+    if (newParent && [newParent tree] != tree) {
+        NSLog(@"ZWGalleryAlbum: can't nest %@ in %@, which is in another tree", [self name], [newParent name]);
+        return;
+    }
+    [tree setParent:(newParent ? (int)[newParent index] : ZWAlbumTreeNoAlbum) ofAlbumAtIndex:index];
 }
 
 - (ZWGalleryAlbum*)parent {
-    return parent;
+    int parent = [tree parentOfAlbumAtIndex:index];
+    return (parent == ZWAlbumTreeNoAlbum) ? nil : [tree albumAtIndex:parent];
 }
 
+// The parent is all the tree keeps, so this is the same as setting the child's
 - (void)addChild:(ZWGalleryAlbum*)child {
-    if (children == nil) {
-        children = [[NSMutableArray array] retain];
-    }
-    [children addObject:child];
+    [child setParent:self];
 }
 
 - (NSArray*)children {
-    return children;
+    return [tree childrenOfAlbumAtIndex:index];
 }
 
 - (void)setCanAddItem:(BOOL)newCanAddItem {
-    canAddItem = newCanAddItem;
+    int permissions = [tree permissionsOfAlbumAtIndex:index];
+    [tree setPermissions:(newCanAddItem ? (permissions | ZWAlbumCanAddItem) : (permissions & ~ZWAlbumCanAddItem)) ofAlbumAtIndex:index];
 }
 
 - (BOOL)canAddItem {
-    return canAddItem;
+    return ([tree permissionsOfAlbumAtIndex:index] & ZWAlbumCanAddItem) != 0;
 }
 
 #pragma mark -
 
 - (BOOL)canAddItemToAlbumOrSub {
-    if (canAddItem)
-        return TRUE;
-    if (children == nil) 
-        return FALSE;
-    
-    NSEnumerator *enumerator = [children objectEnumerator];
-    id album;
-    while (album = [enumerator nextObject]) {
-        if ([album canAddItemToAlbumOrSub]) 
-            return TRUE;
-    }
-    return FALSE;
+    return ([tree subtreePermissionsOfAlbumAtIndex:index] & ZWAlbumCanAddItem) != 0;
 }
 
 - (void)setCanAddSubAlbum:(BOOL)newCanAddSubAlbum {
-    canAddSubAlbum = newCanAddSubAlbum;
+    int permissions = [tree permissionsOfAlbumAtIndex:index];
+    [tree setPermissions:(newCanAddSubAlbum ? (permissions | ZWAlbumCanAddSubAlbum) : (permissions & ~ZWAlbumCanAddSubAlbum)) ofAlbumAtIndex:index];
 }
 
 - (BOOL)canAddSubAlbum {
-    return canAddSubAlbum;
+    return ([tree permissionsOfAlbumAtIndex:index] & ZWAlbumCanAddSubAlbum) != 0;
 }
 
 - (BOOL)canAddSubToAlbumOrSub
 {
-    if (canAddSubAlbum)
-        return TRUE;
-    if (children == nil)
-        return FALSE;
-    NSEnumerator *enumerator = [children objectEnumerator];
-    id album;
-    while (album = [enumerator nextObject]) {
-        if ([album canAddSubToAlbumOrSub]) 
-            return TRUE;
-    }
-    return FALSE;
+    return ([tree subtreePermissionsOfAlbumAtIndex:index] & ZWAlbumCanAddSubAlbum) != 0;
 }
 
 - (int)depth {
-    int d = 0;
-    ZWGalleryAlbum* cur_parent = parent;
-    while (cur_parent) {
-        cur_parent = [cur_parent parent];
-        d++;
-    }
-    return d;
+    return [tree depthOfAlbumAtIndex:index];
 }
 
 - (void)cancelOperation
 {
-    cancelled = YES;
+    ZWGalleryOperation *operation;
+    
+    pthread_mutex_lock(&albumOperationLock);
+    operation = [currentOperation retain];
+    pthread_mutex_unlock(&albumOperationLock);
+    
+    [operation cancel];
+    [operation release];
 }
 
 - (ZWGalleryRemoteStatusCode)addItemSynchronously:(ZWGalleryItem *)item 
 {
-    cancelled = NO;
+    NSDictionary *arguments = [NSDictionary dictionaryWithObject:item forKey:@"Item"];
+    ZWGalleryOperation *operation = [[ZWGalleryOperation alloc] initWithPerformer:self 
+                                                                         selector:@selector(performAddItem:) 
+                                                                        arguments:arguments 
+                                                                           target:nil 
+                                                                           action:NULL 
+                                                                           thread:nil];
+    ZWGalleryRemoteStatusCode status;
+    
+    pthread_mutex_lock(&albumOperationLock);
+    [currentOperation release];
+    currentOperation = [operation retain];
+    pthread_mutex_unlock(&albumOperationLock);
+    
+    [operation run];
+    status = [operation status];
+    
+    pthread_mutex_lock(&albumOperationLock);
+    if (currentOperation == operation) {
+        [currentOperation release];
+        currentOperation = nil;
+    }
+    pthread_mutex_unlock(&albumOperationLock);
+    
+    [operation release];
+    return status;
+}
+
+- (ZWGalleryOperation *)addItem:(ZWGalleryItem *)item target:(id)target action:(SEL)action thread:(NSThread *)thread
+{
+    NSDictionary *arguments = [NSDictionary dictionaryWithObject:item forKey:@"Item"];
+    ZWGalleryOperation *operation = [[ZWGalleryOperation alloc] initWithPerformer:self 
+                                                                         selector:@selector(performAddItem:) 
+                                                                        arguments:arguments 
+                                                                           target:target 
+                                                                           action:action 
+                                                                           thread:thread];
+    [operation start];
+    return [operation autorelease];
+}
+
+@end
+
+@implementation ZWGalleryAlbum (PrivateStuff)
+
+- (void)performAddItem:(ZWGalleryOperation *)operation
+{
+    ZWGalleryItem *item = [operation argumentForKey:@"Item"];
+    ZWGalleryRemoteStatusCode status = [self doAddItem:item operation:operation];
+    
+    [operation finishWithStatus:status result:item];
+}
+
+- (ZWGalleryRemoteStatusCode)doAddItem:(ZWGalleryItem *)item operation:(ZWGalleryOperation *)operation
+{
+    ZWGallery *gallery = [self gallery];
+    NSString *name = [self name];
     
     /*
     ZWMutableURLRequest *theRequest = [ZWMutableURLRequest requestWithURL:[gallery fullURL]
@@ -261,9 +337,9 @@
 	NSURL *fullURL = [gallery fullURL];
 	NSString *user = [fullURL user];
 	NSString *password = [fullURL password];
-	NSLog(@"addItemSynchronously: user=%@, password=%@", user, password);
+	NSLog(@"doAddItem: user=%@, password=%@", user, password);
 	if (user != nil) {
-		NSLog(@"addItemSynchronously: adding authentication");
+		NSLog(@"doAddItem: adding authentication");
 		Boolean result = CFHTTPMessageAddAuthentication(messageRef,		// request
 														nil,			// authenticationFailureResponse
 														(CFStringRef)user,
@@ -271,9 +347,9 @@
 														kCFHTTPAuthenticationSchemeBasic,
 														FALSE);			// forProxy
 		if (result) {
-			NSLog(@"addItemSynchronously: added authentication");
+			NSLog(@"doAddItem: added authentication");
 		} else {
-			NSLog(@"addItemSynchronously: failed to add authentication!");
+			NSLog(@"doAddItem: failed to add authentication!");
 		}
 	}
     
@@ -338,14 +414,33 @@
 		[requestData appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"g2_userfile\"; filename=\"%@\"\r\nContent-Type: %@\r\n\r\n", [item filename], [item imageType]] dataUsingEncoding:[gallery sniffedEncoding]]];
 	else
 		[requestData appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"userfile\"; filename=\"%@\"\r\nContent-Type: %@\r\n\r\n", [item filename], [item imageType]] dataUsingEncoding:[gallery sniffedEncoding]]];
-    [requestData appendData:[item data]];
     // closing
-    [requestData appendData:[@"\r\n" dataUsingEncoding:NSASCIIStringEncoding]];
-    [requestData appendData:boundaryData];
-    
-    CFHTTPMessageSetBody(messageRef, (CFDataRef)requestData);
+    NSMutableData *closingData = [NSMutableData dataWithData:[@"\r\n" dataUsingEncoding:NSASCIIStringEncoding]];
+    [closingData appendData:boundaryData];
     
-    CFReadStreamRef readStream = CFReadStreamCreateForHTTPRequest(kCFAllocatorDefault, messageRef);
+    // Files on disk (movies, mostly) are streamed up from there rather than read into memory. The Gallery
+    // protocol has no way to resume an upload, so a failed one starts again from the beginning.
+    ZWStreamedUploadBody *streamedBody = nil;
+    unsigned long long bodyLength;
+    CFReadStreamRef readStream;
+    if ([item dataPath]) {
+        streamedBody = [[ZWStreamedUploadBody alloc] initWithPrefix:requestData filePath:[item dataPath] suffix:closingData];
+        if (streamedBody == nil) {
+            CFRelease(messageRef);
+            return ZW_GALLERY_UNKNOWN_ERROR;
+        }
+        bodyLength = [streamedBody length];
+        CFHTTPMessageSetHeaderFieldValue(messageRef, CFSTR("Content-Length"), (CFStringRef)[NSString stringWithFormat:@"%llu", bodyLength]);
+        readStream = CFReadStreamCreateForStreamedHTTPRequest(kCFAllocatorDefault, messageRef, [streamedBody readStream]);
+        [streamedBody start];
+    }
+    else {
+        [requestData appendData:[item data]];
+        [requestData appendData:closingData];
+        bodyLength = [requestData length];
+        CFHTTPMessageSetBody(messageRef, (CFDataRef)requestData);
+        readStream = CFReadStreamCreateForHTTPRequest(kCFAllocatorDefault, messageRef);
+    }
     // make sure the proxy information is set on the stream
     CFDictionaryRef proxyDict = SCDynamicStoreCopyProxies(NULL);
     CFReadStreamSetProperty(readStream, kCFStreamPropertyHTTPProxy, proxyDict);
@@ -356,9 +451,9 @@
     // TODO: change this from polling to using callbacks (polling was just plain easier...)
     // I have to use CFNetwork so I can get some information on upload progress
     BOOL done = FALSE;
-    unsigned long bytesSentSoFar = 0;
+    unsigned long long bytesSentSoFar = 0;
     NSMutableData *data = [NSMutableData data];
-    while (!done && !cancelled) {
+    while (!done && ![operation isCancelled]) {
         [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
         
         if (CFReadStreamHasBytesAvailable(readStream)) {
@@ -366,6 +461,8 @@
             CFIndex bytesRead = CFReadStreamRead(readStream, buf, BUFSIZE);
             if (bytesRead < 0) {
                 // uh-oh - this returns without releasing our CF objects
+                [streamedBody stop];
+                [streamedBody release];
                 return ZW_GALLERY_UNKNOWN_ERROR;
             } else if (bytesRead == 0) {
                 done = YES;
@@ -379,19 +476,23 @@
         
         // This is why we're using CFStream - we need to find out how much we've uploaded at any given point.
         CFNumberRef bytesWrittenRef = (CFNumberRef)CFReadStreamCopyProperty(readStream, kCFStreamPropertyHTTPRequestBytesWrittenCount);
-        unsigned long bytesWritten = [(NSNumber *)bytesWrittenRef unsignedLongValue];
-        CFRelease(bytesWrittenRef);
+        unsigned long long bytesWritten = [(NSNumber *)bytesWrittenRef unsignedLongLongValue];
+        if (bytesWrittenRef) 
+            CFRelease(bytesWrittenRef);
         
         if (bytesSentSoFar != bytesWritten) {
             bytesSentSoFar = bytesWritten;
-            [delegate album:self item:item updateBytesSent:bytesWritten]; 
+            [[self delegate] album:self item:item updateBytesSent:bytesWritten ofTotal:bodyLength]; 
+            [operation setBytesSent:bytesWritten ofTotal:bodyLength];
         }
     }
     
     CFRelease(messageRef);
     CFRelease(readStream);
+    [streamedBody stop];
+    [streamedBody release];
     
-    if (cancelled)
+    if ([operation isCancelled])
         return ZW_GALLERY_OPERATION_DID_CANCEL;
     
     NSDictionary *galleryResponse = [[self gallery] parseResponseData:data];
@@ -401,7 +502,11 @@
     
     ZWGalleryRemoteStatusCode status = (ZWGalleryRemoteStatusCode)[[galleryResponse objectForKey:@"statusCode"] intValue];
     
+    pthread_mutex_lock(&albumOperationLock);
+    if (items == nil) 
+        items = [[NSMutableArray alloc] init];
     [items addObject:item];
+    pthread_mutex_unlock(&albumOperationLock);
     
     return status;
 }
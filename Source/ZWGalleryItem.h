@@ -38,6 +38,9 @@
 
 @interface ZWGalleryItem : NSObject {
     NSData* data;
+    NSString* dataPath;
+    NSData* thumbnailData;
+    NSData* resizedData;
     NSString* caption;
     NSString* description;
     NSString* filename;
@@ -51,6 +54,18 @@
 - (void)setData:(NSData*)newData;
 - (NSData*)data;
 
+// A file to upload straight from disk instead of data, for movies and anything else too big to hold in memory
+- (void)setDataPath:(NSString*)newDataPath;
+- (NSString*)dataPath;
+
+// Smaller versions of data we made ourselves. The thumbnail is for showing locally; the resize is only 
+// made for galleries that will take it (see -[ZWGallery acceptsClientDerivatives]).
+- (void)setThumbnailData:(NSData*)newThumbnailData;
+- (NSData*)thumbnailData;
+
+- (void)setResizedData:(NSData*)newResizedData;
+- (NSData*)resizedData;
+
 - (void)setCaption:(NSString*)newCaption;
 - (NSString*)caption;
 
@@ -62,6 +77,10 @@
 
 - (void)setImageType:(NSString*)newImageType;
 - (NSString*)imageType;
+- (BOOL)isMovie;
+
+// The MIME type of the file, from what's in it if we know the format, from its extension if not
++ (NSString*)contentTypeForFileAtPath:(NSString*)path;
 
 - (ZWGalleryAlbum*)album;
 
@@ -58,6 +58,42 @@
     return data;
 }
 
+- (void)setDataPath:(NSString*)newDataPath
+{
+    [newDataPath retain];
+    [dataPath release];
+    dataPath = newDataPath;
+}
+
+- (NSString*)dataPath
+{
+    return dataPath;
+}
+
+- (void)setThumbnailData:(NSData*)newThumbnailData
+{
+    [newThumbnailData retain];
+    [thumbnailData release];
+    thumbnailData = newThumbnailData;
+}
+
+- (NSData*)thumbnailData
+{
+    return thumbnailData;
+}
+
+- (void)setResizedData:(NSData*)newResizedData
+{
+    [newResizedData retain];
+    [resizedData release];
+    resizedData = newResizedData;
+}
+
+- (NSData*)resizedData
+{
+    return resizedData;
+}
+
 - (void)setCaption:(NSString*)newCaption
 {
     [newCaption retain];
@@ -106,6 +142,78 @@
     return imageType;
 }
 
+- (BOOL)isMovie
+{
+    return [imageType hasPrefix:@"video/"];
+}
+
++ (NSString*)contentTypeForFileAtPath:(NSString*)path
+{
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
+    NSData *header = [handle readDataOfLength:16];
+    const unsigned char *bytes = [header bytes];
+    NSString *extension = [[path pathExtension] lowercaseString];
+    
+    [handle closeFile];
+    
+    if ([header length] >= 12) {
+        if (bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) 
+            return @"image/jpeg";
+        if (memcmp(bytes, "GIF8", 4) == 0) 
+            return @"image/gif";
+        if (memcmp(bytes, "\x89PNG", 4) == 0) 
+            return @"image/png";
+        if (memcmp(bytes, "II*\0", 4) == 0 || memcmp(bytes, "MM\0*", 4) == 0) {
+            // camera raw files are TIFFs inside, but aren't photos a gallery can show
+            if ([extension isEqualToString:@"tif"] || [extension isEqualToString:@"tiff"]) 
+                return @"image/tiff";
+        }
+        if (bytes[0] == 'B' && bytes[1] == 'M') 
+            return @"image/bmp";
+        
+        // ISO base media files say what they are in the ftyp brand; older QuickTime movies start straight
+        // in with their atoms
+        if (memcmp(bytes + 4, "ftyp", 4) == 0) {
+            if (memcmp(bytes + 8, "qt  ", 4) == 0) 
+                return @"video/quicktime";
+            if (memcmp(bytes + 8, "3gp", 3) == 0) 
+                return @"video/3gpp";
+            if (memcmp(bytes + 8, "M4V", 3) == 0) 
+                return @"video/x-m4v";
+            return @"video/mp4";
+        }
+        if (memcmp(bytes + 4, "moov", 4) == 0 || memcmp(bytes + 4, "mdat", 4) == 0 || 
+            memcmp(bytes + 4, "wide", 4) == 0 || memcmp(bytes + 4, "free", 4) == 0 || memcmp(bytes + 4, "skip", 4) == 0) 
+            return @"video/quicktime";
+        if (memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "AVI ", 4) == 0) 
+            return @"video/x-msvideo";
+        if (bytes[0] == 0 && bytes[1] == 0 && bytes[2] == 1 && (bytes[3] == 0xBA || bytes[3] == 0xB3)) 
+            return @"video/mpeg";
+    }
+    
+    if ([extension isEqualToString:@"gif"]) 
+        return @"image/gif";
+    if ([extension isEqualToString:@"png"]) 
+        return @"image/png";
+    if ([extension isEqualToString:@"tif"] || [extension isEqualToString:@"tiff"]) 
+        return @"image/tiff";
+    if ([extension isEqualToString:@"mov"] || [extension isEqualToString:@"qt"]) 
+        return @"video/quicktime";
+    if ([extension isEqualToString:@"mp4"]) 
+        return @"video/mp4";
+    if ([extension isEqualToString:@"m4v"]) 
+        return @"video/x-m4v";
+    if ([extension isEqualToString:@"3gp"]) 
+        return @"video/3gpp";
+    if ([extension isEqualToString:@"avi"]) 
+        return @"video/x-msvideo";
+    if ([extension isEqualToString:@"mpg"] || [extension isEqualToString:@"mpeg"]) 
+        return @"video/mpeg";
+    
+    // what we've always assumed
+    return @"image/jpeg";
+}
+
 - (ZWGalleryAlbum*)album
 {
     return album;
@@ -114,6 +222,9 @@
 - (void) dealloc
 {
     [data release];
+    [dataPath release];
+    [thumbnailData release];
+    [resizedData release];
     [caption release];
     [description release];
     [filename release];
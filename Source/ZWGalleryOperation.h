@@ -0,0 +1,108 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+#import "ZWGallery.h"
+#include <pthread.h>
+
+@class ZWURLConnection;
+
+// One thing being done with a gallery: logging in, fetching its albums, creating an album or uploading an
+// item. Each has a connection of its own, so any number can run at once and each can be cancelled on its
+// own. ZWGallery and ZWGalleryAlbum hand them out already started, on a thread of their own.
+//
+// When it's done, the target is sent the action, with the operation, on the thread given when it was
+// started. The target is retained until then. Upload progress goes to the progress action, if there is 
+// one, on the same thread; updates that come in while one is still on its way are folded into it. 
+// Messages go by InterThreadMessaging, so the thread has to have been prepared for them and has to run 
+// its run loop. With no thread, nobody's told.
+@interface ZWGalleryOperation : NSObject {
+    id performer;               // the gallery or album doing the work, until it's done
+    SEL selector;
+    NSDictionary *arguments;
+    
+    id target;
+    SEL action;
+    SEL progressAction;
+    NSThread *thread;
+    
+    pthread_mutex_t lock;
+    ZWURLConnection *connection;
+    BOOL cancelled;
+    BOOL finished;
+    BOOL progressPending;
+    unsigned long long bytesSent;
+    unsigned long long bytesTotal;
+    ZWGalleryRemoteStatusCode status;
+    id result;
+}
+
+// The performer is sent the selector with the operation, and ends by sending it -finishWithStatus:result:
+- (id)initWithPerformer:(id)newPerformer 
+               selector:(SEL)newSelector 
+              arguments:(NSDictionary *)newArguments 
+                 target:(id)newTarget 
+                 action:(SEL)newAction 
+                 thread:(NSThread *)newThread;
+
+// On a new thread, or on this one, which returns once it's done
+- (void)start;
+- (void)run;
+
+- (void)cancel;
+- (BOOL)isCancelled;
+- (BOOL)isFinished;
+
+// Progress from before it's set isn't reported
+- (void)setProgressAction:(SEL)newProgressAction;
+
+- (unsigned long long)bytesSent;
+- (unsigned long long)bytesTotal;
+
+// Only meaningful once it's finished. The result is the albums for a fetch, the new album's name for a
+// create, and the item for an upload.
+- (ZWGalleryRemoteStatusCode)status;
+- (id)result;
+
+@end
+
+// For the galleries and albums doing the work
+@interface ZWGalleryOperation (ZWGalleryOperationPerformer)
+
+- (id)argumentForKey:(NSString *)key;
+
+// Loads the request on the calling thread's run loop, and returns once it's done or the operation is
+// cancelled. The connection says which.
+- (ZWURLConnection *)loadRequest:(NSURLRequest *)request;
+
+- (void)setBytesSent:(unsigned long long)sent ofTotal:(unsigned long long)total;
+- (void)finishWithStatus:(ZWGalleryRemoteStatusCode)newStatus result:(id)newResult;
+
+@end
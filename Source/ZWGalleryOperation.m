@@ -0,0 +1,308 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWGalleryOperation.h"
+#import "ZWURLConnection.h"
+#import "InterThreadMessaging.h"
+
+@interface ZWGalleryOperation (PrivateStuff)
+- (void)operationThread:(id)unused;
+- (void)deliverProgress;
+- (void)deliverFinish;
+@end
+
+@implementation ZWGalleryOperation
+
+- (id)initWithPerformer:(id)newPerformer 
+               selector:(SEL)newSelector 
+              arguments:(NSDictionary *)newArguments 
+                 target:(id)newTarget 
+                 action:(SEL)newAction 
+                 thread:(NSThread *)newThread
+{
+    self = [super init];
+    if (self) {
+        performer = [newPerformer retain];
+        selector = newSelector;
+        arguments = [newArguments retain];
+        target = [newTarget retain];    // until it's been told the operation finished
+        action = newAction;
+        thread = [newThread retain];
+        status = ZW_GALLERY_UNKNOWN_ERROR;
+        pthread_mutex_init(&lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [performer release];
+    [arguments release];
+    [target release];
+    [thread release];
+    [connection release];
+    [result release];
+    pthread_mutex_destroy(&lock);
+    [super dealloc];
+}
+
+- (void)start
+{
+    [NSThread detachNewThreadSelector:@selector(operationThread:) toTarget:self withObject:nil];
+}
+
+- (void)run
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    id working;
+    
+    pthread_mutex_lock(&lock);
+    working = [performer retain];
+    pthread_mutex_unlock(&lock);
+    
+    [working performSelector:selector withObject:self];
+    [working release];
+    
+    // does nothing if the performer finished it
+    [self finishWithStatus:ZW_GALLERY_UNKNOWN_ERROR result:nil];
+    
+    [pool release];
+}
+
+- (void)cancel
+{
+    ZWURLConnection *running;
+    
+    pthread_mutex_lock(&lock);
+    cancelled = YES;
+    running = [connection retain];
+    pthread_mutex_unlock(&lock);
+    
+    if ([running isRunning]) 
+        [running cancel];
+    [running release];
+}
+
+- (BOOL)isCancelled
+{
+    BOOL wasCancelled;
+    
+    pthread_mutex_lock(&lock);
+    wasCancelled = cancelled;
+    pthread_mutex_unlock(&lock);
+    
+    return wasCancelled;
+}
+
+- (BOOL)isFinished
+{
+    BOOL wasFinished;
+    
+    pthread_mutex_lock(&lock);
+    wasFinished = finished;
+    pthread_mutex_unlock(&lock);
+    
+    return wasFinished;
+}
+
+- (void)setProgressAction:(SEL)newProgressAction
+{
+    pthread_mutex_lock(&lock);
+    progressAction = newProgressAction;
+    pthread_mutex_unlock(&lock);
+}
+
+- (unsigned long long)bytesSent
+{
+    unsigned long long sent;
+    
+    pthread_mutex_lock(&lock);
+    sent = bytesSent;
+    pthread_mutex_unlock(&lock);
+    
+    return sent;
+}
+
+- (unsigned long long)bytesTotal
+{
+    unsigned long long total;
+    
+    pthread_mutex_lock(&lock);
+    total = bytesTotal;
+    pthread_mutex_unlock(&lock);
+    
+    return total;
+}
+
+- (ZWGalleryRemoteStatusCode)status
+{
+    ZWGalleryRemoteStatusCode finishedStatus;
+    
+    pthread_mutex_lock(&lock);
+    finishedStatus = status;
+    pthread_mutex_unlock(&lock);
+    
+    return finishedStatus;
+}
+
+- (id)result
+{
+    id finishedResult;
+    
+    pthread_mutex_lock(&lock);
+    finishedResult = [[result retain] autorelease];
+    pthread_mutex_unlock(&lock);
+    
+    return finishedResult;
+}
+
+@end
+
+@implementation ZWGalleryOperation (ZWGalleryOperationPerformer)
+
+- (id)argumentForKey:(NSString *)key
+{
+    return [arguments objectForKey:key];
+}
+
+- (ZWURLConnection *)loadRequest:(NSURLRequest *)request
+{
+    ZWURLConnection *newConnection = [ZWURLConnection connectionWithRequest:request];
+    BOOL wasCancelled;
+    
+    // held on to, so a cancel from another thread never finds it gone
+    pthread_mutex_lock(&lock);
+    [newConnection retain];
+    [connection release];
+    connection = newConnection;
+    wasCancelled = cancelled;
+    pthread_mutex_unlock(&lock);
+    
+    // cancelled before there was a connection to cancel
+    if (wasCancelled) 
+        [newConnection cancel];
+    
+    while ([newConnection isRunning]) 
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    
+    return newConnection;
+}
+
+- (void)setBytesSent:(unsigned long long)sent ofTotal:(unsigned long long)total
+{
+    BOOL send;
+    
+    pthread_mutex_lock(&lock);
+    bytesSent = sent;
+    bytesTotal = total;
+    send = (progressAction != NULL && thread != nil && !progressPending);
+    if (send) 
+        progressPending = YES;
+    pthread_mutex_unlock(&lock);
+    
+    if (send) 
+        [self performSelector:@selector(deliverProgress) inThread:thread];
+}
+
+- (void)finishWithStatus:(ZWGalleryRemoteStatusCode)newStatus result:(id)newResult
+{
+    id finishedPerformer, untoldTarget = nil;
+    BOOL tell = (thread != nil && action != NULL);
+    
+    // only the first finish counts, whichever thread it's on
+    pthread_mutex_lock(&lock);
+    if (finished) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    finished = YES;
+    status = (cancelled && newStatus != GR_STAT_SUCCESS) ? ZW_GALLERY_OPERATION_DID_CANCEL : newStatus;
+    result = [newResult retain];
+    finishedPerformer = performer;
+    performer = nil;
+    [connection release];
+    connection = nil;
+    if (!tell) {
+        untoldTarget = target;
+        target = nil;
+    }
+    pthread_mutex_unlock(&lock);
+    
+    [finishedPerformer autorelease];
+    [untoldTarget release];
+    
+    // after any progress already on its way, since messages to a thread arrive in order
+    if (tell) 
+        [self performSelector:@selector(deliverFinish) inThread:thread];
+}
+
+@end
+
+@implementation ZWGalleryOperation (PrivateStuff)
+
+- (void)operationThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    [NSThread prepareForInterThreadMessages];
+    [self run];
+    
+    [pool release];
+}
+
+- (void)deliverProgress
+{
+    SEL deliveredAction;
+    id progressTarget;
+    
+    pthread_mutex_lock(&lock);
+    progressPending = NO;
+    deliveredAction = progressAction;
+    progressTarget = [target retain];
+    pthread_mutex_unlock(&lock);
+    
+    [progressTarget performSelector:deliveredAction withObject:self];
+    [progressTarget release];
+}
+
+- (void)deliverFinish
+{
+    id finishedTarget;
+    
+    pthread_mutex_lock(&lock);
+    finishedTarget = target;
+    target = nil;
+    pthread_mutex_unlock(&lock);
+    
+    [finishedTarget performSelector:action withObject:self];
+    [finishedTarget release];
+}
+
+@end
@@ -0,0 +1,73 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// A separable Lanczos (a = 3) resampler that works a row at a time. Input rows are resampled 
+// horizontally as they arrive and kept in a ring just tall enough for the vertical filter, and each 
+// output row is handed to a callback as soon as all the input it depends on has been seen. Memory use 
+// depends on the output width and the scale factor, never on the input height.
+//
+// With a color transform the filtering is done in linear light: each input row goes through the 
+// transform's tone curves on its way into the horizontal pass, and each output row through the rest of 
+// the transform (to sRGB) on its way out of the vertical pass. Averaging gamma-encoded values instead
+// darkens fine detail and high-contrast edges.
+
+#ifndef ZWIMAGERESAMPLER_H
+#define ZWIMAGERESAMPLER_H
+
+#include "ZWScratchArena.h"
+#include "ZWColorTransform.h"
+
+typedef struct ZWImageResampler ZWImageResampler;
+
+// Called with each finished output row (outputWidth * components bytes). Return 0 to stop.
+typedef int (*ZWImageResamplerRowFunction)(void *context, const unsigned char *row, int y);
+
+// The resampler's buffers come from arena if it isn't NULL
+ZWImageResampler *ZWImageResamplerCreate(int inputWidth, int inputHeight, int outputWidth, int outputHeight, int components, 
+                                         ZWImageResamplerRowFunction rowFunction, void *context, ZWScratchArena *arena);
+void ZWImageResamplerDestroy(ZWImageResampler *resampler);
+
+// Unsharp masking, to win back some of the crispness downscaling costs: each output pixel gets amount
+// times its difference from a Gaussian blur (of radius output pixels) of its neighbours added to it. 
+// Since that's as linear as the resampling, it rides along with the passes we already make instead of
+// being one of its own: vertically it's folded into the filter weights, horizontally it's run along each
+// output row. It's applied along each axis in turn, which is close to (but not quite) a 2-D unsharp 
+// mask. Must be called before the first row, and only once. Returns 0 if there's no memory for it.
+int ZWImageResamplerSetSharpening(ZWImageResampler *resampler, float amount, float radius);
+
+// Resample in linear light and put out sRGB (see above). Must be called before the first row, and the
+// transform has to outlive the resampler. Returns 0 if the transform's components don't match ours or 
+// there's no memory for its buffer.
+int ZWImageResamplerSetColorTransform(ZWImageResampler *resampler, const ZWColorTransform *transform);
+
+// Feed the input rows in order, top to bottom. Returns 0 if the row function asked to stop.
+int ZWImageResamplerPushRow(ZWImageResampler *resampler, const unsigned char *row);
+
+#endif
@@ -0,0 +1,496 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWImageResampler.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LANCZOS_A 3.0
+
+// Sharpening radii are clamped to this many output pixels, and the blur is cut off at 3 radii
+#define MAX_SHARPEN_RADIUS 4
+#define MAX_SHARPEN_TAPS (6 * MAX_SHARPEN_RADIUS + 1)
+
+// The taps for one output pixel (or row): weights[0..count) apply to inputs start..start+count-1
+typedef struct {
+    int start;
+    int count;
+    float *weights;
+} Contribution;
+
+struct ZWImageResampler {
+    ZWScratchArena *arena;
+    int inputWidth, inputHeight;
+    int outputWidth, outputHeight;
+    int components;
+    ZWImageResamplerRowFunction rowFunction;
+    void *context;
+    
+    Contribution *horizontal;
+    Contribution *vertical;
+    float *weightStorage;
+    
+    float *ring;                // horizontally resampled rows, ringSize of them
+    int ringSize;
+    int rowsPushed;
+    int nextOutputRow;
+    
+    float *accumulator;
+    unsigned char *outputRow;
+    
+    const ZWColorTransform *colorTransform;
+    float *linearRow;           // the input row in linear light, when there's a transform
+    
+    int sharpened;
+    float sharpenKernel[MAX_SHARPEN_TAPS];
+    int sharpenReach;
+    float *paddedRow;           // an output row with its edge pixels repeated sharpenReach times either side
+    float *sharpenStorage;      // the sharpened vertical weights
+};
+
+static double lanczos(double x)
+{
+    if (x < 0) 
+        x = -x;
+    if (x < 1e-8) 
+        return 1.0;
+    if (x >= LANCZOS_A) 
+        return 0.0;
+    x *= M_PI;
+    return LANCZOS_A * sin(x) * sin(x / LANCZOS_A) / (x * x);
+}
+
+// When shrinking, the filter is stretched to cover scale input pixels per output pixel so that every
+// input pixel counts. Taps that would fall off the edge are dropped and the rest renormalized.
+static int maxTaps(int inputSize, int outputSize)
+{
+    double scale = (double)inputSize / outputSize;
+    double support = LANCZOS_A * (scale > 1.0 ? scale : 1.0);
+    return (int)ceil(support * 2) + 1;
+}
+
+static void computeContributions(Contribution *contributions, float **storage, int inputSize, int outputSize)
+{
+    double scale = (double)inputSize / outputSize;
+    double filterScale = scale > 1.0 ? scale : 1.0;
+    double support = LANCZOS_A * filterScale;
+    int i, j;
+    
+    for (i = 0; i < outputSize; i++) {
+        Contribution *contribution = &contributions[i];
+        double center = (i + 0.5) * scale;
+        int left = (int)floor(center - support);
+        int right = (int)ceil(center + support);
+        double total = 0.0;
+        
+        if (left < 0) left = 0;
+        if (right > inputSize) right = inputSize;
+        if (right <= left) right = left + 1;
+        
+        contribution->start = left;
+        contribution->count = right - left;
+        contribution->weights = *storage;
+        *storage += contribution->count;
+        
+        for (j = left; j < right; j++) {
+            double weight = lanczos((j + 0.5 - center) / filterScale);
+            contribution->weights[j - left] = (float)weight;
+            total += weight;
+        }
+        
+        if (total != 0.0) {
+            for (j = 0; j < contribution->count; j++) 
+                contribution->weights[j] = (float)(contribution->weights[j] / total);
+        }
+    }
+}
+
+ZWImageResampler *ZWImageResamplerCreate(int inputWidth, int inputHeight, int outputWidth, int outputHeight, int components, 
+                                         ZWImageResamplerRowFunction rowFunction, void *context, ZWScratchArena *arena)
+{
+    ZWImageResampler *resampler;
+    int horizontalTaps, verticalTaps, i;
+    float *storage;
+    
+    if (inputWidth <= 0 || inputHeight <= 0 || outputWidth <= 0 || outputHeight <= 0 || components <= 0) 
+        return NULL;
+    
+    resampler = (ZWImageResampler *)calloc(1, sizeof(ZWImageResampler));
+    if (resampler == NULL) 
+        return NULL;
+    
+    resampler->arena = arena;
+    resampler->inputWidth = inputWidth;
+    resampler->inputHeight = inputHeight;
+    resampler->outputWidth = outputWidth;
+    resampler->outputHeight = outputHeight;
+    resampler->components = components;
+    resampler->rowFunction = rowFunction;
+    resampler->context = context;
+    
+    horizontalTaps = maxTaps(inputWidth, outputWidth);
+    verticalTaps = maxTaps(inputHeight, outputHeight);
+    
+    resampler->horizontal = (Contribution *)ZWScratchAlloc(arena, sizeof(Contribution) * outputWidth);
+    resampler->vertical = (Contribution *)ZWScratchAlloc(arena, sizeof(Contribution) * outputHeight);
+    resampler->weightStorage = (float *)ZWScratchAlloc(arena, sizeof(float) * (outputWidth * horizontalTaps + outputHeight * verticalTaps));
+    
+    // the window for an output row can't span more input rows than this
+    resampler->ringSize = verticalTaps < inputHeight ? verticalTaps : inputHeight;
+    resampler->ring = (float *)ZWScratchAlloc(arena, sizeof(float) * outputWidth * components * resampler->ringSize);
+    resampler->accumulator = (float *)ZWScratchAlloc(arena, sizeof(float) * outputWidth * components);
+    resampler->outputRow = (unsigned char *)ZWScratchAlloc(arena, outputWidth * components);
+    
+    if (!resampler->horizontal || !resampler->vertical || !resampler->weightStorage || 
+        !resampler->ring || !resampler->accumulator || !resampler->outputRow) {
+        ZWImageResamplerDestroy(resampler);
+        return NULL;
+    }
+    
+    storage = resampler->weightStorage;
+    computeContributions(resampler->horizontal, &storage, inputWidth, outputWidth);
+    computeContributions(resampler->vertical, &storage, inputHeight, outputHeight);
+    
+    // the clamping at the edges can only make windows shorter, but be sure
+    for (i = 0; i < outputHeight; i++) {
+        if (resampler->vertical[i].count > resampler->ringSize) 
+            resampler->vertical[i].count = resampler->ringSize;
+    }
+    
+    return resampler;
+}
+
+void ZWImageResamplerDestroy(ZWImageResampler *resampler)
+{
+    if (resampler == NULL) 
+        return;
+    
+    ZWScratchFree(resampler->arena, resampler->horizontal);
+    ZWScratchFree(resampler->arena, resampler->vertical);
+    ZWScratchFree(resampler->arena, resampler->weightStorage);
+    ZWScratchFree(resampler->arena, resampler->ring);
+    ZWScratchFree(resampler->arena, resampler->accumulator);
+    ZWScratchFree(resampler->arena, resampler->outputRow);
+    ZWScratchFree(resampler->arena, resampler->linearRow);
+    ZWScratchFree(resampler->arena, resampler->sharpenStorage);
+    ZWScratchFree(resampler->arena, resampler->paddedRow);
+    free(resampler);
+}
+
+// The unsharp mask as a filter on output pixels: 1 + amount at the center, less amount times a Gaussian.
+// Returns how far it reaches either side of the center.
+static int makeSharpeningKernel(float *kernel, float amount, float radius)
+{
+    int reach, k;
+    double total = 0.0;
+    
+    if (radius > MAX_SHARPEN_RADIUS) 
+        radius = MAX_SHARPEN_RADIUS;
+    reach = (int)ceil(3.0 * radius);
+    
+    for (k = -reach; k <= reach; k++) {
+        kernel[k + reach] = (float)exp(-(double)k * k / (2.0 * radius * radius));
+        total += kernel[k + reach];
+    }
+    for (k = -reach; k <= reach; k++) 
+        kernel[k + reach] = (float)(-amount * kernel[k + reach] / total);
+    kernel[reach] += 1.0f + amount;
+    
+    return reach;
+}
+
+// The inputs reached by output pixel i's contribution once it's been spread over its neighbours
+static void sharpenedSpan(const Contribution *contributions, int outputSize, int i, int reach, int *start, int *end)
+{
+    int k;
+    
+    *start = contributions[i].start;
+    *end = contributions[i].start + contributions[i].count;
+    for (k = -reach; k <= reach; k++) {
+        int neighbour = i + k < 0 ? 0 : i + k >= outputSize ? outputSize - 1 : i + k;
+        const Contribution *contribution = &contributions[neighbour];
+        
+        if (contribution->start < *start) 
+            *start = contribution->start;
+        if (contribution->start + contribution->count > *end) 
+            *end = contribution->start + contribution->count;
+    }
+}
+
+// Makes each of sharpened the kernel-weighted sum of its neighbours in contributions, repeating the 
+// edge pixels past the ends
+static void sharpenContributions(Contribution *sharpened, float **storage, const Contribution *contributions, int outputSize, const float *kernel, int reach)
+{
+    int i, j, k, start, end;
+    
+    for (i = 0; i < outputSize; i++) {
+        sharpenedSpan(contributions, outputSize, i, reach, &start, &end);
+        sharpened[i].start = start;
+        sharpened[i].count = end - start;
+        sharpened[i].weights = *storage;
+        *storage += end - start;
+        memset(sharpened[i].weights, 0, sizeof(float) * (end - start));
+        
+        for (k = -reach; k <= reach; k++) {
+            int neighbour = i + k < 0 ? 0 : i + k >= outputSize ? outputSize - 1 : i + k;
+            const Contribution *contribution = &contributions[neighbour];
+            float *weights = sharpened[i].weights + (contribution->start - start);
+            
+            for (j = 0; j < contribution->count; j++) 
+                weights[j] += kernel[k + reach] * contribution->weights[j];
+        }
+    }
+}
+
+// Vertically the unsharp mask is folded into the weights, which only lengthens the vertical pass, whose
+// cost doesn't grow with the scale factor. Folding it into the horizontal weights too would add taps to 
+// every input row, so horizontally it's applied to each output row instead (see emitRow).
+int ZWImageResamplerSetSharpening(ZWImageResampler *resampler, float amount, float radius)
+{
+    Contribution *vertical;
+    float *weightStorage, *storage, *ring = NULL, *paddedRow;
+    int reach, i, start, end, ringSize = 0;
+    size_t weights = 0;
+    
+    if (resampler->rowsPushed > 0 || resampler->sharpened) 
+        return 0;
+    if (amount <= 0.0f || radius <= 0.0f) 
+        return 1;
+    
+    reach = makeSharpeningKernel(resampler->sharpenKernel, amount, radius);
+    
+    for (i = 0; i < resampler->outputHeight; i++) {
+        sharpenedSpan(resampler->vertical, resampler->outputHeight, i, reach, &start, &end);
+        weights += end - start;
+        if (end - start > ringSize) 
+            ringSize = end - start;
+    }
+    
+    vertical = (Contribution *)ZWScratchAlloc(resampler->arena, sizeof(Contribution) * resampler->outputHeight);
+    weightStorage = (float *)ZWScratchAlloc(resampler->arena, sizeof(float) * weights);
+    paddedRow = (float *)ZWScratchAlloc(resampler->arena, sizeof(float) * (resampler->outputWidth + 2 * reach) * resampler->components);
+    if (ringSize > resampler->ringSize) 
+        ring = (float *)ZWScratchAlloc(resampler->arena, sizeof(float) * resampler->outputWidth * resampler->components * ringSize);
+    
+    if (!vertical || !weightStorage || !paddedRow || (ringSize > resampler->ringSize && !ring)) {
+        ZWScratchFree(resampler->arena, vertical);
+        ZWScratchFree(resampler->arena, weightStorage);
+        ZWScratchFree(resampler->arena, paddedRow);
+        ZWScratchFree(resampler->arena, ring);
+        return 0;
+    }
+    
+    storage = weightStorage;
+    sharpenContributions(vertical, &storage, resampler->vertical, resampler->outputHeight, resampler->sharpenKernel, reach);
+    
+    // The horizontal weights live in the same block as the old vertical ones, so that stays
+    ZWScratchFree(resampler->arena, resampler->vertical);
+    resampler->vertical = vertical;
+    resampler->sharpenStorage = weightStorage;
+    resampler->paddedRow = paddedRow;
+    resampler->sharpenReach = reach;
+    if (ring) {
+        ZWScratchFree(resampler->arena, resampler->ring);
+        resampler->ring = ring;
+        resampler->ringSize = ringSize;
+    }
+    resampler->sharpened = 1;
+    
+    return 1;
+}
+
+int ZWImageResamplerSetColorTransform(ZWImageResampler *resampler, const ZWColorTransform *transform)
+{
+    if (resampler->rowsPushed > 0 || ZWColorTransformGetComponents(transform) != resampler->components) 
+        return 0;
+    
+    if (resampler->linearRow == NULL) {
+        resampler->linearRow = (float *)ZWScratchAlloc(resampler->arena, sizeof(float) * resampler->inputWidth * resampler->components);
+        if (resampler->linearRow == NULL) 
+            return 0;
+    }
+    resampler->colorTransform = transform;
+    return 1;
+}
+
+static void resampleRowHorizontally(ZWImageResampler *resampler, const unsigned char *row, float *out)
+{
+    int x, i, c, components = resampler->components;
+    
+    for (x = 0; x < resampler->outputWidth; x++) {
+        const Contribution *contribution = &resampler->horizontal[x];
+        const unsigned char *in = row + contribution->start * components;
+        
+        if (components == 3) {
+            float r = 0, g = 0, b = 0;
+            for (i = 0; i < contribution->count; i++) {
+                float weight = contribution->weights[i];
+                r += in[0] * weight;
+                g += in[1] * weight;
+                b += in[2] * weight;
+                in += 3;
+            }
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+        }
+        else {
+            for (c = 0; c < components; c++) {
+                float sum = 0;
+                for (i = 0; i < contribution->count; i++) 
+                    sum += in[i * components + c] * contribution->weights[i];
+                out[c] = sum;
+            }
+        }
+        out += components;
+    }
+}
+
+// The same again for a row the color transform has taken to linear light
+static void resampleLinearRowHorizontally(ZWImageResampler *resampler, const float *row, float *out)
+{
+    int x, i, c, components = resampler->components;
+    
+    for (x = 0; x < resampler->outputWidth; x++) {
+        const Contribution *contribution = &resampler->horizontal[x];
+        const float *in = row + contribution->start * components;
+        
+        if (components == 3) {
+            float r = 0, g = 0, b = 0;
+            for (i = 0; i < contribution->count; i++) {
+                float weight = contribution->weights[i];
+                r += in[0] * weight;
+                g += in[1] * weight;
+                b += in[2] * weight;
+                in += 3;
+            }
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+        }
+        else {
+            for (c = 0; c < components; c++) {
+                float sum = 0;
+                for (i = 0; i < contribution->count; i++) 
+                    sum += in[i * components + c] * contribution->weights[i];
+                out[c] = sum;
+            }
+        }
+        out += components;
+    }
+}
+
+// Runs the sharpening kernel along an output row in place. Each tap is a multiply-add over the whole 
+// (padded) row, so like the vertical pass it's all straight runs the compiler can vectorize.
+static void sharpenRowHorizontally(ZWImageResampler *resampler, float *row)
+{
+    int components = resampler->components, reach = resampler->sharpenReach;
+    int rowLength = resampler->outputWidth * components;
+    float *padded = resampler->paddedRow;
+    int i, k;
+    
+    for (i = 0; i < reach; i++) {
+        memcpy(padded + i * components, row, sizeof(float) * components);
+        memcpy(padded + (reach + resampler->outputWidth + i) * components, row + rowLength - components, sizeof(float) * components);
+    }
+    memcpy(padded + reach * components, row, sizeof(float) * rowLength);
+    
+    memset(row, 0, sizeof(float) * rowLength);
+    for (k = 0; k <= 2 * reach; k++) {
+        const float *in = padded + k * components;
+        float weight = resampler->sharpenKernel[k];
+        for (i = 0; i < rowLength; i++) 
+            row[i] += in[i] * weight;
+    }
+}
+
+static int emitRow(ZWImageResampler *resampler, int y)
+{
+    const Contribution *contribution = &resampler->vertical[y];
+    int rowLength = resampler->outputWidth * resampler->components;
+    float *accumulator = resampler->accumulator;
+    int i, x;
+    
+    memset(accumulator, 0, sizeof(float) * rowLength);
+    for (i = 0; i < contribution->count; i++) {
+        const float *in = resampler->ring + ((contribution->start + i) % resampler->ringSize) * rowLength;
+        float weight = contribution->weights[i];
+        for (x = 0; x < rowLength; x++) 
+            accumulator[x] += in[x] * weight;
+    }
+    
+    if (resampler->sharpened) 
+        sharpenRowHorizontally(resampler, accumulator);
+    
+    if (resampler->colorTransform) {
+        ZWColorTransformToSRGB(resampler->colorTransform, accumulator, resampler->outputRow, resampler->outputWidth);
+        return resampler->rowFunction(resampler->context, resampler->outputRow, y);
+    }
+    
+    // Lanczos rings a little past black and white
+    for (x = 0; x < rowLength; x++) {
+        int value = (int)(accumulator[x] + 0.5f);
+        resampler->outputRow[x] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+    
+    return resampler->rowFunction(resampler->context, resampler->outputRow, y);
+}
+
+int ZWImageResamplerPushRow(ZWImageResampler *resampler, const unsigned char *row)
+{
+    int rowLength = resampler->outputWidth * resampler->components;
+    float *out = resampler->ring + (resampler->rowsPushed % resampler->ringSize) * rowLength;
+    
+    if (resampler->rowsPushed >= resampler->inputHeight) 
+        return 1;
+    
+    if (resampler->colorTransform) {
+        ZWColorTransformToLinear(resampler->colorTransform, row, resampler->linearRow, resampler->inputWidth);
+        resampleLinearRowHorizontally(resampler, resampler->linearRow, out);
+    }
+    else {
+        resampleRowHorizontally(resampler, row, out);
+    }
+    resampler->rowsPushed++;
+    
+    // send out every row whose window is now complete
+    while (resampler->nextOutputRow < resampler->outputHeight) {
+        const Contribution *contribution = &resampler->vertical[resampler->nextOutputRow];
+        if (contribution->start + contribution->count > resampler->rowsPushed) 
+            break;
+        if (!emitRow(resampler, resampler->nextOutputRow)) 
+            return 0;
+        resampler->nextOutputRow++;
+    }
+    
+    return 1;
+}
@@ -0,0 +1,60 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+
+// Picks what to resize a photo from. iPhoto keeps smaller renditions of every photo on disk (the 
+// thumbnail, and the previews it shows in the main window), and for a small export any of those that's
+// big enough is a far cheaper source than a multi-megabyte original. Candidates are checked by reading 
+// just their headers: they have to be at least as big as the scaled photo, have the original's aspect ratio,
+// and be newer than the original (an older one is left over from before an edit).
+@interface ZWImageSourceSelector : NSObject {
+    unsigned int renditionsUsed;
+    unsigned int originalsUsed;
+}
+
+// Returns the path of the smallest rendition that can stand in for the original when scaling it to fit
+// size, or originalPath if there isn't one. thumbnailPath (from iPhoto) and originalSize are optional.
+- (NSString *)sourcePathForOriginal:(NSString *)originalPath originalSize:(NSSize)originalSize thumbnailPath:(NSString *)thumbnailPath scaledToFit:(NSSize)size;
+
+// Photos scaled from a rendition have lost the original's EXIF. This puts it back: returns jpegData with
+// the original's EXIF segment added (its orientation reset, since renditions are already upright), or 
+// jpegData itself if the original has none or jpegData already has its own. Only the original's header 
+// is read.
++ (NSData *)JPEGData:(NSData *)jpegData byAddingEXIFFromImageAtPath:(NSString *)originalPath;
+
+// Reads just enough of an image file to find its pixel dimensions. Handles JPEG and PNG.
++ (BOOL)getDimensions:(NSSize *)size ofImageAtPath:(NSString *)path;
+
+- (void)resetStatistics;
+- (unsigned int)renditionsUsed;
+- (unsigned int)originalsUsed;
+
+@end
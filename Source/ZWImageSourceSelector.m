@@ -0,0 +1,236 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWImageSourceSelector.h"
+#import "ImageResizer.h"
+#import "ZWJPEGCommon.h"
+
+#include <math.h>
+
+// Enough for the headers of nearly every JPEG; ones with a big EXIF thumbnail or ICC profile get a second, longer read
+#define SHORT_HEADER_LENGTH (64 * 1024)
+#define LONG_HEADER_LENGTH (1024 * 1024)
+
+// Renditions are rounded to whole pixels, so allow this much slop when comparing aspect ratios
+#define ASPECT_TOLERANCE_PIXELS 1.5
+
+static NSData *readHeader(NSString *path, unsigned int length)
+{
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
+    NSData *header = [handle readDataOfLength:length];
+    
+    [handle closeFile];
+    return header;
+}
+
+static BOOL hasAspectOf(NSSize size, NSSize reference)
+{
+    double expectedHeight = size.width * reference.height / reference.width;
+    return fabs(expectedHeight - size.height) <= ASPECT_TOLERANCE_PIXELS;
+}
+
+@interface ZWImageSourceSelector (PrivateStuff)
+- (NSArray *)candidatePathsForOriginal:(NSString *)originalPath thumbnailPath:(NSString *)thumbnailPath;
+@end
+
+@implementation ZWImageSourceSelector
+
++ (BOOL)getDimensions:(NSSize *)size ofImageAtPath:(NSString *)path
+{
+    NSData *header = readHeader(path, SHORT_HEADER_LENGTH);
+    const unsigned char *bytes = [header bytes];
+    unsigned int length = [header length];
+    ZWJPEGInfo info;
+    
+    // PNG: the IHDR chunk always comes first
+    if (length >= 24 && memcmp(bytes, "\211PNG\r\n\032\n", 8) == 0 && memcmp(bytes + 12, "IHDR", 4) == 0) {
+        size->width = (bytes[16] << 24) | (bytes[17] << 16) | (bytes[18] << 8) | bytes[19];
+        size->height = (bytes[20] << 24) | (bytes[21] << 16) | (bytes[22] << 8) | bytes[23];
+        return (size->width > 0 && size->height > 0);
+    }
+    
+    if (!ZWJPEGGetInfo(bytes, length, &info)) {
+        if (length < SHORT_HEADER_LENGTH) 
+            return NO;
+        header = readHeader(path, LONG_HEADER_LENGTH);
+        if (!ZWJPEGGetInfo([header bytes], [header length], &info)) 
+            return NO;
+    }
+    
+    size->width = info.width;
+    size->height = info.height;
+    return YES;
+}
+
++ (NSData *)JPEGData:(NSData *)jpegData byAddingEXIFFromImageAtPath:(NSString *)originalPath
+{
+    const unsigned char *jpeg = [jpegData bytes];
+    ZWJPEGSegment segment;
+    size_t position = 2, insertAt = 2;
+    
+    if (ZWJPEGFindSegment(jpeg, [jpegData length], ZWJPEG_APP1, "Exif\0\0", 6, &segment)) 
+        return jpegData;
+    
+    // EXIF has to fit in one (64K) segment and comes first, so this is plenty
+    NSData *header = readHeader(originalPath, SHORT_HEADER_LENGTH * 2);
+    if (!ZWJPEGFindSegment([header bytes], [header length], ZWJPEG_APP1, "Exif\0\0", 6, &segment)) 
+        return jpegData;
+    
+    NSMutableData *exif = [NSMutableData dataWithBytes:segment.data length:segment.length];
+    ZWJPEGExifOrientation([exif mutableBytes], [exif length], 1);
+    
+    // after SOI and the JFIF header, which has to come first
+    while (ZWJPEGNextSegment(jpeg, [jpegData length], &position, &segment) && segment.marker == ZWJPEG_APP0) 
+        insertAt = position;
+    
+    unsigned char marker[4] = { 0xFF, ZWJPEG_APP1, ([exif length] + 2) >> 8, ([exif length] + 2) & 0xFF };
+    NSMutableData *result = [NSMutableData dataWithCapacity:[jpegData length] + [exif length] + 4];
+    [result appendBytes:jpeg length:insertAt];
+    [result appendBytes:marker length:4];
+    [result appendData:exif];
+    [result appendBytes:jpeg + insertAt length:[jpegData length] - insertAt];
+    
+    return result;
+}
+
+- (NSString *)sourcePathForOriginal:(NSString *)originalPath originalSize:(NSSize)originalSize thumbnailPath:(NSString *)thumbnailPath scaledToFit:(NSSize)size
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSDate *originalDate = [[fileManager fileAttributesAtPath:originalPath traverseLink:YES] fileModificationDate];
+    NSString *bestPath = nil;
+    double bestPixels = 0;
+    
+    if (originalDate == nil || 
+        ((originalSize.width <= 0 || originalSize.height <= 0) && ![ZWImageSourceSelector getDimensions:&originalSize ofImageAtPath:originalPath])) {
+        originalsUsed++;
+        return originalPath;
+    }
+    
+    NSSize needed = getGoodSize(originalSize, size);
+    NSSize rotatedOriginal = NSMakeSize(originalSize.height, originalSize.width);
+    NSEnumerator *enumerator = [[self candidatePathsForOriginal:originalPath thumbnailPath:thumbnailPath] objectEnumerator];
+    NSString *candidate;
+    
+    while ((candidate = [enumerator nextObject])) {
+        NSDate *candidateDate = [[fileManager fileAttributesAtPath:candidate traverseLink:YES] fileModificationDate];
+        NSSize candidateSize;
+        
+        // an older rendition is from before the photo was last edited
+        if (candidateDate == nil || [candidateDate compare:originalDate] == NSOrderedAscending) 
+            continue;
+        if (![ZWImageSourceSelector getDimensions:&candidateSize ofImageAtPath:candidate]) 
+            continue;
+        
+        // Renditions are already rotated upright, which the original may not be
+        if (hasAspectOf(candidateSize, originalSize)) {
+            if (candidateSize.width < needed.width || candidateSize.height < needed.height) 
+                continue;
+        }
+        else if (hasAspectOf(candidateSize, rotatedOriginal)) {
+            if (candidateSize.width < needed.height || candidateSize.height < needed.width) 
+                continue;
+        }
+        else {
+            continue;   // cropped since, or not a rendition of this photo at all
+        }
+        
+        if (bestPath == nil || candidateSize.width * candidateSize.height < bestPixels) {
+            bestPath = candidate;
+            bestPixels = candidateSize.width * candidateSize.height;
+        }
+    }
+    
+    if (bestPath) {
+        renditionsUsed++;
+        return bestPath;
+    }
+    
+    originalsUsed++;
+    return originalPath;
+}
+
+- (void)resetStatistics
+{
+    renditionsUsed = 0;
+    originalsUsed = 0;
+}
+
+- (unsigned int)renditionsUsed
+{
+    return renditionsUsed;
+}
+
+- (unsigned int)originalsUsed
+{
+    return originalsUsed;
+}
+
+@end
+
+@implementation ZWImageSourceSelector (PrivateStuff)
+
+// iPhoto mirrors the Originals (or Modified) folder structure in the folders it keeps its previews in, 
+// which have been called different things in different versions
+- (NSArray *)candidatePathsForOriginal:(NSString *)originalPath thumbnailPath:(NSString *)thumbnailPath
+{
+    NSMutableArray *candidates = [NSMutableArray array];
+    NSArray *components = [originalPath pathComponents];
+    int i;
+    
+    if (thumbnailPath && ![thumbnailPath isEqualToString:originalPath]) 
+        [candidates addObject:thumbnailPath];
+    
+    for (i = [components count] - 1; i >= 0; i--) {
+        NSString *component = [components objectAtIndex:i];
+        if ([component isEqualToString:@"Originals"] || [component isEqualToString:@"Modified"]) 
+            break;
+    }
+    if (i < 0) 
+        return candidates;
+    
+    NSString *libraryPath = [NSString pathWithComponents:[components subarrayWithRange:NSMakeRange(0, i)]];
+    NSString *relativePath = [NSString pathWithComponents:[components subarrayWithRange:NSMakeRange(i + 1, [components count] - i - 1)]];
+    NSArray *previewFolders = [NSArray arrayWithObjects:@"Previews", @"Data", @"Data.noindex", nil];
+    NSEnumerator *enumerator = [previewFolders objectEnumerator];
+    NSString *folder;
+    
+    while ((folder = [enumerator nextObject])) {
+        NSString *previewPath = [[libraryPath stringByAppendingPathComponent:folder] stringByAppendingPathComponent:relativePath];
+        [candidates addObject:previewPath];
+        
+        // previews are always JPEGs, whatever the original was
+        if ([[previewPath pathExtension] caseInsensitiveCompare:@"jpg"] != NSOrderedSame) 
+            [candidates addObject:[[previewPath stringByDeletingPathExtension] stringByAppendingPathExtension:@"jpg"]];
+    }
+    
+    return candidates;
+}
+
+@end
@@ -0,0 +1,127 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Bits and pieces shared by our JPEG decoder and encoder. This is all plain C so it can be used from
+// any thread without an autorelease pool.
+
+#ifndef ZWJPEGCOMMON_H
+#define ZWJPEGCOMMON_H
+
+#include <stddef.h>
+
+enum {
+    ZWJPEG_SOF0 = 0xC0,     // baseline
+    ZWJPEG_SOF1 = 0xC1,     // extended sequential, Huffman
+    ZWJPEG_SOF2 = 0xC2,     // progressive, Huffman
+    ZWJPEG_DHT  = 0xC4,
+    ZWJPEG_RST0 = 0xD0,
+    ZWJPEG_RST7 = 0xD7,
+    ZWJPEG_SOI  = 0xD8,
+    ZWJPEG_EOI  = 0xD9,
+    ZWJPEG_SOS  = 0xDA,
+    ZWJPEG_DQT  = 0xDB,
+    ZWJPEG_DRI  = 0xDD,
+    ZWJPEG_APP0 = 0xE0,
+    ZWJPEG_APP1 = 0xE1,
+    ZWJPEG_APP2 = 0xE2,
+    ZWJPEG_APP14 = 0xEE,
+    ZWJPEG_COM  = 0xFE
+};
+
+// A marker segment. For markers without a payload (SOI, EOI, RSTn) data is NULL and length is 0.
+typedef struct {
+    int marker;
+    size_t offset;                  // of the 0xFF that starts the marker
+    const unsigned char *data;      // the payload, after the length field
+    size_t length;                  // of the payload
+} ZWJPEGSegment;
+
+// What we can learn from the headers without decoding anything
+typedef struct {
+    int width;
+    int height;
+    int components;
+    int progressive;
+    int baseline;                   // sequential Huffman, 8 bit: something our decoder can handle
+} ZWJPEGInfo;
+
+// zigzag[i] is the natural (row-major) index of the i'th coefficient in zigzag order
+extern const unsigned char ZWJPEGZigzag[64];
+
+// The example tables from Annex K of the spec, in natural order (quantization) and in DHT form (Huffman)
+extern const unsigned char ZWJPEGStdLuminanceQuant[64];
+extern const unsigned char ZWJPEGStdChrominanceQuant[64];
+extern const unsigned char ZWJPEGStdDCLuminanceBits[17];
+extern const unsigned char ZWJPEGStdDCLuminanceValues[12];
+extern const unsigned char ZWJPEGStdDCChrominanceBits[17];
+extern const unsigned char ZWJPEGStdDCChrominanceValues[12];
+extern const unsigned char ZWJPEGStdACLuminanceBits[17];
+extern const unsigned char ZWJPEGStdACLuminanceValues[162];
+extern const unsigned char ZWJPEGStdACChrominanceBits[17];
+extern const unsigned char ZWJPEGStdACChrominanceValues[162];
+
+// The AAN DCT scale factors: cos(k*PI/16) * sqrt(2) for k > 0, 1 for k = 0
+extern const double ZWJPEGAANScaleFactor[8];
+
+// Reads the marker segment at *position (skipping any fill bytes) and advances past it. Returns 0 at the
+// end of the data or if the data doesn't look like a marker.
+int ZWJPEGNextSegment(const unsigned char *jpeg, size_t length, size_t *position, ZWJPEGSegment *segment);
+
+// Reads the headers up to the first SOF. Returns 0 if this isn't a JPEG we can make sense of.
+int ZWJPEGGetInfo(const unsigned char *jpeg, size_t length, ZWJPEGInfo *info);
+
+// Finds the first segment with the given marker before the image data whose payload starts with 
+// prefix (which may be NULL). Returns 0 if there isn't one.
+int ZWJPEGFindSegment(const unsigned char *jpeg, size_t length, int marker, const char *prefix, size_t prefixLength, ZWJPEGSegment *segment);
+
+// Puts together the ICC profile carried in the APP2 segment(s) before the image data: big profiles are
+// split across several, numbered so they can be put back in order. If profile isn't NULL the profile is
+// copied there, which needs room for the length returned. Returns 0 if there isn't a complete profile.
+size_t ZWJPEGCopyICCProfile(const unsigned char *jpeg, size_t length, unsigned char *profile);
+
+// Finds the orientation tag in IFD0 of an APP1 Exif payload (starting with "Exif\0\0"). Returns its 
+// value (1-8), or 0 if there isn't one. If newOrientation is non-zero, the tag is changed to it in place.
+int ZWJPEGExifOrientation(unsigned char *exif, size_t length, int newOrientation);
+
+// Finds the JPEG thumbnail most cameras put in IFD1 of an APP1 Exif payload. Sets its offset (from the
+// start of exif) and length and returns 1, or returns 0 if there isn't one.
+int ZWJPEGExifThumbnail(const unsigned char *exif, size_t length, size_t *thumbnailOffset, size_t *thumbnailLength);
+
+// Removes the GPS IFD from an APP1 Exif payload in place: its entry comes out of IFD0 and its tags and 
+// values are zeroed. Nothing moves, so the payload stays the same length. Returns 0 if there wasn't one.
+int ZWJPEGExifRemoveGPS(unsigned char *exif, size_t length);
+
+// Writes a copy of an APP1 Exif payload to output (which must have room for length bytes) with the 
+// maker note and/or GPS IFD left out and everything else packed up behind them, so unlike the above it
+// gets smaller. Maker notes are private formats that often contain offsets of their own, which is why we 
+// don't try to move them. Returns the new length, or 0 if the Exif couldn't be rebuilt.
+size_t ZWJPEGExifRebuild(const unsigned char *exif, size_t length, int dropMakerNote, int dropGPS, unsigned char *output);
+
+#endif
@@ -0,0 +1,585 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWJPEGCommon.h"
+
+#include <string.h>
+
+const unsigned char ZWJPEGZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+const unsigned char ZWJPEGStdLuminanceQuant[64] = {
+    16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99
+};
+
+const unsigned char ZWJPEGStdChrominanceQuant[64] = {
+    17,  18,  24,  47,  99,  99,  99,  99,
+    18,  21,  26,  66,  99,  99,  99,  99,
+    24,  26,  56,  99,  99,  99,  99,  99,
+    47,  66,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99
+};
+
+// bits[0] is unused so that bits[n] is the number of codes of length n
+const unsigned char ZWJPEGStdDCLuminanceBits[17] = { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const unsigned char ZWJPEGStdDCLuminanceValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const unsigned char ZWJPEGStdDCChrominanceBits[17] = { 0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const unsigned char ZWJPEGStdDCChrominanceValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const unsigned char ZWJPEGStdACLuminanceBits[17] = { 0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const unsigned char ZWJPEGStdACLuminanceValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const unsigned char ZWJPEGStdACChrominanceBits[17] = { 0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const unsigned char ZWJPEGStdACChrominanceValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const double ZWJPEGAANScaleFactor[8] = {
+    1.0, 1.387039845, 1.306562965, 1.175875602,
+    1.0, 0.785694958, 0.541196100, 0.275899379
+};
+
+int ZWJPEGNextSegment(const unsigned char *jpeg, size_t length, size_t *position, ZWJPEGSegment *segment)
+{
+    size_t pos = *position;
+    
+    if (pos + 1 >= length || jpeg[pos] != 0xFF) 
+        return 0;
+    
+    // any number of 0xFF fill bytes may precede a marker
+    while (pos + 1 < length && jpeg[pos + 1] == 0xFF) 
+        pos++;
+    if (pos + 1 >= length) 
+        return 0;
+    
+    segment->offset = pos;
+    segment->marker = jpeg[pos + 1];
+    pos += 2;
+    
+    if (segment->marker == ZWJPEG_SOI || segment->marker == ZWJPEG_EOI || segment->marker == 0x01 ||
+        (segment->marker >= ZWJPEG_RST0 && segment->marker <= ZWJPEG_RST7)) {
+        segment->data = NULL;
+        segment->length = 0;
+    }
+    else {
+        size_t segmentLength;
+        
+        if (pos + 2 > length) 
+            return 0;
+        segmentLength = (jpeg[pos] << 8) | jpeg[pos + 1];
+        if (segmentLength < 2 || pos + segmentLength > length) 
+            return 0;
+        
+        segment->data = jpeg + pos + 2;
+        segment->length = segmentLength - 2;
+        pos += segmentLength;
+    }
+    
+    *position = pos;
+    return 1;
+}
+
+int ZWJPEGFindSegment(const unsigned char *jpeg, size_t length, int marker, const char *prefix, size_t prefixLength, ZWJPEGSegment *segment)
+{
+    size_t position = 0;
+    
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != ZWJPEG_SOI) 
+        return 0;
+    
+    while (ZWJPEGNextSegment(jpeg, length, &position, segment)) {
+        if (segment->marker == ZWJPEG_SOS || segment->marker == ZWJPEG_EOI) 
+            break;
+        if (segment->marker == marker && segment->length >= prefixLength && 
+            (prefix == NULL || memcmp(segment->data, prefix, prefixLength) == 0)) 
+            return 1;
+    }
+    
+    return 0;
+}
+
+// "ICC_PROFILE\0", then this chunk's number (from 1) and the number of chunks
+#define ICC_CHUNK_HEADER_LENGTH 14
+
+size_t ZWJPEGCopyICCProfile(const unsigned char *jpeg, size_t length, unsigned char *profile)
+{
+    ZWJPEGSegment segment;
+    size_t position, total = 0;
+    int chunks = 0, chunk, found;
+    
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != ZWJPEG_SOI) 
+        return 0;
+    
+    // Take the chunks in their numbered order, which isn't necessarily the order they're in the file
+    for (chunk = 1; chunks == 0 || chunk <= chunks; chunk++) {
+        found = 0;
+        position = 0;
+        while (!found && ZWJPEGNextSegment(jpeg, length, &position, &segment)) {
+            if (segment.marker == ZWJPEG_SOS || segment.marker == ZWJPEG_EOI) 
+                break;
+            if (segment.marker != ZWJPEG_APP2 || segment.length < ICC_CHUNK_HEADER_LENGTH || 
+                memcmp(segment.data, "ICC_PROFILE\0", 12) != 0 || segment.data[12] != chunk) 
+                continue;
+            
+            if (chunks == 0) 
+                chunks = segment.data[13];
+            if (chunks == 0 || segment.data[13] != chunks) 
+                return 0;
+            
+            if (profile) 
+                memcpy(profile + total, segment.data + ICC_CHUNK_HEADER_LENGTH, segment.length - ICC_CHUNK_HEADER_LENGTH);
+            total += segment.length - ICC_CHUNK_HEADER_LENGTH;
+            found = 1;
+        }
+        if (!found) 
+            return 0;
+    }
+    
+    return total;
+}
+
+static unsigned int readTIFF16(const unsigned char *p, int bigEndian)
+{
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned long readTIFF32(const unsigned char *p, int bigEndian)
+{
+    return bigEndian ? ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] 
+                     : ((unsigned long)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static void writeTIFF16(unsigned char *p, unsigned int value, int bigEndian)
+{
+    p[bigEndian ? 0 : 1] = (unsigned char)(value >> 8);
+    p[bigEndian ? 1 : 0] = (unsigned char)value;
+}
+
+static void writeTIFF32(unsigned char *p, unsigned long value, int bigEndian)
+{
+    int i;
+    for (i = 0; i < 4; i++) 
+        p[bigEndian ? i : 3 - i] = (unsigned char)(value >> (24 - i * 8));
+}
+
+// bytes per value of each TIFF field type (BYTE, ASCII, SHORT, LONG, RATIONAL, SBYTE, UNDEFINED, ...)
+static const unsigned int tiffTypeSizes[13] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8 };
+
+int ZWJPEGExifOrientation(unsigned char *exif, size_t length, int newOrientation)
+{
+    unsigned char *tiff;
+    size_t tiffLength;
+    unsigned long ifdOffset;
+    unsigned int entries, i;
+    int bigEndian;
+    
+    if (length < 6 + 8 || memcmp(exif, "Exif\0\0", 6) != 0) 
+        return 0;
+    
+    tiff = exif + 6;
+    tiffLength = length - 6;
+    if (tiff[0] == 'M' && tiff[1] == 'M') 
+        bigEndian = 1;
+    else if (tiff[0] == 'I' && tiff[1] == 'I') 
+        bigEndian = 0;
+    else 
+        return 0;
+    
+    ifdOffset = readTIFF32(tiff + 4, bigEndian);
+    if (ifdOffset + 2 > tiffLength) 
+        return 0;
+    
+    entries = readTIFF16(tiff + ifdOffset, bigEndian);
+    for (i = 0; i < entries; i++) {
+        unsigned char *entry = tiff + ifdOffset + 2 + i * 12;
+        if ((size_t)(entry + 12 - tiff) > tiffLength) 
+            return 0;
+        
+        // tag 0x0112, type SHORT, count 1 - the value sits in the first two bytes of the value field
+        if (readTIFF16(entry, bigEndian) == 0x0112 && readTIFF16(entry + 2, bigEndian) == 3) {
+            int orientation = readTIFF16(entry + 8, bigEndian);
+            if (newOrientation) {
+                entry[8] = bigEndian ? 0 : (unsigned char)newOrientation;
+                entry[9] = bigEndian ? (unsigned char)newOrientation : 0;
+            }
+            return orientation;
+        }
+    }
+    
+    return 0;
+}
+
+int ZWJPEGExifThumbnail(const unsigned char *exif, size_t length, size_t *thumbnailOffset, size_t *thumbnailLength)
+{
+    const unsigned char *tiff;
+    size_t tiffLength;
+    unsigned long ifdOffset, offset = 0, count = 0;
+    unsigned int entries, i;
+    int bigEndian;
+    
+    if (length < 6 + 8 || memcmp(exif, "Exif\0\0", 6) != 0) 
+        return 0;
+    
+    tiff = exif + 6;
+    tiffLength = length - 6;
+    if (tiff[0] == 'M' && tiff[1] == 'M') 
+        bigEndian = 1;
+    else if (tiff[0] == 'I' && tiff[1] == 'I') 
+        bigEndian = 0;
+    else 
+        return 0;
+    
+    // skip over IFD0 to find IFD1
+    ifdOffset = readTIFF32(tiff + 4, bigEndian);
+    if (ifdOffset + 2 > tiffLength) 
+        return 0;
+    entries = readTIFF16(tiff + ifdOffset, bigEndian);
+    if (ifdOffset + 2 + entries * 12 + 4 > tiffLength) 
+        return 0;
+    ifdOffset = readTIFF32(tiff + ifdOffset + 2 + entries * 12, bigEndian);
+    if (ifdOffset == 0 || ifdOffset + 2 > tiffLength) 
+        return 0;
+    
+    entries = readTIFF16(tiff + ifdOffset, bigEndian);
+    for (i = 0; i < entries; i++) {
+        const unsigned char *entry = tiff + ifdOffset + 2 + i * 12;
+        if ((size_t)(entry + 12 - tiff) > tiffLength) 
+            return 0;
+        
+        // JPEGInterchangeFormat and JPEGInterchangeFormatLength, both LONG
+        if (readTIFF16(entry, bigEndian) == 0x0201) 
+            offset = readTIFF32(entry + 8, bigEndian);
+        else if (readTIFF16(entry, bigEndian) == 0x0202) 
+            count = readTIFF32(entry + 8, bigEndian);
+    }
+    
+    if (offset == 0 || count == 0 || offset + count > tiffLength) 
+        return 0;
+    
+    *thumbnailOffset = 6 + offset;
+    *thumbnailLength = count;
+    return 1;
+}
+
+int ZWJPEGGetInfo(const unsigned char *jpeg, size_t length, ZWJPEGInfo *info)
+{
+    ZWJPEGSegment segment;
+    size_t position = 0;
+    
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != ZWJPEG_SOI) 
+        return 0;
+    
+    while (ZWJPEGNextSegment(jpeg, length, &position, &segment)) {
+        int marker = segment.marker;
+        
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC) which share the range
+        if (marker >= 0xC0 && marker <= 0xCF && marker != ZWJPEG_DHT && marker != 0xC8 && marker != 0xCC) {
+            if (segment.length < 6) 
+                return 0;
+            info->height = (segment.data[1] << 8) | segment.data[2];
+            info->width = (segment.data[3] << 8) | segment.data[4];
+            info->components = segment.data[5];
+            info->progressive = (marker == ZWJPEG_SOF2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE);
+            info->baseline = ((marker == ZWJPEG_SOF0 || marker == ZWJPEG_SOF1) && segment.data[0] == 8);
+            return (info->width > 0 && info->height > 0);
+        }
+        
+        if (marker == ZWJPEG_SOS || marker == ZWJPEG_EOI) 
+            break;
+    }
+    
+    return 0;
+}
+
+int ZWJPEGExifRemoveGPS(unsigned char *exif, size_t length)
+{
+    unsigned char *tiff, *entry;
+    size_t tiffLength;
+    unsigned long ifdOffset, gpsOffset;
+    unsigned int entries, gpsEntries, i, j;
+    int bigEndian;
+    
+    if (length < 6 + 8 || memcmp(exif, "Exif\0\0", 6) != 0) 
+        return 0;
+    
+    tiff = exif + 6;
+    tiffLength = length - 6;
+    if (tiff[0] == 'M' && tiff[1] == 'M') 
+        bigEndian = 1;
+    else if (tiff[0] == 'I' && tiff[1] == 'I') 
+        bigEndian = 0;
+    else 
+        return 0;
+    
+    ifdOffset = readTIFF32(tiff + 4, bigEndian);
+    if (ifdOffset + 2 > tiffLength) 
+        return 0;
+    entries = readTIFF16(tiff + ifdOffset, bigEndian);
+    if (entries == 0 || ifdOffset + 2 + entries * 12 + 4 > tiffLength) 
+        return 0;
+    
+    for (i = 0; i < entries; i++) {
+        if (readTIFF16(tiff + ifdOffset + 2 + i * 12, bigEndian) == 0x8825) 
+            break;
+    }
+    if (i == entries) 
+        return 0;
+    entry = tiff + ifdOffset + 2 + i * 12;
+    gpsOffset = readTIFF32(entry + 8, bigEndian);
+    
+    // Zero the GPS IFD and everything it points to, so nothing is left to find by scanning the bytes
+    if (gpsOffset >= 8 && gpsOffset + 2 <= tiffLength) {
+        gpsEntries = readTIFF16(tiff + gpsOffset, bigEndian);
+        if (gpsOffset + 2 + gpsEntries * 12 + 4 <= tiffLength) {
+            for (j = 0; j < gpsEntries; j++) {
+                const unsigned char *gpsEntry = tiff + gpsOffset + 2 + j * 12;
+                unsigned int type = readTIFF16(gpsEntry + 2, bigEndian);
+                unsigned long count = readTIFF32(gpsEntry + 4, bigEndian);
+                unsigned long valueOffset = readTIFF32(gpsEntry + 8, bigEndian);
+                unsigned long size;
+                
+                if (type > 12 || count > tiffLength) 
+                    continue;
+                size = count * tiffTypeSizes[type];
+                if (size > 4 && valueOffset >= 8 && valueOffset + size <= tiffLength) 
+                    memset(tiff + valueOffset, 0, size);
+            }
+            memset(tiff + gpsOffset, 0, 2 + gpsEntries * 12 + 4);
+        }
+    }
+    
+    // and take its entry out of IFD0, moving the rest (and the next IFD offset) down
+    memmove(entry, entry + 12, (entries - 1 - i) * 12 + 4);
+    memset(tiff + ifdOffset + 2 + (entries - 1) * 12 + 4, 0, 12);
+    writeTIFF16(tiff + ifdOffset, entries - 1, bigEndian);
+    
+    return 1;
+}
+
+typedef struct {
+    const unsigned char *tiff;
+    size_t length;
+    int bigEndian;
+    int dropMakerNote, dropGPS;
+    unsigned char *output;
+    size_t used, capacity;
+} ExifRebuild;
+
+static int droppedTag(const ExifRebuild *rebuild, unsigned int tag)
+{
+    // SubIFDs point at structures we don't know how to move, so they go too
+    return (rebuild->dropMakerNote && tag == 0x927C) || (rebuild->dropGPS && tag == 0x8825) || tag == 0x014A;
+}
+
+// Makes room for size bytes at the end of the output, on a word boundary as TIFF asks. Returns the offset 
+// of the room, or 0 if there isn't enough.
+static unsigned long reserveExifSpace(ExifRebuild *rebuild, size_t size)
+{
+    size_t offset = (rebuild->used + 1) & ~(size_t)1;
+    
+    if (offset + size > rebuild->capacity) 
+        return 0;
+    memset(rebuild->output + rebuild->used, 0, offset + size - rebuild->used);
+    rebuild->used = offset + size;
+    return offset;
+}
+
+// Copies the IFD at offset, and everything it points to, to the end of the output. Returns its new offset,
+// or 0 if it couldn't be copied.
+static unsigned long rebuildIFD(ExifRebuild *rebuild, unsigned long offset, int depth)
+{
+    const unsigned char *tiff = rebuild->tiff;
+    int bigEndian = rebuild->bigEndian;
+    unsigned int entries, kept = 0, i;
+    unsigned long newOffset, thumbnailLength = 0, next;
+    
+    if (depth > 4 || offset < 8 || offset + 2 > rebuild->length) 
+        return 0;
+    entries = readTIFF16(tiff + offset, bigEndian);
+    if (offset + 2 + entries * 12 + 4 > rebuild->length) 
+        return 0;
+    
+    for (i = 0; i < entries; i++) {
+        const unsigned char *entry = tiff + offset + 2 + i * 12;
+        if (droppedTag(rebuild, readTIFF16(entry, bigEndian))) 
+            continue;
+        if (readTIFF16(entry, bigEndian) == 0x0202) 
+            thumbnailLength = readTIFF32(entry + 8, bigEndian);
+        kept++;
+    }
+    
+    newOffset = reserveExifSpace(rebuild, 2 + kept * 12 + 4);
+    if (newOffset == 0) 
+        return 0;
+    writeTIFF16(rebuild->output + newOffset, kept, bigEndian);
+    
+    kept = 0;
+    for (i = 0; i < entries; i++) {
+        const unsigned char *entry = tiff + offset + 2 + i * 12;
+        unsigned char *newEntry = rebuild->output + newOffset + 2 + kept * 12;
+        unsigned int tag = readTIFF16(entry, bigEndian), type = readTIFF16(entry + 2, bigEndian);
+        unsigned long count = readTIFF32(entry + 4, bigEndian), value = readTIFF32(entry + 8, bigEndian);
+        unsigned long size = (type <= 12 && count <= rebuild->length) ? count * tiffTypeSizes[type] : 0;
+        
+        if (droppedTag(rebuild, tag)) 
+            continue;
+        memcpy(newEntry, entry, 12);
+        kept++;
+        
+        if (tag == 0x8769 || tag == 0x8825 || tag == 0xA005) {
+            // the Exif, GPS and interoperability IFDs
+            unsigned long subIFD = rebuildIFD(rebuild, value, depth + 1);
+            if (subIFD == 0) 
+                return 0;
+            writeTIFF32(newEntry + 8, subIFD, bigEndian);
+            continue;
+        }
+        
+        // the thumbnail's offset is just a LONG, so the data it points to isn't covered by the count
+        if (tag == 0x0201 && thumbnailLength) 
+            size = thumbnailLength;
+        else if (size <= 4) 
+            continue;
+        
+        if (value < 8 || value + size > rebuild->length) 
+            return 0;
+        {
+            unsigned long newValue = reserveExifSpace(rebuild, size);
+            if (newValue == 0) 
+                return 0;
+            memcpy(rebuild->output + newValue, tiff + value, size);
+            writeTIFF32(newEntry + 8, newValue, bigEndian);
+        }
+    }
+    
+    // IFD0 is followed by IFD1 with the thumbnail. If that can't be copied we're better off without it.
+    next = (depth == 0) ? readTIFF32(tiff + offset + 2 + entries * 12, bigEndian) : 0;
+    if (next) {
+        size_t used = rebuild->used;
+        next = rebuildIFD(rebuild, next, depth + 1);
+        if (next == 0) 
+            rebuild->used = used;
+    }
+    writeTIFF32(rebuild->output + newOffset + 2 + kept * 12, next, bigEndian);
+    
+    return newOffset;
+}
+
+size_t ZWJPEGExifRebuild(const unsigned char *exif, size_t length, int dropMakerNote, int dropGPS, unsigned char *output)
+{
+    ExifRebuild rebuild;
+    unsigned long ifd0;
+    
+    if (length < 6 + 8 || memcmp(exif, "Exif\0\0", 6) != 0) 
+        return 0;
+    
+    rebuild.tiff = exif + 6;
+    rebuild.length = length - 6;
+    if (rebuild.tiff[0] == 'M' && rebuild.tiff[1] == 'M') 
+        rebuild.bigEndian = 1;
+    else if (rebuild.tiff[0] == 'I' && rebuild.tiff[1] == 'I') 
+        rebuild.bigEndian = 0;
+    else 
+        return 0;
+    rebuild.dropMakerNote = dropMakerNote;
+    rebuild.dropGPS = dropGPS;
+    rebuild.output = output + 6;
+    rebuild.capacity = length - 6;
+    rebuild.used = 8;
+    
+    // the header (byte order, 42, IFD0 offset) stays as it was apart from the offset
+    memcpy(output, exif, 6 + 8);
+    ifd0 = rebuildIFD(&rebuild, readTIFF32(rebuild.tiff + 4, rebuild.bigEndian), 0);
+    if (ifd0 == 0) 
+        return 0;
+    writeTIFF32(rebuild.output + 4, ifd0, rebuild.bigEndian);
+    
+    return 6 + rebuild.used;
+}
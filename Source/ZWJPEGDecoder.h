@@ -0,0 +1,81 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// A small baseline JPEG decoder that hands back one scanline at a time. It only ever holds one row of 
+// MCUs (8 or 16 scanlines) in memory, so it can read images far too large to decode all at once.
+// Progressive, arithmetic-coded, 12-bit, CMYK and multi-scan images aren't supported - 
+// ZWJPEGDecoderCreate returns NULL for those and the caller should fall back to QuickTime.
+
+#ifndef ZWJPEGDECODER_H
+#define ZWJPEGDECODER_H
+
+#include <stddef.h>
+#include "ZWScratchArena.h"
+
+typedef struct ZWJPEGDecoder ZWJPEGDecoder;
+
+// The data must stay around (and unchanged) until the decoder is destroyed. The decoder's buffers come 
+// from arena if it isn't NULL.
+ZWJPEGDecoder *ZWJPEGDecoderCreate(const unsigned char *jpeg, size_t length, ZWScratchArena *arena);
+void ZWJPEGDecoderDestroy(ZWJPEGDecoder *decoder);
+
+// Asks for the image at 1/8 scale, made from just the DC coefficient of each block - no IDCT at all, which
+// makes it several times faster than a full decode. Must be called before the first scanline.
+void ZWJPEGDecoderSetEighthScale(ZWJPEGDecoder *decoder);
+
+// The size of the scanlines we'll hand back (so taking ZWJPEGDecoderSetEighthScale into account)
+int ZWJPEGDecoderGetWidth(ZWJPEGDecoder *decoder);
+int ZWJPEGDecoderGetHeight(ZWJPEGDecoder *decoder);
+
+// 1 for grayscale, 3 for RGB
+int ZWJPEGDecoderGetComponents(ZWJPEGDecoder *decoder);
+
+// Fills row with the next scanline (width * components bytes, RGB interleaved). Returns 1 on success, 
+// 0 when there are no more scanlines. Corrupt data doesn't stop the decode; the rest of the image just
+// comes out gray, the same as other decoders.
+int ZWJPEGDecoderReadScanline(ZWJPEGDecoder *decoder, unsigned char *row);
+
+// For working on the coefficients themselves (lossless transforms), rather than on pixels
+typedef struct {
+    int identifier;
+    int h, v;                   // sampling factors (always 1 for grayscale)
+    int quantTable;
+    int blocksPerRow;           // in one row of MCUs, counting the padding out to whole MCUs
+} ZWJPEGComponentInfo;
+
+void ZWJPEGDecoderGetComponentInfo(ZWJPEGDecoder *decoder, int component, ZWJPEGComponentInfo *info);
+int ZWJPEGDecoderGetMCURows(ZWJPEGDecoder *decoder);
+
+// Entropy-decodes the next row of MCUs with no IDCT. blocks[c] gets component c's blocksPerRow * v blocks,
+// a row of blocks at a time, each 64 quantized coefficients in natural order. Returns 0 when there are no
+// more rows. Can't be mixed with ZWJPEGDecoderReadScanline.
+int ZWJPEGDecoderReadCoefficientRow(ZWJPEGDecoder *decoder, short *blocks[]);
+
+#endif
@@ -0,0 +1,764 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWJPEGDecoder.h"
+#include "ZWJPEGCommon.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COMPONENTS 3
+#define LOOKAHEAD_BITS 8
+
+typedef struct {
+    int defined;
+    unsigned char lookupLength[1 << LOOKAHEAD_BITS];   // 0 if the code is longer than LOOKAHEAD_BITS
+    unsigned char lookupValue[1 << LOOKAHEAD_BITS];
+    int maxCode[18];                                    // largest code of each length, -1 if none
+    int valueOffset[17];                                // values[] index of the first code of each length, minus that code
+    unsigned char values[256];
+} HuffmanTable;
+
+typedef struct {
+    int identifier;
+    int h, v;                   // sampling factors
+    int quantTable;
+    int dcTable, acTable;
+    int dcPredictor;
+    
+    unsigned char *plane;       // one MCU row of samples for this component
+    int planeStride;
+} Component;
+
+struct ZWJPEGDecoder {
+    ZWScratchArena *arena;
+    const unsigned char *data;
+    size_t length;
+    size_t position;            // of the next entropy-coded byte
+    
+    int width, height;
+    int componentCount;
+    int blockSize;              // samples per block side we output: 8, or 1 for DC only
+    int outputWidth, outputHeight;
+    int hMax, vMax;
+    int mcusPerRow, mcuRows;
+    int colorTransform;         // YCbCr -> RGB? (an Adobe marker can say the data is already RGB)
+    
+    Component components[MAX_COMPONENTS];
+    float quant[4][64];         // dequantization, premultiplied by the AAN scale factors
+    int quantDefined[4];
+    HuffmanTable dcTables[4];
+    HuffmanTable acTables[4];
+    
+    int restartInterval;
+    int mcusUntilRestart;
+    
+    unsigned int bitBuffer;
+    int bitCount;
+    int hitMarker;
+    
+    int nextMCURow;
+    int rowInMCURow;            // next scanline to hand out from the decoded MCU row, or -1 for none
+    int scanlinesRead;
+    
+    int crToR[256], cbToB[256], crToG[256], cbToG[256];
+};
+
+static int parseHeaders(ZWJPEGDecoder *decoder);
+static void buildHuffmanTable(HuffmanTable *table, const unsigned char *bits, const unsigned char *values);
+static int allocatePlanes(ZWJPEGDecoder *decoder);
+static void decodeMCURow(ZWJPEGDecoder *decoder);
+static void idctBlock(const short *coefficients, const float *quant, unsigned char *output, int stride);
+
+#pragma mark Bit reading
+
+static void fillBits(ZWJPEGDecoder *decoder)
+{
+    while (decoder->bitCount <= 24) {
+        unsigned int byte = 0;
+        
+        if (!decoder->hitMarker && decoder->position < decoder->length) {
+            byte = decoder->data[decoder->position];
+            if (byte == 0xFF) {
+                unsigned int next = (decoder->position + 1 < decoder->length) ? decoder->data[decoder->position + 1] : 0xD9;
+                if (next == 0x00) {
+                    decoder->position += 2;
+                }
+                else {
+                    // A marker: stop here and feed zeros from now on. We leave position pointing at it.
+                    decoder->hitMarker = 1;
+                    byte = 0;
+                }
+            }
+            else {
+                decoder->position++;
+            }
+        }
+        
+        decoder->bitBuffer = (decoder->bitBuffer << 8) | byte;
+        decoder->bitCount += 8;
+    }
+}
+
+static inline int getBits(ZWJPEGDecoder *decoder, int count)
+{
+    int value;
+    
+    if (count == 0) 
+        return 0;
+    if (decoder->bitCount < count) 
+        fillBits(decoder);
+    
+    value = (decoder->bitBuffer >> (decoder->bitCount - count)) & ((1 << count) - 1);
+    decoder->bitCount -= count;
+    return value;
+}
+
+// Turns the count-bit magnitude category value into a signed coefficient (F.2.2.1)
+static inline int extend(int value, int count)
+{
+    return (value < (1 << (count - 1))) ? value - (1 << count) + 1 : value;
+}
+
+static inline int decodeHuffman(ZWJPEGDecoder *decoder, const HuffmanTable *table)
+{
+    int look, length, code;
+    
+    if (decoder->bitCount < 16) 
+        fillBits(decoder);
+    
+    look = (decoder->bitBuffer >> (decoder->bitCount - LOOKAHEAD_BITS)) & ((1 << LOOKAHEAD_BITS) - 1);
+    length = table->lookupLength[look];
+    if (length) {
+        decoder->bitCount -= length;
+        return table->lookupValue[look];
+    }
+    
+    for (length = LOOKAHEAD_BITS + 1; length <= 16; length++) {
+        code = (decoder->bitBuffer >> (decoder->bitCount - length)) & ((1 << length) - 1);
+        if (code <= table->maxCode[length]) {
+            decoder->bitCount -= length;
+            return table->values[(table->valueOffset[length] + code) & 0xFF];
+        }
+    }
+    
+    // not a valid code - corrupt data
+    decoder->bitCount -= 16;
+    return 0;
+}
+
+static void processRestart(ZWJPEGDecoder *decoder)
+{
+    size_t position = decoder->position;
+    
+    // throw away whatever's left of the last byte(s) and find the RSTn marker
+    decoder->bitBuffer = 0;
+    decoder->bitCount = 0;
+    decoder->hitMarker = 0;
+    
+    while (position + 1 < decoder->length) {
+        if (decoder->data[position] == 0xFF && decoder->data[position + 1] >= ZWJPEG_RST0 && decoder->data[position + 1] <= ZWJPEG_RST7) {
+            position += 2;
+            break;
+        }
+        position++;
+    }
+    decoder->position = position;
+    
+    {
+        int i;
+        for (i = 0; i < decoder->componentCount; i++) 
+            decoder->components[i].dcPredictor = 0;
+    }
+    decoder->mcusUntilRestart = decoder->restartInterval;
+}
+
+static void decodeBlock(ZWJPEGDecoder *decoder, Component *component, short *coefficients)
+{
+    int s, k, rs;
+    
+    memset(coefficients, 0, sizeof(short) * 64);
+    
+    s = decodeHuffman(decoder, &decoder->dcTables[component->dcTable]);
+    if (s) 
+        component->dcPredictor += extend(getBits(decoder, s), s);
+    coefficients[0] = (short)component->dcPredictor;
+    
+    for (k = 1; k < 64; k++) {
+        rs = decodeHuffman(decoder, &decoder->acTables[component->acTable]);
+        s = rs & 15;
+        if (s) {
+            k += rs >> 4;
+            if (k > 63) 
+                break;
+            coefficients[ZWJPEGZigzag[k]] = (short)extend(getBits(decoder, s), s);
+        }
+        else if ((rs >> 4) == 15) {
+            k += 15;
+        }
+        else {
+            break;      // end of block
+        }
+    }
+}
+
+#pragma mark Public
+
+ZWJPEGDecoder *ZWJPEGDecoderCreate(const unsigned char *jpeg, size_t length, ZWScratchArena *arena)
+{
+    ZWJPEGDecoder *decoder;
+    int i;
+    
+    decoder = (ZWJPEGDecoder *)calloc(1, sizeof(ZWJPEGDecoder));
+    if (decoder == NULL) 
+        return NULL;
+    
+    decoder->arena = arena;
+    decoder->data = jpeg;
+    decoder->length = length;
+    decoder->colorTransform = -1;
+    decoder->rowInMCURow = -1;
+    decoder->blockSize = 8;
+    
+    if (!parseHeaders(decoder)) {
+        ZWJPEGDecoderDestroy(decoder);
+        return NULL;
+    }
+    decoder->outputWidth = decoder->width;
+    decoder->outputHeight = decoder->height;
+    
+    // fixed point (16 bit fraction) YCbCr -> RGB tables, as in the JFIF spec
+    for (i = 0; i < 256; i++) {
+        int x = i - 128;
+        decoder->crToR[i] = (int)(1.40200 * 65536 + 0.5) * x + 32768;
+        decoder->cbToB[i] = (int)(1.77200 * 65536 + 0.5) * x + 32768;
+        decoder->crToG[i] = -(int)(0.71414 * 65536 + 0.5) * x;
+        decoder->cbToG[i] = -(int)(0.34414 * 65536 + 0.5) * x + 32768;
+    }
+    
+    decoder->mcusUntilRestart = decoder->restartInterval;
+    
+    return decoder;
+}
+
+void ZWJPEGDecoderDestroy(ZWJPEGDecoder *decoder)
+{
+    int i;
+    
+    if (decoder == NULL) 
+        return;
+    
+    for (i = 0; i < MAX_COMPONENTS; i++) 
+        ZWScratchFree(decoder->arena, decoder->components[i].plane);
+    free(decoder);
+}
+
+void ZWJPEGDecoderSetEighthScale(ZWJPEGDecoder *decoder)
+{
+    if (decoder->rowInMCURow >= 0) 
+        return;
+    
+    decoder->blockSize = 1;
+    decoder->outputWidth = (decoder->width + 7) / 8;
+    decoder->outputHeight = (decoder->height + 7) / 8;
+}
+
+int ZWJPEGDecoderGetWidth(ZWJPEGDecoder *decoder)
+{
+    return decoder->outputWidth;
+}
+
+int ZWJPEGDecoderGetHeight(ZWJPEGDecoder *decoder)
+{
+    return decoder->outputHeight;
+}
+
+int ZWJPEGDecoderGetComponents(ZWJPEGDecoder *decoder)
+{
+    return decoder->componentCount;
+}
+
+int ZWJPEGDecoderReadScanline(ZWJPEGDecoder *decoder, unsigned char *row)
+{
+    int x, i, rowsPerMCU = decoder->vMax * decoder->blockSize;
+    
+    if (decoder->scanlinesRead >= decoder->outputHeight) 
+        return 0;
+    
+    if (decoder->rowInMCURow < 0 && !allocatePlanes(decoder)) 
+        return 0;
+    
+    if (decoder->rowInMCURow < 0 || decoder->rowInMCURow >= rowsPerMCU) {
+        decodeMCURow(decoder);
+        decoder->rowInMCURow = 0;
+    }
+    
+    if (decoder->componentCount == 1) {
+        memcpy(row, decoder->components[0].plane + decoder->rowInMCURow * decoder->components[0].planeStride, decoder->outputWidth);
+    }
+    else {
+        const unsigned char *planeRows[MAX_COMPONENTS];
+        int shifts[MAX_COMPONENTS];
+        
+        // Point at the right row of each plane. Subsampled components just repeat their samples.
+        for (i = 0; i < MAX_COMPONENTS; i++) {
+            Component *component = &decoder->components[i];
+            planeRows[i] = component->plane + (decoder->rowInMCURow * component->v / decoder->vMax) * component->planeStride;
+            shifts[i] = (component->h == decoder->hMax) ? 0 : (component->h * 2 == decoder->hMax) ? 1 : -1;
+        }
+        
+        for (x = 0; x < decoder->outputWidth; x++) {
+            int c[MAX_COMPONENTS];
+            
+            for (i = 0; i < MAX_COMPONENTS; i++) {
+                if (shifts[i] >= 0) 
+                    c[i] = planeRows[i][x >> shifts[i]];
+                else 
+                    c[i] = planeRows[i][x * decoder->components[i].h / decoder->hMax];
+            }
+            
+            if (decoder->colorTransform) {
+                int y = c[0] << 16, r, g, b;
+                r = (y + decoder->crToR[c[2]]) >> 16;
+                g = (y + decoder->cbToG[c[1]] + decoder->crToG[c[2]]) >> 16;
+                b = (y + decoder->cbToB[c[1]]) >> 16;
+                row[0] = (unsigned char)(r < 0 ? 0 : r > 255 ? 255 : r);
+                row[1] = (unsigned char)(g < 0 ? 0 : g > 255 ? 255 : g);
+                row[2] = (unsigned char)(b < 0 ? 0 : b > 255 ? 255 : b);
+            }
+            else {
+                row[0] = (unsigned char)c[0];
+                row[1] = (unsigned char)c[1];
+                row[2] = (unsigned char)c[2];
+            }
+            row += 3;
+        }
+    }
+    
+    decoder->rowInMCURow++;
+    decoder->scanlinesRead++;
+    return 1;
+}
+
+void ZWJPEGDecoderGetComponentInfo(ZWJPEGDecoder *decoder, int component, ZWJPEGComponentInfo *info)
+{
+    Component *c = &decoder->components[component];
+    
+    info->identifier = c->identifier;
+    info->h = c->h;
+    info->v = c->v;
+    info->quantTable = c->quantTable;
+    info->blocksPerRow = decoder->mcusPerRow * c->h;
+}
+
+int ZWJPEGDecoderGetMCURows(ZWJPEGDecoder *decoder)
+{
+    return decoder->mcuRows;
+}
+
+int ZWJPEGDecoderReadCoefficientRow(ZWJPEGDecoder *decoder, short *blocks[])
+{
+    int mcu, i, bx, by;
+    
+    if (decoder->nextMCURow >= decoder->mcuRows) 
+        return 0;
+    
+    for (mcu = 0; mcu < decoder->mcusPerRow; mcu++) {
+        if (decoder->restartInterval) {
+            if (decoder->mcusUntilRestart == 0) 
+                processRestart(decoder);
+            decoder->mcusUntilRestart--;
+        }
+        
+        for (i = 0; i < decoder->componentCount; i++) {
+            Component *component = &decoder->components[i];
+            int blocksPerRow = decoder->mcusPerRow * component->h;
+            for (by = 0; by < component->v; by++) {
+                for (bx = 0; bx < component->h; bx++) 
+                    decodeBlock(decoder, component, blocks[i] + (by * blocksPerRow + mcu * component->h + bx) * 64);
+            }
+        }
+    }
+    
+    decoder->nextMCURow++;
+    return 1;
+}
+
+#pragma mark Private
+
+static int parseHeaders(ZWJPEGDecoder *decoder)
+{
+    ZWJPEGSegment segment;
+    size_t position = 0;
+    int sawFrame = 0, sawJFIF = 0;
+    int i, j;
+    
+    if (decoder->length < 4 || decoder->data[0] != 0xFF || decoder->data[1] != ZWJPEG_SOI) 
+        return 0;
+    
+    while (ZWJPEGNextSegment(decoder->data, decoder->length, &position, &segment)) {
+        const unsigned char *p = segment.data;
+        size_t remaining = segment.length;
+        
+        switch (segment.marker) {
+            case ZWJPEG_DQT:
+                while (remaining >= 65) {
+                    int precision = p[0] >> 4, table = p[0] & 3;
+                    size_t tableLength = precision ? 129 : 65;
+                    if (remaining < tableLength) 
+                        return 0;
+                    for (i = 0; i < 64; i++) {
+                        int natural = ZWJPEGZigzag[i];
+                        int value = precision ? ((p[1 + i * 2] << 8) | p[2 + i * 2]) : p[1 + i];
+                        decoder->quant[table][natural] = (float)(value * ZWJPEGAANScaleFactor[natural >> 3] * ZWJPEGAANScaleFactor[natural & 7]);
+                    }
+                    decoder->quantDefined[table] = 1;
+                    p += tableLength;
+                    remaining -= tableLength;
+                }
+                break;
+                
+            case ZWJPEG_DHT:
+                while (remaining >= 17) {
+                    int tableClass = p[0] >> 4, table = p[0] & 3, count = 0;
+                    unsigned char bits[17];
+                    bits[0] = 0;
+                    for (i = 1; i <= 16; i++) {
+                        bits[i] = p[i];
+                        count += p[i];
+                    }
+                    if (count > 256 || remaining < (size_t)(17 + count)) 
+                        return 0;
+                    buildHuffmanTable(tableClass ? &decoder->acTables[table] : &decoder->dcTables[table], bits, p + 17);
+                    p += 17 + count;
+                    remaining -= 17 + count;
+                }
+                break;
+                
+            case ZWJPEG_DRI:
+                if (remaining < 2) 
+                    return 0;
+                decoder->restartInterval = (p[0] << 8) | p[1];
+                break;
+                
+            case ZWJPEG_APP0:
+                if (remaining >= 5 && memcmp(p, "JFIF\0", 5) == 0) 
+                    sawJFIF = 1;
+                break;
+                
+            case ZWJPEG_APP14:
+                // Adobe's marker says whether the three components are YCbCr or plain RGB
+                if (remaining >= 12 && memcmp(p, "Adobe", 5) == 0) 
+                    decoder->colorTransform = (p[11] != 0);
+                break;
+                
+            case ZWJPEG_SOF0:
+            case ZWJPEG_SOF1:
+                if (remaining < 6 || p[0] != 8) 
+                    return 0;
+                decoder->height = (p[1] << 8) | p[2];
+                decoder->width = (p[3] << 8) | p[4];
+                decoder->componentCount = p[5];
+                if (decoder->width <= 0 || decoder->height <= 0) 
+                    return 0;
+                if (decoder->componentCount != 1 && decoder->componentCount != 3) 
+                    return 0;
+                if (remaining < (size_t)(6 + decoder->componentCount * 3)) 
+                    return 0;
+                for (i = 0; i < decoder->componentCount; i++) {
+                    Component *component = &decoder->components[i];
+                    component->identifier = p[6 + i * 3];
+                    component->h = p[7 + i * 3] >> 4;
+                    component->v = p[7 + i * 3] & 15;
+                    component->quantTable = p[8 + i * 3] & 3;
+                    if (component->h < 1 || component->h > 4 || component->v < 1 || component->v > 4) 
+                        return 0;
+                }
+                sawFrame = 1;
+                break;
+                
+            case ZWJPEG_SOS:
+                if (!sawFrame || remaining < 1 || p[0] != decoder->componentCount) 
+                    return 0;   // multi-scan (non-interleaved) images aren't supported
+                for (i = 0; i < decoder->componentCount; i++) {
+                    int identifier = p[1 + i * 2];
+                    for (j = 0; j < decoder->componentCount; j++) {
+                        if (decoder->components[j].identifier == identifier) {
+                            decoder->components[j].dcTable = p[2 + i * 2] >> 4 & 3;
+                            decoder->components[j].acTable = p[2 + i * 2] & 3;
+                            break;
+                        }
+                    }
+                    if (j == decoder->componentCount || j != i) 
+                        return 0;
+                }
+                
+                for (i = 0; i < decoder->componentCount; i++) {
+                    Component *component = &decoder->components[i];
+                    if (!decoder->quantDefined[component->quantTable] || 
+                        !decoder->dcTables[component->dcTable].defined || 
+                        !decoder->acTables[component->acTable].defined) 
+                        return 0;
+                }
+                
+                // a single component scan is never interleaved, so its MCU is one block whatever the
+                // sampling factors claim
+                if (decoder->componentCount == 1) 
+                    decoder->components[0].h = decoder->components[0].v = 1;
+                
+                decoder->hMax = decoder->vMax = 1;
+                for (i = 0; i < decoder->componentCount; i++) {
+                    if (decoder->components[i].h > decoder->hMax) decoder->hMax = decoder->components[i].h;
+                    if (decoder->components[i].v > decoder->vMax) decoder->vMax = decoder->components[i].v;
+                }
+                decoder->mcusPerRow = (decoder->width + decoder->hMax * 8 - 1) / (decoder->hMax * 8);
+                decoder->mcuRows = (decoder->height + decoder->vMax * 8 - 1) / (decoder->vMax * 8);
+                
+                if (decoder->colorTransform < 0) {
+                    // No Adobe marker. JFIF is always YCbCr; otherwise guess from the component ids like libjpeg.
+                    decoder->colorTransform = 1;
+                    if (!sawJFIF && decoder->componentCount == 3 && 
+                        decoder->components[0].identifier == 'R' && decoder->components[1].identifier == 'G' && decoder->components[2].identifier == 'B') 
+                        decoder->colorTransform = 0;
+                }
+                
+                decoder->position = position;
+                return 1;
+                
+            case ZWJPEG_EOI:
+                return 0;
+                
+            default:
+                // progressive, lossless, arithmetic and hierarchical frames all land here and get skipped,
+                // which means we'll fail at SOS because there's no frame
+                if (segment.marker >= 0xC0 && segment.marker <= 0xCF && segment.marker != ZWJPEG_DHT) 
+                    return 0;
+                break;
+        }
+    }
+    
+    return 0;
+}
+
+static void buildHuffmanTable(HuffmanTable *table, const unsigned char *bits, const unsigned char *values)
+{
+    int length, i, code = 0, k = 0;
+    
+    memset(table, 0, sizeof(HuffmanTable));
+    
+    for (length = 1; length <= 16; length++) {
+        table->valueOffset[length] = k - code;
+        for (i = 0; i < bits[length]; i++) {
+            table->values[k] = values[k];
+            
+            // every LOOKAHEAD_BITS-bit pattern starting with this code decodes to it
+            if (length <= LOOKAHEAD_BITS) {
+                int shift = LOOKAHEAD_BITS - length;
+                int first = code << shift, j;
+                for (j = 0; j < (1 << shift); j++) {
+                    table->lookupLength[first + j] = (unsigned char)length;
+                    table->lookupValue[first + j] = values[k];
+                }
+            }
+            
+            code++;
+            k++;
+        }
+        table->maxCode[length] = bits[length] ? code - 1 : -1;
+        code <<= 1;
+    }
+    table->maxCode[17] = 0x7FFFFFFF;
+    table->defined = 1;
+}
+
+static inline unsigned char clampSample(float value)
+{
+    int sample = (int)(value + 128.5f);     // the output is level shifted by 128
+    return (unsigned char)(sample < 0 ? 0 : sample > 255 ? 255 : sample);
+}
+
+// Done on the first scanline rather than up front, since the plane size depends on the output scale
+static int allocatePlanes(ZWJPEGDecoder *decoder)
+{
+    int i, blockSize = decoder->blockSize;
+    
+    for (i = 0; i < decoder->componentCount; i++) {
+        Component *component = &decoder->components[i];
+        component->planeStride = decoder->mcusPerRow * component->h * blockSize;
+        if (component->plane) 
+            continue;
+        component->plane = (unsigned char *)ZWScratchAlloc(decoder->arena, component->planeStride * component->v * blockSize);
+        if (component->plane == NULL) 
+            return 0;
+    }
+    
+    return 1;
+}
+
+static void decodeMCURow(ZWJPEGDecoder *decoder)
+{
+    short coefficients[64];
+    int mcu, i, bx, by, blockSize = decoder->blockSize;
+    
+    if (decoder->nextMCURow >= decoder->mcuRows) 
+        return;
+    
+    for (mcu = 0; mcu < decoder->mcusPerRow; mcu++) {
+        if (decoder->restartInterval) {
+            if (decoder->mcusUntilRestart == 0) 
+                processRestart(decoder);
+            decoder->mcusUntilRestart--;
+        }
+        
+        for (i = 0; i < decoder->componentCount; i++) {
+            Component *component = &decoder->components[i];
+            for (by = 0; by < component->v; by++) {
+                for (bx = 0; bx < component->h; bx++) {
+                    unsigned char *output = component->plane + (by * blockSize) * component->planeStride + (mcu * component->h + bx) * blockSize;
+                    decodeBlock(decoder, component, coefficients);
+                    if (blockSize == 8) 
+                        idctBlock(coefficients, decoder->quant[component->quantTable], output, component->planeStride);
+                    else 
+                        *output = clampSample(coefficients[0] * decoder->quant[component->quantTable][0] * 0.125f);
+                }
+            }
+        }
+    }
+    
+    decoder->nextMCURow++;
+}
+
+
+// The floating point AAN inverse DCT (as in libjpeg's jidctflt.c). quant has the scale factors folded in.
+static void idctBlock(const short *coefficients, const float *quant, unsigned char *output, int stride)
+{
+    float workspace[64];
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13, z5, z10, z11, z12, z13;
+    int i;
+    
+    // columns
+    for (i = 0; i < 8; i++) {
+        const short *in = coefficients + i;
+        const float *q = quant + i;
+        float *ws = workspace + i;
+        
+        if (in[8] == 0 && in[16] == 0 && in[24] == 0 && in[32] == 0 && in[40] == 0 && in[48] == 0 && in[56] == 0) {
+            float dc = in[0] * q[0];
+            ws[0] = ws[8] = ws[16] = ws[24] = ws[32] = ws[40] = ws[48] = ws[56] = dc;
+            continue;
+        }
+        
+        tmp0 = in[0] * q[0];
+        tmp1 = in[16] * q[16];
+        tmp2 = in[32] * q[32];
+        tmp3 = in[48] * q[48];
+        
+        tmp10 = tmp0 + tmp2;
+        tmp11 = tmp0 - tmp2;
+        tmp13 = tmp1 + tmp3;
+        tmp12 = (tmp1 - tmp3) * 1.414213562f - tmp13;
+        
+        tmp0 = tmp10 + tmp13;
+        tmp3 = tmp10 - tmp13;
+        tmp1 = tmp11 + tmp12;
+        tmp2 = tmp11 - tmp12;
+        
+        tmp4 = in[8] * q[8];
+        tmp5 = in[24] * q[24];
+        tmp6 = in[40] * q[40];
+        tmp7 = in[56] * q[56];
+        
+        z13 = tmp6 + tmp5;
+        z10 = tmp6 - tmp5;
+        z11 = tmp4 + tmp7;
+        z12 = tmp4 - tmp7;
+        
+        tmp7 = z11 + z13;
+        tmp11 = (z11 - z13) * 1.414213562f;
+        z5 = (z10 + z12) * 1.847759065f;
+        tmp10 = 1.082392200f * z12 - z5;
+        tmp12 = -2.613125930f * z10 + z5;
+        
+        tmp6 = tmp12 - tmp7;
+        tmp5 = tmp11 - tmp6;
+        tmp4 = tmp10 + tmp5;
+        
+        ws[0] = tmp0 + tmp7;
+        ws[56] = tmp0 - tmp7;
+        ws[8] = tmp1 + tmp6;
+        ws[48] = tmp1 - tmp6;
+        ws[16] = tmp2 + tmp5;
+        ws[40] = tmp2 - tmp5;
+        ws[32] = tmp3 + tmp4;
+        ws[24] = tmp3 - tmp4;
+    }
+    
+    // rows
+    for (i = 0; i < 8; i++) {
+        float *ws = workspace + i * 8;
+        unsigned char *out = output + i * stride;
+        
+        tmp10 = ws[0] + ws[4];
+        tmp11 = ws[0] - ws[4];
+        tmp13 = ws[2] + ws[6];
+        tmp12 = (ws[2] - ws[6]) * 1.414213562f - tmp13;
+        
+        tmp0 = tmp10 + tmp13;
+        tmp3 = tmp10 - tmp13;
+        tmp1 = tmp11 + tmp12;
+        tmp2 = tmp11 - tmp12;
+        
+        z13 = ws[5] + ws[3];
+        z10 = ws[5] - ws[3];
+        z11 = ws[1] + ws[7];
+        z12 = ws[1] - ws[7];
+        
+        tmp7 = z11 + z13;
+        tmp11 = (z11 - z13) * 1.414213562f;
+        z5 = (z10 + z12) * 1.847759065f;
+        tmp10 = 1.082392200f * z12 - z5;
+        tmp12 = -2.613125930f * z10 + z5;
+        
+        tmp6 = tmp12 - tmp7;
+        tmp5 = tmp11 - tmp6;
+        tmp4 = tmp10 + tmp5;
+        
+        // the 1/8 from the two passes is applied here
+        out[0] = clampSample((tmp0 + tmp7) * 0.125f);
+        out[7] = clampSample((tmp0 - tmp7) * 0.125f);
+        out[1] = clampSample((tmp1 + tmp6) * 0.125f);
+        out[6] = clampSample((tmp1 - tmp6) * 0.125f);
+        out[2] = clampSample((tmp2 + tmp5) * 0.125f);
+        out[5] = clampSample((tmp2 - tmp5) * 0.125f);
+        out[4] = clampSample((tmp3 + tmp4) * 0.125f);
+        out[3] = clampSample((tmp3 - tmp4) * 0.125f);
+    }
+}
@@ -0,0 +1,69 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// A small baseline JPEG encoder fed one scanline at a time, to go with ZWJPEGDecoder. Color images are
+// written as YCbCr 4:2:0, grayscale as a single component, with the standard Huffman tables and the IJG
+// quality scaling, so quality settings mean the same thing they do everywhere else.
+
+#ifndef ZWJPEGENCODER_H
+#define ZWJPEGENCODER_H
+
+#include <stddef.h>
+#include "ZWScratchArena.h"
+
+typedef struct ZWJPEGEncoder ZWJPEGEncoder;
+
+// Called with each chunk of encoded output. Return 0 to give up on the encode.
+typedef int (*ZWJPEGWriteFunction)(void *context, const unsigned char *bytes, size_t length);
+
+// components is 1 (gray) or 3 (RGB). quality is 1-100. The encoder's buffers come from arena if it isn't NULL.
+ZWJPEGEncoder *ZWJPEGEncoderCreate(int width, int height, int components, int quality, ZWJPEGWriteFunction writer, void *context, ZWScratchArena *arena);
+void ZWJPEGEncoderDestroy(ZWJPEGEncoder *encoder);
+
+// Puts a restart marker every interval MCUs (0, the default, means none). Must be called before the first scanline.
+void ZWJPEGEncoderSetRestartInterval(ZWJPEGEncoder *encoder, int interval);
+
+// Entropy codes the image in horizontal strips on threads worker threads, with a restart marker between
+// each strip (this replaces any restart interval). The output is still a single baseline JPEG that any
+// decoder reads. Must be called before the first scanline. Returns 0 if the threads couldn't be started,
+// in which case the encoder carries on by itself.
+int ZWJPEGEncoderSetThreads(ZWJPEGEncoder *encoder, int threads);
+
+// Writes an extra marker segment (APP1 for EXIF, APP2 for ICC, ...) after the JFIF header. Must be called
+// before the first scanline. Returns 0 if the payload is too big for a segment or the write failed.
+int ZWJPEGEncoderWriteMarker(ZWJPEGEncoder *encoder, int marker, const unsigned char *data, size_t length);
+
+// row is width * components bytes. Returns 0 if the writer gave up.
+int ZWJPEGEncoderWriteScanline(ZWJPEGEncoder *encoder, const unsigned char *row);
+
+// Flushes the last MCU row and writes EOI. Must be called after the last scanline.
+int ZWJPEGEncoderFinish(ZWJPEGEncoder *encoder);
+
+#endif
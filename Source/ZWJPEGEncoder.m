@@ -0,0 +1,873 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWJPEGEncoder.h"
+#include "ZWJPEGCommon.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_BUFFER_SIZE 16384
+
+// When strips are coded on threads, each is about this many pixels (in whole MCU rows)
+#define STRIP_PIXELS (256 * 1024)
+
+typedef struct {
+    unsigned short codes[256];
+    unsigned char sizes[256];
+} HuffmanCodes;
+
+// Where entropy coded bytes go. The encoder's own coder writes to a fixed buffer that's handed to the 
+// writer whenever it fills; a strip's coder (see below) has a buffer of its own that grows as needed.
+typedef struct {
+    ZWJPEGEncoder *encoder;         // for the encoder's own coder, NULL for a strip's
+    unsigned char *bytes;
+    size_t used;
+    size_t capacity;
+    int failed;
+    
+    unsigned int bitBuffer;
+    int bitCount;
+    int dcPredictors[3];
+} EntropyCoder;
+
+// With threads, the image is cut into strips of whole MCU rows with a restart marker between each. A
+// restart resets the DC predictors, so each strip can be coded without knowing anything about the one 
+// before it, and the coded strips are written out in order as they're finished.
+typedef enum {
+    STRIP_FILLING,
+    STRIP_QUEUED,
+    STRIP_CODING,
+    STRIP_CODED
+} StripState;
+
+typedef struct {
+    unsigned char *planes[3];       // stripMCURows MCU rows of samples
+    int mcuRows;                    // filled so far
+    int index;                      // in the image
+    StripState state;
+    EntropyCoder coder;
+} Strip;
+
+struct ZWJPEGEncoder {
+    ZWScratchArena *arena;
+    int width, height;
+    int components;
+    int restartInterval;
+    int mcuSize;                    // 16 for 4:2:0 color, 8 for gray
+    int mcusPerRow;
+    
+    ZWJPEGWriteFunction writer;
+    void *context;
+    int failed;
+    
+    unsigned char quantTables[2][64];  // natural order
+    float divisors[2][64];          // reciprocals of the quant values, with the AAN scaling folded in
+    HuffmanCodes dcCodes[2];
+    HuffmanCodes acCodes[2];
+    
+    // One MCU row of samples in YCbCr (gray just uses planes[0]), padded out to whole MCUs
+    unsigned char *planes[3];
+    int planeStride;
+    int rowsBuffered;
+    int scanlinesWritten;
+    int wroteHeaders;
+    
+    int mcusUntilRestart;
+    int nextRestart;
+    
+    EntropyCoder coder;
+    unsigned char output[OUTPUT_BUFFER_SIZE];
+    
+    // Threaded coding. Strip i lives in strips[i % stripCount].
+    int threadCount;
+    pthread_t *threads;
+    pthread_mutex_t stripLock;
+    pthread_cond_t stripCondition;
+    Strip *strips;
+    int stripCount;
+    int stripMCURows;
+    int stripsStarted;              // filled or being filled
+    int stripsQueued;               // handed to the threads
+    int stripsTaken;                // by a thread
+    int stripsWritten;
+    int stopThreads;
+};
+
+static void buildHuffmanCodes(HuffmanCodes *codes, const unsigned char *bits, const unsigned char *values);
+static void encodeMCURow(ZWJPEGEncoder *encoder, EntropyCoder *coder, unsigned char **planes, int restarts);
+static void fdctBlock(float *block);
+static void stopThreads(ZWJPEGEncoder *encoder);
+
+#pragma mark Output
+
+static void flushOutput(ZWJPEGEncoder *encoder)
+{
+    if (encoder->coder.used && !encoder->failed) {
+        if (!encoder->writer(encoder->context, encoder->coder.bytes, encoder->coder.used)) 
+            encoder->failed = 1;
+    }
+    encoder->coder.used = 0;
+}
+
+// Makes room in a full coder buffer. Returns 0 if the byte has to be dropped.
+static int makeRoom(EntropyCoder *coder)
+{
+    unsigned char *bytes;
+    size_t capacity;
+    
+    if (coder->encoder) {
+        flushOutput(coder->encoder);
+        return 1;
+    }
+    
+    capacity = coder->capacity ? coder->capacity * 2 : OUTPUT_BUFFER_SIZE;
+    bytes = (unsigned char *)realloc(coder->bytes, capacity);
+    if (bytes == NULL) {
+        coder->failed = 1;
+        return 0;
+    }
+    coder->bytes = bytes;
+    coder->capacity = capacity;
+    return 1;
+}
+
+static inline void putByte(EntropyCoder *coder, unsigned char byte)
+{
+    if (coder->used == coder->capacity && !makeRoom(coder)) 
+        return;
+    coder->bytes[coder->used++] = byte;
+}
+
+static void putBytes(EntropyCoder *coder, const unsigned char *bytes, size_t length)
+{
+    while (length--) 
+        putByte(coder, *bytes++);
+}
+
+static void putMarker(EntropyCoder *coder, int marker, size_t payloadLength)
+{
+    putByte(coder, 0xFF);
+    putByte(coder, (unsigned char)marker);
+    if (marker != ZWJPEG_SOI && marker != ZWJPEG_EOI && !(marker >= ZWJPEG_RST0 && marker <= ZWJPEG_RST7)) {
+        putByte(coder, (unsigned char)((payloadLength + 2) >> 8));
+        putByte(coder, (unsigned char)((payloadLength + 2) & 0xFF));
+    }
+}
+
+static inline void putBits(EntropyCoder *coder, unsigned int bits, int count)
+{
+    coder->bitBuffer = (coder->bitBuffer << count) | (bits & ((1 << count) - 1));
+    coder->bitCount += count;
+    
+    while (coder->bitCount >= 8) {
+        unsigned char byte = (unsigned char)(coder->bitBuffer >> (coder->bitCount - 8));
+        putByte(coder, byte);
+        if (byte == 0xFF) 
+            putByte(coder, 0);
+        coder->bitCount -= 8;
+    }
+}
+
+// pads the last byte with 1 bits, as the spec asks
+static void flushBits(EntropyCoder *coder)
+{
+    if (coder->bitCount > 0) 
+        putBits(coder, 0x7F, 8 - coder->bitCount);
+    coder->bitBuffer = 0;
+    coder->bitCount = 0;
+}
+
+#pragma mark Public
+
+ZWJPEGEncoder *ZWJPEGEncoderCreate(int width, int height, int components, int quality, ZWJPEGWriteFunction writer, void *context, ZWScratchArena *arena)
+{
+    static const unsigned char jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    ZWJPEGEncoder *encoder;
+    int scale, i, t;
+    
+    if (width <= 0 || height <= 0 || width > 65535 || height > 65535 || (components != 1 && components != 3)) 
+        return NULL;
+    
+    encoder = (ZWJPEGEncoder *)calloc(1, sizeof(ZWJPEGEncoder));
+    if (encoder == NULL) 
+        return NULL;
+    
+    encoder->arena = arena;
+    encoder->width = width;
+    encoder->height = height;
+    encoder->components = components;
+    encoder->writer = writer;
+    encoder->context = context;
+    encoder->mcuSize = (components == 3) ? 16 : 8;
+    encoder->mcusPerRow = (width + encoder->mcuSize - 1) / encoder->mcuSize;
+    encoder->planeStride = encoder->mcusPerRow * encoder->mcuSize;
+    encoder->coder.encoder = encoder;
+    encoder->coder.bytes = encoder->output;
+    encoder->coder.capacity = OUTPUT_BUFFER_SIZE;
+    
+    for (i = 0; i < components; i++) {
+        encoder->planes[i] = (unsigned char *)ZWScratchAlloc(arena, encoder->planeStride * encoder->mcuSize);
+        if (encoder->planes[i] == NULL) {
+            ZWJPEGEncoderDestroy(encoder);
+            return NULL;
+        }
+    }
+    
+    // the same scaling libjpeg uses, so quality 75 here is quality 75 there
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    scale = (quality < 50) ? 5000 / quality : 200 - quality * 2;
+    
+    for (t = 0; t < 2; t++) {
+        const unsigned char *base = t ? ZWJPEGStdChrominanceQuant : ZWJPEGStdLuminanceQuant;
+        for (i = 0; i < 64; i++) {
+            int value = (base[i] * scale + 50) / 100;
+            if (value < 1) value = 1;
+            if (value > 255) value = 255;
+            encoder->quantTables[t][i] = (unsigned char)value;
+            encoder->divisors[t][i] = (float)(1.0 / (value * ZWJPEGAANScaleFactor[i >> 3] * ZWJPEGAANScaleFactor[i & 7] * 8.0));
+        }
+    }
+    
+    buildHuffmanCodes(&encoder->dcCodes[0], ZWJPEGStdDCLuminanceBits, ZWJPEGStdDCLuminanceValues);
+    buildHuffmanCodes(&encoder->acCodes[0], ZWJPEGStdACLuminanceBits, ZWJPEGStdACLuminanceValues);
+    buildHuffmanCodes(&encoder->dcCodes[1], ZWJPEGStdDCChrominanceBits, ZWJPEGStdDCChrominanceValues);
+    buildHuffmanCodes(&encoder->acCodes[1], ZWJPEGStdACChrominanceBits, ZWJPEGStdACChrominanceValues);
+    
+    putMarker(&encoder->coder, ZWJPEG_SOI, 0);
+    putMarker(&encoder->coder, ZWJPEG_APP0, sizeof(jfif));
+    putBytes(&encoder->coder, jfif, sizeof(jfif));
+    
+    return encoder;
+}
+
+void ZWJPEGEncoderDestroy(ZWJPEGEncoder *encoder)
+{
+    int i, c;
+    
+    if (encoder == NULL) 
+        return;
+    
+    if (encoder->threadCount) 
+        stopThreads(encoder);
+    for (i = 0; i < encoder->stripCount; i++) {
+        for (c = 0; c < 3; c++) 
+            ZWScratchFree(encoder->arena, encoder->strips[i].planes[c]);
+        free(encoder->strips[i].coder.bytes);
+    }
+    free(encoder->strips);
+    
+    for (i = 0; i < 3; i++) 
+        ZWScratchFree(encoder->arena, encoder->planes[i]);
+    free(encoder);
+}
+
+void ZWJPEGEncoderSetRestartInterval(ZWJPEGEncoder *encoder, int interval)
+{
+    if (!encoder->wroteHeaders && !encoder->threadCount && interval >= 0 && interval <= 65535) 
+        encoder->restartInterval = interval;
+}
+
+int ZWJPEGEncoderWriteMarker(ZWJPEGEncoder *encoder, int marker, const unsigned char *data, size_t length)
+{
+    if (encoder->wroteHeaders || length > 65533) 
+        return 0;
+    
+    putMarker(&encoder->coder, marker, length);
+    putBytes(&encoder->coder, data, length);
+    return !encoder->failed;
+}
+
+static void writeHeaders(ZWJPEGEncoder *encoder)
+{
+    EntropyCoder *coder = &encoder->coder;
+    int t, i, c;
+    
+    // DQT
+    for (t = 0; t < (encoder->components == 3 ? 2 : 1); t++) {
+        putMarker(coder, ZWJPEG_DQT, 65);
+        putByte(coder, (unsigned char)t);
+        for (i = 0; i < 64; i++) 
+            putByte(coder, encoder->quantTables[t][ZWJPEGZigzag[i]]);
+    }
+    
+    // SOF0
+    putMarker(coder, ZWJPEG_SOF0, 6 + encoder->components * 3);
+    putByte(coder, 8);
+    putByte(coder, (unsigned char)(encoder->height >> 8));
+    putByte(coder, (unsigned char)(encoder->height & 0xFF));
+    putByte(coder, (unsigned char)(encoder->width >> 8));
+    putByte(coder, (unsigned char)(encoder->width & 0xFF));
+    putByte(coder, (unsigned char)encoder->components);
+    for (c = 0; c < encoder->components; c++) {
+        putByte(coder, (unsigned char)(c + 1));
+        putByte(coder, (c == 0 && encoder->components == 3) ? 0x22 : 0x11);
+        putByte(coder, (unsigned char)(c ? 1 : 0));
+    }
+    
+    // DHT
+    for (t = 0; t < (encoder->components == 3 ? 2 : 1); t++) {
+        const unsigned char *dcBits = t ? ZWJPEGStdDCChrominanceBits : ZWJPEGStdDCLuminanceBits;
+        const unsigned char *dcValues = t ? ZWJPEGStdDCChrominanceValues : ZWJPEGStdDCLuminanceValues;
+        const unsigned char *acBits = t ? ZWJPEGStdACChrominanceBits : ZWJPEGStdACLuminanceBits;
+        const unsigned char *acValues = t ? ZWJPEGStdACChrominanceValues : ZWJPEGStdACLuminanceValues;
+        
+        putMarker(coder, ZWJPEG_DHT, 1 + 16 + 12);
+        putByte(coder, (unsigned char)t);
+        putBytes(coder, dcBits + 1, 16);
+        putBytes(coder, dcValues, 12);
+        
+        putMarker(coder, ZWJPEG_DHT, 1 + 16 + 162);
+        putByte(coder, (unsigned char)(0x10 | t));
+        putBytes(coder, acBits + 1, 16);
+        putBytes(coder, acValues, 162);
+    }
+    
+    if (encoder->restartInterval) {
+        putMarker(coder, ZWJPEG_DRI, 2);
+        putByte(coder, (unsigned char)(encoder->restartInterval >> 8));
+        putByte(coder, (unsigned char)(encoder->restartInterval & 0xFF));
+    }
+    
+    // SOS
+    putMarker(coder, ZWJPEG_SOS, 1 + encoder->components * 2 + 3);
+    putByte(coder, (unsigned char)encoder->components);
+    for (c = 0; c < encoder->components; c++) {
+        putByte(coder, (unsigned char)(c + 1));
+        putByte(coder, (unsigned char)(c ? 0x11 : 0x00));
+    }
+    putByte(coder, 0);
+    putByte(coder, 63);
+    putByte(coder, 0);
+    
+    encoder->mcusUntilRestart = encoder->restartInterval;
+    encoder->wroteHeaders = 1;
+}
+
+#pragma mark Strips
+
+static void *codeStrips(void *argument)
+{
+    ZWJPEGEncoder *encoder = (ZWJPEGEncoder *)argument;
+    
+    pthread_mutex_lock(&encoder->stripLock);
+    while (1) {
+        Strip *strip;
+        int mcuRow;
+        
+        while (!encoder->stopThreads && encoder->stripsTaken == encoder->stripsQueued) 
+            pthread_cond_wait(&encoder->stripCondition, &encoder->stripLock);
+        if (encoder->stopThreads) 
+            break;
+        
+        strip = &encoder->strips[encoder->stripsTaken % encoder->stripCount];
+        encoder->stripsTaken++;
+        strip->state = STRIP_CODING;
+        pthread_mutex_unlock(&encoder->stripLock);
+        
+        // The restart marker in front of the strip is written when it's stitched in
+        strip->coder.used = 0;
+        strip->coder.dcPredictors[0] = strip->coder.dcPredictors[1] = strip->coder.dcPredictors[2] = 0;
+        for (mcuRow = 0; mcuRow < strip->mcuRows; mcuRow++) {
+            unsigned char *planes[3];
+            int c;
+            
+            for (c = 0; c < encoder->components; c++) 
+                planes[c] = strip->planes[c] + mcuRow * encoder->mcuSize * encoder->planeStride;
+            encodeMCURow(encoder, &strip->coder, planes, 0);
+        }
+        flushBits(&strip->coder);
+        
+        pthread_mutex_lock(&encoder->stripLock);
+        strip->state = STRIP_CODED;
+        pthread_cond_broadcast(&encoder->stripCondition);
+    }
+    pthread_mutex_unlock(&encoder->stripLock);
+    
+    return NULL;
+}
+
+static void stopThreads(ZWJPEGEncoder *encoder)
+{
+    int i;
+    
+    pthread_mutex_lock(&encoder->stripLock);
+    encoder->stopThreads = 1;
+    pthread_cond_broadcast(&encoder->stripCondition);
+    pthread_mutex_unlock(&encoder->stripLock);
+    
+    for (i = 0; i < encoder->threadCount; i++) 
+        pthread_join(encoder->threads[i], NULL);
+    free(encoder->threads);
+    encoder->threads = NULL;
+    encoder->threadCount = 0;
+    
+    pthread_cond_destroy(&encoder->stripCondition);
+    pthread_mutex_destroy(&encoder->stripLock);
+}
+
+int ZWJPEGEncoderSetThreads(ZWJPEGEncoder *encoder, int threads)
+{
+    int stripMCURows, i, c;
+    
+    if (encoder->wroteHeaders || encoder->threadCount) 
+        return 0;
+    if (threads < 2) 
+        return 1;
+    
+    // The restart interval is a strip's worth of MCUs, and has to fit in 16 bits
+    stripMCURows = STRIP_PIXELS / (encoder->planeStride * encoder->mcuSize);
+    if (stripMCURows < 1) 
+        stripMCURows = 1;
+    if (stripMCURows > 65535 / encoder->mcusPerRow) 
+        stripMCURows = 65535 / encoder->mcusPerRow;
+    if (stripMCURows < 1) 
+        return 0;
+    
+    // Enough strips for every thread to have one while the next is being filled
+    encoder->stripCount = threads + 1;
+    encoder->strips = (Strip *)calloc(encoder->stripCount, sizeof(Strip));
+    encoder->threads = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    if (encoder->strips == NULL || encoder->threads == NULL) 
+        goto bail;
+    for (i = 0; i < encoder->stripCount; i++) {
+        for (c = 0; c < encoder->components; c++) {
+            encoder->strips[i].planes[c] = (unsigned char *)ZWScratchAlloc(encoder->arena, stripMCURows * encoder->mcuSize * encoder->planeStride);
+            if (encoder->strips[i].planes[c] == NULL) 
+                goto bail;
+        }
+    }
+    
+    pthread_mutex_init(&encoder->stripLock, NULL);
+    pthread_cond_init(&encoder->stripCondition, NULL);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&encoder->threads[i], NULL, codeStrips, encoder) != 0) 
+            break;
+        encoder->threadCount++;
+    }
+    if (encoder->threadCount == 0) {
+        pthread_cond_destroy(&encoder->stripCondition);
+        pthread_mutex_destroy(&encoder->stripLock);
+        goto bail;
+    }
+    
+    encoder->stripMCURows = stripMCURows;
+    encoder->restartInterval = stripMCURows * encoder->mcusPerRow;
+    return 1;
+    
+bail:
+    if (encoder->strips) {
+        for (i = 0; i < encoder->stripCount; i++) 
+            for (c = 0; c < 3; c++) 
+                ZWScratchFree(encoder->arena, encoder->strips[i].planes[c]);
+    }
+    free(encoder->strips);
+    free(encoder->threads);
+    encoder->strips = NULL;
+    encoder->threads = NULL;
+    encoder->stripCount = 0;
+    return 0;
+}
+
+// Waits for the next strip in order to be coded and stitches it onto the output
+static void writeNextStrip(ZWJPEGEncoder *encoder)
+{
+    Strip *strip = &encoder->strips[encoder->stripsWritten % encoder->stripCount];
+    
+    pthread_mutex_lock(&encoder->stripLock);
+    while (strip->state != STRIP_CODED) 
+        pthread_cond_wait(&encoder->stripCondition, &encoder->stripLock);
+    pthread_mutex_unlock(&encoder->stripLock);
+    
+    if (strip->coder.failed) 
+        encoder->failed = 1;
+    if (encoder->stripsWritten > 0) {
+        putMarker(&encoder->coder, ZWJPEG_RST0 + encoder->nextRestart, 0);
+        encoder->nextRestart = (encoder->nextRestart + 1) & 7;
+    }
+    putBytes(&encoder->coder, strip->coder.bytes, strip->coder.used);
+    encoder->stripsWritten++;
+}
+
+static void queueStrip(ZWJPEGEncoder *encoder, Strip *strip)
+{
+    pthread_mutex_lock(&encoder->stripLock);
+    strip->state = STRIP_QUEUED;
+    encoder->stripsQueued++;
+    pthread_cond_broadcast(&encoder->stripCondition);
+    pthread_mutex_unlock(&encoder->stripLock);
+}
+
+// The strip the next MCU row goes in, starting a new one (once its slot's last strip is written) if need be
+static Strip *fillingStrip(ZWJPEGEncoder *encoder)
+{
+    Strip *strip;
+    
+    if (encoder->stripsStarted > encoder->stripsQueued) 
+        return &encoder->strips[encoder->stripsQueued % encoder->stripCount];
+    
+    if (encoder->stripsStarted - encoder->stripsWritten == encoder->stripCount) 
+        writeNextStrip(encoder);
+    
+    strip = &encoder->strips[encoder->stripsStarted % encoder->stripCount];
+    strip->state = STRIP_FILLING;
+    strip->index = encoder->stripsStarted;
+    strip->mcuRows = 0;
+    encoder->stripsStarted++;
+    return strip;
+}
+
+#pragma mark Scanlines
+
+int ZWJPEGEncoderWriteScanline(ZWJPEGEncoder *encoder, const unsigned char *row)
+{
+    int x, y = encoder->rowsBuffered;
+    unsigned char **planes = encoder->planes;
+    unsigned char *stripPlanes[3];
+    Strip *strip = NULL;
+    
+    if (encoder->failed || encoder->scanlinesWritten >= encoder->height) 
+        return 0;
+    if (!encoder->wroteHeaders) 
+        writeHeaders(encoder);
+    
+    // With threads, samples go straight into their strip
+    if (encoder->threadCount) {
+        int c;
+        
+        strip = fillingStrip(encoder);
+        for (c = 0; c < encoder->components; c++) 
+            stripPlanes[c] = strip->planes[c] + strip->mcuRows * encoder->mcuSize * encoder->planeStride;
+        planes = stripPlanes;
+    }
+    
+    if (encoder->components == 1) {
+        unsigned char *out = planes[0] + y * encoder->planeStride;
+        memcpy(out, row, encoder->width);
+        memset(out + encoder->width, row[encoder->width - 1], encoder->planeStride - encoder->width);
+    }
+    else {
+        unsigned char *outY = planes[0] + y * encoder->planeStride;
+        unsigned char *outCb = planes[1] + y * encoder->planeStride;
+        unsigned char *outCr = planes[2] + y * encoder->planeStride;
+        
+        // fixed point JFIF RGB -> YCbCr, rounded
+        for (x = 0; x < encoder->width; x++) {
+            int r = row[0], g = row[1], b = row[2];
+            outY[x] = (unsigned char)((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+            outCb[x] = (unsigned char)((-11056 * r - 21712 * g + 32768 * b + (128 << 16) + 32767) >> 16);
+            outCr[x] = (unsigned char)((32768 * r - 27440 * g - 5328 * b + (128 << 16) + 32767) >> 16);
+            row += 3;
+        }
+        
+        // replicate the last pixel out to the MCU boundary
+        for (; x < encoder->planeStride; x++) {
+            outY[x] = outY[x - 1];
+            outCb[x] = outCb[x - 1];
+            outCr[x] = outCr[x - 1];
+        }
+    }
+    
+    encoder->rowsBuffered++;
+    encoder->scanlinesWritten++;
+    
+    if (encoder->rowsBuffered == encoder->mcuSize) {
+        if (strip) {
+            strip->mcuRows++;
+            if (strip->mcuRows == encoder->stripMCURows || encoder->scanlinesWritten == encoder->height) 
+                queueStrip(encoder, strip);
+        }
+        else {
+            encodeMCURow(encoder, &encoder->coder, encoder->planes, 1);
+        }
+        encoder->rowsBuffered = 0;
+    }
+    
+    return !encoder->failed;
+}
+
+int ZWJPEGEncoderFinish(ZWJPEGEncoder *encoder)
+{
+    int c;
+    
+    if (encoder->failed || encoder->scanlinesWritten != encoder->height) 
+        return 0;
+    
+    if (encoder->rowsBuffered) {
+        Strip *strip = encoder->threadCount ? fillingStrip(encoder) : NULL;
+        unsigned char *planes[3];
+        
+        for (c = 0; c < encoder->components; c++) 
+            planes[c] = strip ? strip->planes[c] + strip->mcuRows * encoder->mcuSize * encoder->planeStride : encoder->planes[c];
+        
+        // replicate the last row down to the MCU boundary
+        for (c = 0; c < encoder->components; c++) {
+            int y;
+            for (y = encoder->rowsBuffered; y < encoder->mcuSize; y++) 
+                memcpy(planes[c] + y * encoder->planeStride, planes[c] + (y - 1) * encoder->planeStride, encoder->planeStride);
+        }
+        
+        if (strip) {
+            strip->mcuRows++;
+            queueStrip(encoder, strip);
+        }
+        else {
+            encodeMCURow(encoder, &encoder->coder, encoder->planes, 1);
+        }
+        encoder->rowsBuffered = 0;
+    }
+    
+    while (encoder->stripsWritten < encoder->stripsStarted) 
+        writeNextStrip(encoder);
+    
+    flushBits(&encoder->coder);
+    putMarker(&encoder->coder, ZWJPEG_EOI, 0);
+    flushOutput(encoder);
+    
+    return !encoder->failed;
+}
+
+#pragma mark Private
+
+static void buildHuffmanCodes(HuffmanCodes *codes, const unsigned char *bits, const unsigned char *values)
+{
+    int length, i, code = 0, k = 0;
+    
+    memset(codes, 0, sizeof(HuffmanCodes));
+    for (length = 1; length <= 16; length++) {
+        for (i = 0; i < bits[length]; i++) {
+            codes->codes[values[k]] = (unsigned short)code;
+            codes->sizes[values[k]] = (unsigned char)length;
+            code++;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+static inline int bitLength(int value)
+{
+    int count = 0;
+    
+    if (value < 0) 
+        value = -value;
+    while (value) {
+        count++;
+        value >>= 1;
+    }
+    return count;
+}
+
+static void encodeBlock(ZWJPEGEncoder *encoder, EntropyCoder *coder, float *block, int component)
+{
+    int table = component ? 1 : 0;
+    const float *divisors = encoder->divisors[table];
+    const HuffmanCodes *dc = &encoder->dcCodes[table];
+    const HuffmanCodes *ac = &encoder->acCodes[table];
+    int quantized[64];
+    int i, diff, size, run = 0;
+    
+    fdctBlock(block);
+    
+    for (i = 0; i < 64; i++) {
+        int natural = ZWJPEGZigzag[i];
+        float value = block[natural] * divisors[natural];
+        quantized[i] = (int)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+    
+    diff = quantized[0] - coder->dcPredictors[component];
+    coder->dcPredictors[component] = quantized[0];
+    size = bitLength(diff);
+    putBits(coder, dc->codes[size], dc->sizes[size]);
+    if (size) 
+        putBits(coder, diff < 0 ? diff - 1 : diff, size);
+    
+    for (i = 1; i < 64; i++) {
+        int value = quantized[i];
+        
+        if (value == 0) {
+            run++;
+            continue;
+        }
+        
+        while (run > 15) {
+            putBits(coder, ac->codes[0xF0], ac->sizes[0xF0]);
+            run -= 16;
+        }
+        
+        size = bitLength(value);
+        putBits(coder, ac->codes[(run << 4) | size], ac->sizes[(run << 4) | size]);
+        putBits(coder, value < 0 ? value - 1 : value, size);
+        run = 0;
+    }
+    
+    if (run) 
+        putBits(coder, ac->codes[0x00], ac->sizes[0x00]);
+}
+
+// Codes one MCU row of planes. restarts is 0 for strips, which only restart between themselves.
+static void encodeMCURow(ZWJPEGEncoder *encoder, EntropyCoder *coder, unsigned char **planes, int restarts)
+{
+    float block[64];
+    int mcu, x, y, c, bx, by;
+    
+    for (mcu = 0; mcu < encoder->mcusPerRow; mcu++) {
+        if (restarts && encoder->restartInterval) {
+            if (encoder->mcusUntilRestart == 0) {
+                flushBits(coder);
+                putMarker(coder, ZWJPEG_RST0 + encoder->nextRestart, 0);
+                encoder->nextRestart = (encoder->nextRestart + 1) & 7;
+                coder->dcPredictors[0] = coder->dcPredictors[1] = coder->dcPredictors[2] = 0;
+                encoder->mcusUntilRestart = encoder->restartInterval;
+            }
+            encoder->mcusUntilRestart--;
+        }
+        
+        if (encoder->components == 1) {
+            const unsigned char *in = planes[0] + mcu * 8;
+            for (y = 0; y < 8; y++) 
+                for (x = 0; x < 8; x++) 
+                    block[y * 8 + x] = (float)in[y * encoder->planeStride + x] - 128.0f;
+            encodeBlock(encoder, coder, block, 0);
+            continue;
+        }
+        
+        // four luminance blocks...
+        for (by = 0; by < 2; by++) {
+            for (bx = 0; bx < 2; bx++) {
+                const unsigned char *in = planes[0] + (by * 8) * encoder->planeStride + mcu * 16 + bx * 8;
+                for (y = 0; y < 8; y++) 
+                    for (x = 0; x < 8; x++) 
+                        block[y * 8 + x] = (float)in[y * encoder->planeStride + x] - 128.0f;
+                encodeBlock(encoder, coder, block, 0);
+            }
+        }
+        
+        // ...and one of each chrominance, averaged down 2x2
+        for (c = 1; c < 3; c++) {
+            const unsigned char *in = planes[c] + mcu * 16;
+            for (y = 0; y < 8; y++) {
+                const unsigned char *row0 = in + (y * 2) * encoder->planeStride;
+                const unsigned char *row1 = row0 + encoder->planeStride;
+                for (x = 0; x < 8; x++) 
+                    block[y * 8 + x] = (row0[x * 2] + row0[x * 2 + 1] + row1[x * 2] + row1[x * 2 + 1]) * 0.25f - 128.0f;
+            }
+            encodeBlock(encoder, coder, block, c);
+        }
+    }
+}
+
+// The floating point AAN forward DCT (as in libjpeg's jfdctflt.c). The output is scaled up by 8 times the
+// AAN factors, which the quantization divisors take back out.
+static void fdctBlock(float *block)
+{
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13;
+    float *p;
+    int i;
+    
+    // rows
+    for (i = 0, p = block; i < 8; i++, p += 8) {
+        tmp0 = p[0] + p[7];
+        tmp7 = p[0] - p[7];
+        tmp1 = p[1] + p[6];
+        tmp6 = p[1] - p[6];
+        tmp2 = p[2] + p[5];
+        tmp5 = p[2] - p[5];
+        tmp3 = p[3] + p[4];
+        tmp4 = p[3] - p[4];
+        
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+        
+        p[0] = tmp10 + tmp11;
+        p[4] = tmp10 - tmp11;
+        z1 = (tmp12 + tmp13) * 0.707106781f;
+        p[2] = tmp13 + z1;
+        p[6] = tmp13 - z1;
+        
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+        z5 = (tmp10 - tmp12) * 0.382683433f;
+        z2 = 0.541196100f * tmp10 + z5;
+        z4 = 1.306562965f * tmp12 + z5;
+        z3 = tmp11 * 0.707106781f;
+        z11 = tmp7 + z3;
+        z13 = tmp7 - z3;
+        
+        p[5] = z13 + z2;
+        p[3] = z13 - z2;
+        p[1] = z11 + z4;
+        p[7] = z11 - z4;
+    }
+    
+    // columns
+    for (i = 0, p = block; i < 8; i++, p++) {
+        tmp0 = p[0] + p[56];
+        tmp7 = p[0] - p[56];
+        tmp1 = p[8] + p[48];
+        tmp6 = p[8] - p[48];
+        tmp2 = p[16] + p[40];
+        tmp5 = p[16] - p[40];
+        tmp3 = p[24] + p[32];
+        tmp4 = p[24] - p[32];
+        
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+        
+        p[0] = tmp10 + tmp11;
+        p[32] = tmp10 - tmp11;
+        z1 = (tmp12 + tmp13) * 0.707106781f;
+        p[16] = tmp13 + z1;
+        p[48] = tmp13 - z1;
+        
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+        z5 = (tmp10 - tmp12) * 0.382683433f;
+        z2 = 0.541196100f * tmp10 + z5;
+        z4 = 1.306562965f * tmp12 + z5;
+        z3 = tmp11 * 0.707106781f;
+        z11 = tmp7 + z3;
+        z13 = tmp7 - z3;
+        
+        p[40] = z13 + z2;
+        p[24] = z13 - z2;
+        p[8] = z11 + z4;
+        p[56] = z11 - z4;
+    }
+}
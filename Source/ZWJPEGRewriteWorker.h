@@ -0,0 +1,66 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Foundation/Foundation.h>
+
+// Rewrites JPEG files with ZWJPEGRewrite on a thread of its own, so the export thread can have the next
+// photo rewritten while it uploads the current one. Only the latest request is worked on; asking for
+// another file before the last one is collected throws the last one away.
+@interface ZWJPEGRewriteWorker : NSObject {
+    int flags;
+    BOOL applyOrientation;
+    
+    NSConditionLock *lock;
+    NSString *pendingPath;
+    NSData *rewrittenData;
+    BOOL stopping;
+    unsigned long long bytesRead, bytesWritten;
+    
+    NSString *lastRequestedPath;    // only touched by the thread using us
+}
+
+// flags are ZWJPEGRewrite's. With applyOrientation, photos are also turned upright by their Exif orientation.
+- (id)initWithFlags:(int)newFlags applyOrientation:(BOOL)newApplyOrientation;
+
+- (void)start;
+- (void)stop;
+
+// Starts rewriting the file in the background
+- (void)rewriteFileAtPath:(NSString *)path;
+
+// Waits for the rewrite of path (starting it if it wasn't asked for) and returns the result, or nil if
+// there was nothing to change or the file couldn't be rewritten - the original is the one to use then.
+- (NSData *)rewrittenDataForFileAtPath:(NSString *)path;
+
+// Totals over the files we've rewritten, for seeing what it saves
+- (unsigned long long)bytesRead;
+- (unsigned long long)bytesWritten;
+
+@end
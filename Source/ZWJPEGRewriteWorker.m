@@ -0,0 +1,195 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWJPEGRewriteWorker.h"
+#import "ImageResizer.h"
+#import "ZWMappedData.h"
+#import "ZWScratchArena.h"
+
+enum {
+    IDLE = 0,
+    REQUESTED,
+    WORKING,
+    DONE
+};
+
+@interface ZWJPEGRewriteWorker (PrivateStuff)
+- (void)rewriteThread:(id)unused;
+@end
+
+@implementation ZWJPEGRewriteWorker
+
+- (id)initWithFlags:(int)newFlags applyOrientation:(BOOL)newApplyOrientation
+{
+    self = [super init];
+    if (self) {
+        flags = newFlags;
+        applyOrientation = newApplyOrientation;
+        lock = [[NSConditionLock alloc] initWithCondition:IDLE];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [lock release];
+    [pendingPath release];
+    [rewrittenData release];
+    [lastRequestedPath release];
+    [super dealloc];
+}
+
+- (void)start
+{
+    // the thread keeps us alive until it's stopped
+    [self retain];
+    [NSThread detachNewThreadSelector:@selector(rewriteThread:) toTarget:self withObject:nil];
+}
+
+- (void)stop
+{
+    [lock lock];
+    stopping = YES;
+    
+    // if a rewrite is under way the thread will notice when it's done
+    [lock unlockWithCondition:([lock condition] == WORKING ? WORKING : REQUESTED)];
+}
+
+- (void)rewriteFileAtPath:(NSString *)path
+{
+    [lastRequestedPath release];
+    lastRequestedPath = [path copy];
+    
+    [lock lock];
+    [pendingPath release];
+    pendingPath = [path copy];
+    [rewrittenData release];
+    rewrittenData = nil;
+    [lock unlockWithCondition:([lock condition] == WORKING ? WORKING : REQUESTED)];
+}
+
+- (NSData *)rewrittenDataForFileAtPath:(NSString *)path
+{
+    NSData *data;
+    
+    if (![lastRequestedPath isEqualToString:path]) 
+        [self rewriteFileAtPath:path];
+    
+    // only the latest request ever gets to DONE, so this is ours
+    [lock lockWhenCondition:DONE];
+    data = [rewrittenData autorelease];
+    rewrittenData = nil;
+    [lock unlockWithCondition:IDLE];
+    
+    [lastRequestedPath release];
+    lastRequestedPath = nil;
+    
+    return data;
+}
+
+- (unsigned long long)bytesRead
+{
+    unsigned long long result;
+    
+    [lock lock];
+    result = bytesRead;
+    [lock unlockWithCondition:[lock condition]];
+    return result;
+}
+
+- (unsigned long long)bytesWritten
+{
+    unsigned long long result;
+    
+    [lock lock];
+    result = bytesWritten;
+    [lock unlockWithCondition:[lock condition]];
+    return result;
+}
+
+@end
+
+@implementation ZWJPEGRewriteWorker (PrivateStuff)
+
+- (void)rewriteThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    // ours alone, so it doesn't need locking
+    ZWScratchArena *arena = ZWScratchArenaCreate();
+    
+    while (1) {
+        NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+        NSString *path;
+        
+        [lock lockWhenCondition:REQUESTED];
+        if (stopping) {
+            [lock unlockWithCondition:IDLE];
+            [innerPool release];
+            break;
+        }
+        path = [pendingPath autorelease];
+        pendingPath = nil;
+        [lock unlockWithCondition:WORKING];
+        
+        NSData *original = [ZWMappedData mappedDataWithContentsOfFile:path];
+        NSData *rewritten = nil;
+        if (original) 
+            rewritten = [ImageResizer rewriteJPEGData:original flags:flags applyOrientation:applyOrientation scratchArena:arena];
+        ZWScratchArenaReset(arena);
+        
+        [lock lock];
+        if (rewritten) {
+            bytesRead += [original length];
+            bytesWritten += [rewritten length];
+        }
+        if (stopping) {
+            [lock unlockWithCondition:IDLE];
+            [innerPool release];
+            break;
+        }
+        if (pendingPath) {
+            // asked for something else while we were busy, so this one isn't wanted
+            [lock unlockWithCondition:REQUESTED];
+        }
+        else {
+            rewrittenData = [rewritten retain];
+            [lock unlockWithCondition:DONE];
+        }
+        
+        [innerPool release];
+    }
+    
+    ZWScratchArenaDestroy(arena);
+    [pool release];
+    [self release];
+}
+
+@end
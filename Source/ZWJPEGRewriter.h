@@ -0,0 +1,86 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Rewrites a JPEG without decoding it to pixels. Metadata segments (Exif, XMP, ICC profiles, comments, 
+// the other APPn junk cameras and editors leave) can be kept or dropped, GPS can be taken out of the Exif,
+// and the image can be rotated or flipped losslessly by moving the DCT blocks around. With no transform
+// the image data is copied byte for byte, so the whole thing costs about what copying the file does.
+
+#ifndef ZWJPEGREWRITER_H
+#define ZWJPEGREWRITER_H
+
+#include <stddef.h>
+#include "ZWScratchArena.h"
+#include "ZWJPEGEncoder.h"
+
+// What to keep. JFIF and Adobe segments are always kept, since they say how to decode the image.
+enum {
+    ZWJPEGKeepExif          = 1 << 0,
+    ZWJPEGKeepXMP           = 1 << 1,
+    ZWJPEGKeepICC           = 1 << 2,
+    ZWJPEGKeepComments      = 1 << 3,
+    ZWJPEGKeepOtherMetadata = 1 << 4,   // IPTC, multi-picture and maker-specific APPn segments
+    ZWJPEGKeepAllMetadata   = 0x1F,
+    
+    // Takes the location out of the Exif, and drops XMP that mentions it
+    ZWJPEGStripGPS          = 1 << 8,
+    
+    // Re-encodes the scan with Huffman tables built for this image rather than the generic ones most 
+    // cameras use. The coefficients are untouched, so the pixels come out identical.
+    ZWJPEGOptimizeHuffman   = 1 << 9,
+    
+    // Leaves the camera's maker note out of the Exif (often 10-100 KB of private data)
+    ZWJPEGStripMakerNotes   = 1 << 10
+};
+
+// Ordered so that each one undoes the Exif orientation one more than its value. Rotations are clockwise.
+typedef enum {
+    ZWJPEGTransformNone = 0,
+    ZWJPEGTransformFlipHorizontal,
+    ZWJPEGTransformRotate180,
+    ZWJPEGTransformFlipVertical,
+    ZWJPEGTransformTranspose,
+    ZWJPEGTransformRotate90,
+    ZWJPEGTransformTransverse,
+    ZWJPEGTransformRotate270
+} ZWJPEGTransform;
+
+// The transform that makes an image with this Exif orientation display right with none
+ZWJPEGTransform ZWJPEGTransformForExifOrientation(int orientation);
+
+// Writes the rewritten JPEG to writer. A transform sets the Exif orientation to 1, and trims any partial
+// MCU off the edges that would end up on the top or left (at most 15 pixels), as jpegtran -trim does. 
+// Transforms and ZWJPEGOptimizeHuffman need a JPEG ZWJPEGDecoder can read and use its memory (about 3 
+// bytes a pixel, from arena if it isn't NULL); without ZWJPEGOptimizeHuffman their output uses the 
+// standard Huffman tables. Returns 0 if the JPEG couldn't be rewritten or the writer gave up.
+int ZWJPEGRewrite(const unsigned char *jpeg, size_t length, int flags, ZWJPEGTransform transform, 
+                  ZWJPEGWriteFunction writer, void *context, ZWScratchArena *arena);
+
+#endif
@@ -0,0 +1,784 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWJPEGRewriter.h"
+#include "ZWJPEGCommon.h"
+#include "ZWJPEGDecoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COMPONENTS 3
+#define OUTPUT_BUFFER_SIZE 16384
+
+typedef struct {
+    unsigned short codes[256];
+    unsigned char sizes[256];
+} HuffmanCodes;
+
+typedef struct {
+    ZWJPEGWriteFunction writer;
+    void *context;
+    int failed;
+    
+    unsigned int bitBuffer;
+    int bitCount;
+    unsigned char buffer[OUTPUT_BUFFER_SIZE];
+    size_t used;
+} Output;
+
+// How each transform moves things, in terms of the output: transpose first, then mirror
+static const struct {
+    int transpose, flipX, flipY;
+} transformGeometry[8] = {
+    { 0, 0, 0 },    // none
+    { 0, 1, 0 },    // flip horizontal
+    { 0, 1, 1 },    // rotate 180
+    { 0, 0, 1 },    // flip vertical
+    { 1, 0, 0 },    // transpose
+    { 1, 1, 0 },    // rotate 90
+    { 1, 1, 1 },    // transverse
+    { 1, 0, 1 }     // rotate 270
+};
+
+static const char XMPPrefix[] = "http://ns.adobe.com/xap/1.0/";
+static const char extendedXMPPrefix[] = "http://ns.adobe.com/xmp/extension/";
+
+static int copySegments(Output *out, const unsigned char *jpeg, size_t length, int flags, int writingCoefficients, int resetOrientation, size_t *scanOffset);
+static size_t findEndOfImage(const unsigned char *jpeg, size_t length, size_t position);
+static int writeCoefficients(Output *out, const unsigned char *jpeg, size_t length, ZWJPEGDecoder *decoder, ZWJPEGTransform transform, int optimizeHuffman, ZWScratchArena *arena);
+
+#pragma mark Output
+
+static void flushOutput(Output *out)
+{
+    if (out->used && !out->failed) {
+        if (!out->writer(out->context, out->buffer, out->used)) 
+            out->failed = 1;
+    }
+    out->used = 0;
+}
+
+static inline void putByte(Output *out, unsigned char byte)
+{
+    if (out->used == OUTPUT_BUFFER_SIZE) 
+        flushOutput(out);
+    out->buffer[out->used++] = byte;
+}
+
+// Big runs (the image data we pass through) go straight to the writer rather than through the buffer
+static void putBytes(Output *out, const unsigned char *bytes, size_t length)
+{
+    if (length >= OUTPUT_BUFFER_SIZE) {
+        flushOutput(out);
+        if (!out->failed && !out->writer(out->context, bytes, length)) 
+            out->failed = 1;
+        return;
+    }
+    
+    while (length--) 
+        putByte(out, *bytes++);
+}
+
+static void putMarker(Output *out, int marker, size_t payloadLength)
+{
+    putByte(out, 0xFF);
+    putByte(out, (unsigned char)marker);
+    if (marker != ZWJPEG_SOI && marker != ZWJPEG_EOI) {
+        putByte(out, (unsigned char)((payloadLength + 2) >> 8));
+        putByte(out, (unsigned char)((payloadLength + 2) & 0xFF));
+    }
+}
+
+static inline void putBits(Output *out, unsigned int bits, int count)
+{
+    out->bitBuffer = (out->bitBuffer << count) | (bits & ((1 << count) - 1));
+    out->bitCount += count;
+    
+    while (out->bitCount >= 8) {
+        unsigned char byte = (unsigned char)(out->bitBuffer >> (out->bitCount - 8));
+        putByte(out, byte);
+        if (byte == 0xFF) 
+            putByte(out, 0);
+        out->bitCount -= 8;
+    }
+}
+
+// pads the last byte with 1 bits, as the spec asks
+static void flushBits(Output *out)
+{
+    if (out->bitCount > 0) 
+        putBits(out, 0x7F, 8 - out->bitCount);
+    out->bitBuffer = 0;
+    out->bitCount = 0;
+}
+
+#pragma mark Public
+
+ZWJPEGTransform ZWJPEGTransformForExifOrientation(int orientation)
+{
+    if (orientation < 1 || orientation > 8) 
+        return ZWJPEGTransformNone;
+    return (ZWJPEGTransform)(orientation - 1);
+}
+
+int ZWJPEGRewrite(const unsigned char *jpeg, size_t length, int flags, ZWJPEGTransform transform, 
+                  ZWJPEGWriteFunction writer, void *context, ZWScratchArena *arena)
+{
+    Output out;
+    ZWJPEGDecoder *decoder = NULL;
+    size_t scanOffset;
+    int result = 0;
+    
+    if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != ZWJPEG_SOI) 
+        return 0;
+    if ((int)transform < 0 || (int)transform > ZWJPEGTransformRotate270) 
+        return 0;
+    
+    // find out whether we can get at the coefficients before writing anything
+    if (transform != ZWJPEGTransformNone || (flags & ZWJPEGOptimizeHuffman)) {
+        decoder = ZWJPEGDecoderCreate(jpeg, length, arena);
+        if (decoder == NULL) 
+            return 0;
+    }
+    
+    out.writer = writer;
+    out.context = context;
+    out.failed = 0;
+    out.bitBuffer = 0;
+    out.bitCount = 0;
+    out.used = 0;
+    
+    putMarker(&out, ZWJPEG_SOI, 0);
+    if (copySegments(&out, jpeg, length, flags, decoder != NULL, transform != ZWJPEGTransformNone, &scanOffset)) {
+        if (decoder) {
+            result = writeCoefficients(&out, jpeg, length, decoder, transform, (flags & ZWJPEGOptimizeHuffman) != 0, arena);
+        }
+        else {
+            // Everything from the first SOS to EOI goes across untouched. Anything after EOI (the extra 
+            // images of a multi-picture file, phone makers' trailers) doesn't.
+            size_t position = scanOffset, end;
+            ZWJPEGSegment segment;
+            
+            ZWJPEGNextSegment(jpeg, length, &position, &segment);
+            end = findEndOfImage(jpeg, length, position);
+            putBytes(&out, jpeg + scanOffset, end - scanOffset);
+            if (end < scanOffset + 2 || jpeg[end - 2] != 0xFF || jpeg[end - 1] != ZWJPEG_EOI) 
+                putMarker(&out, ZWJPEG_EOI, 0);
+            result = 1;
+        }
+    }
+    flushOutput(&out);
+    
+    ZWJPEGDecoderDestroy(decoder);
+    
+    return result && !out.failed;
+}
+
+#pragma mark Segments
+
+static int startsWith(const ZWJPEGSegment *segment, const char *prefix, size_t prefixLength)
+{
+    return segment->length >= prefixLength && memcmp(segment->data, prefix, prefixLength) == 0;
+}
+
+// XMP is text, so rather than try to edit it we just look for any of the exif:GPS... properties
+static int mentionsGPS(const ZWJPEGSegment *segment)
+{
+    size_t i;
+    
+    for (i = 0; i + 8 <= segment->length; i++) {
+        if (segment->data[i] == 'e' && memcmp(segment->data + i, "exif:GPS", 8) == 0) 
+            return 1;
+    }
+    return 0;
+}
+
+static int keepSegment(const ZWJPEGSegment *segment, int flags)
+{
+    switch (segment->marker) {
+        case ZWJPEG_APP0:
+            return startsWith(segment, "JFIF\0", 5) || (flags & ZWJPEGKeepOtherMetadata);
+            
+        case ZWJPEG_APP1:
+            if (startsWith(segment, "Exif\0\0", 6)) 
+                return (flags & ZWJPEGKeepExif) != 0;
+            if (startsWith(segment, XMPPrefix, sizeof(XMPPrefix)) || startsWith(segment, extendedXMPPrefix, sizeof(extendedXMPPrefix))) 
+                return (flags & ZWJPEGKeepXMP) && !((flags & ZWJPEGStripGPS) && mentionsGPS(segment));
+            return (flags & ZWJPEGKeepOtherMetadata) != 0;
+            
+        case ZWJPEG_APP2:
+            if (startsWith(segment, "ICC_PROFILE\0", 12)) 
+                return (flags & ZWJPEGKeepICC) != 0;
+            return (flags & ZWJPEGKeepOtherMetadata) != 0;
+            
+        case ZWJPEG_APP14:
+            return 1;
+            
+        case ZWJPEG_COM:
+            return (flags & ZWJPEGKeepComments) != 0;
+            
+        default:
+            if (segment->marker > ZWJPEG_APP2 && segment->marker <= 0xEF) 
+                return (flags & ZWJPEGKeepOtherMetadata) != 0;
+            return 1;
+    }
+}
+
+// Copies the segments before the first SOS that we're keeping and sets scanOffset to the SOS. When we're
+// writing the coefficients ourselves, the tables, frame header and restart interval are left for 
+// writeCoefficients to write.
+static int copySegments(Output *out, const unsigned char *jpeg, size_t length, int flags, int writingCoefficients, int resetOrientation, size_t *scanOffset)
+{
+    ZWJPEGSegment segment;
+    size_t position = 0;
+    
+    while (ZWJPEGNextSegment(jpeg, length, &position, &segment)) {
+        int isMetadata = ((segment.marker >= ZWJPEG_APP0 && segment.marker <= 0xEF) || segment.marker == ZWJPEG_COM);
+        
+        if (segment.marker == ZWJPEG_SOS) {
+            *scanOffset = segment.offset;
+            return 1;
+        }
+        if (segment.marker == ZWJPEG_SOI) 
+            continue;
+        if (segment.marker == ZWJPEG_EOI) 
+            return 0;
+        if (!isMetadata && writingCoefficients) 
+            continue;
+        if (!keepSegment(&segment, flags)) 
+            continue;
+        
+        if (segment.marker == ZWJPEG_APP1 && startsWith(&segment, "Exif\0\0", 6) && (flags & (ZWJPEGStripGPS | ZWJPEGStripMakerNotes) || resetOrientation)) {
+            // edit a copy, since the original is probably a read-only mapping
+            unsigned char *exif = (unsigned char *)malloc(segment.length);
+            size_t exifLength = 0;
+            if (exif == NULL) 
+                return 0;
+            
+            if (flags & ZWJPEGStripMakerNotes) 
+                exifLength = ZWJPEGExifRebuild(segment.data, segment.length, 1, (flags & ZWJPEGStripGPS) != 0, exif);
+            if (exifLength == 0) {
+                exifLength = segment.length;
+                memcpy(exif, segment.data, segment.length);
+                if (flags & ZWJPEGStripGPS) 
+                    ZWJPEGExifRemoveGPS(exif, exifLength);
+            }
+            if (resetOrientation && ZWJPEGExifOrientation(exif, exifLength, 0)) 
+                ZWJPEGExifOrientation(exif, exifLength, 1);
+            
+            putMarker(out, segment.marker, exifLength);
+            putBytes(out, exif, exifLength);
+            free(exif);
+        }
+        else {
+            size_t segmentLength = segment.data ? (size_t)((segment.data + segment.length) - (jpeg + segment.offset)) : 2;
+            putBytes(out, jpeg + segment.offset, segmentLength);
+        }
+    }
+    
+    return 0;
+}
+
+// position is just past an SOS segment. Returns the offset just past the EOI, skipping over the tables
+// and headers between the scans of a progressive image, or length if there's no EOI.
+static size_t findEndOfImage(const unsigned char *jpeg, size_t length, size_t position)
+{
+    ZWJPEGSegment segment;
+    
+    while (position + 1 < length) {
+        const unsigned char *p = (const unsigned char *)memchr(jpeg + position, 0xFF, length - position - 1);
+        int marker;
+        
+        if (p == NULL) 
+            return length;
+        position = p - jpeg;
+        marker = jpeg[position + 1];
+        
+        // stuffed zeros, restart markers and fill bytes are all part of the scan
+        if (marker == 0 || marker == 0xFF || (marker >= ZWJPEG_RST0 && marker <= ZWJPEG_RST7)) {
+            position++;
+            continue;
+        }
+        if (marker == ZWJPEG_EOI) 
+            return position + 2;
+        if (!ZWJPEGNextSegment(jpeg, length, &position, &segment)) 
+            return length;
+    }
+    
+    return length;
+}
+
+#pragma mark Coefficients
+
+// The decoded coefficients and where each output block comes from
+typedef struct {
+    int components;
+    ZWJPEGComponentInfo info[MAX_COMPONENTS];
+    short *coefficients[MAX_COMPONENTS];
+    int mcuRows;
+    int transpose, flipX, flipY;
+    int outMCUsPerRow, outMCURows;
+} Blocks;
+
+// How often each Huffman symbol comes up, for building optimal tables. The extra slot is for the code
+// point that's reserved so no code is all 1 bits.
+typedef struct {
+    long dc[2][257];
+    long ac[2][257];
+} SymbolCounts;
+
+static void buildHuffmanCodes(HuffmanCodes *codes, const unsigned char *bits, const unsigned char *values)
+{
+    int length, i, code = 0, k = 0;
+    
+    memset(codes, 0, sizeof(HuffmanCodes));
+    for (length = 1; length <= 16; length++) {
+        for (i = 0; i < bits[length]; i++) {
+            codes->codes[values[k]] = (unsigned short)code;
+            codes->sizes[values[k]] = (unsigned char)length;
+            code++;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+// Builds the best code lengths for the counts, no longer than 16 bits, as in section K.2 of the spec
+static void buildOptimalTable(const long *symbolCounts, unsigned char bits[17], unsigned char values[256])
+{
+    long frequencies[257];
+    int codeSizes[257], others[257], lengthCounts[33];
+    int i, j, c1, c2, k = 0;
+    
+    memcpy(frequencies, symbolCounts, sizeof(frequencies));
+    frequencies[256] = 1;
+    for (i = 0; i < 257; i++) {
+        codeSizes[i] = 0;
+        others[i] = -1;
+    }
+    
+    // Huffman's algorithm: keep merging the two least frequent trees
+    while (1) {
+        long least = 0x7FFFFFFF;
+        
+        c1 = -1;
+        for (i = 0; i < 257; i++) {
+            if (frequencies[i] && frequencies[i] <= least) {
+                least = frequencies[i];
+                c1 = i;
+            }
+        }
+        c2 = -1;
+        least = 0x7FFFFFFF;
+        for (i = 0; i < 257; i++) {
+            if (frequencies[i] && frequencies[i] <= least && i != c1) {
+                least = frequencies[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) 
+            break;
+        
+        frequencies[c1] += frequencies[c2];
+        frequencies[c2] = 0;
+        
+        codeSizes[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            codeSizes[c1]++;
+        }
+        others[c1] = c2;
+        
+        codeSizes[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            codeSizes[c2]++;
+        }
+    }
+    
+    memset(lengthCounts, 0, sizeof(lengthCounts));
+    for (i = 0; i < 257; i++) {
+        if (codeSizes[i]) 
+            lengthCounts[codeSizes[i] > 32 ? 32 : codeSizes[i]]++;
+    }
+    
+    // Codes longer than 16 bits: move pairs of them up a level, and push a shorter code down to make room
+    for (i = 32; i > 16; i--) {
+        while (lengthCounts[i] > 0) {
+            j = i - 2;
+            while (lengthCounts[j] == 0) 
+                j--;
+            lengthCounts[i] -= 2;
+            lengthCounts[i - 1]++;
+            lengthCounts[j + 1] += 2;
+            lengthCounts[j]--;
+        }
+    }
+    
+    // and give back the reserved code point, which is one of the longest
+    while (lengthCounts[i] == 0) 
+        i--;
+    lengthCounts[i]--;
+    
+    bits[0] = 0;
+    for (i = 1; i <= 16; i++) 
+        bits[i] = (unsigned char)lengthCounts[i];
+    for (i = 1; i <= 32; i++) {
+        for (j = 0; j < 256; j++) {
+            if (codeSizes[j] == i) 
+                values[k++] = (unsigned char)j;
+        }
+    }
+}
+
+static void putHuffmanTable(Output *out, int tableClass, int table, const unsigned char *bits, const unsigned char *values)
+{
+    int i, count = 0;
+    
+    for (i = 1; i <= 16; i++) 
+        count += bits[i];
+    
+    putMarker(out, ZWJPEG_DHT, 17 + count);
+    putByte(out, (unsigned char)((tableClass << 4) | table));
+    putBytes(out, bits + 1, 16);
+    putBytes(out, values, count);
+}
+
+static inline int bitLength(int value)
+{
+    int count = 0;
+    
+    if (value < 0) 
+        value = -value;
+    while (value) {
+        count++;
+        value >>= 1;
+    }
+    return count;
+}
+
+// Either writes the block with the given codes, or (with out NULL) just counts the symbols it would use
+static void encodeBlock(Output *out, const short *block, int *predictor, const HuffmanCodes *dc, const HuffmanCodes *ac, long *dcCounts, long *acCounts)
+{
+    int i, diff, size, run = 0;
+    
+    diff = block[0] - *predictor;
+    *predictor = block[0];
+    size = bitLength(diff);
+    if (out == NULL) {
+        dcCounts[size]++;
+    }
+    else {
+        putBits(out, dc->codes[size], dc->sizes[size]);
+        if (size) 
+            putBits(out, diff < 0 ? diff - 1 : diff, size);
+    }
+    
+    for (i = 1; i < 64; i++) {
+        int value = block[ZWJPEGZigzag[i]];
+        
+        if (value == 0) {
+            run++;
+            continue;
+        }
+        
+        while (run > 15) {
+            if (out == NULL) 
+                acCounts[0xF0]++;
+            else 
+                putBits(out, ac->codes[0xF0], ac->sizes[0xF0]);
+            run -= 16;
+        }
+        
+        size = bitLength(value);
+        if (out == NULL) {
+            acCounts[(run << 4) | size]++;
+        }
+        else {
+            putBits(out, ac->codes[(run << 4) | size], ac->sizes[(run << 4) | size]);
+            putBits(out, value < 0 ? value - 1 : value, size);
+        }
+        run = 0;
+    }
+    
+    if (run) {
+        if (out == NULL) 
+            acCounts[0x00]++;
+        else 
+            putBits(out, ac->codes[0x00], ac->sizes[0x00]);
+    }
+}
+
+// Goes through the output blocks in order, writing them or counting their symbols (see encodeBlock). Each 
+// output block comes from the source block it lands on, with its coefficients transposed and every odd
+// frequency along a mirrored axis negated.
+static void scanBlocks(const Blocks *blocks, Output *out, const HuffmanCodes dc[2], const HuffmanCodes ac[2], SymbolCounts *counts)
+{
+    int predictors[MAX_COMPONENTS] = { 0, 0, 0 };
+    int row, mcu, i, bx, by, u, v;
+    
+    for (row = 0; row < blocks->outMCURows && !(out && out->failed); row++) {
+        for (mcu = 0; mcu < blocks->outMCUsPerRow; mcu++) {
+            for (i = 0; i < blocks->components; i++) {
+                const ZWJPEGComponentInfo *info = &blocks->info[i];
+                int outH = blocks->transpose ? info->v : info->h;
+                int outV = blocks->transpose ? info->h : info->v;
+                int sourceBlocksHigh = info->v * blocks->mcuRows;
+                int table = i ? 1 : 0;
+                
+                for (by = 0; by < outV; by++) {
+                    for (bx = 0; bx < outH; bx++) {
+                        int x = mcu * outH + bx, y = row * outV + by, sx, sy;
+                        short block[64];
+                        const short *source;
+                        
+                        if (blocks->flipX) 
+                            x = blocks->outMCUsPerRow * outH - 1 - x;
+                        if (blocks->flipY) 
+                            y = blocks->outMCURows * outV - 1 - y;
+                        sx = blocks->transpose ? y : x;
+                        sy = blocks->transpose ? x : y;
+                        
+                        if (sx >= info->blocksPerRow || sy >= sourceBlocksHigh) {
+                            memset(block, 0, sizeof(block));
+                            source = block;
+                        }
+                        else if (!blocks->transpose && !blocks->flipX && !blocks->flipY) {
+                            source = blocks->coefficients[i] + 64 * (sy * info->blocksPerRow + sx);
+                        }
+                        else {
+                            source = blocks->coefficients[i] + 64 * (sy * info->blocksPerRow + sx);
+                            for (v = 0; v < 8; v++) {
+                                for (u = 0; u < 8; u++) {
+                                    int value = blocks->transpose ? source[u * 8 + v] : source[v * 8 + u];
+                                    if ((blocks->flipX && (u & 1)) != (blocks->flipY && (v & 1))) 
+                                        value = -value;
+                                    block[v * 8 + u] = (short)value;
+                                }
+                            }
+                            source = block;
+                        }
+                        
+                        if (out) 
+                            encodeBlock(out, source, &predictors[i], &dc[table], &ac[table], NULL, NULL);
+                        else 
+                            encodeBlock(NULL, source, &predictors[i], NULL, NULL, counts->dc[table], counts->ac[table]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Reads the quantization tables (natural order) from the DQT segments before the first SOS
+static void readQuantTables(const unsigned char *jpeg, size_t length, unsigned short quant[4][64], int defined[4])
+{
+    ZWJPEGSegment segment;
+    size_t position = 0;
+    int i;
+    
+    while (ZWJPEGNextSegment(jpeg, length, &position, &segment) && segment.marker != ZWJPEG_SOS) {
+        const unsigned char *p = segment.data;
+        size_t remaining = segment.length;
+        
+        if (segment.marker != ZWJPEG_DQT) 
+            continue;
+        
+        while (remaining >= 65) {
+            int precision = p[0] >> 4, table = p[0] & 3;
+            size_t tableLength = precision ? 129 : 65;
+            if (remaining < tableLength) 
+                break;
+            for (i = 0; i < 64; i++) 
+                quant[table][ZWJPEGZigzag[i]] = (unsigned short)(precision ? ((p[1 + i * 2] << 8) | p[2 + i * 2]) : p[1 + i]);
+            defined[table] = 1;
+            p += tableLength;
+            remaining -= tableLength;
+        }
+    }
+}
+
+static int writeCoefficients(Output *out, const unsigned char *jpeg, size_t length, ZWJPEGDecoder *decoder, ZWJPEGTransform transform, int optimizeHuffman, ZWScratchArena *arena)
+{
+    Blocks blocks;
+    unsigned short quant[4][64];
+    int quantDefined[4] = { 0, 0, 0, 0 };
+    HuffmanCodes dcCodes[2], acCodes[2];
+    SymbolCounts *counts = NULL;
+    int width = ZWJPEGDecoderGetWidth(decoder);
+    int height = ZWJPEGDecoderGetHeight(decoder);
+    int hMax = 1, vMax = 1, outWidth, outHeight, outHMax, outVMax;
+    int i, j, row, u, v, extended = 0, result = 0;
+    
+    blocks.components = ZWJPEGDecoderGetComponents(decoder);
+    blocks.mcuRows = ZWJPEGDecoderGetMCURows(decoder);
+    blocks.transpose = transformGeometry[transform].transpose;
+    blocks.flipX = transformGeometry[transform].flipX;
+    blocks.flipY = transformGeometry[transform].flipY;
+    for (i = 0; i < MAX_COMPONENTS; i++) 
+        blocks.coefficients[i] = NULL;
+    
+    for (i = 0; i < blocks.components; i++) {
+        ZWJPEGDecoderGetComponentInfo(decoder, i, &blocks.info[i]);
+        if (blocks.info[i].h > hMax) hMax = blocks.info[i].h;
+        if (blocks.info[i].v > vMax) vMax = blocks.info[i].v;
+    }
+    
+    // A partial MCU on an edge that gets mirrored would end up on the top or left, padding and all, so
+    // it's trimmed off
+    if (blocks.flipX) {
+        if (blocks.transpose) height -= height % (vMax * 8);
+        else width -= width % (hMax * 8);
+    }
+    if (blocks.flipY) {
+        if (blocks.transpose) width -= width % (hMax * 8);
+        else height -= height % (vMax * 8);
+    }
+    if (width == 0 || height == 0) 
+        return 0;
+    
+    outWidth = blocks.transpose ? height : width;
+    outHeight = blocks.transpose ? width : height;
+    outHMax = blocks.transpose ? vMax : hMax;
+    outVMax = blocks.transpose ? hMax : vMax;
+    blocks.outMCUsPerRow = (outWidth + outHMax * 8 - 1) / (outHMax * 8);
+    blocks.outMCURows = (outHeight + outVMax * 8 - 1) / (outVMax * 8);
+    
+    readQuantTables(jpeg, length, quant, quantDefined);
+    for (i = 0; i < blocks.components; i++) {
+        if (!quantDefined[blocks.info[i].quantTable]) 
+            return 0;
+    }
+    
+    // Get every coefficient of the image, since a rotation needs the bottom of it first and optimizing the
+    // tables needs to see all of it before writing any
+    for (i = 0; i < blocks.components; i++) {
+        blocks.coefficients[i] = (short *)ZWScratchAlloc(arena, sizeof(short) * 64 * blocks.info[i].blocksPerRow * blocks.info[i].v * blocks.mcuRows);
+        if (blocks.coefficients[i] == NULL) 
+            goto bail;
+    }
+    for (row = 0; row < blocks.mcuRows; row++) {
+        short *rowBlocks[MAX_COMPONENTS];
+        for (i = 0; i < blocks.components; i++) 
+            rowBlocks[i] = blocks.coefficients[i] + 64 * blocks.info[i].blocksPerRow * blocks.info[i].v * row;
+        if (!ZWJPEGDecoderReadCoefficientRow(decoder, rowBlocks)) 
+            goto bail;
+    }
+    
+    // Tables. The quantization tables get transposed along with the coefficients.
+    for (j = 0; j < 4; j++) {
+        unsigned short table[64];
+        int precision = 0;
+        
+        if (!quantDefined[j]) 
+            continue;
+        for (v = 0; v < 8; v++) {
+            for (u = 0; u < 8; u++) {
+                table[v * 8 + u] = blocks.transpose ? quant[j][u * 8 + v] : quant[j][v * 8 + u];
+                if (table[v * 8 + u] > 255) 
+                    precision = 1;
+            }
+        }
+        extended |= precision;
+        
+        putMarker(out, ZWJPEG_DQT, precision ? 129 : 65);
+        putByte(out, (unsigned char)((precision << 4) | j));
+        for (i = 0; i < 64; i++) {
+            if (precision) 
+                putByte(out, (unsigned char)(table[ZWJPEGZigzag[i]] >> 8));
+            putByte(out, (unsigned char)table[ZWJPEGZigzag[i]]);
+        }
+    }
+    
+    // 16 bit quantization tables aren't allowed in a baseline image
+    putMarker(out, extended ? ZWJPEG_SOF1 : ZWJPEG_SOF0, 6 + blocks.components * 3);
+    putByte(out, 8);
+    putByte(out, (unsigned char)(outHeight >> 8));
+    putByte(out, (unsigned char)outHeight);
+    putByte(out, (unsigned char)(outWidth >> 8));
+    putByte(out, (unsigned char)outWidth);
+    putByte(out, (unsigned char)blocks.components);
+    for (i = 0; i < blocks.components; i++) {
+        const ZWJPEGComponentInfo *info = &blocks.info[i];
+        putByte(out, (unsigned char)info->identifier);
+        putByte(out, (unsigned char)(blocks.transpose ? (info->v << 4) | info->h : (info->h << 4) | info->v));
+        putByte(out, (unsigned char)info->quantTable);
+    }
+    
+    // Luminance gets table 0 and both chroma components share table 1, either the standard ones or ones
+    // made to fit this image from a first pass over the blocks
+    if (optimizeHuffman) {
+        counts = (SymbolCounts *)calloc(1, sizeof(SymbolCounts));
+        if (counts == NULL) 
+            goto bail;
+        scanBlocks(&blocks, NULL, NULL, NULL, counts);
+    }
+    for (j = 0; j < (blocks.components > 1 ? 2 : 1); j++) {
+        unsigned char dcBits[17], dcValues[256], acBits[17], acValues[256];
+        
+        if (counts) {
+            buildOptimalTable(counts->dc[j], dcBits, dcValues);
+            buildOptimalTable(counts->ac[j], acBits, acValues);
+        }
+        else {
+            memcpy(dcBits, j ? ZWJPEGStdDCChrominanceBits : ZWJPEGStdDCLuminanceBits, 17);
+            memcpy(dcValues, j ? ZWJPEGStdDCChrominanceValues : ZWJPEGStdDCLuminanceValues, 12);
+            memcpy(acBits, j ? ZWJPEGStdACChrominanceBits : ZWJPEGStdACLuminanceBits, 17);
+            memcpy(acValues, j ? ZWJPEGStdACChrominanceValues : ZWJPEGStdACLuminanceValues, 162);
+        }
+        
+        putHuffmanTable(out, 0, j, dcBits, dcValues);
+        putHuffmanTable(out, 1, j, acBits, acValues);
+        buildHuffmanCodes(&dcCodes[j], dcBits, dcValues);
+        buildHuffmanCodes(&acCodes[j], acBits, acValues);
+    }
+    
+    putMarker(out, ZWJPEG_SOS, 4 + blocks.components * 2);
+    putByte(out, (unsigned char)blocks.components);
+    for (i = 0; i < blocks.components; i++) {
+        putByte(out, (unsigned char)blocks.info[i].identifier);
+        putByte(out, i ? 0x11 : 0x00);
+    }
+    putByte(out, 0);
+    putByte(out, 63);
+    putByte(out, 0);
+    
+    scanBlocks(&blocks, out, dcCodes, acCodes, NULL);
+    flushBits(out);
+    putMarker(out, ZWJPEG_EOI, 0);
+    result = 1;
+    
+bail:
+    free(counts);
+    for (i = 0; i < blocks.components; i++) 
+        ZWScratchFree(arena, blocks.coefficients[i]);
+    return result;
+}
@@ -0,0 +1,103 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWMappedData.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+@implementation ZWMappedData
+
++ (ZWMappedData *)mappedDataWithContentsOfFile:(NSString *)path
+{
+    return [[[self alloc] initWithMappedFile:path] autorelease];
+}
+
+- (id)initWithMappedFile:(NSString *)path
+{
+    if (!(self = [super init])) 
+        return nil;
+    
+    int fd = open([path fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) {
+        [self release];
+        return nil;
+    }
+    
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size > (off_t)UINT_MAX) {
+        close(fd);
+        [self release];
+        return nil;
+    }
+    
+    mappedLength = (unsigned)sb.st_size;
+    if (mappedLength > 0) {
+        mappedBytes = mmap(NULL, mappedLength, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
+        if (mappedBytes == MAP_FAILED) {
+            mappedBytes = NULL;
+            close(fd);
+            [self release];
+            return nil;
+        }
+        madvise(mappedBytes, mappedLength, MADV_SEQUENTIAL);
+    }
+    
+    // the mapping holds its own reference to the file
+    close(fd);
+    
+    return self;
+}
+
+- (void)dealloc
+{
+    if (mappedBytes) 
+        munmap(mappedBytes, mappedLength);
+    
+    [super dealloc];
+}
+
+#pragma mark NSData
+
+- (const void *)bytes
+{
+    return mappedBytes;
+}
+
+- (unsigned)length
+{
+    return mappedLength;
+}
+
+@end
@@ -0,0 +1,76 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+//
+//  Timing for the ways messages get between threads here: InterThreadMessaging's transports and
+//  -performSelectorOnMainThread:. Run by hand from the Benchmarks tool. It switches InterThreadMessaging's
+//  transport for every thread prepared while it runs, so it has no place in the plugin.
+//
+
+#import <Foundation/Foundation.h>
+#import "InterThreadMessaging.h"
+
+typedef enum {
+    ZWMessagingPortTransport = 0,       // InterThreadMessaging over NSPorts
+    ZWMessagingQueueTransport,          // InterThreadMessaging's lock-free queue
+    ZWMessagingMainThreadTransport      // -performSelectorOnMainThread:, to the main thread
+} ZWMessagingBenchmarkTransport;
+
+@interface ZWMessagingBenchmark : NSObject {
+    ZWMessagingBenchmarkTransport transport;
+    unsigned long messagesPerProducer;
+    double interval;
+    
+    NSConditionLock *lock;
+    NSThread *consumerThread;
+    NSArray *modes;
+    BOOL done;
+    
+    unsigned long expected;
+    unsigned long received;     // these are the consumer's alone
+    uint64_t finishTime;
+    uint64_t *latencies;
+}
+
+// Every transport above, in order
++ (NSArray *)allTransports;
+
+// Starts that many producer threads, which each send messagesPerProducer messages, at rate messages a second (as fast as 
+// they can if it's 0), to one thread running its run loop. The InterThreadMessaging transports get a thread 
+// of their own to send to; the main thread one sends to the main thread, so it has to be called from some 
+// other thread. Returns a dictionary with "Transport" (the one actually used), "Producers", 
+// "MessagesPerProducer", "Rate", "MessagesPerSecond", and "MeanLatencySeconds", "P50LatencySeconds", 
+// "P99LatencySeconds", "P999LatencySeconds" and "MaxLatencySeconds" from send to delivery.
++ (NSDictionary *)benchmarkTransport:(ZWMessagingBenchmarkTransport)transport 
+                           producers:(unsigned int)producers 
+                 messagesPerProducer:(unsigned long)count 
+                                rate:(double)rate;
+
+@end
@@ -0,0 +1,254 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWMessagingBenchmark.h"
+#include <mach/mach_time.h>
+#include <math.h>
+
+enum {
+    STARTING = 0,
+    READY,
+    FINISHED
+};
+
+@interface ZWMessagingBenchmark (PrivateStuff)
+- (NSDictionary *)runWithProducers:(unsigned int)producers;
+- (void)consumerThread:(id)unused;
+- (void)producerThread:(id)unused;
+- (void)receive:(NSNumber *)sendTime;
+@end
+
+static double secondsFromAbsolute(uint64_t absolute)
+{
+    static mach_timebase_info_data_t timebase;
+    
+    if (timebase.denom == 0) 
+        mach_timebase_info(&timebase);
+    return (double)absolute * timebase.numer / timebase.denom / 1e9;
+}
+
+static uint64_t absoluteFromSeconds(double seconds)
+{
+    static mach_timebase_info_data_t timebase;
+    
+    if (timebase.denom == 0) 
+        mach_timebase_info(&timebase);
+    return (uint64_t)(seconds * 1e9 * timebase.denom / timebase.numer);
+}
+
+static int compareLatencies(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+    return (first > second) - (first < second);
+}
+
+// Nearest rank, from latencies already sorted
+static NSNumber *percentile(const uint64_t *latencies, unsigned long count, double fraction)
+{
+    unsigned long rank = (unsigned long)ceil(fraction * count);
+    
+    if (rank < 1) 
+        rank = 1;
+    return [NSNumber numberWithDouble:secondsFromAbsolute(latencies[rank - 1])];
+}
+
+@implementation ZWMessagingBenchmark
+
++ (NSArray *)allTransports
+{
+    return [NSArray arrayWithObjects:
+        [NSNumber numberWithInt:ZWMessagingPortTransport], 
+        [NSNumber numberWithInt:ZWMessagingQueueTransport], 
+        [NSNumber numberWithInt:ZWMessagingMainThreadTransport], 
+        nil];
+}
+
++ (NSDictionary *)benchmarkTransport:(ZWMessagingBenchmarkTransport)newTransport 
+                           producers:(unsigned int)producers 
+                 messagesPerProducer:(unsigned long)count 
+                                rate:(double)rate
+{
+    InterThreadMessageTransport previous = [NSThread interThreadMessageTransport];
+    ZWMessagingBenchmark *benchmark = [[[self alloc] init] autorelease];
+    NSMutableDictionary *result;
+    NSString *name;
+    
+    if (producers == 0 || count == 0) 
+        return nil;
+    
+    // Only threads prepared from now on get the transport, so the consumer is one of ours
+    if (newTransport == ZWMessagingPortTransport) 
+        [NSThread setInterThreadMessageTransport:kITMPortTransport];
+    else if (newTransport == ZWMessagingQueueTransport && [NSThread setInterThreadMessageTransport:kITMQueueTransport] != kITMQueueTransport) 
+        newTransport = ZWMessagingPortTransport;
+    
+    benchmark->transport = newTransport;
+    benchmark->messagesPerProducer = count;
+    benchmark->interval = (rate > 0) ? 1.0 / rate : 0;
+    result = [NSMutableDictionary dictionaryWithDictionary:[benchmark runWithProducers:producers]];
+    [NSThread setInterThreadMessageTransport:previous];
+    
+    if (newTransport == ZWMessagingQueueTransport) 
+        name = @"queue";
+    else if (newTransport == ZWMessagingPortTransport) 
+        name = @"port";
+    else 
+        name = @"main-thread";
+    [result setObject:name forKey:@"Transport"];
+    [result setObject:[NSNumber numberWithUnsignedInt:producers] forKey:@"Producers"];
+    [result setObject:[NSNumber numberWithUnsignedLong:count] forKey:@"MessagesPerProducer"];
+    [result setObject:[NSNumber numberWithDouble:rate] forKey:@"Rate"];
+    return result;
+}
+
+- (void)dealloc
+{
+    [lock release];
+    [consumerThread release];
+    [modes release];
+    free(latencies);
+    [super dealloc];
+}
+
+@end
+
+@implementation ZWMessagingBenchmark (PrivateStuff)
+
+- (NSDictionary *)runWithProducers:(unsigned int)producers
+{
+    uint64_t start, totalLatency = 0;
+    unsigned long i;
+    unsigned int p;
+    
+    expected = messagesPerProducer * producers;
+    latencies = malloc(expected * sizeof(uint64_t));
+    if (latencies == NULL) 
+        return nil;
+    
+    // the main thread could be in a modal session, like it is during an export
+    modes = [[NSArray alloc] initWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil];
+    lock = [[NSConditionLock alloc] initWithCondition:STARTING];
+    if (transport == ZWMessagingMainThreadTransport) {
+        [lock lock];
+        [lock unlockWithCondition:READY];
+    } else {
+        [NSThread detachNewThreadSelector:@selector(consumerThread:) toTarget:self withObject:nil];
+    }
+    [lock lockWhenCondition:READY];
+    [lock unlock];
+    
+    start = mach_absolute_time();
+    for (p = 0; p < producers; p++) 
+        [NSThread detachNewThreadSelector:@selector(producerThread:) toTarget:self withObject:nil];
+    
+    [lock lockWhenCondition:FINISHED];
+    [lock unlock];
+    
+    for (i = 0; i < expected; i++) 
+        totalLatency += latencies[i];
+    qsort(latencies, expected, sizeof(uint64_t), compareLatencies);
+    
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithDouble:expected / secondsFromAbsolute(finishTime - start)], @"MessagesPerSecond",
+        [NSNumber numberWithDouble:secondsFromAbsolute(totalLatency) / expected], @"MeanLatencySeconds",
+        percentile(latencies, expected, 0.5), @"P50LatencySeconds",
+        percentile(latencies, expected, 0.99), @"P99LatencySeconds",
+        percentile(latencies, expected, 0.999), @"P999LatencySeconds",
+        [NSNumber numberWithDouble:secondsFromAbsolute(latencies[expected - 1])], @"MaxLatencySeconds",
+        nil];
+}
+
+- (void)consumerThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    [self retain];
+    [NSThread prepareForInterThreadMessages];
+    consumerThread = [[NSThread currentThread] retain];
+    
+    [lock lock];
+    [lock unlockWithCondition:READY];
+    
+    while (!done) {
+        NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+        [innerPool release];
+    }
+    
+    [pool release];
+    [self release];
+}
+
+- (void)producerThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    uint64_t next = mach_absolute_time(), step = absoluteFromSeconds(interval);
+    unsigned long i;
+    
+    [self retain];
+    
+    for (i = 0; i < messagesPerProducer; i++) {
+        NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+        NSNumber *sendTime;
+        
+        // paced from when we started rather than from the last send, so a late message doesn't slow the rest
+        if (step) {
+            mach_wait_until(next);
+            next += step;
+        }
+        
+        sendTime = [NSNumber numberWithUnsignedLongLong:mach_absolute_time()];
+        if (transport == ZWMessagingMainThreadTransport) 
+            [self performSelectorOnMainThread:@selector(receive:) withObject:sendTime waitUntilDone:NO modes:modes];
+        else 
+            [self performSelector:@selector(receive:) withObject:sendTime inThread:consumerThread];
+        
+        [innerPool release];
+    }
+    
+    [pool release];
+    [self release];
+}
+
+- (void)receive:(NSNumber *)sendTime
+{
+    uint64_t now = mach_absolute_time();
+    
+    latencies[received] = now - [sendTime unsignedLongLongValue];
+    
+    if (++received == expected) {
+        finishTime = now;
+        done = YES;
+        [lock lock];
+        [lock unlockWithCondition:FINISHED];
+    }
+}
+
+@end
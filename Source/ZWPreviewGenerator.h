@@ -0,0 +1,61 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Cocoa/Cocoa.h>
+
+@class ZWProgressChannel;
+
+// Makes the small pictures shown in the progress panel, on a thread of its own so the export thread never
+// waits on them. A preview comes from the cheapest place that has one: iPhoto's thumbnail, then the 
+// thumbnail embedded in the photo's EXIF, then a 1/8 scale decode of the JPEG that only looks at each 
+// block's DC coefficient. Only the newest request is kept, so a slow preview never holds up the next one.
+@interface ZWPreviewGenerator : NSObject {
+    ZWProgressChannel *channel;
+    NSSize maxSize;
+    
+    NSConditionLock *requestLock;
+    NSDictionary *pendingRequest;
+    BOOL stopping;
+}
+
+// Previews are put in the channel along with the index they were asked for with, and are no bigger than
+// about twice maxSize.
+- (id)initWithProgressChannel:(ZWProgressChannel *)newChannel maxSize:(NSSize)newMaxSize;
+
+- (void)start;
+- (void)stop;
+
+// Replaces any request that hasn't been started yet. thumbnailPath may be nil.
+- (void)requestPreviewForIndex:(int)index imagePath:(NSString *)imagePath thumbnailPath:(NSString *)thumbnailPath;
+
+// The same thing, synchronously, on the calling thread
++ (NSImage *)previewForImageAtPath:(NSString *)imagePath thumbnailPath:(NSString *)thumbnailPath maxSize:(NSSize)maxSize;
+
+@end
@@ -0,0 +1,242 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWPreviewGenerator.h"
+#import "ZWProgressChannel.h"
+#import "ImageResizer.h"
+#import "ZWMappedData.h"
+#import "ZWJPEGCommon.h"
+#import "ZWJPEGDecoder.h"
+#import "ZWImageResampler.h"
+
+enum {
+    NO_REQUEST = 0,
+    HAS_REQUEST
+};
+
+// EXIF comes first and has to fit in one segment
+#define EXIF_HEADER_LENGTH (128 * 1024)
+
+static int copyRowToBitmap(void *context, const unsigned char *row, int y)
+{
+    NSBitmapImageRep *bitmap = (NSBitmapImageRep *)context;
+    memcpy([bitmap bitmapData] + y * [bitmap bytesPerRow], row, [bitmap pixelsWide] * [bitmap samplesPerPixel]);
+    return 1;
+}
+
+static NSImage *imageWithBitmap(NSBitmapImageRep *bitmap)
+{
+    NSImage *image = [[[NSImage alloc] initWithSize:NSMakeSize([bitmap pixelsWide], [bitmap pixelsHigh])] autorelease];
+    [image addRepresentation:bitmap];
+    return image;
+}
+
+@interface ZWPreviewGenerator (PrivateStuff)
+- (void)previewThread:(id)unused;
++ (NSImage *)EXIFThumbnailOfImageAtPath:(NSString *)imagePath;
++ (NSImage *)eighthScalePreviewOfJPEGAtPath:(NSString *)imagePath maxSize:(NSSize)maxSize;
+@end
+
+@implementation ZWPreviewGenerator
+
+- (id)initWithProgressChannel:(ZWProgressChannel *)newChannel maxSize:(NSSize)newMaxSize
+{
+    self = [super init];
+    if (self) {
+        channel = [newChannel retain];
+        maxSize = newMaxSize;
+        requestLock = [[NSConditionLock alloc] initWithCondition:NO_REQUEST];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [requestLock release];
+    [pendingRequest release];
+    [channel release];
+    [super dealloc];
+}
+
+- (void)start
+{
+    // the thread keeps us alive until it's stopped
+    [self retain];
+    [NSThread detachNewThreadSelector:@selector(previewThread:) toTarget:self withObject:nil];
+}
+
+- (void)stop
+{
+    [requestLock lock];
+    stopping = YES;
+    [requestLock unlockWithCondition:HAS_REQUEST];
+}
+
+- (void)requestPreviewForIndex:(int)index imagePath:(NSString *)imagePath thumbnailPath:(NSString *)thumbnailPath
+{
+    NSDictionary *request = [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithInt:index], @"Index",
+        imagePath, @"ImagePath",
+        thumbnailPath, @"ThumbnailPath",    // may be nil, so last
+        nil];
+    
+    [requestLock lock];
+    [pendingRequest release];
+    pendingRequest = [request retain];
+    [requestLock unlockWithCondition:HAS_REQUEST];
+}
+
++ (NSImage *)previewForImageAtPath:(NSString *)imagePath thumbnailPath:(NSString *)thumbnailPath maxSize:(NSSize)maxSize
+{
+    NSImage *preview = nil;
+    
+    if (thumbnailPath && [[NSFileManager defaultManager] fileExistsAtPath:thumbnailPath]) 
+        preview = [[[NSImage alloc] initWithContentsOfFile:thumbnailPath] autorelease];
+    if (preview == nil) 
+        preview = [self EXIFThumbnailOfImageAtPath:imagePath];
+    if (preview == nil) 
+        preview = [self eighthScalePreviewOfJPEGAtPath:imagePath maxSize:maxSize];
+    
+    return preview;
+}
+
+@end
+
+@implementation ZWPreviewGenerator (PrivateStuff)
+
+- (void)previewThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    while (1) {
+        NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+        NSDictionary *request;
+        BOOL stop;
+        
+        [requestLock lockWhenCondition:HAS_REQUEST];
+        request = [pendingRequest autorelease];
+        pendingRequest = nil;
+        stop = stopping;
+        [requestLock unlockWithCondition:NO_REQUEST];
+        
+        if (stop) {
+            [innerPool release];
+            break;
+        }
+        
+        NSImage *preview = [ZWPreviewGenerator previewForImageAtPath:[request objectForKey:@"ImagePath"] 
+                                                       thumbnailPath:[request objectForKey:@"ThumbnailPath"] 
+                                                             maxSize:maxSize];
+        if (preview) 
+            [channel setPreview:preview forIndex:[[request objectForKey:@"Index"] unsignedLongValue]];
+        
+        [innerPool release];
+    }
+    
+    [pool release];
+    [self release];
+}
+
++ (NSImage *)EXIFThumbnailOfImageAtPath:(NSString *)imagePath
+{
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:imagePath];
+    NSData *header = [handle readDataOfLength:EXIF_HEADER_LENGTH];
+    ZWJPEGSegment segment;
+    size_t offset, length;
+    
+    [handle closeFile];
+    
+    if (!ZWJPEGFindSegment([header bytes], [header length], ZWJPEG_APP1, "Exif\0\0", 6, &segment)) 
+        return nil;
+    if (!ZWJPEGExifThumbnail(segment.data, segment.length, &offset, &length)) 
+        return nil;
+    
+    NSData *thumbnailData = [NSData dataWithBytes:segment.data + offset length:length];
+    return [[[NSImage alloc] initWithData:thumbnailData] autorelease];
+}
+
++ (NSImage *)eighthScalePreviewOfJPEGAtPath:(NSString *)imagePath maxSize:(NSSize)maxSize
+{
+    NSData *data = [ZWMappedData mappedDataWithContentsOfFile:imagePath];
+    ZWJPEGDecoder *decoder;
+    NSBitmapImageRep *bitmap = nil;
+    unsigned char *row;
+    int width, height, components;
+    
+    decoder = ZWJPEGDecoderCreate([data bytes], [data length], NULL);
+    if (decoder == NULL) 
+        return nil;
+    
+    ZWJPEGDecoderSetEighthScale(decoder);
+    width = ZWJPEGDecoderGetWidth(decoder);
+    height = ZWJPEGDecoderGetHeight(decoder);
+    components = ZWJPEGDecoderGetComponents(decoder);
+    
+    // a 1/8 scale decode of a really big photo is still far bigger than we need, so shrink it as it comes
+    NSSize previewSize = getGoodSize(NSMakeSize(width, height), NSMakeSize(maxSize.width * 2, maxSize.height * 2));
+    if (previewSize.width < 1 || previewSize.height < 1 || previewSize.width >= width || previewSize.height >= height) 
+        previewSize = NSMakeSize(width, height);
+    
+    bitmap = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL 
+                                                      pixelsWide:previewSize.width 
+                                                      pixelsHigh:previewSize.height 
+                                                   bitsPerSample:8 
+                                                 samplesPerPixel:components 
+                                                        hasAlpha:NO 
+                                                        isPlanar:NO 
+                                                  colorSpaceName:(components == 3 ? NSCalibratedRGBColorSpace : NSCalibratedWhiteColorSpace) 
+                                                     bytesPerRow:0 
+                                                    bitsPerPixel:0] autorelease];
+    row = (unsigned char *)malloc(width * components);
+    
+    if (bitmap && row) {
+        ZWImageResampler *resampler = NULL;
+        int y = 0;
+        
+        if ((int)previewSize.width != width || (int)previewSize.height != height) 
+            resampler = ZWImageResamplerCreate(width, height, previewSize.width, previewSize.height, components, copyRowToBitmap, bitmap, NULL);
+        
+        while (ZWJPEGDecoderReadScanline(decoder, row)) {
+            if (resampler) 
+                ZWImageResamplerPushRow(resampler, row);
+            else if (y < height)
+                copyRowToBitmap(bitmap, row, y);
+            y++;
+        }
+        ZWImageResamplerDestroy(resampler);
+    }
+    
+    free(row);
+    ZWJPEGDecoderDestroy(decoder);
+    
+    return bitmap ? imageWithBitmap(bitmap) : nil;
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Cocoa/Cocoa.h>
+#include <pthread.h>
+
+// Which of a snapshot's values have changed since the last one
+enum {
+    ZWProgressLocationChanged = 1 << 0,
+    ZWProgressStatusChanged = 1 << 1,
+    ZWProgressPreviewChanged = 1 << 2
+};
+
+typedef struct {
+    unsigned int changed;
+    double location;
+    NSString *status;
+    NSString *detail;
+    NSImage *preview;
+    unsigned long previewIndex;
+} ZWProgressSnapshot;
+
+// Carries progress from the threads doing an export to the panel showing it. Each kind of value has one
+// slot that a new value simply overwrites, and the main thread picks up whatever is newest no more often
+// than the display refreshes. However fast bytes go out, the main thread only ever sees about 60 updates
+// a second, and setting a slot doesn't allocate anything.
+@interface ZWProgressChannel : NSObject {
+    id delegate;
+    NSTimer *timer;
+    
+    pthread_mutex_t lock;
+    ZWProgressSnapshot pending;
+}
+
+- (id)initWithDelegate:(id)newDelegate;
+
+// Both are called on the main thread. stop passes on anything still waiting.
+- (void)start;
+- (void)stop;
+
+// These can be called from any thread. The channel keeps the objects until they've been shown.
+- (void)setLocation:(double)location;
+- (void)setStatus:(NSString *)status detail:(NSString *)detail;
+- (void)setPreview:(NSImage *)preview forIndex:(unsigned long)index;
+
+@end
+
+@interface NSObject (ZWProgressChannelDelegate)
+
+// Called on the main thread with the newest values of whatever has changed. The snapshot is only good
+// for the length of the call.
+- (void)progressChannel:(ZWProgressChannel *)channel didChange:(const ZWProgressSnapshot *)snapshot;
+
+@end
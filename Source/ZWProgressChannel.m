@@ -0,0 +1,170 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWProgressChannel.h"
+
+// for displays that don't say, which is most flat panels
+#define DEFAULT_REFRESH_RATE 60.0
+
+static NSTimeInterval displayRefreshInterval(void)
+{
+    CFDictionaryRef mode = CGDisplayCurrentMode(CGMainDisplayID());
+    CFNumberRef number = mode ? CFDictionaryGetValue(mode, kCGDisplayRefreshRate) : NULL;
+    double rate = 0;
+    
+    if (number) 
+        CFNumberGetValue(number, kCFNumberDoubleType, &rate);
+    if (rate < 1) 
+        rate = DEFAULT_REFRESH_RATE;
+    
+    return 1.0 / rate;
+}
+
+@interface ZWProgressChannel (PrivateStuff)
+- (void)drain:(NSTimer *)unused;
+@end
+
+@implementation ZWProgressChannel
+
+- (id)initWithDelegate:(id)newDelegate
+{
+    self = [super init];
+    if (self) {
+        delegate = newDelegate;     // weak reference
+        pthread_mutex_init(&lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [timer invalidate];
+    [timer release];
+    [pending.status release];
+    [pending.detail release];
+    [pending.preview release];
+    pthread_mutex_destroy(&lock);
+    [super dealloc];
+}
+
+- (void)start
+{
+    if (timer) 
+        return;
+    
+    // the progress panel is a sheet, so we have to keep going while it's up too
+    timer = [[NSTimer timerWithTimeInterval:displayRefreshInterval() target:self selector:@selector(drain:) userInfo:nil repeats:YES] retain];
+    [[NSRunLoop currentRunLoop] addTimer:timer forMode:NSDefaultRunLoopMode];
+    [[NSRunLoop currentRunLoop] addTimer:timer forMode:NSModalPanelRunLoopMode];
+}
+
+- (void)stop
+{
+    [timer invalidate];
+    [timer release];
+    timer = nil;
+    
+    [self drain:nil];
+}
+
+- (void)setLocation:(double)location
+{
+    pthread_mutex_lock(&lock);
+    pending.location = location;
+    pending.changed |= ZWProgressLocationChanged;
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)setStatus:(NSString *)status detail:(NSString *)detail
+{
+    NSString *oldStatus, *oldDetail;
+    
+    [status retain];
+    [detail retain];
+    
+    pthread_mutex_lock(&lock);
+    oldStatus = pending.status;
+    oldDetail = pending.detail;
+    pending.status = status;
+    pending.detail = detail;
+    pending.changed |= ZWProgressStatusChanged;
+    pthread_mutex_unlock(&lock);
+    
+    // outside the lock, since the last release might take a while
+    [oldStatus release];
+    [oldDetail release];
+}
+
+- (void)setPreview:(NSImage *)preview forIndex:(unsigned long)index
+{
+    NSImage *oldPreview;
+    
+    [preview retain];
+    
+    pthread_mutex_lock(&lock);
+    oldPreview = pending.preview;
+    pending.preview = preview;
+    pending.previewIndex = index;
+    pending.changed |= ZWProgressPreviewChanged;
+    pthread_mutex_unlock(&lock);
+    
+    [oldPreview release];
+}
+
+@end
+
+@implementation ZWProgressChannel (PrivateStuff)
+
+- (void)drain:(NSTimer *)unused
+{
+    ZWProgressSnapshot snapshot;
+    
+    // most ticks find nothing new, and a stale read here just means we look again next tick
+    if (pending.changed == 0) 
+        return;
+    
+    // take the objects along with the values, so the slots start out empty again
+    pthread_mutex_lock(&lock);
+    snapshot = pending;
+    pending.changed = 0;
+    pending.status = nil;
+    pending.detail = nil;
+    pending.preview = nil;
+    pthread_mutex_unlock(&lock);
+    
+    if (snapshot.changed && [delegate respondsToSelector:@selector(progressChannel:didChange:)]) 
+        [delegate progressChannel:self didChange:&snapshot];
+    
+    [snapshot.status release];
+    [snapshot.detail release];
+    [snapshot.preview release];
+}
+
+@end
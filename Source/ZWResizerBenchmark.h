@@ -0,0 +1,72 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+//
+//  Timing for ImageResizer, run by hand from the Benchmarks tool. Nothing here is used in a normal export.
+//
+
+#import <Foundation/Foundation.h>
+#import "ZWScratchArena.h"
+
+@interface ZWResizerBenchmark : NSObject {
+
+}
+
+// Times making each of sizes (NSValue-wrapped NSSizes, largest first) with a separate resize call per size 
+// against making them all from one decode with +[ImageResizer getScaledImagesFromData:toSizes:...]. Each 
+// is run iterations times and the best time kept. Returns a dictionary with the times in seconds 
+// ("SeparateSeconds", "CascadeSeconds") and the output sizes in bytes ("SeparateBytes", "CascadeBytes").
++ (NSDictionary *)benchmarkDerivativesFromData:(NSData *)data toSizes:(NSArray *)sizes iterations:(int)iterations scratchArena:(ZWScratchArena *)arena;
+
+// Runs every image in directory through the resizer at size, iterations times each, for tracking speed and
+// quality from one release to the next. The corpus is whatever is in the folder; it's meant to hold one of 
+// each kind of photo we get - portrait and landscape, grayscale, CMYK, progressive JPEG, PNG with alpha, 
+// GIF, a huge panorama. Each image gets a dictionary in "Images" with:
+//
+//   "Name", "SourceBytes", "SourceWidth", "SourceHeight", "OutputWidth", "OutputHeight", "OutputBytes"
+//   "ResizerSeconds"   the whole ImageResizer call, best of the iterations
+//   "SizingSeconds"    -[NSBitmapImageRep representationWithSize:] to the same size, for comparison
+//   "DecodeSeconds", "ResampleSeconds", "EncodeSeconds"
+//                      our decoder, resampler and encoder on their own - baseline JPEGs only, since that's
+//                      all they read
+//   "ScratchBytes"     the most scratch memory the resize had from the arena at once
+//   "ResidentBytes"    the process's resident size after the resize
+//   "PSNR", "SSIM"     of the output against a reference: a file named <name>-reference.<anything> next to
+//                      the image if there is one, or otherwise an exact area average of the source in 
+//                      linear light. Missing if neither could be read.
+//
+// Files ending in -reference and anything the resizer fails on are skipped, failures getting an "Error". 
++ (NSDictionary *)benchmarkCorpusAtPath:(NSString *)directory toSize:(NSSize)size iterations:(int)iterations scratchArena:(ZWScratchArena *)arena;
+
+// The results above (or any other benchmark's dictionary) as JSON, to be written out and compared against
+// earlier runs
++ (NSString *)JSONStringFromResults:(NSDictionary *)results;
+
+@end
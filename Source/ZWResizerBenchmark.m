@@ -0,0 +1,792 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Cocoa/Cocoa.h>
+#import <mach/mach.h>
+#import <math.h>
+#import "ZWResizerBenchmark.h"
+#import "ImageResizer.h"
+#import "NSBitmapImageRep+sizing.h"
+#import "ZWJPEGCommon.h"
+#import "ZWJPEGDecoder.h"
+#import "ZWJPEGEncoder.h"
+#import "ZWImageResampler.h"
+#import "ZWColorTransform.h"
+
+// What ImageResizer gives its own encoder when there's no byte budget
+#define BENCHMARK_ENCODER_QUALITY 85
+
+// PSNR of identical images is infinite, which JSON can't say
+#define MAX_PSNR 100.0
+
+#pragma mark Pixels
+
+// Rows of 8 bit gray or RGB from a baseline JPEG (through our decoder) or from anything NSBitmapImageRep
+// reads as 8 bit RGB or gray. Alpha is dropped.
+typedef struct {
+    ZWJPEGDecoder *decoder;
+    NSBitmapImageRep *rep;
+    int width, height, components;
+    int repSamples;
+    int y;
+    unsigned char *row;
+} PixelSource;
+
+static void closePixelSource(PixelSource *source)
+{
+    ZWJPEGDecoderDestroy(source->decoder);
+    [source->rep release];
+    free(source->row);
+    memset(source, 0, sizeof(*source));
+}
+
+static BOOL openPixelSource(PixelSource *source, NSData *data)
+{
+    memset(source, 0, sizeof(*source));
+    
+    source->decoder = ZWJPEGDecoderCreate([data bytes], [data length], NULL);
+    if (source->decoder) {
+        source->width = ZWJPEGDecoderGetWidth(source->decoder);
+        source->height = ZWJPEGDecoderGetHeight(source->decoder);
+        source->components = ZWJPEGDecoderGetComponents(source->decoder);
+    }
+    else {
+        NSBitmapImageRep *rep = [NSBitmapImageRep imageRepWithData:data];
+        NSString *colorSpace = [rep colorSpaceName];
+        
+        if (rep == nil || [rep isPlanar] || [rep bitsPerSample] != 8) 
+            return NO;
+        if ([colorSpace isEqualToString:NSCalibratedRGBColorSpace] || [colorSpace isEqualToString:NSDeviceRGBColorSpace]) 
+            source->components = 3;
+        else if ([colorSpace isEqualToString:NSCalibratedWhiteColorSpace] || [colorSpace isEqualToString:NSDeviceWhiteColorSpace]) 
+            source->components = 1;
+        else 
+            return NO;
+        
+        source->rep = [rep retain];
+        source->width = [rep pixelsWide];
+        source->height = [rep pixelsHigh];
+        source->repSamples = [rep samplesPerPixel];
+    }
+    
+    source->row = (unsigned char *)malloc(source->width * source->components);
+    if (source->row == NULL) {
+        closePixelSource(source);
+        return NO;
+    }
+    return YES;
+}
+
+// Returns NULL after the last row
+static const unsigned char *readPixelRow(PixelSource *source)
+{
+    if (source->y >= source->height) 
+        return NULL;
+    
+    if (source->decoder) {
+        if (!ZWJPEGDecoderReadScanline(source->decoder, source->row)) 
+            return NULL;
+    }
+    else {
+        const unsigned char *in = [source->rep bitmapData] + source->y * [source->rep bytesPerRow];
+        unsigned char *out = source->row;
+        int x, c;
+        
+        for (x = 0; x < source->width; x++) {
+            for (c = 0; c < source->components; c++) 
+                *out++ = in[c];
+            in += source->repSamples;
+        }
+    }
+    
+    source->y++;
+    return source->row;
+}
+
+// Reads the whole image. The caller frees the pixels.
+static unsigned char *copyPixels(NSData *data, int *width, int *height, int *components)
+{
+    PixelSource source;
+    unsigned char *pixels;
+    const unsigned char *row;
+    size_t rowLength;
+    
+    if (!openPixelSource(&source, data)) 
+        return NULL;
+    
+    rowLength = source.width * source.components;
+    pixels = (unsigned char *)malloc(rowLength * source.height);
+    if (pixels) {
+        while ((row = readPixelRow(&source))) 
+            memcpy(pixels + (source.y - 1) * rowLength, row, rowLength);
+        *width = source.width;
+        *height = source.height;
+        *components = source.components;
+    }
+    
+    closePixelSource(&source);
+    return pixels;
+}
+
+#pragma mark Reference
+
+static double linearFromSRGB(double value)
+{
+    return (value <= 0.04045) ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+}
+
+static unsigned char sRGBFromLinear(double value)
+{
+    double encoded = (value <= 0.0031308) ? value * 12.92 : 1.055 * pow(value, 1.0 / 2.4) - 0.055;
+    int rounded = (int)(encoded * 255.0 + 0.5);
+    
+    return (unsigned char)(rounded < 0 ? 0 : (rounded > 255 ? 255 : rounded));
+}
+
+// Where source pixel i lands at scale (source pixels per output pixel, at least 1): output pixel *first 
+// gets *share of it and the next output pixel gets the rest.
+static void areaSpan(int i, double scale, int outputLength, int *first, double *share)
+{
+    double left = i / scale, right = (i + 1) / scale;
+    
+    *first = (int)left;
+    if (*first >= outputLength - 1 || right <= *first + 1) 
+        *share = 1.0;
+    else 
+        *share = (*first + 1 - left) / (right - left);
+    if (*first > outputLength - 1) 
+        *first = outputLength - 1;
+}
+
+static void finishAreaRow(double *sums, double *weights, unsigned char *out, int width, int components)
+{
+    int x, c;
+    
+    for (x = 0; x < width; x++) {
+        for (c = 0; c < components; c++) 
+            *out++ = sRGBFromLinear(weights[x] > 0 ? sums[x * components + c] / weights[x] : 0);
+    }
+}
+
+// The exact average of the source pixels each output pixel covers, in linear light, a row at a time so
+// huge sources don't have to fit in memory. Only scales down. The caller frees the pixels.
+static unsigned char *createAreaAverage(NSData *data, int outputWidth, int outputHeight, int *components)
+{
+    PixelSource source;
+    const unsigned char *row;
+    double linear[256], scaleX, scaleY;
+    double *sums[2] = { NULL, NULL }, *weights[2] = { NULL, NULL };
+    int *columns = NULL;
+    double *columnShares = NULL;
+    unsigned char *pixels = NULL;
+    int current = 0, i, x, c;
+    size_t rowLength;
+    
+    if (!openPixelSource(&source, data)) 
+        return NULL;
+    if (outputWidth > source.width || outputHeight > source.height) 
+        goto bail;
+    
+    for (i = 0; i < 256; i++) 
+        linear[i] = linearFromSRGB(i / 255.0);
+    scaleX = (double)source.width / outputWidth;
+    scaleY = (double)source.height / outputHeight;
+    rowLength = outputWidth * source.components;
+    
+    columns = (int *)malloc(source.width * sizeof(int));
+    columnShares = (double *)malloc(source.width * sizeof(double));
+    pixels = (unsigned char *)malloc(rowLength * outputHeight);
+    for (i = 0; i < 2; i++) {
+        sums[i] = (double *)calloc(rowLength, sizeof(double));
+        weights[i] = (double *)calloc(outputWidth, sizeof(double));
+    }
+    if (!columns || !columnShares || !pixels || !sums[0] || !sums[1] || !weights[0] || !weights[1]) {
+        free(pixels);
+        pixels = NULL;
+        goto bail;
+    }
+    
+    for (x = 0; x < source.width; x++) 
+        areaSpan(x, scaleX, outputWidth, &columns[x], &columnShares[x]);
+    
+    while ((row = readPixelRow(&source))) {
+        int outputRow;
+        double rowShare;
+        
+        areaSpan(source.y - 1, scaleY, outputHeight, &outputRow, &rowShare);
+        
+        // Rows above this one are done
+        while (current < outputRow) {
+            double *swap;
+            
+            finishAreaRow(sums[0], weights[0], pixels + current * rowLength, outputWidth, source.components);
+            swap = sums[0]; sums[0] = sums[1]; sums[1] = swap;
+            swap = weights[0]; weights[0] = weights[1]; weights[1] = swap;
+            memset(sums[1], 0, rowLength * sizeof(double));
+            memset(weights[1], 0, outputWidth * sizeof(double));
+            current++;
+        }
+        
+        for (x = 0; x < source.width; x++) {
+            int column = columns[x];
+            double shares[2][2];
+            int r, k;
+            
+            shares[0][0] = rowShare * columnShares[x];
+            shares[0][1] = rowShare * (1.0 - columnShares[x]);
+            shares[1][0] = (1.0 - rowShare) * columnShares[x];
+            shares[1][1] = (1.0 - rowShare) * (1.0 - columnShares[x]);
+            
+            for (r = 0; r < 2; r++) {
+                for (k = 0; k < 2; k++) {
+                    double share = shares[r][k];
+                    if (share <= 0) 
+                        continue;
+                    weights[r][column + k] += share;
+                    for (c = 0; c < source.components; c++) 
+                        sums[r][(column + k) * source.components + c] += share * linear[row[x * source.components + c]];
+                }
+            }
+        }
+    }
+    
+    for (; current < outputHeight; current++) {
+        finishAreaRow(sums[0], weights[0], pixels + current * rowLength, outputWidth, source.components);
+        memcpy(sums[0], sums[1], rowLength * sizeof(double));
+        memcpy(weights[0], weights[1], outputWidth * sizeof(double));
+        memset(sums[1], 0, rowLength * sizeof(double));
+        memset(weights[1], 0, outputWidth * sizeof(double));
+    }
+    *components = source.components;
+    
+bail:
+    for (i = 0; i < 2; i++) {
+        free(sums[i]);
+        free(weights[i]);
+    }
+    free(columns);
+    free(columnShares);
+    closePixelSource(&source);
+    return pixels;
+}
+
+#pragma mark Metrics
+
+// Rec. 601 luma, for comparing images with different numbers of components (and for SSIM)
+static unsigned char *copyLuma(const unsigned char *pixels, int count, int components)
+{
+    unsigned char *luma = (unsigned char *)malloc(count);
+    int i;
+    
+    if (luma == NULL) 
+        return NULL;
+    for (i = 0; i < count; i++) {
+        if (components == 3) 
+            luma[i] = (unsigned char)((pixels[0] * 299 + pixels[1] * 587 + pixels[2] * 114 + 500) / 1000);
+        else 
+            luma[i] = pixels[0];
+        pixels += components;
+    }
+    return luma;
+}
+
+static double computePSNR(const unsigned char *a, const unsigned char *b, size_t count)
+{
+    double squares = 0, mse;
+    size_t i;
+    
+    for (i = 0; i < count; i++) {
+        double difference = (double)a[i] - b[i];
+        squares += difference * difference;
+    }
+    mse = squares / count;
+    
+    return (mse > 0) ? MIN(10.0 * log10(255.0 * 255.0 / mse), MAX_PSNR) : MAX_PSNR;
+}
+
+// Mean SSIM over 8x8 windows a half window apart, on luma
+static double computeSSIM(const unsigned char *a, const unsigned char *b, int width, int height)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+    double total = 0;
+    int windows = 0, wx, wy, x, y;
+    
+    if (width < 8 || height < 8) 
+        return computePSNR(a, b, width * height) >= MAX_PSNR ? 1.0 : 0.0;
+    
+    for (wy = 0; wy + 8 <= height; wy += 4) {
+        for (wx = 0; wx + 8 <= width; wx += 4) {
+            double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+            double meanA, meanB, varianceA, varianceB, covariance;
+            
+            for (y = wy; y < wy + 8; y++) {
+                for (x = wx; x < wx + 8; x++) {
+                    double pa = a[y * width + x], pb = b[y * width + x];
+                    sumA += pa;
+                    sumB += pb;
+                    sumAA += pa * pa;
+                    sumBB += pb * pb;
+                    sumAB += pa * pb;
+                }
+            }
+            
+            meanA = sumA / 64;
+            meanB = sumB / 64;
+            varianceA = sumAA / 64 - meanA * meanA;
+            varianceB = sumBB / 64 - meanB * meanB;
+            covariance = sumAB / 64 - meanA * meanB;
+            
+            total += ((2 * meanA * meanB + c1) * (2 * covariance + c2)) / ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+            windows++;
+        }
+    }
+    
+    return total / windows;
+}
+
+#pragma mark Stages
+
+typedef struct {
+    unsigned char *pixels;
+    int rowLength;
+} ScaledPixels;
+
+static int keepScaledRow(void *context, const unsigned char *row, int y)
+{
+    ScaledPixels *scaled = (ScaledPixels *)context;
+    
+    memcpy(scaled->pixels + y * scaled->rowLength, row, scaled->rowLength);
+    return 1;
+}
+
+static int discardOutput(void *context, const unsigned char *bytes, size_t length)
+{
+    *(size_t *)context += length;
+    return 1;
+}
+
+// Our decoder, resampler and encoder each on their own, the way ImageResizer strings them together.
+// Adds the best time of each to result. Does nothing if the source isn't a baseline JPEG.
+static void timeStages(NSData *data, int width, int height, int iterations, ZWScratchArena *arena, NSMutableDictionary *result)
+{
+    NSTimeInterval bestDecode = 0, bestDecodeAndResample = 0, bestEncode = 0;
+    int i, y;
+    
+    for (i = 0; i < iterations; i++) {
+        ZWJPEGDecoder *decoder;
+        ZWImageResampler *resampler = NULL;
+        ZWColorTransform *transform = NULL;
+        ZWJPEGEncoder *encoder;
+        ScaledPixels scaled;
+        unsigned char *sourceRow, *profile = NULL;
+        size_t profileLength, encodedLength = 0;
+        NSTimeInterval start, elapsed;
+        int components;
+        BOOL ok;
+        
+        // decode alone
+        start = [NSDate timeIntervalSinceReferenceDate];
+        decoder = ZWJPEGDecoderCreate([data bytes], [data length], arena);
+        if (decoder == NULL) 
+            return;
+        components = ZWJPEGDecoderGetComponents(decoder);
+        sourceRow = (unsigned char *)ZWScratchAlloc(arena, ZWJPEGDecoderGetWidth(decoder) * components);
+        while (sourceRow && ZWJPEGDecoderReadScanline(decoder, sourceRow)) 
+            ;
+        ZWScratchFree(arena, sourceRow);
+        ZWJPEGDecoderDestroy(decoder);
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < bestDecode) 
+            bestDecode = elapsed;
+        
+        // decode and resample, converting to sRGB in linear light
+        start = [NSDate timeIntervalSinceReferenceDate];
+        decoder = ZWJPEGDecoderCreate([data bytes], [data length], arena);
+        if (decoder == NULL) 
+            return;
+        profileLength = ZWJPEGCopyICCProfile([data bytes], [data length], NULL);
+        if (profileLength && (profile = (unsigned char *)ZWScratchAlloc(arena, profileLength))) {
+            ZWJPEGCopyICCProfile([data bytes], [data length], profile);
+            transform = ZWColorTransformCreateFromICC(profile, profileLength, components);
+            ZWScratchFree(arena, profile);
+        }
+        if (transform == NULL) 
+            transform = ZWColorTransformCreateSRGB(components);
+        
+        scaled.rowLength = width * components;
+        scaled.pixels = (unsigned char *)ZWScratchAlloc(arena, scaled.rowLength * height);
+        sourceRow = (unsigned char *)ZWScratchAlloc(arena, ZWJPEGDecoderGetWidth(decoder) * components);
+        if (scaled.pixels) 
+            resampler = ZWImageResamplerCreate(ZWJPEGDecoderGetWidth(decoder), ZWJPEGDecoderGetHeight(decoder), width, height, components, keepScaledRow, &scaled, arena);
+        ok = (sourceRow && resampler && transform && ZWImageResamplerSetColorTransform(resampler, transform));
+        while (ok && ZWJPEGDecoderReadScanline(decoder, sourceRow)) 
+            ok = ZWImageResamplerPushRow(resampler, sourceRow);
+        ZWImageResamplerDestroy(resampler);
+        ZWColorTransformDestroy(transform);
+        ZWScratchFree(arena, sourceRow);
+        ZWJPEGDecoderDestroy(decoder);
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < bestDecodeAndResample) 
+            bestDecodeAndResample = elapsed;
+        
+        if (!ok) {
+            ZWScratchFree(arena, scaled.pixels);
+            return;
+        }
+        
+        // encode
+        start = [NSDate timeIntervalSinceReferenceDate];
+        encoder = ZWJPEGEncoderCreate(width, height, components, BENCHMARK_ENCODER_QUALITY, discardOutput, &encodedLength, arena);
+        for (y = 0; encoder && y < height; y++) 
+            ZWJPEGEncoderWriteScanline(encoder, scaled.pixels + y * scaled.rowLength);
+        if (encoder) 
+            ZWJPEGEncoderFinish(encoder);
+        ZWJPEGEncoderDestroy(encoder);
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < bestEncode) 
+            bestEncode = elapsed;
+        
+        ZWScratchFree(arena, scaled.pixels);
+    }
+    
+    [result setObject:[NSNumber numberWithDouble:bestDecode] forKey:@"DecodeSeconds"];
+    [result setObject:[NSNumber numberWithDouble:MAX(bestDecodeAndResample - bestDecode, 0)] forKey:@"ResampleSeconds"];
+    [result setObject:[NSNumber numberWithDouble:bestEncode] forKey:@"EncodeSeconds"];
+}
+
+static unsigned long long residentBytes(void)
+{
+    struct task_basic_info info;
+    mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+    
+    if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) 
+        return 0;
+    return info.resident_size;
+}
+
+#pragma mark JSON
+
+static void appendJSON(NSMutableString *json, id object, int depth)
+{
+    unsigned int i;
+    
+    if ([object isKindOfClass:[NSDictionary class]]) {
+        // sorted, so runs diff cleanly against each other
+        NSArray *keys = [[object allKeys] sortedArrayUsingSelector:@selector(compare:)];
+        
+        [json appendString:@"{"];
+        for (i = 0; i < [keys count]; i++) {
+            [json appendFormat:@"%@\n%*s", i ? @"," : @"", (depth + 1) * 2, ""];
+            appendJSON(json, [keys objectAtIndex:i], depth + 1);
+            [json appendString:@": "];
+            appendJSON(json, [object objectForKey:[keys objectAtIndex:i]], depth + 1);
+        }
+        [json appendFormat:@"\n%*s}", depth * 2, ""];
+    }
+    else if ([object isKindOfClass:[NSArray class]]) {
+        [json appendString:@"["];
+        for (i = 0; i < [object count]; i++) {
+            [json appendFormat:@"%@\n%*s", i ? @"," : @"", (depth + 1) * 2, ""];
+            appendJSON(json, [object objectAtIndex:i], depth + 1);
+        }
+        [json appendFormat:@"\n%*s]", depth * 2, ""];
+    }
+    else if ([object isKindOfClass:[NSNumber class]]) {
+        const char *type = [object objCType];
+        
+        if (strchr("cislqCISLQ", type[0])) 
+            [json appendFormat:@"%lld", [object longLongValue]];
+        else 
+            [json appendFormat:@"%.6g", [object doubleValue]];
+    }
+    else {
+        NSString *string = [object description];
+        
+        [json appendString:@"\""];
+        for (i = 0; i < [string length]; i++) {
+            unichar character = [string characterAtIndex:i];
+            
+            if (character == '"' || character == '\\') 
+                [json appendFormat:@"\\%C", character];
+            else if (character < 0x20) 
+                [json appendFormat:@"\\u%04x", character];
+            else 
+                [json appendFormat:@"%C", character];
+        }
+        [json appendString:@"\""];
+    }
+}
+
+@interface ZWResizerBenchmark (PrivateStuff)
++ (void)timeSizing:(NSMutableDictionary *)job;
++ (NSDictionary *)benchmarkImageAtPath:(NSString *)path toSize:(NSSize)size iterations:(int)iterations scratchArena:(ZWScratchArena *)arena;
+@end
+
+@implementation ZWResizerBenchmark
+
++ (NSDictionary *)benchmarkDerivativesFromData:(NSData *)data toSizes:(NSArray *)sizes iterations:(int)iterations scratchArena:(ZWScratchArena *)arena
+{
+    NSTimeInterval bestSeparate = 0, bestCascade = 0;
+    unsigned long separateBytes = 0, cascadeBytes = 0;
+    int i;
+    unsigned int j;
+    
+    for (i = 0; i < iterations; i++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSTimeInterval start, elapsed;
+        
+        // one full decode per size
+        start = [NSDate timeIntervalSinceReferenceDate];
+        separateBytes = 0;
+        for (j = 0; j < [sizes count]; j++) {
+            NSData *image = [ImageResizer getScaledImageFromData:data toSize:[[sizes objectAtIndex:j] sizeValue] maxBytes:0 scratchArena:arena];
+            separateBytes += [image length];
+        }
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < bestSeparate) 
+            bestSeparate = elapsed;
+        
+        // one decode, each size made from the last
+        start = [NSDate timeIntervalSinceReferenceDate];
+        NSArray *images = [ImageResizer getScaledImagesFromData:data toSizes:sizes maxBytes:0 scratchArena:arena];
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < bestCascade) 
+            bestCascade = elapsed;
+        
+        cascadeBytes = 0;
+        for (j = 0; j < [images count]; j++) 
+            cascadeBytes += [[images objectAtIndex:j] length];
+        
+        if (arena) 
+            ZWScratchArenaReset(arena);
+        [pool release];
+    }
+    
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithDouble:bestSeparate], @"SeparateSeconds",
+        [NSNumber numberWithDouble:bestCascade], @"CascadeSeconds",
+        [NSNumber numberWithUnsignedLong:separateBytes], @"SeparateBytes",
+        [NSNumber numberWithUnsignedLong:cascadeBytes], @"CascadeBytes",
+        nil];
+}
+
++ (NSDictionary *)benchmarkCorpusAtPath:(NSString *)directory toSize:(NSSize)size iterations:(int)iterations scratchArena:(ZWScratchArena *)arena
+{
+    static NSString *imageExtensions[] = { @"jpg", @"jpeg", @"png", @"gif", @"tif", @"tiff" };
+    NSArray *files = [[[NSFileManager defaultManager] directoryContentsAtPath:directory] sortedArrayUsingSelector:@selector(compare:)];
+    NSMutableArray *images = [NSMutableArray array];
+    ZWScratchArena *ownArena = NULL;
+    unsigned int i, e;
+    
+    if (arena == NULL) 
+        arena = ownArena = ZWScratchArenaCreate();
+    
+    for (i = 0; i < [files count]; i++) {
+        NSString *file = [files objectAtIndex:i];
+        NSString *extension = [[file pathExtension] lowercaseString];
+        BOOL isImage = NO;
+        
+        for (e = 0; e < sizeof(imageExtensions) / sizeof(imageExtensions[0]); e++) 
+            isImage = isImage || [extension isEqualToString:imageExtensions[e]];
+        if (!isImage || [file hasPrefix:@"."] || [[file stringByDeletingPathExtension] hasSuffix:@"-reference"]) 
+            continue;
+        
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [images addObject:[self benchmarkImageAtPath:[directory stringByAppendingPathComponent:file] toSize:size iterations:iterations scratchArena:arena]];
+        [pool release];
+    }
+    
+    if (ownArena) 
+        ZWScratchArenaDestroy(ownArena);
+    
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+        [ImageResizer encoderIdentifier], @"EncoderIdentifier",
+        [NSNumber numberWithInt:(int)size.width], @"Width",
+        [NSNumber numberWithInt:(int)size.height], @"Height",
+        [NSNumber numberWithInt:iterations], @"Iterations",
+        images, @"Images",
+        nil];
+}
+
++ (NSString *)JSONStringFromResults:(NSDictionary *)results
+{
+    NSMutableString *json = [NSMutableString string];
+    
+    appendJSON(json, results, 0);
+    [json appendString:@"\n"];
+    return json;
+}
+
+@end
+
+@implementation ZWResizerBenchmark (PrivateStuff)
+
+// NSImage drawing belongs on the main thread, so this is run there
++ (void)timeSizing:(NSMutableDictionary *)job
+{
+    NSBitmapImageRep *rep = [NSBitmapImageRep imageRepWithData:[job objectForKey:@"Data"]];
+    NSSize size = [[job objectForKey:@"Size"] sizeValue];
+    int iterations = [[job objectForKey:@"Iterations"] intValue];
+    NSTimeInterval best = 0;
+    int i;
+    
+    if (rep == nil) 
+        return;
+    
+    for (i = 0; i < iterations; i++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate], elapsed;
+        
+        [rep representationWithSize:size];
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (i == 0 || elapsed < best) 
+            best = elapsed;
+        [pool release];
+    }
+    
+    [job setObject:[NSNumber numberWithDouble:best] forKey:@"SizingSeconds"];
+}
+
++ (NSDictionary *)benchmarkImageAtPath:(NSString *)path toSize:(NSSize)size iterations:(int)iterations scratchArena:(ZWScratchArena *)arena
+{
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithObject:[path lastPathComponent] forKey:@"Name"];
+    NSData *data = [NSData dataWithContentsOfFile:path];
+    NSData *output = nil;
+    NSTimeInterval best = 0;
+    ZWScratchArenaStats arenaStats;
+    int sourceWidth = 0, sourceHeight = 0, outputWidth, outputHeight, outputComponents;
+    int referenceWidth, referenceHeight, referenceComponents = 0;
+    unsigned char *outputPixels = NULL, *referencePixels = NULL;
+    unsigned long long mostScratchBytes = 0;
+    ZWJPEGInfo jpegInfo;
+    unsigned int i;
+    int iteration;
+    
+    if (data == nil) {
+        [result setObject:@"unreadable" forKey:@"Error"];
+        return result;
+    }
+    [result setObject:[NSNumber numberWithUnsignedLong:[data length]] forKey:@"SourceBytes"];
+    
+    if (ZWJPEGGetInfo([data bytes], [data length], &jpegInfo)) {
+        sourceWidth = jpegInfo.width;
+        sourceHeight = jpegInfo.height;
+    }
+    else {
+        NSBitmapImageRep *rep = [NSBitmapImageRep imageRepWithData:data];
+        sourceWidth = [rep pixelsWide];
+        sourceHeight = [rep pixelsHigh];
+    }
+    [result setObject:[NSNumber numberWithInt:sourceWidth] forKey:@"SourceWidth"];
+    [result setObject:[NSNumber numberWithInt:sourceHeight] forKey:@"SourceHeight"];
+    
+    // The whole resize, starting each time from an empty arena so its high water mark is this photo's
+    for (iteration = 0; iteration < iterations; iteration++) {
+        NSTimeInterval start, elapsed;
+        
+        ZWScratchArenaReset(arena);
+        ZWScratchArenaTrim(arena, 0);
+        start = [NSDate timeIntervalSinceReferenceDate];
+        output = [ImageResizer getScaledImageFromData:data toSize:size maxBytes:0 scratchArena:arena];
+        elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+        if (iteration == 0 || elapsed < best) 
+            best = elapsed;
+        
+        ZWScratchArenaGetStats(arena, &arenaStats);
+        mostScratchBytes = MAX(mostScratchBytes, arenaStats.bytesHeld);
+    }
+    ZWScratchArenaReset(arena);
+    
+    if (output == nil) {
+        [result setObject:@"resize failed" forKey:@"Error"];
+        return result;
+    }
+    [result setObject:[NSNumber numberWithDouble:best] forKey:@"ResizerSeconds"];
+    [result setObject:[NSNumber numberWithUnsignedLong:[output length]] forKey:@"OutputBytes"];
+    [result setObject:[NSNumber numberWithUnsignedLongLong:mostScratchBytes] forKey:@"ScratchBytes"];
+    [result setObject:[NSNumber numberWithUnsignedLongLong:residentBytes()] forKey:@"ResidentBytes"];
+    
+    outputPixels = copyPixels(output, &outputWidth, &outputHeight, &outputComponents);
+    if (outputPixels == NULL) 
+        return result;
+    [result setObject:[NSNumber numberWithInt:outputWidth] forKey:@"OutputWidth"];
+    [result setObject:[NSNumber numberWithInt:outputHeight] forKey:@"OutputHeight"];
+    
+    NSMutableDictionary *sizingJob = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+        data, @"Data", 
+        [NSValue valueWithSize:NSMakeSize(outputWidth, outputHeight)], @"Size", 
+        [NSNumber numberWithInt:iterations], @"Iterations", 
+        nil];
+    [self performSelectorOnMainThread:@selector(timeSizing:) withObject:sizingJob waitUntilDone:YES modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];
+    if ([sizingJob objectForKey:@"SizingSeconds"]) 
+        [result setObject:[sizingJob objectForKey:@"SizingSeconds"] forKey:@"SizingSeconds"];
+    
+    timeStages(data, outputWidth, outputHeight, iterations, arena, result);
+    ZWScratchArenaReset(arena);
+    
+    // A reference image saved next to the source wins over the area average
+    NSString *referencePrefix = [[[path lastPathComponent] stringByDeletingPathExtension] stringByAppendingString:@"-reference."];
+    NSArray *neighbours = [[NSFileManager defaultManager] directoryContentsAtPath:[path stringByDeletingLastPathComponent]];
+    for (i = 0; i < [neighbours count] && referencePixels == NULL; i++) {
+        if ([[neighbours objectAtIndex:i] hasPrefix:referencePrefix]) {
+            NSData *referenceData = [NSData dataWithContentsOfFile:[[path stringByDeletingLastPathComponent] stringByAppendingPathComponent:[neighbours objectAtIndex:i]]];
+            referencePixels = copyPixels(referenceData, &referenceWidth, &referenceHeight, &referenceComponents);
+            if (referencePixels && (referenceWidth != outputWidth || referenceHeight != outputHeight)) {
+                free(referencePixels);
+                referencePixels = NULL;
+            }
+        }
+    }
+    if (referencePixels == NULL) 
+        referencePixels = createAreaAverage(data, outputWidth, outputHeight, &referenceComponents);
+    
+    if (referencePixels) {
+        int count = outputWidth * outputHeight;
+        unsigned char *outputLuma = copyLuma(outputPixels, count, outputComponents);
+        unsigned char *referenceLuma = copyLuma(referencePixels, count, referenceComponents);
+        
+        if (outputLuma && referenceLuma) {
+            // PSNR over every channel if the two match, luma if not (a gray photo that came out as RGB)
+            double psnr = (outputComponents == referenceComponents) ? 
+                computePSNR(outputPixels, referencePixels, count * outputComponents) : computePSNR(outputLuma, referenceLuma, count);
+            
+            [result setObject:[NSNumber numberWithDouble:psnr] forKey:@"PSNR"];
+            [result setObject:[NSNumber numberWithDouble:computeSSIM(outputLuma, referenceLuma, outputWidth, outputHeight)] forKey:@"SSIM"];
+        }
+        free(outputLuma);
+        free(referenceLuma);
+        free(referencePixels);
+    }
+    free(outputPixels);
+    
+    return result;
+}
+
+@end
@@ -0,0 +1,75 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// A pool of scratch buffers meant to live for a whole export. Buffers handed back (or all of them, at
+// ZWScratchArenaReset) go back in the pool and are handed out again for later requests that fit, so a run
+// of similar-size photos allocates its decode and resample buffers once instead of once per photo. A buffer
+// only grows when a bigger photo comes along. Memory from the arena isn't zeroed.
+//
+// An arena isn't thread safe; give each thread that needs one its own.
+
+#ifndef ZWSCRATCHARENA_H
+#define ZWSCRATCHARENA_H
+
+#include <stddef.h>
+
+typedef struct ZWScratchArena ZWScratchArena;
+
+typedef struct {
+    unsigned long requests;             // buffers handed out
+    unsigned long allocations;          // requests that needed new (or bigger) memory from the system
+    unsigned long long bytesRequested;
+    unsigned long long bytesAllocated;  // from the system, to satisfy the above
+    unsigned long long bytesHeld;       // by the arena right now, in use or not
+} ZWScratchArenaStats;
+
+ZWScratchArena *ZWScratchArenaCreate(void);
+void ZWScratchArenaDestroy(ZWScratchArena *arena);
+
+// Returns NULL if the memory can't be had. 
+void *ZWScratchArenaAlloc(ZWScratchArena *arena, size_t size);
+
+// Gives a buffer back to the arena for reuse. NULL is ignored.
+void ZWScratchArenaFree(ZWScratchArena *arena, void *buffer);
+
+// Gives back every buffer at once, for the end of a photo
+void ZWScratchArenaReset(ZWScratchArena *arena);
+
+// Frees unused buffers until the arena holds no more than maxBytes
+void ZWScratchArenaTrim(ZWScratchArena *arena, size_t maxBytes);
+
+void ZWScratchArenaGetStats(ZWScratchArena *arena, ZWScratchArenaStats *stats);
+void ZWScratchArenaResetStats(ZWScratchArena *arena);
+
+// For code that takes an optional arena: allocate from it if there is one, from malloc otherwise
+void *ZWScratchAlloc(ZWScratchArena *arena, size_t size);
+void ZWScratchFree(ZWScratchArena *arena, void *buffer);
+
+#endif
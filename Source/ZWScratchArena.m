@@ -0,0 +1,202 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWScratchArena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    void *buffer;
+    size_t capacity;
+    int inUse;
+} Slot;
+
+struct ZWScratchArena {
+    Slot *slots;
+    int slotCount;
+    int slotCapacity;
+    ZWScratchArenaStats stats;
+};
+
+ZWScratchArena *ZWScratchArenaCreate(void)
+{
+    return (ZWScratchArena *)calloc(1, sizeof(ZWScratchArena));
+}
+
+void ZWScratchArenaDestroy(ZWScratchArena *arena)
+{
+    int i;
+    
+    if (arena == NULL) 
+        return;
+    
+    for (i = 0; i < arena->slotCount; i++) 
+        free(arena->slots[i].buffer);
+    free(arena->slots);
+    free(arena);
+}
+
+void *ZWScratchArenaAlloc(ZWScratchArena *arena, size_t size)
+{
+    int i, best = -1, largestFree = -1;
+    Slot *slot;
+    
+    if (size == 0) 
+        size = 1;
+    
+    arena->stats.requests++;
+    arena->stats.bytesRequested += size;
+    
+    // the smallest free buffer that's big enough
+    for (i = 0; i < arena->slotCount; i++) {
+        slot = &arena->slots[i];
+        if (slot->inUse) 
+            continue;
+        if (slot->capacity >= size && (best < 0 || slot->capacity < arena->slots[best].capacity)) 
+            best = i;
+        if (largestFree < 0 || slot->capacity > arena->slots[largestFree].capacity) 
+            largestFree = i;
+    }
+    
+    if (best >= 0) {
+        arena->slots[best].inUse = 1;
+        return arena->slots[best].buffer;
+    }
+    
+    // Nothing fits. Grow the biggest free buffer rather than adding another one, so the arena doesn't
+    // collect buffers that are all a bit too small.
+    if (largestFree >= 0) {
+        void *grown;
+        
+        slot = &arena->slots[largestFree];
+        grown = realloc(slot->buffer, size);
+        if (grown == NULL) 
+            return NULL;
+        
+        arena->stats.allocations++;
+        arena->stats.bytesAllocated += size;
+        arena->stats.bytesHeld += size - slot->capacity;
+        
+        slot->buffer = grown;
+        slot->capacity = size;
+        slot->inUse = 1;
+        return grown;
+    }
+    
+    if (arena->slotCount == arena->slotCapacity) {
+        int newCapacity = arena->slotCapacity ? arena->slotCapacity * 2 : 8;
+        Slot *newSlots = (Slot *)realloc(arena->slots, sizeof(Slot) * newCapacity);
+        if (newSlots == NULL) 
+            return NULL;
+        arena->slots = newSlots;
+        arena->slotCapacity = newCapacity;
+    }
+    
+    slot = &arena->slots[arena->slotCount];
+    slot->buffer = malloc(size);
+    if (slot->buffer == NULL) 
+        return NULL;
+    slot->capacity = size;
+    slot->inUse = 1;
+    arena->slotCount++;
+    
+    arena->stats.allocations++;
+    arena->stats.bytesAllocated += size;
+    arena->stats.bytesHeld += size;
+    
+    return slot->buffer;
+}
+
+void ZWScratchArenaFree(ZWScratchArena *arena, void *buffer)
+{
+    int i;
+    
+    if (buffer == NULL) 
+        return;
+    
+    for (i = 0; i < arena->slotCount; i++) {
+        if (arena->slots[i].buffer == buffer) {
+            arena->slots[i].inUse = 0;
+            return;
+        }
+    }
+}
+
+void ZWScratchArenaReset(ZWScratchArena *arena)
+{
+    int i;
+    
+    for (i = 0; i < arena->slotCount; i++) 
+        arena->slots[i].inUse = 0;
+}
+
+void ZWScratchArenaTrim(ZWScratchArena *arena, size_t maxBytes)
+{
+    int i;
+    
+    // there are only ever a handful of slots, so just drop free ones until we're under
+    for (i = arena->slotCount - 1; i >= 0 && arena->stats.bytesHeld > maxBytes; i--) {
+        Slot *slot = &arena->slots[i];
+        if (slot->inUse) 
+            continue;
+        
+        arena->stats.bytesHeld -= slot->capacity;
+        free(slot->buffer);
+        arena->slots[i] = arena->slots[arena->slotCount - 1];
+        arena->slotCount--;
+    }
+}
+
+void ZWScratchArenaGetStats(ZWScratchArena *arena, ZWScratchArenaStats *stats)
+{
+    *stats = arena->stats;
+}
+
+void ZWScratchArenaResetStats(ZWScratchArena *arena)
+{
+    unsigned long long bytesHeld = arena->stats.bytesHeld;
+    
+    memset(&arena->stats, 0, sizeof(ZWScratchArenaStats));
+    arena->stats.bytesHeld = bytesHeld;
+}
+
+void *ZWScratchAlloc(ZWScratchArena *arena, size_t size)
+{
+    return arena ? ZWScratchArenaAlloc(arena, size) : malloc(size);
+}
+
+void ZWScratchFree(ZWScratchArena *arena, void *buffer)
+{
+    if (arena) 
+        ZWScratchArenaFree(arena, buffer);
+    else 
+        free(buffer);
+}
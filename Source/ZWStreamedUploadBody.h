@@ -0,0 +1,62 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import <Cocoa/Cocoa.h>
+
+// The body of an upload too big to hold in memory: some bytes, a file, then some more bytes, fed to 
+// CFNetwork through a socket pair by a thread of our own a buffer at a time. CFNetwork (as far back as we
+// go) has no way to make a read stream out of several pieces, and copying the whole thing to a temporary
+// file first would mean reading and writing every movie twice.
+@interface ZWStreamedUploadBody : NSObject {
+    NSData *prefix;
+    NSString *path;
+    NSData *suffix;
+    unsigned long long fileLength;
+    
+    int readSocket, writeSocket;
+    CFReadStreamRef readStream;
+    NSConditionLock *lock;
+}
+
+// Returns nil if the file can't be read
+- (id)initWithPrefix:(NSData *)newPrefix filePath:(NSString *)newPath suffix:(NSData *)newSuffix;
+
+// All of it, for the Content-Length header
+- (unsigned long long)length;
+
+// For CFReadStreamCreateForStreamedHTTPRequest
+- (CFReadStreamRef)readStream;
+
+// Starts feeding the stream. -stop gives up on whatever hasn't been read, and waits for the thread to finish; 
+// it must be called before the body is released if it was started.
+- (void)start;
+- (void)stop;
+
+@end
@@ -0,0 +1,186 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#import "ZWStreamedUploadBody.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// How much of the file is read at a time
+#define UPLOAD_BUFFER_SIZE (64 * 1024)
+
+enum {
+    RUNNING = 0,
+    FINISHED
+};
+
+@interface ZWStreamedUploadBody (PrivateStuff)
+- (void)writeThread:(id)unused;
+@end
+
+static BOOL writeAll(int socket, const void *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(socket, bytes, length);
+        if (written < 0) 
+            return NO;
+        bytes = (const char *)bytes + written;
+        length -= written;
+    }
+    return YES;
+}
+
+@implementation ZWStreamedUploadBody
+
+- (id)initWithPrefix:(NSData *)newPrefix filePath:(NSString *)newPath suffix:(NSData *)newSuffix
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] fileAttributesAtPath:newPath traverseLink:YES];
+    int sockets[2], on = 1;
+    
+    self = [super init];
+    if (self == nil) 
+        return nil;
+    readSocket = writeSocket = -1;
+    
+    if (attributes == nil || socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        [self release];
+        return nil;
+    }
+    readSocket = sockets[0];
+    writeSocket = sockets[1];
+    
+    // a write after the reader has gone away should fail, not kill iPhoto
+    setsockopt(readSocket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    setsockopt(writeSocket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    
+    CFStreamCreatePairWithSocket(kCFAllocatorDefault, readSocket, &readStream, NULL);
+    if (readStream == NULL) {
+        [self release];
+        return nil;
+    }
+    
+    prefix = [newPrefix copy];
+    path = [newPath copy];
+    suffix = [newSuffix copy];
+    fileLength = [attributes fileSize];
+    lock = [[NSConditionLock alloc] initWithCondition:FINISHED];
+    
+    return self;
+}
+
+- (void)dealloc
+{
+    if (readStream) 
+        CFRelease(readStream);
+    if (readSocket >= 0) 
+        close(readSocket);
+    if (writeSocket >= 0) 
+        close(writeSocket);
+    [prefix release];
+    [path release];
+    [suffix release];
+    [lock release];
+    [super dealloc];
+}
+
+- (unsigned long long)length
+{
+    return [prefix length] + fileLength + [suffix length];
+}
+
+- (CFReadStreamRef)readStream
+{
+    return readStream;
+}
+
+- (void)start
+{
+    [lock lock];
+    [lock unlockWithCondition:RUNNING];
+    
+    // the thread keeps us alive until it's done
+    [self retain];
+    [NSThread detachNewThreadSelector:@selector(writeThread:) toTarget:self withObject:nil];
+}
+
+- (void)stop
+{
+    // If the thread is stuck writing to a reader that's gone (the upload was cancelled or failed), this
+    // makes the write fail
+    shutdown(readSocket, SHUT_RDWR);
+    
+    [lock lockWhenCondition:FINISHED];
+    [lock unlock];
+}
+
+@end
+
+@implementation ZWStreamedUploadBody (PrivateStuff)
+
+- (void)writeThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int file = open([path fileSystemRepresentation], O_RDONLY);
+    unsigned long long remaining = fileLength;
+    char *buffer = (char *)malloc(UPLOAD_BUFFER_SIZE);
+    BOOL ok = (file >= 0 && buffer != NULL);
+    
+    if (ok) 
+        ok = writeAll(writeSocket, [prefix bytes], [prefix length]);
+    
+    // Exactly the length we promised, even if the file changes under us; a short file is cut off instead
+    while (ok && remaining > 0) {
+        ssize_t bytesRead = read(file, buffer, (size_t)MIN(remaining, (unsigned long long)UPLOAD_BUFFER_SIZE));
+        if (bytesRead <= 0) 
+            ok = NO;
+        else 
+            ok = writeAll(writeSocket, buffer, bytesRead);
+        remaining -= (bytesRead > 0) ? bytesRead : 0;
+    }
+    
+    if (ok) 
+        writeAll(writeSocket, [suffix bytes], [suffix length]);
+    
+    // the reader sees the end of the body (or the short body, and the request fails)
+    shutdown(writeSocket, SHUT_WR);
+    
+    if (file >= 0) 
+        close(file);
+    free(buffer);
+    
+    [lock lock];
+    [lock unlockWithCondition:FINISHED];
+    
+    [pool release];
+    [self release];
+}
+
+@end
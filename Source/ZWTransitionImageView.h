@@ -30,24 +30,41 @@
 
 #import <Cocoa/Cocoa.h>
 
-@class CIFilter;
-@class CIImage;
+#define TRANSITION_DURATION 0.7
 
-@interface ZWTransitionImageView : NSView {
+// A bitmap a photo is matted into, and the CGImage that draws it
+typedef struct {
+    unsigned char *data;
+    size_t width, height, bytesPerRow;
+    CGContextRef context;
+    CGImageRef image;
+} ZWTransitionBuffer;
 
+// Shows a photo matted in a rounded frame, cross-fading from one photo to the next. The matting is done on
+// a thread of our own into bitmaps that are kept from one photo to the next, so all the main thread does per
+// photo is hand the photo over and draw the result. If the next photo turns up before a fade is over, or 
+// while one is still being matted, the fade is skipped.
+@interface ZWTransitionImageView : NSView {
     NSImage *image;
-    NSImage *oldImage;
-    NSImage *actualOldImage;
-    
-    BOOL imageIsBlank;
-    NSRect mattedImageRect;
- 
-    CIImage *inputShadingImage;     // an environment-map image that the transitionFilter may use in generating the transition effect
-    CIFilter *transitionFilter;      // the Core Image transition filter that will generate the animation frames
-    NSRect imageRect;         // the subrect of the AnimatingTabView where the animating image should be composited
     NSAnimation *animation;
+    
+    // Three buffers take turns: the one shown, the one a fade is leaving, and a spare for the compositor
+    NSConditionLock *compositeLock;
+    ZWTransitionBuffer buffers[3];
+    int shownBuffer, leavingBuffer, spareBuffer, readyBuffer;
+    BOOL hasShown, shownIsBlank, readyIsBlank;
+    
+    BOOL hasPendingRequest;
+    NSBitmapImageRep *pendingBitmap;    // nil for just the frame
+    NSSize pendingSize;
+    BOOL compositorRunning;
+    
+    ZWTransitionBuffer matte;           // the empty frame, for the last size asked for. The compositor's alone.
 }
 
+// How long the change from one image to the next takes to animate
++ (NSTimeInterval)transitionDuration;
+
 - (NSImage *)image;
 - (void)setImage:(NSImage *)newImage;
 
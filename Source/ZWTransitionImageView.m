@@ -29,202 +29,438 @@
 //
 
 #import "ZWTransitionImageView.h"
-#import <Quartz/Quartz.h>
+
+enum {
+    NO_WORK = 0,
+    HAS_WORK
+};
+
+// The compositor thread goes away after this long with nothing to do, and comes back with the next photo
+#define COMPOSITOR_IDLE_SECONDS 10.0
+
+// Where the frame and the photo go, inside the view's bounds
+#define FRAME_INSET 4
+#define MATTE_INSET 5
+#define FRAME_RADIUS 5
+#define FRAME_LINE_WIDTH 2
 
 static NSBitmapImageRep *BitmapImageRepFromNSImage(NSImage *nsImage);
 
 @interface MyViewAnimation : NSAnimation
 @end
 
+@interface ZWTransitionImageView (PrivateStuff)
+- (int)compositorCondition;
+- (void)compositorThread:(id)unused;
+- (void)compositeReady:(id)unused;
+- (void)stopTransition;
+@end
+
+#pragma mark Buffers
+
+static void releaseBitmap(void *info, const void *data, size_t size)
+{
+    [(NSBitmapImageRep *)info release];
+}
+
+// Whether the compositor can draw the bitmap as it is
+static BOOL canMakeImageFromBitmap(NSBitmapImageRep *bitmap)
+{
+    int colors = [bitmap samplesPerPixel] - ([bitmap hasAlpha] ? 1 : 0);
+    
+    return bitmap && ![bitmap isPlanar] && [bitmap bitsPerSample] == 8 && (colors == 1 || colors == 3);
+}
+
+// The image keeps the bitmap it draws from
+static CGImageRef createImageFromBitmap(NSBitmapImageRep *bitmap)
+{
+    int samples = [bitmap samplesPerPixel];
+    BOOL hasAlpha = [bitmap hasAlpha];
+    CGColorSpaceRef colorSpace;
+    CGDataProviderRef provider;
+    CGImageAlphaInfo alphaInfo;
+    CGImageRef image;
+    
+    if (!canMakeImageFromBitmap(bitmap)) 
+        return NULL;
+    
+    if (hasAlpha) 
+        alphaInfo = kCGImageAlphaPremultipliedLast;
+    else if ([bitmap bitsPerPixel] > samples * 8) 
+        alphaInfo = kCGImageAlphaNoneSkipLast;
+    else 
+        alphaInfo = kCGImageAlphaNone;
+    
+    colorSpace = (samples - (hasAlpha ? 1 : 0) == 1) ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
+    provider = CGDataProviderCreateWithData([bitmap retain], [bitmap bitmapData], [bitmap bytesPerRow] * [bitmap pixelsHigh], releaseBitmap);
+    image = CGImageCreate([bitmap pixelsWide], [bitmap pixelsHigh], 8, [bitmap bitsPerPixel], [bitmap bytesPerRow], 
+                          colorSpace, alphaInfo, provider, NULL, true, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    CGColorSpaceRelease(colorSpace);
+    
+    return image;
+}
+
+static void freeBuffer(ZWTransitionBuffer *buffer)
+{
+    if (buffer->image) 
+        CGImageRelease(buffer->image);
+    if (buffer->context) 
+        CGContextRelease(buffer->context);
+    free(buffer->data);
+    memset(buffer, 0, sizeof(ZWTransitionBuffer));
+}
+
+// Gets a buffer ready to be drawn into again, keeping its memory if it's already the right size
+static BOOL prepareBuffer(ZWTransitionBuffer *buffer, size_t width, size_t height)
+{
+    CGColorSpaceRef colorSpace;
+    
+    if (buffer->image) {
+        CGImageRelease(buffer->image);
+        buffer->image = NULL;
+    }
+    
+    if (buffer->data == NULL || buffer->width != width || buffer->height != height) {
+        freeBuffer(buffer);
+        buffer->width = width;
+        buffer->height = height;
+        buffer->bytesPerRow = (width * 4 + 15) & ~15;
+        buffer->data = malloc(buffer->bytesPerRow * height);
+        if (buffer->data == NULL) 
+            return NO;
+        
+        colorSpace = CGColorSpaceCreateDeviceRGB();
+        buffer->context = CGBitmapContextCreate(buffer->data, width, height, 8, buffer->bytesPerRow, colorSpace, kCGImageAlphaPremultipliedFirst);
+        CGColorSpaceRelease(colorSpace);
+        if (buffer->context == NULL) {
+            freeBuffer(buffer);
+            return NO;
+        }
+    }
+    
+    CGContextClearRect(buffer->context, CGRectMake(0, 0, width, height));
+    return YES;
+}
+
+// Done drawing; makes the image that shows what was drawn
+static void finishBuffer(ZWTransitionBuffer *buffer)
+{
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, buffer->data, buffer->bytesPerRow * buffer->height, NULL);
+    
+    CGContextFlush(buffer->context);
+    buffer->image = CGImageCreate(buffer->width, buffer->height, 8, 32, buffer->bytesPerRow, colorSpace, 
+                                  kCGImageAlphaPremultipliedFirst, provider, NULL, false, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    CGColorSpaceRelease(colorSpace);
+}
+
+static void addRoundedRect(CGContextRef context, CGRect rect, float radius)
+{
+    CGRect inner = CGRectInset(rect, radius, radius);
+    
+    CGContextBeginPath(context);
+    CGContextAddArc(context, CGRectGetMinX(inner), CGRectGetMinY(inner), radius, M_PI, 3 * M_PI_2, 0);
+    CGContextAddArc(context, CGRectGetMaxX(inner), CGRectGetMinY(inner), radius, 3 * M_PI_2, 2 * M_PI, 0);
+    CGContextAddArc(context, CGRectGetMaxX(inner), CGRectGetMaxY(inner), radius, 0, M_PI_2, 0);
+    CGContextAddArc(context, CGRectGetMinX(inner), CGRectGetMaxY(inner), radius, M_PI_2, M_PI, 0);
+    CGContextClosePath(context);
+}
+
+// The white rounded frame with its gray border, that every photo goes in
+static BOOL drawMatte(ZWTransitionBuffer *buffer, size_t width, size_t height)
+{
+    CGRect borderRect = CGRectInset(CGRectMake(0, 0, width, height), FRAME_INSET, FRAME_INSET);
+    float radius = MIN(FRAME_RADIUS, 0.5f * MIN(CGRectGetWidth(borderRect), CGRectGetHeight(borderRect)));
+    
+    if (!prepareBuffer(buffer, width, height)) 
+        return NO;
+    
+    addRoundedRect(buffer->context, borderRect, radius);
+    CGContextSetRGBFillColor(buffer->context, 1, 1, 1, 1);
+    CGContextFillPath(buffer->context);
+    
+    addRoundedRect(buffer->context, borderRect, radius);
+    CGContextSetRGBStrokeColor(buffer->context, 0.5, 0.5, 0.5, 1);
+    CGContextSetLineWidth(buffer->context, FRAME_LINE_WIDTH);
+    CGContextStrokePath(buffer->context);
+    
+    finishBuffer(buffer);
+    return YES;
+}
+
+// Fits the photo in the frame, keeping its shape
+static CGRect photoRectInFrame(size_t width, size_t height, CGImageRef photo)
+{
+    CGRect mattedRect = CGRectInset(CGRectMake(0, 0, width, height), FRAME_INSET + MATTE_INSET, FRAME_INSET + MATTE_INSET);
+    float aspect = (float)CGImageGetWidth(photo) / CGImageGetHeight(photo);
+    CGRect rect;
+    
+    if (aspect > 1.0) {
+        rect.size.width = mattedRect.size.width;
+        rect.size.height = rect.size.width / aspect;
+        rect.origin.x = mattedRect.origin.x;
+        rect.origin.y = (mattedRect.size.height - rect.size.height) / 2 + mattedRect.origin.y;
+    }
+    else {
+        rect.size.height = mattedRect.size.height;
+        rect.size.width = rect.size.height * aspect;
+        rect.origin.y = mattedRect.origin.y;
+        rect.origin.x = (mattedRect.size.width - rect.size.width) / 2 + mattedRect.origin.x;
+    }
+    
+    return rect;
+}
+
 @implementation ZWTransitionImageView
 
++ (NSTimeInterval)transitionDuration
+{
+    return TRANSITION_DURATION;
+}
+
 - (id)initWithFrame:(NSRect)frame {
     self = [super initWithFrame:frame];
     if (self) {
-        // Initialization code here.
+        compositeLock = [[NSConditionLock alloc] initWithCondition:NO_WORK];
+        shownBuffer = 0;
+        leavingBuffer = 1;
+        spareBuffer = 2;
+        readyBuffer = -1;
     }
     return self;
 }
 
 - (void)dealloc
 {
+    int i;
+    
+    [self stopTransition];
     [image release];
-    [oldImage release];
+    [pendingBitmap release];
+    [compositeLock release];
+    for (i = 0; i < 3; i++) 
+        freeBuffer(&buffers[i]);
+    freeBuffer(&matte);
     [super dealloc];
 }
 
-- (void)awakeFromNib {
-    // Preload shading bitmap to use in transitions (borrowed from the "Fun House" Core Image example).
-    /*
-    NSData *shadingBitmapData = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"restrictedshine" ofType:@"tiff"]];
-    NSBitmapImageRep *shadingBitmap = [[[NSBitmapImageRep alloc] initWithData:shadingBitmapData] autorelease];
-    inputShadingImage = [[CIImage alloc] initWithBitmapImageRep:shadingBitmap];
-    */
-}
-
 #pragma mark Accessors
 
 - (void)setImage:(NSImage *)newImage
 {
-    BOOL imageWasBlank = imageIsBlank;
-    imageIsBlank = (newImage == nil);
+    NSBitmapImageRep *bitmap = nil;
+    NSEnumerator *enumerator;
+    NSImageRep *representation;
     
-    // save the previous image
-    [oldImage autorelease];
-    oldImage = image;
+    [newImage retain];
+    [image release];
+    image = newImage;
     
-    // create a new matted image with the image we were given
-    NSRect borderRect = NSInsetRect([self bounds], 4, 4);
-    NSSize newImageSize = [newImage size];
-    mattedImageRect = NSInsetRect(borderRect, 5, 5);
-    image = [[NSImage alloc] initWithSize:[self bounds].size];
+    // The previews we're given are almost always bitmaps the compositor can draw straight from. Anything 
+    // else is drawn into one here.
+    enumerator = [[image representations] objectEnumerator];
+    while (bitmap == nil && (representation = [enumerator nextObject])) {
+        if ([representation isKindOfClass:[NSBitmapImageRep class]] && canMakeImageFromBitmap((NSBitmapImageRep *)representation)) 
+            bitmap = (NSBitmapImageRep *)representation;
+    }
+    if (image && bitmap == nil) {
+        bitmap = BitmapImageRepFromNSImage(image);
+        if (!canMakeImageFromBitmap(bitmap)) 
+            bitmap = nil;
+    }
     
-    float aspect = newImageSize.width / newImageSize.height;
+    // a request the compositor hasn't got to yet is simply replaced
+    [compositeLock lock];
+    [bitmap retain];
+    [pendingBitmap release];
+    pendingBitmap = bitmap;
+    pendingSize = [self bounds].size;
+    hasPendingRequest = YES;
+    if (!compositorRunning) {
+        // the thread keeps us alive until it goes
+        compositorRunning = YES;
+        [self retain];
+        [NSThread detachNewThreadSelector:@selector(compositorThread:) toTarget:self withObject:nil];
+    }
+    [compositeLock unlockWithCondition:[self compositorCondition]];
+}
+
+- (NSImage *)image
+{
+    return image;
+}
+
+- (void)animationDidEnd:(NSAnimation*)theAnimation {
+    [animation autorelease];
+    animation = nil;
+    [self setNeedsDisplay:YES];
+}
+
+#pragma mark NSView
+
+- (void)drawRect:(NSRect)rect 
+{
+    CGContextRef context = (CGContextRef)[[NSGraphicsContext currentContext] graphicsPort];
+    CGImageRef shownImage = buffers[shownBuffer].image;
+    CGImageRef leavingImage = buffers[leavingBuffer].image;
     
-    NSRect newImageRect = NSZeroRect;
-    if (aspect > 1.0) {
-        newImageRect.size.width = mattedImageRect.size.width;
-        newImageRect.size.height = newImageRect.size.width / aspect;
-        newImageRect.origin.x = mattedImageRect.origin.x;
-        newImageRect.origin.y = (mattedImageRect.size.height - newImageRect.size.height) / 2 + mattedImageRect.origin.y;
+    if (!hasShown || shownImage == NULL) 
+        return;
+    
+    if (animation != nil && leavingImage) {
+        CGContextDrawImage(context, CGRectMake(0, 0, CGImageGetWidth(leavingImage), CGImageGetHeight(leavingImage)), leavingImage);
+        CGContextSaveGState(context);
+        CGContextSetAlpha(context, [animation currentValue]);
+        CGContextDrawImage(context, CGRectMake(0, 0, CGImageGetWidth(shownImage), CGImageGetHeight(shownImage)), shownImage);
+        CGContextRestoreGState(context);
     }
     else {
-        newImageRect.size.height = mattedImageRect.size.height;
-        newImageRect.size.width = newImageRect.size.height * aspect;
-        newImageRect.origin.y = mattedImageRect.origin.y;
-        newImageRect.origin.x = (mattedImageRect.size.width - newImageRect.size.width) / 2 + mattedImageRect.origin.x;
+        CGContextDrawImage(context, CGRectMake(0, 0, CGImageGetWidth(shownImage), CGImageGetHeight(shownImage)), shownImage);
     }
-    
-    [image lockFocus]; {
-
-        NSBezierPath* path = [NSBezierPath bezierPath];
-        float radius = MIN(5, 0.5f * MIN(NSWidth(borderRect), NSHeight(borderRect)));
-        NSRect rect = NSInsetRect(borderRect, radius, radius);
-        [path appendBezierPathWithArcWithCenter:NSMakePoint(NSMinX(rect), NSMinY(rect)) radius:radius startAngle:180.0 endAngle:270.0];
-        [path appendBezierPathWithArcWithCenter:NSMakePoint(NSMaxX(rect), NSMinY(rect)) radius:radius startAngle:270.0 endAngle:360.0];
-        [path appendBezierPathWithArcWithCenter:NSMakePoint(NSMaxX(rect), NSMaxY(rect)) radius:radius startAngle:  0.0 endAngle: 90.0];
-        [path appendBezierPathWithArcWithCenter:NSMakePoint(NSMinX(rect), NSMaxY(rect)) radius:radius startAngle: 90.0 endAngle:180.0];
-        [path closePath];
-        [path setLineWidth:2.0];
-        
-        // background
-        [[NSColor whiteColor] setFill];
-        [path fill];
-        
-        // black border
-        [[NSColor grayColor] set];
-        [path stroke];
-        
-        [newImage drawInRect:newImageRect 
-                    fromRect:NSMakeRect(0, 0, newImageSize.width, newImageSize.height) 
-                   operation:NSCompositeSourceOver 
-                    fraction:1.0];
+}
 
-        [path stroke];
+@end
 
-    } [image unlockFocus];
+@implementation ZWTransitionImageView (PrivateStuff)
 
-    Class CIImageClass = NSClassFromString(@"CIImage");
-    if (oldImage && image && !imageIsBlank && !imageWasBlank && actualOldImage != newImage && CIImageClass != nil) {
-        NSBitmapImageRep *initialBitmap = BitmapImageRepFromNSImage(oldImage);
-        NSBitmapImageRep *finalBitmap = BitmapImageRepFromNSImage(image);
-        
-        id initialCIImage = [[CIImageClass alloc] initWithBitmapImageRep:initialBitmap];
-        id finalCIImage = [[CIImageClass alloc] initWithBitmapImageRep:finalBitmap];
+// Called with compositeLock held
+- (int)compositorCondition
+{
+    return (hasPendingRequest && spareBuffer >= 0) ? HAS_WORK : NO_WORK;
+}
 
-        NSRect rect = [self bounds];
+- (void)compositorThread:(id)unused
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    while (1) {
+        NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init];
+        NSBitmapImageRep *bitmap;
+        ZWTransitionBuffer *buffer;
+        CGImageRef photo = NULL;
+        size_t width, height;
+        int working;
+        
+        if (![compositeLock lockWhenCondition:HAS_WORK beforeDate:[NSDate dateWithTimeIntervalSinceNow:COMPOSITOR_IDLE_SECONDS]]) {
+            BOOL idle;
+            
+            [compositeLock lock];
+            idle = ([self compositorCondition] == NO_WORK && readyBuffer < 0);
+            if (idle) 
+                compositorRunning = NO;
+            [compositeLock unlockWithCondition:[self compositorCondition]];
+            
+            [innerPool release];
+            if (idle) 
+                break;
+            continue;
+        }
+        bitmap = [pendingBitmap autorelease];
+        pendingBitmap = nil;
+        hasPendingRequest = NO;
+        width = MAX(pendingSize.width, 1);
+        height = MAX(pendingSize.height, 1);
+        working = spareBuffer;
+        spareBuffer = -1;
+        [compositeLock unlockWithCondition:[self compositorCondition]];
+        
+        // The frame's the same for every photo, so it's only drawn again if we've been resized
+        if (matte.image == NULL || matte.width != width || matte.height != height) 
+            drawMatte(&matte, width, height);
         
-        /* Page curl transition - busted at small sizes like we need
-        transitionFilter = [[CIFilter filterWithName:@"CIPageCurlTransition"] retain];
-        [transitionFilter setDefaults];
-        [transitionFilter setValue:[NSNumber numberWithFloat:-M_PI_4] forKey:@"inputAngle"];
-        [transitionFilter setValue:initialCIImage forKey:@"inputBacksideImage"];
-        [transitionFilter setValue:inputShadingImage forKey:@"inputShadingImage"];
-        [transitionFilter setValue:[CIVector vectorWithX:rect.origin.x Y:rect.origin.y Z:rect.size.width W:rect.size.height] forKey:@"inputExtent"];
-        */
+        buffer = &buffers[working];
+        if (bitmap) 
+            photo = createImageFromBitmap(bitmap);
+        if (matte.image && prepareBuffer(buffer, width, height)) {
+            CGContextDrawImage(buffer->context, CGRectMake(0, 0, width, height), matte.image);
+            if (photo) {
+                CGContextSetInterpolationQuality(buffer->context, kCGInterpolationHigh);
+                CGContextDrawImage(buffer->context, photoRectInFrame(width, height, photo), photo);
+            }
+            finishBuffer(buffer);
+        }
+        if (photo) 
+            CGImageRelease(photo);
         
-        Class CIFilterClass = NSClassFromString(@"CIFilter");
-        transitionFilter = [[CIFilterClass filterWithName:@"CICopyMachineTransition"] retain];
-        [transitionFilter setDefaults];
-        Class CIVectorClass = NSClassFromString(@"CIVector");
-        [transitionFilter setValue:[CIVectorClass vectorWithX:rect.origin.x Y:rect.origin.y Z:rect.size.width W:rect.size.height] forKey:@"inputExtent"];
+        [compositeLock lock];
+        readyBuffer = working;
+        readyIsBlank = (photo == NULL);
+        [compositeLock unlockWithCondition:[self compositorCondition]];
         
-        [transitionFilter setValue:initialCIImage forKey:@"inputImage"];
-        [transitionFilter setValue:finalCIImage forKey:@"inputTargetImage"];
+        [self performSelectorOnMainThread:@selector(compositeReady:) withObject:nil waitUntilDone:NO modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];
         
-        [initialCIImage release];
-        [finalCIImage release];
+        [innerPool release];
+    }
+    
+    [pool release];
+    
+    // views belong to the main thread, right up until they're freed
+    [self performSelectorOnMainThread:@selector(release) withObject:nil waitUntilDone:NO];
+}
 
-        animation = [[MyViewAnimation alloc] initWithDuration:0.7 animationCurve:NSAnimationEaseInOut];
+- (void)compositeReady:(id)unused
+{
+    BOOL wasBlank = shownIsBlank, hadShown = hasShown, wasAnimating = (animation != nil);
+    BOOL isBlank, newerWaiting;
+    int doneBuffer;
+    
+    // The buffer a fade was leaving is done with, and becomes the compositor's spare
+    [compositeLock lock];
+    doneBuffer = leavingBuffer;
+    leavingBuffer = shownBuffer;
+    shownBuffer = readyBuffer;
+    spareBuffer = doneBuffer;
+    readyBuffer = -1;
+    isBlank = readyIsBlank;
+    newerWaiting = hasPendingRequest;
+    [compositeLock unlockWithCondition:[self compositorCondition]];
+    
+    hasShown = YES;
+    shownIsBlank = isBlank;
+    [self stopTransition];
+    
+    // Photos coming faster than we can fade between them are just shown
+    if (hadShown && !wasBlank && !isBlank && !wasAnimating && !newerWaiting && buffers[leavingBuffer].image) {
+        animation = [[MyViewAnimation alloc] initWithDuration:TRANSITION_DURATION animationCurve:NSAnimationEaseInOut];
         [animation setDelegate:self];
         [animation setAnimationBlockingMode:NSAnimationNonblocking];
-        
         [animation startAnimation];
     }
     
     [self setNeedsDisplay:YES];
-    
-    [actualOldImage autorelease];
-    actualOldImage = [newImage retain];
 }
 
-- (NSImage *)image
+- (void)stopTransition
 {
-    return image;
-}
-
-- (void)animationDidEnd:(NSAnimation*)theAnimation {
+    if (animation == nil) 
+        return;
+    
+    [animation setDelegate:nil];
+    [animation stopAnimation];
     [animation autorelease];
     animation = nil;
-    [transitionFilter release];
-    transitionFilter = nil;
-}
-
-#pragma mark NSView
-
-- (void)drawRect:(NSRect)rect 
-{
-    if (animation != nil) {
-        [transitionFilter setValue:[NSNumber numberWithFloat:[animation currentValue]] forKey:@"inputTime"];
-        id outputCIImage = [transitionFilter valueForKey:@"outputImage"];
-        
-        // Composite the outputImage into the view (which triggers on-demand rendering of the result).
-        [outputCIImage drawInRect:[self bounds] fromRect:NSMakeRect(0, 0, [self bounds].size.width, [self bounds].size.height) operation:NSCompositeSourceOver fraction:1.0];
-    }
-    else {
-        [image drawAtPoint:NSMakePoint(0, 0) 
-                  fromRect:NSMakeRect(0, 0, [self bounds].size.width, [self bounds].size.height) 
-                 operation:NSCompositeSourceOver 
-                  fraction:1.0];
-    }
 }
 
 @end
 
 @implementation MyViewAnimation
 
-// Override NSAnimation's -setCurrentProgress: method, and use it as our point to hook in and advance our Core Image transition effect to the next time slice.
+// Override NSAnimation's -setCurrentProgress: method, and use it as our point to hook in and advance the fade to the next time slice.
 - (void)setCurrentProgress:(NSAnimationProgress)progress {
-    // First, invoke super's implementation, so that the NSAnimation will remember the proposed progress value and hand it back to us when we ask for it in AnimatingTabView's -drawRect: method.
+    // First, invoke super's implementation, so that the NSAnimation will remember the proposed progress value and hand it back to us when we ask for it in -drawRect:.
     [super setCurrentProgress:progress];
     
-    // Now ask the AnimatingTabView (which set itself as our delegate) to display.  Sending a -display message differs from sending -setNeedsDisplay: or -setNeedsDisplayInRect: in that it demands an immediate, syncrhonous redraw of the view.  Most of the time, it's preferrable to send a -setNeedsDisplay... message, which gives AppKit the opportunity to coalesce potentially numerous display requests and update the window efficiently when it's convenient.  But for a syncrhonously executing animation, it's appropriate to use -display.
-    [[self delegate] display];
+    // Only ask for the view to be redrawn, rather than drawing it now. If the main thread is busy, AppKit 
+    // puts several steps together into one redraw and the fade drops frames instead of falling behind.
+    [[self delegate] setNeedsDisplay:YES];
 }
 
 @end
 
 static NSBitmapImageRep *BitmapImageRepFromNSImage(NSImage *nsImage) {
-    // See if the NSImage has an NSBitmapImageRep.  If so, return the first NSBitmapImageRep encountered.  An NSImage that is initialized by loading the contents of a bitmap image file (such as JPEG, TIFF, or PNG) and, not subsequently rescaled, will usually have a single NSBitmapImageRep.
-    NSEnumerator *enumerator = [[nsImage representations] objectEnumerator];
-    NSImageRep *representation;
-    while (representation = [enumerator nextObject]) {
-        if ([representation isKindOfClass:[NSBitmapImageRep class]]) {
-            return (NSBitmapImageRep *)representation;
-        }
-    }
-    
-    // If we didn't find an NSBitmapImageRep (perhaps because we received a PDF image), we can create one using one of two approaches: (1) lock focus on the NSImage, and create the bitmap using -[NSBitmapImageRep initWithFocusedViewRect:], or (2) (Tiger and later) create an NSBitmapImageRep, and an NSGraphicsContext that draws into it using +[NSGraphicsContext graphicsContextWithBitmapImageRep:], and composite the NSImage into the bitmap graphics context.  We'll use approach (1) here, since it is simple and supported on all versions of Mac OS X.
+    // If we didn't find a usable NSBitmapImageRep (perhaps because we received a PDF image), we can create one using one of two approaches: (1) lock focus on the NSImage, and create the bitmap using -[NSBitmapImageRep initWithFocusedViewRect:], or (2) (Tiger and later) create an NSBitmapImageRep, and an NSGraphicsContext that draws into it using +[NSGraphicsContext graphicsContextWithBitmapImageRep:], and composite the NSImage into the bitmap graphics context.  We'll use approach (1) here, since it is simple and supported on all versions of Mac OS X.
     NSSize size = [nsImage size];
     [nsImage lockFocus];
     NSBitmapImageRep *bitmapImageRep = [[NSBitmapImageRep alloc] initWithFocusedViewRect:NSMakeRect(0, 0, size.width, size.height)];
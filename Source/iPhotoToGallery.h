@@ -31,7 +31,7 @@
 #import <Cocoa/Cocoa.h>
 #import "iPhotoExporter.h"
 
-@class ZWGallery, ZWGalleryAlbum, ZWGalleryItem;
+@class ZWGallery, ZWGalleryAlbum, ZWGalleryItem, ZWProgressChannel;
 
 // This protocol description was class-dump'd out of iPhoto, and we must implement it.
 @protocol ExportPluginProtocol
@@ -99,6 +99,7 @@ struct progressStruct {
     
     // main screen
     IBOutlet id mainAddToAlbumPopup;
+    IBOutlet id mainAlbumSearchField;
     IBOutlet id mainCreateNewAlbumButton;
     IBOutlet id mainExportCommentsSwitch;
     IBOutlet id mainGalleryPopup;
@@ -106,6 +107,8 @@ struct progressStruct {
     IBOutlet id mainScaleImagesHeightField;
     IBOutlet id mainScaleImagesSwitch;
     IBOutlet id mainScaleImagesWidthField;
+    IBOutlet id mainScaleImagesMaxKBField;
+    IBOutlet id mainScaleImagesSharpeningPopup;
     IBOutlet id mainStatusString;
     IBOutlet id mainProgressIndicator;
     IBOutlet id mainConnectCancelButton;
@@ -140,12 +143,21 @@ struct progressStruct {
     int indexOfLastGallery;
     NSTimer *showCancelTimer;
     
-    unsigned long currentItemProgress;
-    unsigned long currentImageSize;
+    unsigned long long currentItemProgress;
+    unsigned long long currentImageSize;
     unsigned long currentImageIndex;
+    ZWProgressChannel *progressChannel;
     
     ZWGalleryAlbum *currentAlbum;
     
+    // the gallery being logged in to and fetched in the background, and the ones whose threads are still going
+    ZWGallery *warmGallery;
+    NSMutableArray *warmingGalleries;
+    NSLock *warmUpLock;
+    NSTimeInterval warmUpFinishedTime;
+    BOOL waitingForWarmUp;
+    BOOL restartWarmUp;
+    
     int heightOfAdvancedBox;
 }
 
@@ -30,6 +30,15 @@
 
 #import "iPhotoToGallery.h"
 #import "ImageResizer.h"
+#import "ZWDerivedImageCache.h"
+#import "ZWImageSourceSelector.h"
+#import "ZWAlbumSearchIndex.h"
+#import "ZWPreviewGenerator.h"
+#import "ZWProgressChannel.h"
+#import "ZWJPEGRewriteWorker.h"
+#import "ZWJPEGRewriter.h"
+#import "ZWTransitionImageView.h"
+#import "ZWMappedData.h"
 #import "ZWAlbumNameFormatter.h"
 #import "InterThreadMessaging.h"
 #import "NSView+Fading.h"
@@ -41,10 +50,46 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <Growl/Growl.h>
 
+// The sizes Gallery makes its own thumbnails and resizes at by default
+#define THUMBNAIL_DERIVATIVE_SIZE 150
+#define RESIZED_DERIVATIVE_SIZE 640
+
+// How many albums a search puts at the top of the album popup, and the tag they're marked with
+#define ALBUM_SEARCH_LIMIT 20
+#define ALBUM_SEARCH_MATCH_TAG 1
+
+// How long a gallery logged in to and fetched in the background can be shown without going back to it
+#define WARM_UP_FRESH_SECONDS (10 * 60)
+
+// The sharpening popup's choices, in order: unsharp mask amount, and radius in pixels of the scaled photo
+static const float sharpeningPresets[][2] = {
+    { 0.0f, 0.0f },
+    { 0.4f, 0.5f },
+    { 0.7f, 0.6f },
+    { 1.1f, 0.8f }
+};
+
 @interface iPhotoToGallery (PrivateStuff)
 
-- (int)addAlbumAndChildren:(ZWGalleryAlbum *)album toMenu:(NSMenu *)menu indentLevel:(int)level addSub:(BOOL)addSub;
+- (int)fillAlbumPopup:(NSPopUpButton *)popup forSubAlbums:(BOOL)forSub withNone:(BOOL)withNone;
+- (NSMenuItem *)menuItemForAlbum:(ZWGalleryAlbum *)album forSubAlbums:(BOOL)forSub;
+- (void)addChildrenOfAlbum:(ZWGalleryAlbum *)album toMenu:(NSMenu *)menu forSubAlbums:(BOOL)forSub;
+- (void)selectAlbum:(ZWGalleryAlbum *)album inPopup:(NSPopUpButton *)popup;
+- (void)chooseAlbum:(id)sender;
 - (void)openAddGalleryPanel;
+- (NSString *)derivedImageCacheSummary;
+- (void)addScaleImagesMaxKBField;
+- (void)addScaleImagesSharpeningPopup;
+- (void)addAlbumSearchField;
+- (void)searchAlbums:(id)sender;
+- (void)stopProgressChannel;
+- (NSString *)lookupPasswordForGallery:(ZWGallery *)gallery;
+- (void)warmUpGallery:(ZWGallery *)gallery;
+- (void)cancelWarmUp;
+- (BOOL)isWarmGallery:(ZWGallery *)gallery;
+- (BOOL)wantsWarmUpOfGallery:(ZWGallery *)gallery;
+- (void)warmUpThread:(ZWGallery *)gallery;
+- (void)warmUpDidFinish:(NSDictionary *)result;
 
 @end
 
@@ -78,6 +123,25 @@ static int loggingIn;
                 [galleries addObject:gallery];
         }
     }
+    
+    // create the cache here so the export thread never races to do it
+    ZWDerivedImageCache *derivedImageCache = [ZWDerivedImageCache sharedCache];
+    if ([preferences objectForKey:@"derivedImageCacheMaxMB"])
+        [derivedImageCache setMaxBytes:[[preferences objectForKey:@"derivedImageCacheMaxMB"] unsignedLongLongValue] * 1024 * 1024];
+
+    // get going on the gallery used last time, so its albums are there by the time anyone looks
+    warmingGalleries = [[NSMutableArray alloc] init];
+    warmUpLock = [[NSLock alloc] init];
+    if (![[preferences objectForKey:@"disableWarmStart"] boolValue]) {
+        NSEnumerator *each = [galleries objectEnumerator];
+        ZWGallery *gallery;
+        while ((gallery = [each nextObject])) {
+            if ([[gallery identifier] isEqual:[preferences objectForKey:@"defaultGallery"]]) {
+                [self warmUpGallery:gallery];
+                break;
+            }
+        }
+    }
 
     return self;
 }
@@ -85,6 +149,9 @@ static int loggingIn;
 - (void)dealloc {
     [preferences release];
     [galleries release];
+    [warmGallery release];
+    [warmingGalleries release];
+    [warmUpLock release];
     [super dealloc];
 }
 
@@ -120,8 +187,18 @@ static int loggingIn;
         [mainScaleImagesWidthField setIntValue:[[preferences objectForKey:@"scaleImagesWidth"] intValue]];
     if ([preferences objectForKey:@"scaleImagesHeight"])
         [mainScaleImagesHeightField setIntValue:[[preferences objectForKey:@"scaleImagesHeight"] intValue]];
+    if (!mainScaleImagesMaxKBField) 
+        [self addScaleImagesMaxKBField];
+    if ([preferences objectForKey:@"scaleImagesMaxKB"])
+        [mainScaleImagesMaxKBField setIntValue:[[preferences objectForKey:@"scaleImagesMaxKB"] intValue]];
+    if (!mainScaleImagesSharpeningPopup) 
+        [self addScaleImagesSharpeningPopup];
+    if ([preferences objectForKey:@"scaleImagesSharpening"] && [[preferences objectForKey:@"scaleImagesSharpening"] intValue] < [mainScaleImagesSharpeningPopup numberOfItems])
+        [mainScaleImagesSharpeningPopup selectItemAtIndex:[[preferences objectForKey:@"scaleImagesSharpening"] intValue]];
     if ([preferences objectForKey:@"exportComments"])
         [mainExportCommentsSwitch setState:[[preferences objectForKey:@"exportComments"] intValue]];
+    if (!mainAlbumSearchField) 
+        [self addAlbumSearchField];
     
     // if this is their first time, pop down the "add gallery" sheet
     if ([galleries count] == 0 && ![[preferences objectForKey:@"offeredToCreateGalleryOnFirstOpen"] boolValue]) {
@@ -173,6 +250,9 @@ static int loggingIn;
     if ([mainScaleImagesSwitch state] == NSOnState) {
         [preferences setObject:[NSNumber numberWithInt:[mainScaleImagesWidthField intValue]] forKey:@"scaleImagesWidth"];
         [preferences setObject:[NSNumber numberWithInt:[mainScaleImagesHeightField intValue]] forKey:@"scaleImagesHeight"];
+        [preferences setObject:[NSNumber numberWithInt:[mainScaleImagesMaxKBField intValue]] forKey:@"scaleImagesMaxKB"];
+        if (mainScaleImagesSharpeningPopup) 
+            [preferences setObject:[NSNumber numberWithInt:[mainScaleImagesSharpeningPopup indexOfSelectedItem]] forKey:@"scaleImagesSharpening"];
     }
     [preferences setObject:[NSNumber numberWithBool:[mainOpenBrowserSwitch state]] forKey:@"openBrowser"];
     [preferences setObject:[NSNumber numberWithBool:[mainExportCommentsSwitch state]] forKey:@"exportComments"];
@@ -187,6 +267,9 @@ static int loggingIn;
     [progressProgressIndicator startAnimation:self];
     [progressImageView setImage:nil];
     
+    progressChannel = [[ZWProgressChannel alloc] initWithDelegate:self];
+    [progressChannel start];
+    
     [NSThread detachNewThreadSelector:@selector(addItemsThread:) toTarget:self withObject:self];
     [NSApp beginSheet:progressPanel modalForWindow:[exportManager window] modalDelegate:self didEndSelector:@selector(progressSheetDidEnd:returnCode:contextInfo:) contextInfo:NULL];
 }
@@ -210,7 +293,7 @@ static int loggingIn;
 }
 
 - (char)handlesMovieFiles {
-    return NO;
+    return YES;
 }
 
 - (NSString *)defaultDirectory {
@@ -234,6 +317,7 @@ static int loggingIn;
 }
 
 - (void)viewWillBeDeactivated {
+    [self cancelWarmUp];
     if ((currentGallery != nil) && ([currentGallery loggedIn])) {
         [currentGallery logout];
         [self setLoggedInOut];
@@ -241,8 +325,8 @@ static int loggingIn;
 }
 
 - (void)viewWillBeActivated {
-    // logout if we're logged in (we shouldn't be)
-    if ((currentGallery != nil) && ([currentGallery loggedIn])) {
+    // logout if we're logged in (we shouldn't be, unless it was done in the background just now)
+    if ((currentGallery != nil) && ([currentGallery loggedIn]) && ![self isWarmGallery:currentGallery]) {
         [currentGallery logout];
     }
     
@@ -298,7 +382,15 @@ static int loggingIn;
 }
 
 - (IBAction)clickCancelLogin:(id)sender {
-    [currentGallery cancelOperation];
+    if (waitingForWarmUp) {
+        // only while the warm-up still has a connection to cancel
+        [warmUpLock lock];
+        if ([warmingGalleries indexOfObjectIdenticalTo:currentGallery] != NSNotFound) 
+            [currentGallery cancelOperation];
+        [warmUpLock unlock];
+    }
+    else 
+        [currentGallery cancelOperation];
 }
 
 - (IBAction)clickCreateNewAlbum:(id)sender {
@@ -334,20 +426,7 @@ static int loggingIn;
     [albumSettingsDescriptionField setString:currComments];
     
     // populate the "nested in" popup
-    [albumSettingsNestedInPopup removeAllItems];
-    [albumSettingsNestedInPopup setAutoenablesItems:NO];
-	if (![currentGallery isGalleryV2])
-		[albumSettingsNestedInPopup addItemWithTitle:@"(None)"];
-    
-	int count = 0;
-	NSEnumerator *enumerator = [[currentGallery albums] objectEnumerator];
-	ZWGalleryAlbum *album;
-	while (album = [enumerator nextObject]) {
-		if ([album canAddSubToAlbumOrSub] && ![album parent]) 
-			count += [self addAlbumAndChildren:album toMenu:[albumSettingsNestedInPopup menu] indentLevel:0 addSub:YES];
-	}
-    
-    if (count) 
+    if ([self fillAlbumPopup:albumSettingsNestedInPopup forSubAlbums:YES withNone:![currentGallery isGalleryV2]]) 
         [albumSettingsNestedInPopup setEnabled:YES];
     else 
         [albumSettingsNestedInPopup setEnabled:NO];
@@ -356,9 +435,8 @@ static int loggingIn;
     // This is only relevant for G2 - for G1 we will default to an album at root level
     if ([currentGallery isGalleryV2]) {
         ZWGalleryAlbum *selectedAlbum = [[mainAddToAlbumPopup selectedItem] representedObject];
-        int idx = [albumSettingsNestedInPopup indexOfItemWithRepresentedObject:selectedAlbum];
-        if (idx >= 0 && [[albumSettingsNestedInPopup itemAtIndex:idx] isEnabled]) 
-            [albumSettingsNestedInPopup selectItemAtIndex:idx];
+        if ([selectedAlbum canAddSubAlbum]) 
+            [self selectAlbum:selectedAlbum inPopup:albumSettingsNestedInPopup];
     }
     
     [NSApp beginSheet:albumSettingsPanel modalForWindow:[exportManager window] modalDelegate:self didEndSelector:@selector(sheetDidEnd:returnCode:contextInfo:) contextInfo:NULL];
@@ -520,6 +598,9 @@ static int loggingIn;
 - (IBAction)clickGalleryListRemove:(id)sender {
     ZWGallery *gallery = [galleries objectAtIndex:[galleryListTable selectedRow]];
     NSString *username = [gallery username];
+    
+    if (gallery == warmGallery) 
+        [self cancelWarmUp];
     NSString *host = [[gallery url] host];
     NSString *path = [[gallery url] path];
     
@@ -661,24 +742,32 @@ static int loggingIn;
 - (void)loginToSelectedGallery
 {
     if (![[[mainGalleryPopup selectedItem] title] isEqual:@"(None)"]) {
+        ZWGallery *selectedGallery = [[mainGalleryPopup selectedItem] representedObject];
         
-        // logout if we're logged in
-        if ((currentGallery != nil) && ([currentGallery loggedIn])) {
+        // logout if we're logged in, unless it's to this gallery and was done in the background just now
+        if ((currentGallery != nil) && ([currentGallery loggedIn]) && 
+            !(currentGallery == selectedGallery && [self isWarmGallery:currentGallery])) {
             [currentGallery logout];
             [self setLoggedInOut];
         }
-        currentGallery = [[mainGalleryPopup selectedItem] representedObject];
+        currentGallery = selectedGallery;
         [lastGallerySelected release];
         lastGallerySelected = [[mainGalleryPopup titleOfSelectedItem] retain];
-        // attempt to login
-        if (![currentGallery loggedIn] && currentGallery) {
-            [currentGallery setPassword:[self lookupPasswordForCurrentGallery]];
+        
+        if ([self isWarmGallery:currentGallery]) {
             [currentGallery setDelegate:self];
+            [mainGalleryPopup setEnabled:TRUE];
+            loggingIn = 0;
+            [self galleryDidGetAlbums:currentGallery];
+        }
+        // attempt to login, by way of a warm-up that's waited on (or one that's already under way)
+        else if (![currentGallery loggedIn] && currentGallery) {
             [mainProgressIndicator startAnimation:self];
             [mainStatusString setStringValue:@"Logging in..."];
             [mainGalleryPopup setEnabled:FALSE];
             
-            [currentGallery login];
+            waitingForWarmUp = YES;
+            [self warmUpGallery:currentGallery];
             
             showCancelTimer = [NSTimer timerWithTimeInterval:0.5
                                                       target:self
@@ -768,68 +857,237 @@ static int loggingIn;
     [galleriesPrefs release];
 }
 
-// This is a little helper method that populates those album menus. You hand it an album and it recursively adds it
-// and sub-albums, increasing indentation as you get further down the tree. The confusingly-named "addSub" lets you specify
-// whether or not to only add sub-albums that the user has permission to create a new album in. Or something like that. :)
-- (int)addAlbumAndChildren:(ZWGalleryAlbum *)album toMenu:(NSMenu *)menu indentLevel:(int)level addSub:(BOOL)addSub
+// These populate the album popups. Galleries can have thousands of albums, so only the top level goes in the 
+// popup itself; albums with something under them get a submenu, which is filled in the first time it opens. 
+// The popup's first item stands for the chosen album wherever in the tree it came from, so the rest of the 
+// plugin can keep asking the popup's selected item for it. forSub picks the permission that matters: 
+// creating sub-albums rather than adding photos.
+
+static BOOL albumAllows(ZWGalleryAlbum *album, BOOL forSub)
+{
+    return forSub ? [album canAddSubAlbum] : [album canAddItem];
+}
+
+static BOOL subtreeAllows(ZWGalleryAlbum *album, BOOL forSub)
+{
+    return forSub ? [album canAddSubToAlbumOrSub] : [album canAddItemToAlbumOrSub];
+}
+
+static BOOL anyChildAllows(ZWGalleryAlbum *album, BOOL forSub)
+{
+    NSEnumerator *each = [[album children] objectEnumerator];
+    ZWGalleryAlbum *child;
+    
+    while ((child = [each nextObject])) {
+        if (subtreeAllows(child, forSub)) 
+            return YES;
+    }
+    return NO;
+}
+
+// The first album in the tree the permission allows, in the order the menus show them
+static ZWGalleryAlbum *firstAllowedAlbum(NSEnumerator *albums, BOOL forSub, BOOL rootsOnly)
+{
+    ZWGalleryAlbum *album, *found;
+    
+    while ((album = [albums nextObject])) {
+        if ((rootsOnly && [album parent]) || !subtreeAllows(album, forSub)) 
+            continue;
+        if (albumAllows(album, forSub)) 
+            return album;
+        found = firstAllowedAlbum([[album children] objectEnumerator], forSub, NO);
+        if (found) 
+            return found;
+    }
+    return nil;
+}
+
+static NSString *albumPath(ZWGalleryAlbum *album)
+{
+    NSString *path = [album title];
+    
+    while ((album = [album parent])) 
+        path = [NSString stringWithFormat:@"%@ > %@", [album title], path];
+    return path;
+}
+
+- (int)fillAlbumPopup:(NSPopUpButton *)popup forSubAlbums:(BOOL)forSub withNone:(BOOL)withNone
+{
+    NSMenu *menu = [popup menu];
+    NSEnumerator *enumerator = [[currentGallery albums] objectEnumerator];
+    ZWGalleryAlbum *album;
+    int count = 0;
+    
+    [popup removeAllItems];
+    [popup setAutoenablesItems:NO];
+    
+    NSMenuItem *chosenItem = [[[NSMenuItem alloc] initWithTitle:@"" action:@selector(chooseAlbum:) keyEquivalent:@""] autorelease];
+    [chosenItem setTarget:self];
+    [menu addItem:chosenItem];
+    [menu addItem:[NSMenuItem separatorItem]];
+    
+    if (withNone) {
+        NSMenuItem *noneItem = [[[NSMenuItem alloc] initWithTitle:@"(None)" action:@selector(chooseAlbum:) keyEquivalent:@""] autorelease];
+        [noneItem setTarget:self];
+        [menu addItem:noneItem];
+    }
+    
+    while ((album = [enumerator nextObject])) {
+        if (![album parent] && subtreeAllows(album, forSub)) {
+            [menu addItem:[self menuItemForAlbum:album forSubAlbums:forSub]];
+            count++;
+        }
+    }
+    
+    if (withNone) 
+        [self selectAlbum:nil inPopup:popup];
+    else 
+        [self selectAlbum:firstAllowedAlbum([[currentGallery albums] objectEnumerator], forSub, YES) inPopup:popup];
+    
+    return count;
+}
+
+- (NSMenuItem *)menuItemForAlbum:(ZWGalleryAlbum *)album forSubAlbums:(BOOL)forSub
+{
+    NSMenuItem *item = [[[NSMenuItem alloc] initWithTitle:[album title] action:@selector(chooseAlbum:) keyEquivalent:@""] autorelease];
+    [item setTarget:self];
+    [item setRepresentedObject:album];
+    
+    if (anyChildAllows(album, forSub)) {
+        NSMenu *submenu = [[[NSMenu alloc] initWithTitle:[album title]] autorelease];
+        [submenu setAutoenablesItems:NO];
+        
+        // menus can only be filled in as they open on 10.3 and later
+        if ([submenu respondsToSelector:@selector(setDelegate:)]) 
+            [submenu setDelegate:self];
+        else 
+            [self addChildrenOfAlbum:album toMenu:submenu forSubAlbums:forSub];
+        [item setSubmenu:submenu];
+    }
+    else {
+        [item setEnabled:albumAllows(album, forSub)];
+    }
+    
+    return item;
+}
+
+// An album with a submenu can't be picked itself, so it leads its own submenu
+- (void)addChildrenOfAlbum:(ZWGalleryAlbum *)album toMenu:(NSMenu *)menu forSubAlbums:(BOOL)forSub
+{
+    NSEnumerator *each = [[album children] objectEnumerator];
+    ZWGalleryAlbum *child;
+    
+    NSMenuItem *albumItem = [[[NSMenuItem alloc] initWithTitle:[album title] action:@selector(chooseAlbum:) keyEquivalent:@""] autorelease];
+    [albumItem setTarget:self];
+    [albumItem setRepresentedObject:album];
+    [albumItem setEnabled:albumAllows(album, forSub)];
+    [menu addItem:albumItem];
+    [menu addItem:[NSMenuItem separatorItem]];
+    
+    while ((child = [each nextObject])) {
+        if (subtreeAllows(child, forSub)) 
+            [menu addItem:[self menuItemForAlbum:child forSubAlbums:forSub]];
+    }
+}
+
+- (void)selectAlbum:(ZWGalleryAlbum *)album inPopup:(NSPopUpButton *)popup
+{
+    NSMenuItem *chosenItem = (NSMenuItem *)[popup itemAtIndex:0];
+    
+    [chosenItem setTitle:(album ? albumPath(album) : @"(None)")];
+    [chosenItem setRepresentedObject:album];
+    [popup selectItemAtIndex:0];
+}
+
+- (void)chooseAlbum:(id)sender
+{
+    NSMenu *menu = [sender menu];
+    
+    while ([menu supermenu]) 
+        menu = [menu supermenu];
+    
+    if (menu == [mainAddToAlbumPopup menu]) 
+        [self selectAlbum:[sender representedObject] inPopup:mainAddToAlbumPopup];
+    else if (menu == [albumSettingsNestedInPopup menu]) 
+        [self selectAlbum:[sender representedObject] inPopup:albumSettingsNestedInPopup];
+}
+
+// Matches for what's been typed in the search field go at the top of the popup, under the chosen album, and 
+// the best of them is chosen straight away
+- (void)searchAlbums:(id)sender
 {
-	int count = 0;
-
-	NSMenuItem *albumMenuItem = [[[NSMenuItem alloc] initWithTitle:[album title] action:nil keyEquivalent:@""] autorelease];
-    [albumMenuItem setIndentationLevel:level];
-	[albumMenuItem setRepresentedObject:album];
-	if (!addSub && ![album canAddItem]) 
-		[albumMenuItem setEnabled:FALSE];
-	else if (addSub && ![album canAddSubAlbum])
-		[albumMenuItem setEnabled:FALSE];
-	else
-		[albumMenuItem setEnabled:TRUE];
-	[menu addItem:albumMenuItem];
-	count++;
-	
-	NSEnumerator *each = [[album children] objectEnumerator];
-	ZWGalleryAlbum *child;
-	while (child = [each nextObject]) {
-		if (!addSub && [child canAddItemToAlbumOrSub]) 
-			count += [self addAlbumAndChildren:child toMenu:menu indentLevel:(level + 1) addSub:addSub];
-		else if (addSub && [child canAddSubToAlbumOrSub]) 
-			count += [self addAlbumAndChildren:child toMenu:menu indentLevel:(level + 1) addSub:addSub];
-	}
-	
-	return count;
+    NSMenu *menu = [mainAddToAlbumPopup menu];
+    NSString *query = [sender stringValue];
+    NSArray *matches;
+    int i;
+    
+    for (i = [menu numberOfItems] - 1; i > 0; i--) {
+        if ([[menu itemAtIndex:i] tag] == ALBUM_SEARCH_MATCH_TAG) 
+            [menu removeItemAtIndex:i];
+    }
+    
+    if (![mainAddToAlbumPopup isEnabled] || [query length] == 0) 
+        return;
+    matches = [[currentGallery albumSearchIndex] albumsMatching:query limit:ALBUM_SEARCH_LIMIT];
+    if ([matches count] == 0) 
+        return;
+    
+    for (i = 0; i < (int)[matches count]; i++) {
+        ZWGalleryAlbum *album = [matches objectAtIndex:i];
+        NSMenuItem *item = [[[NSMenuItem alloc] initWithTitle:albumPath(album) action:@selector(chooseAlbum:) keyEquivalent:@""] autorelease];
+        [item setTarget:self];
+        [item setRepresentedObject:album];
+        [item setTag:ALBUM_SEARCH_MATCH_TAG];
+        [menu insertItem:item atIndex:i + 1];
+    }
+    NSMenuItem *separator = [NSMenuItem separatorItem];
+    [separator setTag:ALBUM_SEARCH_MATCH_TAG];
+    [menu insertItem:separator atIndex:i + 1];
+    
+    [self selectAlbum:[matches objectAtIndex:0] inPopup:mainAddToAlbumPopup];
+}
+
+#pragma mark NSMenu delegate
+
+- (void)menuNeedsUpdate:(NSMenu *)menu
+{
+    NSMenu *supermenu = [menu supermenu], *root = menu;
+    int index;
+    
+    if ([menu numberOfItems] || supermenu == nil) 
+        return;
+    
+    index = [supermenu indexOfItemWithSubmenu:menu];
+    if (index < 0) 
+        return;
+    
+    while ([root supermenu]) 
+        root = [root supermenu];
+    
+    [self addChildrenOfAlbum:[[supermenu itemAtIndex:index] representedObject] 
+                      toMenu:menu 
+                forSubAlbums:(root == [albumSettingsNestedInPopup menu])];
 }
 
 - (void)updateAlbumPopupMenu {
     NSArray *albums = [currentGallery albums];
     [mainAddToAlbumPopup removeAllItems];
+    [mainAlbumSearchField setStringValue:@""];
     if (albums == nil) {
+        [mainAlbumSearchField setEnabled:FALSE];
         return;
     }
-    int anyAlbums = 0;
-    
-    [mainAddToAlbumPopup setAutoenablesItems:NO];
     
-	NSEnumerator *enumerator = [albums objectEnumerator];
-	ZWGalleryAlbum *album;
-	while (album = [enumerator nextObject]) {
-		if ([album canAddItemToAlbumOrSub] && ![album parent]) {
-			anyAlbums += [self addAlbumAndChildren:album toMenu:[mainAddToAlbumPopup menu] indentLevel:0 addSub:NO];
-		}
-	}
-	
-    if (!anyAlbums) {
+    if (![self fillAlbumPopup:mainAddToAlbumPopup forSubAlbums:NO withNone:NO]) {
+        [mainAddToAlbumPopup removeAllItems];
         [mainAddToAlbumPopup addItemWithTitle:@"(None)"];
         [mainAddToAlbumPopup setEnabled:FALSE];
+        [mainAlbumSearchField setEnabled:FALSE];
         [exportManager disableControls];
     } else {
         [mainAddToAlbumPopup setEnabled:TRUE];
+        [mainAlbumSearchField setEnabled:([currentGallery albumSearchIndex] != nil)];
         [exportManager enableControls];
-        
-        // make sure a disabled item isn't selected
-        while (![[mainAddToAlbumPopup selectedItem] isEnabled]) {
-            [mainAddToAlbumPopup selectItemAtIndex:([mainAddToAlbumPopup indexOfSelectedItem] + 1)];
-        }
-        
     }
     
 }
@@ -848,22 +1106,122 @@ static int loggingIn;
         
         [mainAddToAlbumPopup removeAllItems];
         [mainAddToAlbumPopup setEnabled:FALSE];
+        [mainAlbumSearchField setStringValue:@""];
+        [mainAlbumSearchField setEnabled:FALSE];
         [mainCreateNewAlbumButton setEnabled:FALSE];
         [mainOpenBrowserSwitch setEnabled:FALSE];
         [mainScaleImagesSwitch setEnabled:FALSE];
         [mainScaleImagesHeightField setEnabled:FALSE];
         [mainScaleImagesWidthField setEnabled:FALSE];
+        [mainScaleImagesMaxKBField setEnabled:FALSE];
+        [mainScaleImagesSharpeningPopup setEnabled:FALSE];
         [mainExportCommentsSwitch setEnabled:FALSE];
     }
 }
 
+// The byte budget field isn't in the nib yet, so build it next to the width/height fields
+- (void)addScaleImagesMaxKBField
+{
+    NSView *scaleBox = [mainScaleImagesHeightField superview];
+    if (scaleBox == nil) 
+        return;
+    
+    NSRect widthFrame = [mainScaleImagesWidthField frame];
+    NSRect heightFrame = [mainScaleImagesHeightField frame];
+    NSRect commentsFrame = [mainExportCommentsSwitch frame];
+    
+    NSRect fieldFrame = NSMakeRect(NSMinX(widthFrame), NSMidY(commentsFrame) - NSHeight(widthFrame) / 2, NSWidth(widthFrame), NSHeight(widthFrame));
+    NSTextField *field = [[[NSTextField alloc] initWithFrame:fieldFrame] autorelease];
+    [[field cell] setFont:[mainScaleImagesWidthField font]];
+    [[field cell] setControlSize:[[mainScaleImagesWidthField cell] controlSize]];
+    [field setAlignment:[mainScaleImagesWidthField alignment]];
+    [field setFormatter:[mainScaleImagesWidthField formatter]];
+    [field setIntValue:0];
+    [field setToolTip:@"Largest size in kilobytes for each scaled photo. 0 means no limit."];
+    [scaleBox addSubview:field];
+    
+    NSRect labelFrame = NSMakeRect(NSMaxX(fieldFrame) + 3, NSMinY(fieldFrame) + 3, NSMaxX(heightFrame) - NSMaxX(fieldFrame), 14);
+    NSTextField *label = [[[NSTextField alloc] initWithFrame:labelFrame] autorelease];
+    [label setStringValue:@"KB max"];
+    [label setFont:[NSFont systemFontOfSize:[NSFont smallSystemFontSize]]];
+    [label setEditable:NO];
+    [label setSelectable:NO];
+    [label setBordered:NO];
+    [label setDrawsBackground:NO];
+    [scaleBox addSubview:label];
+    
+    [mainScaleImagesHeightField setNextKeyView:field];
+    
+    mainScaleImagesMaxKBField = field;
+}
+
+// Nor is the sharpening popup. It goes in the gap between the comments switch and the byte budget field, 
+// if there's room for it once the switch is cut down to the size of its title.
+- (void)addScaleImagesSharpeningPopup
+{
+    NSView *scaleBox = [mainScaleImagesHeightField superview];
+    if (scaleBox == nil || mainScaleImagesMaxKBField == nil) 
+        return;
+    
+    [mainExportCommentsSwitch sizeToFit];
+    
+    NSRect commentsFrame = [mainExportCommentsSwitch frame];
+    NSRect maxKBFrame = [mainScaleImagesMaxKBField frame];
+    float left = NSMaxX(commentsFrame) + 6, right = NSMinX(maxKBFrame) - 6;
+    if (right - left < 90) 
+        return;
+    
+    NSRect popupFrame = NSMakeRect(left, NSMidY(commentsFrame) - 11, right - left, 22);
+    NSPopUpButton *popup = [[[NSPopUpButton alloc] initWithFrame:popupFrame pullsDown:NO] autorelease];
+    [[popup cell] setControlSize:NSSmallControlSize];
+    [popup setFont:[NSFont systemFontOfSize:[NSFont smallSystemFontSize]]];
+    [popup addItemsWithTitles:[NSArray arrayWithObjects:@"No sharpening", @"Sharpen lightly", @"Sharpen", @"Sharpen strongly", nil]];
+    [popup setToolTip:@"Sharpens scaled photos a little to make up for the softening that comes with shrinking them."];
+    [scaleBox addSubview:popup];
+    
+    mainScaleImagesSharpeningPopup = popup;
+}
+
+// The album search field isn't in the nib either. It sits under the album popup, beside the new album button.
+- (void)addAlbumSearchField
+{
+    NSView *albumBox = [mainAddToAlbumPopup superview];
+    if (albumBox == nil) 
+        return;
+    
+    NSRect popupFrame = [mainAddToAlbumPopup frame];
+    NSRect buttonFrame = [mainCreateNewAlbumButton frame];
+    NSRect fieldFrame = NSMakeRect(NSMinX(popupFrame) + 3, NSMidY(buttonFrame) - 11, NSMinX(buttonFrame) - NSMinX(popupFrame) - 7, 22);
+    if (NSWidth(fieldFrame) < 80) 
+        return;
+    
+    // search fields came with 10.3
+    Class fieldClass = NSClassFromString(@"NSSearchField");
+    NSTextField *field = [[[(fieldClass ? fieldClass : [NSTextField class]) alloc] initWithFrame:fieldFrame] autorelease];
+    if ([[field cell] respondsToSelector:@selector(setSendsSearchStringImmediately:)]) 
+        [[field cell] setSendsSearchStringImmediately:YES];
+    if ([[field cell] respondsToSelector:@selector(setPlaceholderString:)]) 
+        [[field cell] setPlaceholderString:@"Find album"];
+    [field setToolTip:@"Type part of an album's name to find it. Words can match the albums it's in, too."];
+    [field setTarget:self];
+    [field setAction:@selector(searchAlbums:)];
+    [field setEnabled:NO];
+    [albumBox addSubview:field];
+    
+    mainAlbumSearchField = field;
+}
+
 - (void)setScaleImages {
     if ([mainScaleImagesSwitch state] == NSOnState) {
         [mainScaleImagesHeightField setEnabled:TRUE];
         [mainScaleImagesWidthField setEnabled:TRUE];
+        [mainScaleImagesMaxKBField setEnabled:TRUE];
+        [mainScaleImagesSharpeningPopup setEnabled:TRUE];
     } else {
         [mainScaleImagesHeightField setEnabled:FALSE];
         [mainScaleImagesWidthField setEnabled:FALSE];
+        [mainScaleImagesMaxKBField setEnabled:FALSE];
+        [mainScaleImagesSharpeningPopup setEnabled:FALSE];
     }
 }
 
@@ -888,11 +1246,16 @@ static int loggingIn;
 }
 
 - (NSString*)lookupPasswordForCurrentGallery {
-    if (currentGallery == nil) 
+    return [self lookupPasswordForGallery:currentGallery];
+}
+
+// The keychain is fine to use from any thread
+- (NSString *)lookupPasswordForGallery:(ZWGallery *)gallery {
+    if (gallery == nil) 
         return nil;
-    NSString *username = [currentGallery username];
-    NSString *host = [[currentGallery url] host];
-    NSString *path = [[currentGallery url] path];
+    NSString *username = [gallery username];
+    NSString *host = [[gallery url] host];
+    NSString *path = [[gallery url] path];
     
     UInt32 passwordLength;
     void *passwordData;
@@ -926,20 +1289,208 @@ static int loggingIn;
     return password;
 }
 
-// This method is always called in the main thread and updates the UI of the progress sheet
-- (void)updateProgress:(NSDictionary *)progressInfo
+// Called in the main thread by the progress channel, at most once a screen refresh
+- (void)progressChannel:(ZWProgressChannel *)channel didChange:(const ZWProgressSnapshot *)snapshot
 {
-    if ([progressInfo objectForKey:@"UploadingTextField"])
-        [progressUploadingTextField setStringValue:[progressInfo objectForKey:@"UploadingTextField"]];
+    if (snapshot->changed & ZWProgressStatusChanged) {
+        [progressUploadingTextField setStringValue:snapshot->status];
+        [progressUploadingDetailField setStringValue:snapshot->detail];
+    }
     
-    if ([progressInfo objectForKey:@"UploadingDetailField"])
-        [progressUploadingDetailField setStringValue:[progressInfo objectForKey:@"UploadingDetailField"]];
+    if (snapshot->changed & ZWProgressLocationChanged) 
+        [progressProgressIndicator setDoubleValue:snapshot->location];
+    
+    // By the time a preview arrives we may have moved on to a later photo, in which case it isn't worth showing
+    if ((snapshot->changed & ZWProgressPreviewChanged) && snapshot->previewIndex == currentImageIndex) 
+        [progressImageView setImage:snapshot->preview];
+}
+
+- (void)stopProgressChannel
+{
+    [progressChannel stop];
+    [progressChannel release];
+    progressChannel = nil;
+}
+
+- (NSString *)derivedImageCacheSummary
+{
+    ZWDerivedImageCache *cache = [ZWDerivedImageCache sharedCache];
+    unsigned int lookups = [cache hits] + [cache misses];
     
-    if ([progressInfo objectForKey:@"ProgressBarLocation"])
-        [progressProgressIndicator setDoubleValue:[[progressInfo objectForKey:@"ProgressBarLocation"] doubleValue]];
+    if (lookups == 0) 
+        return @"";
     
-    if ([progressInfo objectForKey:@"Image"])
-        [progressImageView setImage:[progressInfo objectForKey:@"Image"]];
+    return [NSString stringWithFormat:@"%u of %u resized photos came from the cache, %.0f%% hit rate", 
+        [cache hits], lookups, 100.0 * [cache hits] / lookups];
+}
+
+#pragma mark -
+#pragma mark Warm Start
+
+// A warm-up looks up the gallery's password, logs in and fetches its albums on a thread of its own, so 
+// nothing waits on the main thread between them. The plugin starts one for the last gallery used as soon as 
+// it loads; logging in to a gallery waits on the one already under way for it, or starts its own. Only the 
+// latest gallery asked for is wanted, and any other one still going is cancelled. warmGallery and 
+// warmingGalleries (those with a thread still running) are shared with those threads under warmUpLock; 
+// the rest is the main thread's.
+
+- (void)warmUpGallery:(ZWGallery *)gallery
+{
+    BOOL wasWanted = (gallery == warmGallery), running;
+    
+    [warmUpLock lock];
+    if (!wasWanted) {
+        if (warmGallery && [warmingGalleries indexOfObjectIdenticalTo:warmGallery] != NSNotFound) 
+            [warmGallery cancelOperation];
+        [warmGallery release];
+        warmGallery = [gallery retain];
+    }
+    running = ([warmingGalleries indexOfObjectIdenticalTo:gallery] != NSNotFound);
+    if (!running) 
+        [warmingGalleries addObject:gallery];
+    [warmUpLock unlock];
+    
+    warmUpFinishedTime = 0;
+    
+    // One given up on earlier may still be on its way out. If it was cancelled in time, it's started over
+    // once it's done.
+    if (running) {
+        if (!wasWanted) 
+            restartWarmUp = YES;
+        return;
+    }
+    
+    restartWarmUp = NO;
+    [gallery setDelegate:self];
+    [NSThread detachNewThreadSelector:@selector(warmUpThread:) toTarget:self withObject:gallery];
+}
+
+- (void)cancelWarmUp
+{
+    [warmUpLock lock];
+    if (warmGallery && [warmingGalleries indexOfObjectIdenticalTo:warmGallery] != NSNotFound) 
+        [warmGallery cancelOperation];
+    [warmGallery release];
+    warmGallery = nil;
+    [warmUpLock unlock];
+    
+    // a login waiting on it won't hear back now, so it's over as far as the popup and spinner go
+    if (waitingForWarmUp) {
+        [self hideCancelButton];
+        [mainProgressIndicator stopAnimation:self];
+        [mainStatusString setStringValue:@""];
+        [mainGalleryPopup setEnabled:TRUE];
+        loggingIn = 0;
+    }
+    
+    warmUpFinishedTime = 0;
+    waitingForWarmUp = NO;
+    restartWarmUp = NO;
+}
+
+- (BOOL)isWarmGallery:(ZWGallery *)gallery
+{
+    return (gallery != nil && gallery == warmGallery && warmUpFinishedTime > 0 && 
+            [NSDate timeIntervalSinceReferenceDate] - warmUpFinishedTime < WARM_UP_FRESH_SECONDS && 
+            [gallery loggedIn] && [gallery albums] != nil);
+}
+
+- (BOOL)wantsWarmUpOfGallery:(ZWGallery *)gallery
+{
+    BOOL wanted;
+    
+    [warmUpLock lock];
+    wanted = (gallery == warmGallery);
+    [warmUpLock unlock];
+    
+    return wanted;
+}
+
+- (void)warmUpThread:(ZWGallery *)gallery
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    ZWGalleryRemoteStatusCode status = ZW_GALLERY_OPERATION_DID_CANCEL;
+    BOOL loggedIn = NO;
+    
+    [NSThread prepareForInterThreadMessages];
+    
+    // cancelling only stops a connection that's running, so check in between them too
+    if ([self wantsWarmUpOfGallery:gallery]) {
+        [gallery setPassword:[self lookupPasswordForGallery:gallery]];
+        if ([self wantsWarmUpOfGallery:gallery]) 
+            status = [gallery loginSynchronously];
+    }
+    if (status == GR_STAT_SUCCESS) {
+        loggedIn = YES;
+        status = [self wantsWarmUpOfGallery:gallery] ? [gallery getAlbumsSynchronously] : ZW_GALLERY_OPERATION_DID_CANCEL;
+    }
+    
+    // the gallery has nothing left running, so there's nothing to cancel from here on
+    [warmUpLock lock];
+    [warmingGalleries removeObjectIdenticalTo:gallery];
+    [warmUpLock unlock];
+    
+    [self performSelectorOnMainThread:@selector(warmUpDidFinish:) 
+                           withObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                               gallery, @"Gallery", 
+                               [NSNumber numberWithInt:status], @"Status", 
+                               [NSNumber numberWithBool:loggedIn], @"LoggedIn", 
+                               nil] 
+                        waitUntilDone:NO];
+    
+    [pool release];
+}
+
+- (void)warmUpDidFinish:(NSDictionary *)result
+{
+    ZWGallery *gallery = [result objectForKey:@"Gallery"];
+    NSNumber *statusNumber = [result objectForKey:@"Status"];
+    ZWGalleryRemoteStatusCode status = [statusNumber intValue];
+    
+    // given up on, so don't leave it logged in behind the user's back - even the current gallery, since a 
+    // login to it now would have asked for a warm-up of its own
+    if (gallery != warmGallery) {
+        [gallery logout];
+        if (gallery == currentGallery) 
+            [self setLoggedInOut];
+        return;
+    }
+    
+    if (restartWarmUp) {
+        restartWarmUp = NO;
+        if (status == ZW_GALLERY_OPERATION_DID_CANCEL) {
+            [self warmUpGallery:gallery];
+            return;
+        }
+    }
+    
+    if (status == GR_STAT_SUCCESS) {
+        warmUpFinishedTime = [NSDate timeIntervalSinceReferenceDate];
+    }
+    else {
+        // nobody's waiting to hear about it yet, so the next login starts over and reports it
+        [warmUpLock lock];
+        [warmGallery autorelease];
+        warmGallery = nil;
+        [warmUpLock unlock];
+    }
+    
+    if (!waitingForWarmUp || gallery != currentGallery) 
+        return;
+    waitingForWarmUp = NO;
+    
+    if (status == GR_STAT_SUCCESS) {
+        [mainGalleryPopup setEnabled:TRUE];
+        loggingIn = 0;
+        [self galleryDidGetAlbums:gallery];
+    }
+    else if (![[result objectForKey:@"LoggedIn"] boolValue]) 
+        [self gallery:gallery loginFailedWithCode:statusNumber];
+    else {
+        [mainGalleryPopup setEnabled:TRUE];
+        loggingIn = 0;
+        [self gallery:gallery getAlbumsFailedWithCode:statusNumber];
+    }
 }
 
 #pragma mark -
@@ -955,16 +1506,85 @@ static int loggingIn;
     ZWGalleryAlbum *album = [[mainAddToAlbumPopup selectedItem] representedObject];
     if (album == nil) 
         return;
+    ZWProgressChannel *channel = [progressChannel retain];
     
     currentAlbum = album;
     ZWGalleryRemoteStatusCode status = 0;
     
+    // Retries and exports of the same photos to a second gallery can skip the resize entirely
+    ZWDerivedImageCache *derivedImageCache = nil;
+    if (![preferences objectForKey:@"useDerivedImageCache"] || [[preferences objectForKey:@"useDerivedImageCache"] boolValue]) 
+        derivedImageCache = [ZWDerivedImageCache sharedCache];
+    [[ZWDerivedImageCache sharedCache] resetStatistics];
+    
+    // Decode and resize buffers are recycled from one photo to the next rather than allocated fresh
+    ZWScratchArena *scratchArena = ZWScratchArenaCreate();
+    BOOL logScratchArenaStats = [[preferences objectForKey:@"logScratchArenaStatistics"] boolValue];
+    unsigned long totalScratchRequests = 0, totalScratchAllocations = 0;
+    unsigned long long totalScratchBytesAllocated = 0;
+    
+    // A resize is made alongside the scaled photo if the gallery will take it instead of making its own, and
+    // a thumbnail if Growl is there to show it in the notifications. Otherwise it's just the scaled photo.
+    NSMutableArray *derivativeSizes = [NSMutableArray array];
+    BOOL sendResized = [currentGallery acceptsClientDerivatives];
+    BOOL makeThumbnails = [GrowlApplicationBridge isGrowlRunning];
+    if (sendResized) 
+        [derivativeSizes addObject:[NSValue valueWithSize:NSMakeSize(RESIZED_DERIVATIVE_SIZE, RESIZED_DERIVATIVE_SIZE)]];
+    if (makeThumbnails) 
+        [derivativeSizes addObject:[NSValue valueWithSize:NSMakeSize(THUMBNAIL_DERIVATIVE_SIZE, THUMBNAIL_DERIVATIVE_SIZE)]];
+    
+    // Scaled photos can be sharpened as they're resized, with one of the popup's presets. The amount and
+    // radius can be set outright with hidden preferences.
+    float sharpenAmount = 0, sharpenRadius = 0;
+    int sharpening = [[preferences objectForKey:@"scaleImagesSharpening"] intValue];
+    if (sharpening > 0 && sharpening < (int)(sizeof(sharpeningPresets) / sizeof(sharpeningPresets[0]))) {
+        sharpenAmount = sharpeningPresets[sharpening][0];
+        sharpenRadius = sharpeningPresets[sharpening][1];
+        if ([preferences objectForKey:@"sharpenAmount"]) 
+            sharpenAmount = [[preferences objectForKey:@"sharpenAmount"] floatValue];
+        if ([preferences objectForKey:@"sharpenRadius"]) 
+            sharpenRadius = [[preferences objectForKey:@"sharpenRadius"] floatValue];
+    }
+    
+    // Privacy and orientation fixes for what we send, off unless asked for
+    BOOL stripLocation = [[preferences objectForKey:@"stripLocationFromUploads"] boolValue];
+    BOOL applyOrientation = [[preferences objectForKey:@"rotateUnscaledPhotosUpright"] boolValue];
+    
+    // Photos we don't scale can still be made smaller without losing anything, by re-encoding them with 
+    // Huffman tables made for them and leaving out the maker notes. That and the fixes above are done on 
+    // another thread a photo ahead, so the work overlaps the upload before it.
+    int rewriteFlags = ZWJPEGKeepAllMetadata;
+    if (stripLocation) 
+        rewriteFlags |= ZWJPEGStripGPS;
+    if ([[preferences objectForKey:@"optimizeUnscaledUploads"] boolValue]) 
+        rewriteFlags |= ZWJPEGOptimizeHuffman;
+    if ([[preferences objectForKey:@"stripMakerNotes"] boolValue]) 
+        rewriteFlags |= ZWJPEGStripMakerNotes;
+    ZWJPEGRewriteWorker *rewriteWorker = nil;
+    if (rewriteFlags != ZWJPEGKeepAllMetadata || applyOrientation) {
+        rewriteWorker = [[ZWJPEGRewriteWorker alloc] initWithFlags:rewriteFlags applyOrientation:applyOrientation];
+        [rewriteWorker start];
+    }
+    
+    // Small exports can usually be made from iPhoto's own previews rather than the originals
+    ZWImageSourceSelector *sourceSelector = nil;
+    if (![preferences objectForKey:@"useiPhotoRenditions"] || [[preferences objectForKey:@"useiPhotoRenditions"] boolValue]) 
+        sourceSelector = [[[ZWImageSourceSelector alloc] init] autorelease];
+    
+    // The progress panel's picture is made on another thread from whatever small version of the photo is
+    // handy. When photos go up faster than the picture can animate in, we don't bother making it at all.
+    ZWPreviewGenerator *previewGenerator = [[ZWPreviewGenerator alloc] initWithProgressChannel:channel 
+                                                                                       maxSize:[progressImageView bounds].size];
+    [previewGenerator start];
+    NSTimeInterval averagePhotoSeconds = 0;
+    
     int imageNum;
     BOOL cancel = NO;
     for (imageNum = 0; imageNum < (int)[exportManager imageCount] && !cancel; imageNum++) {
         // Create our own pool so we don't use up tons of memory with autoreleased image data
         NSAutoreleasePool *innerPool = [[NSAutoreleasePool alloc] init]; {
         
+            NSDate *photoStart = [NSDate date];
             NSString *imagePath = [exportManager imagePathAtIndex:imageNum];
             NSDictionary *imageDict = [self exportManagerImageDictionaryAtIndex:imageNum];
             
@@ -973,14 +1593,9 @@ static int loggingIn;
             // add the filename
             [item setFilename:[imagePath lastPathComponent]];
             
-            // add the image type (default to jpg)
-            // TODO: Be smarter here. There are many more possible image types we need to handle.
-            if ([[imagePath pathExtension] caseInsensitiveCompare:@"gif"] == NSOrderedSame) 
-                [item setImageType:@"image/gif"];
-            else if ([[imagePath pathExtension] caseInsensitiveCompare:@"png"] == NSOrderedSame) 
-                [item setImageType:@"image/png"];
-            else 
-                [item setImageType:@"image/jpeg"];
+            // add the image type
+            [item setImageType:[ZWGalleryItem contentTypeForFileAtPath:imagePath]];
+            BOOL isMovie = [item isMovie];
             
             // add the comments and description, if so desired
             if ([mainExportCommentsSwitch state]) {
@@ -990,36 +1605,138 @@ static int loggingIn;
                     [item setDescription:[imageDict objectForKey:@"Annotation"]];
             }
             
-            // finally, add the image data
-            NSData *imageData = [NSData dataWithContentsOfFile:imagePath];
-            NSImage *image = [[[NSImage alloc] initWithData:imageData] autorelease];
+            // movies go up as they are
+            BOOL scaleImages = ([mainScaleImagesSwitch state] == NSOnState && !isMovie);
+            NSSize scaleSize = NSMakeSize([mainScaleImagesWidthField intValue], [mainScaleImagesHeightField intValue]);
+            
+            // If we're scaling, a rendition iPhoto already has on disk may be big enough to use instead
+            NSString *sourcePath = imagePath;
+            if (scaleImages && sourceSelector) 
+                sourcePath = [sourceSelector sourcePathForOriginal:imagePath 
+                                                      originalSize:[exportManager imageSizeAtIndex:imageNum] 
+                                                     thumbnailPath:[exportManager thumbnailPathAtIndex:imageNum] 
+                                                       scaledToFit:scaleSize];
+            
+            // finally, add the image data. Map the file rather than reading it so a 50 MB original doesn't 
+            // cost 50 MB of memory (and the pages it does use can be thrown away instead of paged out).
+            // Movies can be far bigger than we could map, so they're streamed from the file as they upload.
+            NSData *imageData = nil;
+            if (!isMovie) 
+                imageData = [ZWMappedData mappedDataWithContentsOfFile:sourcePath];
+            if (imageData == nil && !isMovie) 
+                imageData = [NSData dataWithContentsOfFile:sourcePath];
 
             currentImageIndex = imageNum;
             
-            if ([mainScaleImagesSwitch state] == NSOnState) {
-                NSDictionary *progressInfo = [NSDictionary dictionaryWithObjectsAndKeys:
-                    [NSString stringWithFormat:@"Resizing %@...", [imagePath lastPathComponent]], @"UploadingTextField",
-                    [NSString stringWithFormat:@"(Photo %i of %i)", imageNum + 1, (int)[exportManager imageCount]], @"UploadingDetailField",
-                    [NSNumber numberWithInt:currentImageIndex], @"ProgressBarLocation",
-                    image, @"Image",
-                    nil];
-                [self performSelectorOnMainThread:@selector(updateProgress:) withObject:progressInfo waitUntilDone:NO modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];
+            if (imageNum == 0 || averagePhotoSeconds >= [ZWTransitionImageView transitionDuration]) 
+                [previewGenerator requestPreviewForIndex:imageNum 
+                                               imagePath:imagePath 
+                                           thumbnailPath:[exportManager thumbnailPathAtIndex:imageNum]];
+            
+            if (scaleImages) {
+                [channel setStatus:[NSString stringWithFormat:@"Resizing %@...", [imagePath lastPathComponent]] 
+                            detail:[NSString stringWithFormat:@"(Photo %i of %i)", imageNum + 1, (int)[exportManager imageCount]]];
+                [channel setLocation:(double)currentImageIndex];
+                
+                unsigned long maxBytes = MAX([mainScaleImagesMaxKBField intValue], 0) * 1024;
+                NSString *encoderOptions = [NSString stringWithFormat:@"%@ max=%lu", [ImageResizer encoderIdentifier], maxBytes];
+                if (sharpenAmount > 0) 
+                    encoderOptions = [encoderOptions stringByAppendingFormat:@" sharpen=%.2f/%.2f", sharpenAmount, sharpenRadius];
+                NSString *cacheKey = [derivedImageCache keyForImageAtPath:sourcePath size:scaleSize options:encoderOptions];
+                NSData *scaledData = [derivedImageCache dataForKey:cacheKey];
+                
+                // The resize and thumbnail are cached next to the scaled photo they were made with, and it's only a
+                // hit if they're all there - otherwise Growl would be left showing the whole upload as its icon
+                NSString *derivativeOptions = [encoderOptions stringByAppendingFormat:@" from=%.0fx%.0f", scaleSize.width, scaleSize.height];
+                NSString *resizedKey = nil, *thumbnailKey = nil;
+                if (sendResized) 
+                    resizedKey = [derivedImageCache keyForImageAtPath:sourcePath 
+                                                                 size:NSMakeSize(RESIZED_DERIVATIVE_SIZE, RESIZED_DERIVATIVE_SIZE) 
+                                                              options:derivativeOptions];
+                if (makeThumbnails) 
+                    thumbnailKey = [derivedImageCache keyForImageAtPath:sourcePath 
+                                                                   size:NSMakeSize(THUMBNAIL_DERIVATIVE_SIZE, THUMBNAIL_DERIVATIVE_SIZE) 
+                                                                options:derivativeOptions];
+                if (scaledData) {
+                    NSData *resizedData = sendResized ? [derivedImageCache dataForKey:resizedKey] : nil;
+                    NSData *thumbnailData = makeThumbnails ? [derivedImageCache dataForKey:thumbnailKey] : nil;
+                    if ((sendResized && resizedData == nil) || (makeThumbnails && thumbnailData == nil)) {
+                        scaledData = nil;
+                    } else {
+                        [item setResizedData:resizedData];
+                        [item setThumbnailData:thumbnailData];
+                    }
+                }
+                
+                if (scaledData == nil) {
+                    ZWScratchArenaStats arenaStats;
+                    NSArray *sizes = [[NSArray arrayWithObject:[NSValue valueWithSize:scaleSize]] arrayByAddingObjectsFromArray:derivativeSizes];
+                    
+                    ZWScratchArenaResetStats(scratchArena);
+                    NSArray *images = [ImageResizer getScaledImagesFromData:imageData 
+                                                                    toSizes:sizes 
+                                                                   maxBytes:maxBytes 
+                                                              sharpenAmount:sharpenAmount 
+                                                              sharpenRadius:sharpenRadius 
+                                                               scratchArena:scratchArena];
+                    ZWScratchArenaReset(scratchArena);
+                    
+                    scaledData = [images count] ? [images objectAtIndex:0] : nil;
+                    if (scaledData && ![sourcePath isEqualToString:imagePath]) 
+                        scaledData = [ZWImageSourceSelector JPEGData:scaledData byAddingEXIFFromImageAtPath:imagePath];
+                    if ([images count] == [sizes count]) {
+                        if (makeThumbnails) {
+                            [item setThumbnailData:[images lastObject]];
+                            [derivedImageCache setData:[images lastObject] forKey:thumbnailKey];
+                        }
+                        if (sendResized) {
+                            [item setResizedData:[images objectAtIndex:1]];
+                            [derivedImageCache setData:[images objectAtIndex:1] forKey:resizedKey];
+                        }
+                    }
+                    [derivedImageCache setData:scaledData forKey:cacheKey];
+                    
+                    ZWScratchArenaGetStats(scratchArena, &arenaStats);
+                    totalScratchRequests += arenaStats.requests;
+                    totalScratchAllocations += arenaStats.allocations;
+                    totalScratchBytesAllocated += arenaStats.bytesAllocated;
+                    if (logScratchArenaStats) 
+                        NSLog(@"iPhotoToGallery: resizing %@ took %lu scratch buffers (%llu KB), %lu newly allocated (%llu KB); arena holds %llu KB", 
+                              [imagePath lastPathComponent], arenaStats.requests, arenaStats.bytesRequested / 1024, 
+                              arenaStats.allocations, arenaStats.bytesAllocated / 1024, arenaStats.bytesHeld / 1024);
+                }
+                
+                // Taking the location out only touches the markers, so it costs about as much as a copy
+                if (stripLocation && [[item imageType] isEqualToString:@"image/jpeg"] && scaledData) {
+                    NSData *rewrittenData = [ImageResizer rewriteJPEGData:scaledData 
+                                                                    flags:(ZWJPEGKeepAllMetadata | ZWJPEGStripGPS) 
+                                                         applyOrientation:NO 
+                                                             scratchArena:scratchArena];
+                    if (rewrittenData) 
+                        scaledData = rewrittenData;
+                }
                 
-                NSData *scaledData = [ImageResizer getScaledImageFromData:imageData toSize:NSMakeSize([mainScaleImagesWidthField intValue], [mainScaleImagesHeightField intValue])];
                 [item setData:scaledData];
-                currentImageSize = [scaledData length];
+            } else if (isMovie) {
+                [item setDataPath:imagePath];
             } else {
-                [item setData:imageData];
-                currentImageSize = [imageData length];
+                NSData *rewrittenData = nil;
+                if (rewriteWorker && [[item imageType] isEqualToString:@"image/jpeg"]) 
+                    rewrittenData = [rewriteWorker rewrittenDataForFileAtPath:sourcePath];
+                
+                [item setData:(rewrittenData ? rewrittenData : imageData)];
+                
+                // and the next one can be getting rewritten while this one goes up
+                if (rewriteWorker && imageNum + 1 < (int)[exportManager imageCount]) {
+                    NSString *nextPath = [exportManager imagePathAtIndex:imageNum + 1];
+                    if ([[ZWGalleryItem contentTypeForFileAtPath:nextPath] isEqualToString:@"image/jpeg"]) 
+                        [rewriteWorker rewriteFileAtPath:nextPath];
+                }
             }
 
-            NSDictionary *progressInfo = [NSDictionary dictionaryWithObjectsAndKeys:
-                [NSString stringWithFormat:@"Uploading %@...", [imagePath lastPathComponent]], @"UploadingTextField",
-                [NSString stringWithFormat:@"(Photo %i of %i)", imageNum + 1, (int)[exportManager imageCount]], @"UploadingDetailField",
-                [NSNumber numberWithInt:currentImageIndex], @"ProgressBarLocation",
-                image, @"Image",
-                nil];
-            [self performSelectorOnMainThread:@selector(updateProgress:) withObject:progressInfo waitUntilDone:NO modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];
+            [channel setStatus:[NSString stringWithFormat:@"Uploading %@...", [imagePath lastPathComponent]] 
+                        detail:[NSString stringWithFormat:@"(Photo %i of %i)", imageNum + 1, (int)[exportManager imageCount]]];
+            [channel setLocation:(double)currentImageIndex];
             
             [album setDelegate:self];
             status = [album addItemSynchronously:item];
@@ -1047,7 +1764,7 @@ static int loggingIn;
                                                 description:[NSString stringWithFormat:@"Export to gallery failed after %i photos were uploaded",
                                                     imageNum]
                                            notificationName:@"Export to Gallery Failed"
-                                                   iconData:[item data]
+                                                   iconData:([item thumbnailData] ? [item thumbnailData] : [item data])
                                                    priority:0
                                                    isSticky:NO
                                                clickContext:NULL];
@@ -1060,17 +1777,56 @@ static int loggingIn;
                                             description:[NSString stringWithFormat:@"Photo %@ uploaded to Gallery",
                                                 [item filename]]
                                        notificationName:@"Photo Uploaded to Gallery"
-                                               iconData:[item data]
+                                               iconData:([item thumbnailData] ? [item thumbnailData] : [item data])
                                                priority:0
                                                isSticky:NO
                                            clickContext:NULL];
             }
             
+            // weighted toward recent photos, since the resize and network speeds can change mid-export
+            NSTimeInterval photoSeconds = -[photoStart timeIntervalSinceNow];
+            averagePhotoSeconds = (imageNum == 0) ? photoSeconds : (averagePhotoSeconds + photoSeconds) / 2;
+            
         } [innerPool release];
     }
     
+    [previewGenerator stop];
+    [previewGenerator release];
+    
+    // the last values still get shown, and the preview generator keeps its own hold on the channel
+    [self performSelectorOnMainThread:@selector(stopProgressChannel) withObject:nil waitUntilDone:NO modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];
+    [channel release];
+    
+    if ([rewriteWorker bytesRead]) 
+        NSLog(@"iPhotoToGallery: rewriting unscaled photos took them from %.1f MB to %.1f MB", 
+              [rewriteWorker bytesRead] / (1024.0 * 1024.0), [rewriteWorker bytesWritten] / (1024.0 * 1024.0));
+    [rewriteWorker stop];
+    [rewriteWorker release];
+    
     [NSApp endSheet:progressPanel];
     
+    if ([sourceSelector renditionsUsed]) 
+        NSLog(@"iPhotoToGallery: %u photos were scaled from iPhoto's previews, %u from the originals", 
+              [sourceSelector renditionsUsed], [sourceSelector originalsUsed]);
+    
+    if (totalScratchRequests) 
+        NSLog(@"iPhotoToGallery: %lu scratch buffers used for resizing, %lu of them allocated (%.1f MB)", 
+              totalScratchRequests, totalScratchAllocations, totalScratchBytesAllocated / (1024.0 * 1024.0));
+    ZWScratchArenaDestroy(scratchArena);
+    
+    [derivedImageCache synchronize];
+    NSString *cacheSummary = [self derivedImageCacheSummary];
+    if ([cacheSummary length]) 
+        NSLog(@"iPhotoToGallery: %@", cacheSummary);
+    
+    // the threads the gallery started for logging in and fetching albums should have taken their ports with them
+    if ([[preferences objectForKey:@"logInterThreadMessaging"] boolValue]) {
+        InterThreadMessagingStatistics messagingStats;
+        [NSThread getInterThreadMessagingStatistics:&messagingStats];
+        NSLog(@"iPhotoToGallery: %u threads prepared for inter-thread messages, %d messages in flight", 
+              messagingStats.livePorts, messagingStats.messagesInFlight);
+    }
+    
     if (status == GR_STAT_SUCCESS) {
         if ([mainOpenBrowserSwitch state] == NSOnState) {
             NSMutableString *albumURLString = nil;
@@ -1091,9 +1847,12 @@ static int loggingIn;
             [[NSWorkspace sharedWorkspace] openURL:[NSURL URLWithString:albumURLString]];
         }
 
+        NSString *description = [NSString stringWithFormat:@"%i photos were uploaded to Gallery", [exportManager imageCount]];
+        if ([cacheSummary length]) 
+            description = [NSString stringWithFormat:@"%@ (%@)", description, cacheSummary];
+        
         [GrowlApplicationBridge notifyWithTitle:@"All Photos Uploaded"
-                                    description:[NSString stringWithFormat:@"%i photos were uploaded to Gallery",
-                                        [exportManager imageCount]]
+                                    description:description
                                notificationName:@"All Photos Uploaded to Gallery"
                                        iconData:nil
                                        priority:0
@@ -1172,14 +1931,13 @@ static int loggingIn;
         
         NSString *newAlbumName = [currentGallery lastCreatedAlbumName];
         
-        int i;
-        for (i = 0; i < [mainAddToAlbumPopup numberOfItems]; i++) {
-            id<NSMenuItem> item = [mainAddToAlbumPopup itemAtIndex:i];
-            if ([[item representedObject] respondsToSelector:@selector(name)] &&
-                [[[item representedObject] name] isEqual:newAlbumName]) {
-                [mainAddToAlbumPopup selectItemAtIndex:i];
+        NSEnumerator *enumerator = [[currentGallery albums] objectEnumerator];
+        ZWGalleryAlbum *album;
+        while ((album = [enumerator nextObject])) {
+            if ([[album name] isEqual:newAlbumName] && [album canAddItem]) {
+                [self selectAlbum:album inPopup:mainAddToAlbumPopup];
                 break;
-            }            
+            }
         }
     }
 }
@@ -1231,16 +1989,13 @@ static int loggingIn;
 #pragma mark -
 #pragma mark ZWGalleryAlbumDelegate
 
-- (void)album:(ZWGalleryAlbum *)sender item:(ZWGalleryItem *)item updateBytesSent:(unsigned long)bytes
+- (void)album:(ZWGalleryAlbum *)sender item:(ZWGalleryItem *)item updateBytesSent:(unsigned long long)bytes ofTotal:(unsigned long long)total
 {
     currentItemProgress = bytes;
+    currentImageSize = total;
     
-    double newProgress = (double)currentImageIndex + ((double)currentItemProgress / ((double)currentImageSize + 1000.0));
-    
-    NSDictionary *progressInfo = [NSDictionary dictionaryWithObjectsAndKeys:
-        [NSNumber numberWithDouble:newProgress], @"ProgressBarLocation",
-        nil];
-    [self performSelectorOnMainThread:@selector(updateProgress:) withObject:progressInfo waitUntilDone:NO modes:[NSArray arrayWithObjects:NSDefaultRunLoopMode, NSModalPanelRunLoopMode, nil]];    
+    // this comes with every write to the socket, so it only goes as far as the channel
+    [progressChannel setLocation:(double)currentImageIndex + (total ? (double)currentItemProgress / (double)currentImageSize : 0.0)];
 }
 
 #pragma mark -
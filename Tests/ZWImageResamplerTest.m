@@ -0,0 +1,242 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWImageResamplerTest.h"
+#include "ZWTestImage.h"
+#include "ZWImageResampler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An odd size in, so the filter windows don't line up with the pixels, and a little over a quarter out
+#define INPUT_WIDTH 257
+#define INPUT_HEIGHT 193
+#define OUTPUT_WIDTH 72
+#define OUTPUT_HEIGHT 54
+
+#define SHARPEN_AMOUNT 0.8f
+#define SHARPEN_RADIUS 1.0f
+
+// PowerPC fuses multiplies and adds where Intel doesn't, which can move a sample by one either way
+#define REFERENCE_TOLERANCE 2
+
+// Rounding the unsharpened output to 8 bits before masking it is off by up to half a step, times
+// 1 + 2 * amount through the two passes of the mask
+#define SEPARATE_MASK_TOLERANCE 3
+
+typedef struct {
+    unsigned char *pixels;
+    int width, components;
+} Output;
+
+static int storeRow(void *context, const unsigned char *row, int y)
+{
+    Output *output = (Output *)context;
+    size_t length = (size_t)output->width * output->components;
+    
+    memcpy(output->pixels + (size_t)y * length, row, length);
+    return 1;
+}
+
+// Returns NULL if the resampler couldn't be made. Free it with free().
+static unsigned char *resample(const unsigned char *input, int components, float amount, float radius)
+{
+    ZWImageResampler *resampler;
+    Output output;
+    size_t rowLength = (size_t)INPUT_WIDTH * components;
+    int y;
+    
+    output.width = OUTPUT_WIDTH;
+    output.components = components;
+    output.pixels = (unsigned char *)malloc((size_t)OUTPUT_WIDTH * OUTPUT_HEIGHT * components);
+    if (output.pixels == NULL) 
+        return NULL;
+    
+    resampler = ZWImageResamplerCreate(INPUT_WIDTH, INPUT_HEIGHT, OUTPUT_WIDTH, OUTPUT_HEIGHT, components, storeRow, &output, NULL);
+    if (resampler == NULL || !ZWImageResamplerSetSharpening(resampler, amount, radius)) {
+        ZWImageResamplerDestroy(resampler);
+        free(output.pixels);
+        return NULL;
+    }
+    
+    for (y = 0; y < INPUT_HEIGHT; y++) 
+        ZWImageResamplerPushRow(resampler, input + y * rowLength);
+    ZWImageResamplerDestroy(resampler);
+    
+    return output.pixels;
+}
+
+// The unsharp mask on its own, the slow way: along each row, then each column, repeating the edges
+static unsigned char *unsharpMask(const unsigned char *input, int width, int height, int components, float amount, float radius)
+{
+    int reach = (int)ceil(3.0 * radius), x, y, c, k;
+    float *kernel = (float *)malloc(sizeof(float) * (2 * reach + 1));
+    float *rows = (float *)malloc(sizeof(float) * width * height * components);
+    unsigned char *output = (unsigned char *)malloc((size_t)width * height * components);
+    double total = 0.0;
+    
+    if (kernel == NULL || rows == NULL || output == NULL) {
+        free(kernel);
+        free(rows);
+        free(output);
+        return NULL;
+    }
+    
+    for (k = -reach; k <= reach; k++) {
+        kernel[k + reach] = (float)exp(-(double)k * k / (2.0 * radius * radius));
+        total += kernel[k + reach];
+    }
+    for (k = -reach; k <= reach; k++) 
+        kernel[k + reach] = (float)(-amount * kernel[k + reach] / total);
+    kernel[reach] += 1.0f + amount;
+    
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            for (c = 0; c < components; c++) {
+                float sum = 0.0f;
+                
+                for (k = -reach; k <= reach; k++) {
+                    int neighbour = x + k < 0 ? 0 : x + k >= width ? width - 1 : x + k;
+                    sum += kernel[k + reach] * input[(y * width + neighbour) * components + c];
+                }
+                rows[(y * width + x) * components + c] = sum;
+            }
+        }
+    }
+    
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            for (c = 0; c < components; c++) {
+                float sum = 0.0f;
+                
+                for (k = -reach; k <= reach; k++) {
+                    int neighbour = y + k < 0 ? 0 : y + k >= height ? height - 1 : y + k;
+                    sum += kernel[k + reach] * rows[(neighbour * width + x) * components + c];
+                }
+                output[(y * width + x) * components + c] = sum <= 0.0f ? 0 : sum >= 255.0f ? 255 : (unsigned char)(sum + 0.5f);
+            }
+        }
+    }
+    
+    free(kernel);
+    free(rows);
+    return output;
+}
+
+static int checkSharpening(const char *name, const char *referenceDirectory, const char *referenceName, 
+                           int components, int writeReference)
+{
+    unsigned char *input = ZWTestImageCreate(INPUT_WIDTH, INPUT_HEIGHT, components);
+    unsigned char *plain = NULL, *sharpened = NULL, *separate = NULL;
+    char testName[128], detail[128];
+    int failures = 0, maxDifference;
+    double meanDifference;
+    
+    if (input) 
+        sharpened = resample(input, components, SHARPEN_AMOUNT, SHARPEN_RADIUS);
+    
+    snprintf(testName, sizeof(testName), "resampler %s", name);
+    if (!ZWTestImageCheckReference(testName, referenceDirectory, referenceName, sharpened, 
+                                   OUTPUT_WIDTH, OUTPUT_HEIGHT, components, REFERENCE_TOLERANCE, writeReference)) 
+        failures++;
+    
+    free(sharpened);
+    sharpened = NULL;
+    
+    // The fused pass should agree with masking the unsharpened output separately, which is what it stands
+    // in for. That's only so where the unsharpened output didn't have to be clipped to 0-255, so this is
+    // done on the image squeezed into the middle half of the range.
+    if (input) {
+        size_t i;
+        
+        for (i = 0; i < (size_t)INPUT_WIDTH * INPUT_HEIGHT * components; i++) 
+            input[i] = 64 + input[i] / 2;
+        plain = resample(input, components, 0.0f, 0.0f);
+        sharpened = resample(input, components, SHARPEN_AMOUNT, SHARPEN_RADIUS);
+    }
+    if (plain && sharpened) 
+        separate = unsharpMask(plain, OUTPUT_WIDTH, OUTPUT_HEIGHT, components, SHARPEN_AMOUNT, SHARPEN_RADIUS);
+    snprintf(testName, sizeof(testName), "resampler %s matches a separate unsharp mask", name);
+    if (separate) {
+        int passed = ZWTestImageCompare(sharpened, separate, OUTPUT_WIDTH, OUTPUT_HEIGHT, components, 
+                                        SEPARATE_MASK_TOLERANCE, &maxDifference, &meanDifference);
+        
+        snprintf(detail, sizeof(detail), "off by at most %d (allowed %d), %.3f on average", 
+                 maxDifference, SEPARATE_MASK_TOLERANCE, meanDifference);
+        if (!ZWTestCheck(testName, passed, detail)) 
+            failures++;
+    }
+    else if (!ZWTestCheck(testName, 0, "no output")) 
+        failures++;
+    
+    free(input);
+    free(plain);
+    free(sharpened);
+    free(separate);
+    return failures;
+}
+
+// A flat image has nothing to sharpen, so it has to come out exactly as it went in
+static int checkFlat(void)
+{
+    unsigned char *input = (unsigned char *)malloc((size_t)INPUT_WIDTH * INPUT_HEIGHT * 3);
+    unsigned char *output = NULL;
+    size_t i;
+    int flat = 0;
+    
+    if (input) {
+        memset(input, 137, (size_t)INPUT_WIDTH * INPUT_HEIGHT * 3);
+        output = resample(input, 3, SHARPEN_AMOUNT, SHARPEN_RADIUS);
+    }
+    if (output) {
+        flat = 1;
+        for (i = 0; i < (size_t)OUTPUT_WIDTH * OUTPUT_HEIGHT * 3; i++) {
+            if (output[i] != 137) 
+                flat = 0;
+        }
+    }
+    
+    free(input);
+    free(output);
+    return ZWTestCheck("resampler sharpening a flat image", flat, flat ? "unchanged" : "changed") ? 0 : 1;
+}
+
+int ZWImageResamplerTestRun(const char *referenceDirectory, int writeReference)
+{
+    int failures = 0;
+    
+    failures += checkSharpening("sharpened RGB", referenceDirectory, "resampler-sharpened-rgb.ppm", 3, writeReference);
+    failures += checkSharpening("sharpened gray", referenceDirectory, "resampler-sharpened-gray.pgm", 1, writeReference);
+    failures += checkFlat();
+    
+    return failures;
+}
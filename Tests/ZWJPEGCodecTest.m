@@ -0,0 +1,254 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWJPEGCodecTest.h"
+#include "ZWTestImage.h"
+#include "ZWJPEGEncoder.h"
+#include "ZWJPEGDecoder.h"
+#include "ZWJPEGRewriter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Odd, so the last row and column of MCUs are only partly filled
+#define ROUND_TRIP_WIDTH 257
+#define ROUND_TRIP_HEIGHT 193
+
+// Whole MCUs, so rotating doesn't trim anything off
+#define ROTATE_WIDTH 256
+#define ROTATE_HEIGHT 192
+
+#define QUALITY 85
+#define ENCODER_THREADS 4
+
+// The DCTs are done in floating point, and PowerPC fuses multiplies and adds where Intel doesn't
+#define REFERENCE_TOLERANCE 2
+
+// The IDCT's rows-then-columns passes can round differently once a block is turned on its side
+#define ROTATE_TOLERANCE 1
+
+typedef struct {
+    unsigned char *bytes;
+    size_t length, capacity;
+} Buffer;
+
+static int appendToBuffer(void *context, const unsigned char *bytes, size_t length)
+{
+    Buffer *buffer = (Buffer *)context;
+    
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 16384;
+        unsigned char *grown;
+        
+        while (capacity < buffer->length + length) 
+            capacity *= 2;
+        grown = (unsigned char *)realloc(buffer->bytes, capacity);
+        if (grown == NULL) 
+            return 0;
+        buffer->bytes = grown;
+        buffer->capacity = capacity;
+    }
+    
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+    return 1;
+}
+
+// Returns 0 if the encode failed. The JPEG is left in buffer either way; free buffer->bytes with free().
+static int encode(const unsigned char *pixels, int width, int height, int components, int threads, Buffer *buffer)
+{
+    ZWJPEGEncoder *encoder;
+    size_t rowLength = (size_t)width * components;
+    int y, ok = 1;
+    
+    memset(buffer, 0, sizeof(Buffer));
+    encoder = ZWJPEGEncoderCreate(width, height, components, QUALITY, appendToBuffer, buffer, NULL);
+    if (encoder == NULL) 
+        return 0;
+    if (threads > 1 && !ZWJPEGEncoderSetThreads(encoder, threads)) 
+        ok = 0;
+    
+    for (y = 0; ok && y < height; y++) 
+        ok = ZWJPEGEncoderWriteScanline(encoder, pixels + y * rowLength);
+    if (ok) 
+        ok = ZWJPEGEncoderFinish(encoder);
+    
+    ZWJPEGEncoderDestroy(encoder);
+    return ok;
+}
+
+// Returns NULL unless the JPEG decodes to an image of the size and kind expected. Free it with free().
+static unsigned char *decode(const Buffer *buffer, int width, int height, int components)
+{
+    ZWJPEGDecoder *decoder = ZWJPEGDecoderCreate(buffer->bytes, buffer->length, NULL);
+    unsigned char *pixels = NULL;
+    size_t rowLength = (size_t)width * components;
+    int y;
+    
+    if (decoder == NULL) 
+        return NULL;
+    
+    if (ZWJPEGDecoderGetWidth(decoder) == width && ZWJPEGDecoderGetHeight(decoder) == height && 
+        ZWJPEGDecoderGetComponents(decoder) == components) 
+        pixels = (unsigned char *)malloc(rowLength * height);
+    
+    for (y = 0; pixels && y < height; y++) {
+        if (!ZWJPEGDecoderReadScanline(decoder, pixels + y * rowLength)) {
+            free(pixels);
+            pixels = NULL;
+        }
+    }
+    
+    ZWJPEGDecoderDestroy(decoder);
+    return pixels;
+}
+
+static int rewrite(const Buffer *jpeg, int flags, ZWJPEGTransform transform, Buffer *buffer)
+{
+    memset(buffer, 0, sizeof(Buffer));
+    return ZWJPEGRewrite(jpeg->bytes, jpeg->length, flags, transform, appendToBuffer, buffer, NULL);
+}
+
+static int checkSame(const char *testName, const unsigned char *a, const unsigned char *b, 
+                     int width, int height, int components, int tolerance)
+{
+    char detail[128];
+    int maxDifference, passed;
+    double meanDifference;
+    
+    if (a == NULL || b == NULL) 
+        return ZWTestCheck(testName, 0, "no output");
+    
+    passed = ZWTestImageCompare(a, b, width, height, components, tolerance, &maxDifference, &meanDifference);
+    snprintf(detail, sizeof(detail), "off by at most %d (allowed %d), %.3f on average", 
+             maxDifference, tolerance, meanDifference);
+    return ZWTestCheck(testName, passed, detail);
+}
+
+static int checkRoundTrip(const char *name, const char *referenceDirectory, const char *referenceName, 
+                          int components, int writeReference)
+{
+    unsigned char *input = ZWTestImageCreate(ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components);
+    unsigned char *decoded = NULL, *threaded = NULL, *optimized = NULL;
+    Buffer jpeg, threadedJPEG, optimizedJPEG;
+    char testName[128], detail[128];
+    int failures = 0, passed;
+    
+    memset(&jpeg, 0, sizeof(Buffer));
+    memset(&threadedJPEG, 0, sizeof(Buffer));
+    memset(&optimizedJPEG, 0, sizeof(Buffer));
+    
+    if (input && encode(input, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components, 1, &jpeg)) 
+        decoded = decode(&jpeg, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components);
+    
+    snprintf(testName, sizeof(testName), "JPEG %s round trip", name);
+    if (!ZWTestImageCheckReference(testName, referenceDirectory, referenceName, decoded, 
+                                   ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components, REFERENCE_TOLERANCE, writeReference)) 
+        failures++;
+    
+    // The strips are coded separately, but the coefficients are the same, so the pixels must be too
+    if (input && encode(input, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components, ENCODER_THREADS, &threadedJPEG)) 
+        threaded = decode(&threadedJPEG, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components);
+    snprintf(testName, sizeof(testName), "JPEG %s threaded encode matches", name);
+    if (!checkSame(testName, decoded, threaded, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components, 0)) 
+        failures++;
+    
+    if (jpeg.length && rewrite(&jpeg, ZWJPEGKeepAllMetadata | ZWJPEGOptimizeHuffman, ZWJPEGTransformNone, &optimizedJPEG)) 
+        optimized = decode(&optimizedJPEG, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components);
+    snprintf(testName, sizeof(testName), "JPEG %s optimized Huffman tables match", name);
+    if (!checkSame(testName, decoded, optimized, ROUND_TRIP_WIDTH, ROUND_TRIP_HEIGHT, components, 0)) 
+        failures++;
+    
+    snprintf(testName, sizeof(testName), "JPEG %s optimized Huffman tables are smaller", name);
+    passed = optimizedJPEG.length > 0 && optimizedJPEG.length < jpeg.length;
+    snprintf(detail, sizeof(detail), "%lu bytes, down from %lu", 
+             (unsigned long)optimizedJPEG.length, (unsigned long)jpeg.length);
+    if (!ZWTestCheck(testName, passed, detail)) 
+        failures++;
+    
+    free(input);
+    free(decoded);
+    free(threaded);
+    free(optimized);
+    free(jpeg.bytes);
+    free(threadedJPEG.bytes);
+    free(optimizedJPEG.bytes);
+    return failures;
+}
+
+// Rotating the blocks should come out the same as decoding and then rotating the pixels
+static int checkRotate(void)
+{
+    unsigned char *input = ZWTestImageCreate(ROTATE_WIDTH, ROTATE_HEIGHT, 3);
+    unsigned char *decoded = NULL, *rotated = NULL, *expected = NULL;
+    Buffer jpeg, rotatedJPEG;
+    int x, y, failures = 0;
+    
+    memset(&jpeg, 0, sizeof(Buffer));
+    memset(&rotatedJPEG, 0, sizeof(Buffer));
+    
+    if (input && encode(input, ROTATE_WIDTH, ROTATE_HEIGHT, 3, 1, &jpeg)) 
+        decoded = decode(&jpeg, ROTATE_WIDTH, ROTATE_HEIGHT, 3);
+    if (decoded && rewrite(&jpeg, ZWJPEGKeepAllMetadata, ZWJPEGTransformRotate90, &rotatedJPEG)) 
+        rotated = decode(&rotatedJPEG, ROTATE_HEIGHT, ROTATE_WIDTH, 3);
+    
+    if (decoded) 
+        expected = (unsigned char *)malloc((size_t)ROTATE_WIDTH * ROTATE_HEIGHT * 3);
+    if (expected) {
+        // Clockwise: the bottom left corner ends up top left
+        for (y = 0; y < ROTATE_WIDTH; y++) {
+            for (x = 0; x < ROTATE_HEIGHT; x++) 
+                memcpy(expected + (y * ROTATE_HEIGHT + x) * 3, decoded + ((ROTATE_HEIGHT - 1 - x) * ROTATE_WIDTH + y) * 3, 3);
+        }
+    }
+    
+    if (!checkSame("JPEG lossless rotation matches", expected, rotated, ROTATE_HEIGHT, ROTATE_WIDTH, 3, ROTATE_TOLERANCE)) 
+        failures++;
+    
+    free(input);
+    free(decoded);
+    free(rotated);
+    free(expected);
+    free(jpeg.bytes);
+    free(rotatedJPEG.bytes);
+    return failures;
+}
+
+int ZWJPEGCodecTestRun(const char *referenceDirectory, int writeReference)
+{
+    int failures = 0;
+    
+    failures += checkRoundTrip("RGB", referenceDirectory, "jpeg-round-trip-rgb.ppm", 3, writeReference);
+    failures += checkRoundTrip("gray", referenceDirectory, "jpeg-round-trip-gray.pgm", 1, writeReference);
+    failures += checkRotate();
+    
+    return failures;
+}
@@ -0,0 +1,61 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// What the regression tests share: a made-up photo to feed the code under test, binary PGM/PPM files 
+// (P5 for gray, P6 for RGB) for the reference output checked in under Tests/Reference, and a comparison
+// that allows for the last bit of rounding to come out differently on another compiler or processor.
+
+#ifndef ZWTESTIMAGE_H
+#define ZWTESTIMAGE_H
+
+// The same every time: smooth gradients, a zone plate (rings that get finer toward the edges, so there's
+// detail at every frequency), and a few hard-edged blocks. components is 1 or 3. Free it with free().
+unsigned char *ZWTestImageCreate(int width, int height, int components);
+
+// Returns 0 if the file couldn't be written
+int ZWTestImageWrite(const char *path, const unsigned char *pixels, int width, int height, int components);
+
+// Returns NULL if the file isn't there, or isn't a PGM/PPM of that size and kind. Free it with free().
+unsigned char *ZWTestImageRead(const char *path, int width, int height, int components);
+
+// Returns 1 if no sample of a is more than tolerance away from b, and says how far off they were
+int ZWTestImageCompare(const unsigned char *a, const unsigned char *b, int width, int height, int components, 
+                       int tolerance, int *maxDifference, double *meanDifference);
+
+// Checks pixels against the named reference, or writes them out as it if writeReference is set. Prints
+// what it found under the test's name, and returns 1 if it passed.
+int ZWTestImageCheckReference(const char *testName, const char *referenceDirectory, const char *referenceName, 
+                              const unsigned char *pixels, int width, int height, int components, 
+                              int tolerance, int writeReference);
+
+// Prints the result of a check that has no reference, and returns passed
+int ZWTestCheck(const char *testName, int passed, const char *detail);
+
+#endif
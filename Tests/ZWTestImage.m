@@ -0,0 +1,186 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ZWTestImage.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned char clampSample(double value)
+{
+    return value <= 0.0 ? 0 : value >= 255.0 ? 255 : (unsigned char)(value + 0.5);
+}
+
+unsigned char *ZWTestImageCreate(int width, int height, int components)
+{
+    unsigned char *pixels = (unsigned char *)malloc((size_t)width * height * components);
+    double centerX = width / 2.0, centerY = height / 2.0;
+    double scale = M_PI / (width > height ? width : height);
+    int x, y, c;
+    
+    if (pixels == NULL) 
+        return NULL;
+    
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            unsigned char *pixel = pixels + ((size_t)y * width + x) * components;
+            double dx = x - centerX, dy = y - centerY;
+            double ring = 0.5 + 0.5 * cos((dx * dx + dy * dy) * scale);
+            double value[3];
+            
+            value[0] = 255.0 * ring * x / (width - 1);
+            value[1] = 255.0 * ring;
+            value[2] = 255.0 * (1.0 - ring) * y / (height - 1) + 64.0 * ((x / 8 + y / 8) & 1);
+            
+            // blocks with hard edges, which is where sharpening and ringing show
+            if (x >= width / 8 && x < width / 4 && y >= height / 8 && y < height / 3) 
+                value[0] = value[1] = value[2] = 250.0;
+            if (x >= width / 2 && x < width / 2 + width / 6 && y >= height / 2 && y < height / 2 + height / 5) 
+                value[0] = value[1] = value[2] = 5.0;
+            
+            if (components == 1) 
+                pixel[0] = clampSample(0.299 * value[0] + 0.587 * value[1] + 0.114 * value[2]);
+            else {
+                for (c = 0; c < 3; c++) 
+                    pixel[c] = clampSample(value[c]);
+            }
+        }
+    }
+    
+    return pixels;
+}
+
+int ZWTestImageWrite(const char *path, const unsigned char *pixels, int width, int height, int components)
+{
+    FILE *file = fopen(path, "wb");
+    size_t length = (size_t)width * height * components;
+    int written;
+    
+    if (file == NULL) 
+        return 0;
+    
+    fprintf(file, "P%d\n%d %d\n255\n", components == 1 ? 5 : 6, width, height);
+    written = (fwrite(pixels, 1, length, file) == length);
+    if (fclose(file) != 0) 
+        written = 0;
+    
+    return written;
+}
+
+unsigned char *ZWTestImageRead(const char *path, int width, int height, int components)
+{
+    FILE *file = fopen(path, "rb");
+    size_t length = (size_t)width * height * components;
+    unsigned char *pixels;
+    int kind, fileWidth, fileHeight, maxValue;
+    
+    if (file == NULL) 
+        return NULL;
+    
+    // the header ends with a single whitespace character before the samples
+    if (fscanf(file, "P%d %d %d %d", &kind, &fileWidth, &fileHeight, &maxValue) != 4 || fgetc(file) == EOF || 
+        kind != (components == 1 ? 5 : 6) || fileWidth != width || fileHeight != height || maxValue != 255) {
+        fclose(file);
+        return NULL;
+    }
+    
+    pixels = (unsigned char *)malloc(length);
+    if (pixels && fread(pixels, 1, length, file) != length) {
+        free(pixels);
+        pixels = NULL;
+    }
+    fclose(file);
+    
+    return pixels;
+}
+
+int ZWTestImageCompare(const unsigned char *a, const unsigned char *b, int width, int height, int components, 
+                       int tolerance, int *maxDifference, double *meanDifference)
+{
+    size_t length = (size_t)width * height * components, i;
+    double total = 0.0;
+    int most = 0;
+    
+    for (i = 0; i < length; i++) {
+        int difference = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        
+        total += difference;
+        if (difference > most) 
+            most = difference;
+    }
+    
+    if (maxDifference) 
+        *maxDifference = most;
+    if (meanDifference) 
+        *meanDifference = length ? total / length : 0.0;
+    
+    return most <= tolerance;
+}
+
+int ZWTestImageCheckReference(const char *testName, const char *referenceDirectory, const char *referenceName, 
+                              const unsigned char *pixels, int width, int height, int components, 
+                              int tolerance, int writeReference)
+{
+    char path[1024], detail[1200];
+    unsigned char *reference;
+    int passed, maxDifference;
+    double meanDifference;
+    
+    snprintf(path, sizeof(path), "%s/%s", referenceDirectory, referenceName);
+    
+    if (pixels == NULL) 
+        return ZWTestCheck(testName, 0, "no output");
+    
+    if (writeReference) {
+        passed = ZWTestImageWrite(path, pixels, width, height, components);
+        snprintf(detail, sizeof(detail), passed ? "wrote %s" : "couldn't write %s", path);
+        return ZWTestCheck(testName, passed, detail);
+    }
+    
+    reference = ZWTestImageRead(path, width, height, components);
+    if (reference == NULL) {
+        snprintf(detail, sizeof(detail), "no %dx%d reference at %s", width, height, path);
+        return ZWTestCheck(testName, 0, detail);
+    }
+    
+    passed = ZWTestImageCompare(pixels, reference, width, height, components, tolerance, &maxDifference, &meanDifference);
+    snprintf(detail, sizeof(detail), "off by at most %d (allowed %d), %.3f on average", maxDifference, tolerance, meanDifference);
+    free(reference);
+    
+    return ZWTestCheck(testName, passed, detail);
+}
+
+int ZWTestCheck(const char *testName, int passed, const char *detail)
+{
+    printf("%s %s: %s\n", passed ? "PASS" : "FAIL", testName, detail);
+    return passed;
+}
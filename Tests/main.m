@@ -0,0 +1,61 @@
+//
+// Copyright (c) Zach Wily
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, 
+// are permitted provided that the following conditions are met:
+// 
+// - Redistributions of source code must retain the above copyright notice, this 
+//     list of conditions and the following disclaimer.
+// 
+// - Redistributions in binary form must reproduce the above copyright notice, this
+//     list of conditions and the following disclaimer in the documentation and/or 
+//     other materials provided with the distribution.
+// 
+// - Neither the name of Zach Wily nor the names of its contributors may be used to 
+//     endorse or promote products derived from this software without specific prior 
+//     written permission.
+// 
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+//  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+//  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR 
+//  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES 
+//  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+//   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON 
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+//  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS 
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// Runs the regression tests, which compare what the image code puts out against the images checked in
+// under Tests/Reference. The Regression Tests target runs it as its last build phase:
+//
+//     RegressionTests <reference directory> [-write-reference]
+//
+// -write-reference replaces the references with what this build puts out. Only use it when a change to
+// the output is intended, and look at the new images before checking them in.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ZWImageResamplerTest.h"
+#include "ZWJPEGCodecTest.h"
+
+int main(int argc, char *argv[])
+{
+    int writeReference = (argc > 2 && strcmp(argv[2], "-write-reference") == 0);
+    int failures = 0;
+    
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <reference directory> [-write-reference]\n", argv[0]);
+        return 2;
+    }
+    
+    failures += ZWImageResamplerTestRun(argv[1], writeReference);
+    failures += ZWJPEGCodecTestRun(argv[1], writeReference);
+    
+    if (failures) 
+        printf("%d regression test%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}